@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+# End to end benchmark of dbipatcher commands on synthetic nro.
+#
+# usage: e2e.sh <dbipatcher> <nrogen> <work dir> [size MB]
+#
+# Cache is disabled, so every command analyzes nro from scratch. Throughput
+# is computed from wall time command itself reports by --stats, real time of
+# process also includes second main sleeps before exit.
+#
+# --new-ru tries every key on every slot, so it only gets BENCH_KEYS keys
+# (256 by default) instead of whole dictionary.
+
+set -e
+
+BIN=$1
+GEN=$2
+DIR=$3
+SIZE=${4:-10}
+
+if [ -z "$BIN" ] || [ -z "$GEN" ] || [ -z "$DIR" ]; then
+    echo "usage: $0 <dbipatcher> <nrogen> <work dir> [size MB]" >&2
+    exit 1
+fi
+
+mkdir -p "$DIR"
+NRO=$DIR/bench_${SIZE}.nro
+DICT=$DIR/bench_${SIZE}.dict
+LANG_FILE=$DIR/bench_${SIZE}.lang
+
+if [ ! -f "$NRO" ] || [ "$GEN" -nt "$NRO" ]; then
+    "$GEN" "$NRO" "$DICT" "$LANG_FILE" "$SIZE"
+fi
+
+KEYS=${BENCH_KEYS:-256}
+BYTES=$(stat -c %s "$NRO" 2>/dev/null || stat -f %z "$NRO")
+
+printf "%-14s %10s %10s %10s %10s %12s %s\n" "command" "real [s]" "wall [s]" "user [s]" "sys [s]" "wall [MB/s]" "status"
+
+run() {
+    local name=$1
+    shift
+
+    local times status=ok
+    TIMEFORMAT="%R %U %S"
+    rm -f "$DIR/$name.json"
+    times=$( { time "$BIN" "$@" --no-cache --stats "$DIR/$name.json" > "$DIR/$name.log" 2>&1 || echo "FAIL" > "$DIR/$name.status"; } 2>&1 )
+
+    if [ -f "$DIR/$name.status" ]; then
+        status=failed
+        rm -f "$DIR/$name.status"
+    fi
+
+    local wall_ns
+    wall_ns=$(sed -n 's/.*"wall_ns": *\([0-9]*\).*/\1/p' "$DIR/$name.json" 2>/dev/null)
+
+    set -- $times
+    awk -v n="$name" -v r="$1" -v u="$2" -v s="$3" -v w="${wall_ns:-0}" -v b="$BYTES" -v st="$status" 'BEGIN {
+        w /= 1e9
+        printf "%-14s %10.2f %10.2f %10.2f %10.2f %12.2f %s\n", n, r, w, u, s, (w > 0 ? b / 1048576 / w : 0), st
+    }'
+}
+
+run find-keys --find-keys --nro "$NRO"
+run scan --scan --nro "$NRO" --dict "$DICT" --out "$DIR/bench_${SIZE}.bp"
+run new-ru --new-ru --nro "$NRO" --keys "$KEYS" --min 3 --dict "$DICT"
+run partials --partials --nro "$NRO" --dict "$DICT"
+run patch --patch "$DIR/bench_${SIZE}.bp" --nro "$NRO" --lang "$LANG_FILE" --out "$DIR/bench_${SIZE}.patched.nro"
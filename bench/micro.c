@@ -0,0 +1,546 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * Microbenchmarks of hot kernels - instruction decoder, MOV prefilter, utf8
+ * validation, key XOR and immediate lookup.
+ *
+ * Every kernel walks fixed input once per repetition. Inputs are synthetic
+ * but shaped like real nro: code is mix of random words with MOV / MOVK key
+ * materializations, ADRP / LDR / BL and NOPs, ciphertext is english and
+ * russian text xored by get_key() keys interleaved with random bytes. Second
+ * copy of code also builds looked up immediate string every IMM_HIT_EVERY
+ * words, so lookups are measured with matches too.
+ *
+ * usage: micro [--reps N] [--warmup N] [--filter name] [--json file]
+ *        micro --compare <old.json> <new.json> [--threshold pct]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "v2/inst.h"
+#include "v2/utf8.h"
+#include "v2/imm.h"
+#include "v2/keys.h"
+
+#define CODE_WORDS          (64 * 1024)
+#define TEXT_LEN            (256 * 1024)
+#define XOR_LEN             2048
+#define IMM_HIT_EVERY       512
+#define IMM_LOOKUP          "Cancel"
+#define IMM_LOOKUP_KEY      42
+#define MAX_KERNELS         16
+#define MAX_NAME            32
+
+#define NOP                 0xD503201F
+#define BL                  0x94000010
+
+typedef struct {
+    uint32_t * code;
+    uint32_t code_cnt;
+    char * plain;
+    char * cipher;
+    uint32_t text_len;
+    ImmStream * stream;
+    uint32_t * code_hit;
+    ImmStream * stream_hit;
+    uint64_t * mask;
+} Inputs;
+
+typedef struct {
+    const char * name;
+    uint64_t (*run)(const Inputs * in);
+    uint64_t (*bytes)(const Inputs * in);
+} Kernel;
+
+typedef struct {
+    char name[MAX_NAME];
+    double median;
+    double p99;
+    double mb_s;
+} Result;
+
+static uint64_t rng_state = 1;
+
+static uint64_t rng_next(void) {
+    // splitmix64
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// inputs
+
+static const char * words[] = {
+    "Install", "title", "from", "SD", "card", "Cannot", "open", "file",
+    "Copying", "Network", "Установка", "файл", "Ошибка", "чтения", "билет",
+    "Готово", "Свободно", "место",
+};
+
+static void inputs_init(Inputs * in) {
+    in->code_cnt = CODE_WORDS;
+    in->code = malloc(sizeof(*in->code) * in->code_cnt);
+
+    // roughly 1 in 8 words is part of MOV sequence, as in real code
+    for(uint32_t i = 0; i < in->code_cnt;) {
+        uint32_t r = rng_next() % 16;
+        uint64_t key = get_key(10 + rng_next() % 4096);
+
+        if(r == 0 && i + 4 <= in->code_cnt) {
+            in->code[i++] = 0xD2800008 | ((key & 0xFFFF) << 5);
+            for(uint32_t h = 1; h < 4; h++) {
+                in->code[i++] = 0xF2800008 | (h << 21) | (((key >> (16 * h)) & 0xFFFF) << 5);
+            }
+        } else if(r == 1) {
+            in->code[i++] = 0x90000000 | (rng_next() & 0x00FFFFE0);
+        } else if(r == 2) {
+            in->code[i++] = BL | (rng_next() & 0x3FFFF);
+        } else if(r == 3) {
+            in->code[i++] = NOP;
+        } else {
+            in->code[i++] = (uint32_t)rng_next();
+        }
+    }
+
+    in->text_len = TEXT_LEN;
+    in->plain = malloc(in->text_len + 8);
+    in->cipher = malloc(in->text_len + 8);
+
+    // strings of few words, 8 B aligned, xored and separated by random slots
+    uint32_t pos = 0;
+    while(pos < in->text_len) {
+        uint32_t start = pos;
+        uint64_t key = get_key(10 + rng_next() % 4096);
+
+        while(pos < in->text_len - 32 && (pos - start < 16 || rng_next() % 4)) {
+            const char * w = words[rng_next() % (sizeof(words) / sizeof(*words))];
+            uint32_t w_len = strlen(w);
+            memcpy(in->plain + pos, w, w_len);
+            in->plain[pos + w_len] = ' ';
+            pos += w_len + 1;
+        }
+
+        in->plain[pos++] = 0;
+        while(pos % 8 && pos < in->text_len) {
+            in->plain[pos++] = 0;
+        }
+
+        for(uint32_t x = start; x < pos; x++) {
+            in->cipher[x] = in->plain[x] ^ ((key >> (((x - start) & 7) * 8)) & 0xFF);
+        }
+
+        for(uint32_t r = rng_next() % 3; r > 0 && pos + 8 <= in->text_len; r--) {
+            uint64_t v = rng_next();
+            memcpy(in->cipher + pos, &v, 8);
+            memset(in->plain + pos, 0, 8);
+            pos += 8;
+        }
+    }
+    in->plain[in->text_len] = 0;
+    in->cipher[in->text_len] = 0;
+
+    in->stream = imm_stream_init(in->code, in->code_cnt * 4);
+    in->mask = calloc((in->code_cnt + 63) / 64, sizeof(*in->mask));
+
+    // encrypted lookup built 2 B at a time by MOV W8, separated by NOPs
+    uint8_t enc[sizeof(IMM_LOOKUP) + 1] = { 0 };
+    uint64_t key = get_key(IMM_LOOKUP_KEY);
+    memcpy(enc, IMM_LOOKUP, sizeof(IMM_LOOKUP));
+    key_xor(enc, 0, sizeof(IMM_LOOKUP), key);
+
+    in->code_hit = malloc(sizeof(*in->code_hit) * in->code_cnt);
+    memcpy(in->code_hit, in->code, sizeof(*in->code_hit) * in->code_cnt);
+
+    for(uint32_t i = 0; i + sizeof(enc) <= in->code_cnt; i += IMM_HIT_EVERY) {
+        for(uint32_t c = 0; c < sizeof(enc) / 2; c++) {
+            uint16_t imm = enc[c * 2] | (enc[c * 2 + 1] << 8);
+            in->code_hit[i + c * 2] = 0x52800008 | (imm << 5);
+            in->code_hit[i + c * 2 + 1] = NOP;
+        }
+    }
+
+    in->stream_hit = imm_stream_init(in->code_hit, in->code_cnt * 4);
+}
+
+static void inputs_free(Inputs * in) {
+    imm_stream_free(in->stream);
+    imm_stream_free(in->stream_hit);
+    free(in->code);
+    free(in->code_hit);
+    free(in->plain);
+    free(in->cipher);
+    free(in->mask);
+}
+
+// kernels
+
+static uint64_t bytes_code(const Inputs * in) {
+    return in->code_cnt * 4;
+}
+
+static uint64_t bytes_text(const Inputs * in) {
+    return in->text_len;
+}
+
+static uint64_t bytes_xor(const Inputs * in) {
+    return (in->text_len / XOR_LEN) * XOR_LEN;
+}
+
+static uint64_t bytes_xor_head(const Inputs * in) {
+    return (in->text_len / 8) * 8;
+}
+
+static uint64_t run_decode(const Inputs * in) {
+    uint64_t sum = 0;
+    arm64_instr_t d;
+
+    for(uint32_t i = 0; i < in->code_cnt; i++) {
+        if(instr_decode(in->code[i], &d, i * 4)) {
+            sum += d.type + d.imm;
+        }
+    }
+
+    return sum;
+}
+
+static uint64_t run_mov_prefilter(const Inputs * in) {
+    instr_mov_candidates(in->code, in->code_cnt, in->mask);
+
+    uint64_t sum = 0;
+    for(uint32_t i = 0; i < (in->code_cnt + 63) / 64; i++) {
+        sum += __builtin_popcountll(in->mask[i]);
+    }
+
+    return sum;
+}
+
+static uint64_t run_utf8_check_char(const Inputs * in) {
+    uint64_t sum = 0;
+
+    for(uint32_t i = 0; i < in->text_len;) {
+        utf8_char_validity v = utf8_check_char(in->plain, i);
+        sum += v.valid;
+        i = v.valid && v.next_offset > i ? v.next_offset : i + 1;
+    }
+
+    return sum;
+}
+
+static uint64_t run_utf8_prefix(const Inputs * in) {
+    uint64_t sum = 0;
+    utf8_prefix prefix;
+
+    // slot by slot, as string scanners do
+    for(uint32_t i = 0; i + 8 <= in->text_len; i += 8) {
+        utf8_validate_prefix(in->plain + i, 8, 0, &prefix);
+        sum += prefix.valid_len + prefix.cyrillic;
+    }
+
+    return sum;
+}
+
+static uint64_t run_key_xor(const Inputs * in) {
+    char tmp[XOR_LEN];
+    uint64_t sum = 0;
+    uint64_t key = get_key(42);
+
+    // whole candidate, as string scanners decode it once first 8 B pass
+    for(uint32_t i = 0; i + XOR_LEN <= in->text_len; i += XOR_LEN) {
+        memcpy(tmp, in->cipher + i, XOR_LEN);
+        key_xor(tmp, 0, XOR_LEN, key);
+
+        sum += (uint8_t)tmp[XOR_LEN - 1];
+    }
+
+    return sum;
+}
+
+static uint64_t run_key_xor_head(const Inputs * in) {
+    char tmp[8];
+    uint64_t sum = 0;
+    uint64_t key = get_key(42);
+
+    // first 8 B of every slot, as string scanners probe each key
+    for(uint32_t i = 0; i + 8 <= in->text_len; i += 8) {
+        memcpy(tmp, in->cipher + i, 8);
+        key_xor(tmp, 0, 8, key);
+
+        sum += (uint8_t)tmp[7];
+    }
+
+    return sum;
+}
+
+static ImmDefine imm_define(void) {
+    ImmDefine d = {
+        .key = get_key(IMM_LOOKUP_KEY),
+        .data = IMM_LOOKUP,
+        .len = sizeof(IMM_LOOKUP),
+        .offset = 0,
+    };
+
+    return d;
+}
+
+static uint64_t imm_lookup_code(const uint32_t * code, uint32_t code_cnt) {
+    ImmDefine d = imm_define();
+
+    ImmResult * res = imm_lookup(code, code_cnt * 4, &d, 4);
+    uint64_t sum = res->matches_cnt;
+    imm_result_free(res);
+
+    return sum;
+}
+
+static uint64_t imm_stream_lookup_code(const ImmStream * stream) {
+    ImmDefine d = imm_define();
+
+    ImmResult * res = imm_stream_lookup(stream, &d, 4);
+    uint64_t sum = res->matches_cnt;
+    imm_result_free(res);
+
+    return sum;
+}
+
+static uint64_t run_imm_lookup(const Inputs * in) {
+    return imm_lookup_code(in->code, in->code_cnt);
+}
+
+static uint64_t run_imm_lookup_hits(const Inputs * in) {
+    return imm_lookup_code(in->code_hit, in->code_cnt);
+}
+
+static uint64_t run_imm_stream_lookup(const Inputs * in) {
+    return imm_stream_lookup_code(in->stream);
+}
+
+static uint64_t run_imm_stream_lookup_hits(const Inputs * in) {
+    return imm_stream_lookup_code(in->stream_hit);
+}
+
+static const Kernel kernels[] = {
+    { "instr_decode", run_decode, bytes_code },
+    { "mov_prefilter", run_mov_prefilter, bytes_code },
+    { "utf8_check_char", run_utf8_check_char, bytes_text },
+    { "utf8_prefix", run_utf8_prefix, bytes_text },
+    { "key_xor", run_key_xor, bytes_xor },
+    { "key_xor_head", run_key_xor_head, bytes_xor_head },
+    { "imm_lookup", run_imm_lookup, bytes_code },
+    { "imm_lookup_hits", run_imm_lookup_hits, bytes_code },
+    { "imm_stream_lookup", run_imm_stream_lookup, bytes_code },
+    { "imm_stream_lookup_hits", run_imm_stream_lookup_hits, bytes_code },
+};
+
+#define KERNEL_CNT  (sizeof(kernels) / sizeof(*kernels))
+
+// harness
+
+static int double_compare(const void * a, const void * b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static volatile uint64_t sink;
+
+static void bench_kernel(const Kernel * k, const Inputs * in, uint32_t warmup, uint32_t reps, Result * res) {
+    double * samples = malloc(sizeof(*samples) * reps);
+
+    for(uint32_t i = 0; i < warmup; i++) {
+        sink += k->run(in);
+    }
+
+    for(uint32_t i = 0; i < reps; i++) {
+        double start = now_ns();
+        sink += k->run(in);
+        samples[i] = now_ns() - start;
+    }
+
+    qsort(samples, reps, sizeof(*samples), double_compare);
+
+    snprintf(res->name, sizeof(res->name), "%s", k->name);
+    res->median = samples[reps / 2];
+    res->p99 = samples[(uint32_t)((reps - 1) * 0.99)];
+    res->mb_s = res->median > 0 ? k->bytes(in) / 1048576.0 / (res->median / 1e9) : 0;
+
+    free(samples);
+}
+
+static void print_results(const Result * res, uint32_t cnt) {
+    printf("%-20s %14s %14s %12s\n", "kernel", "median [us]", "p99 [us]", "MB/s");
+    for(uint32_t i = 0; i < cnt; i++) {
+        printf("%-20s %14.2f %14.2f %12.2f\n", res[i].name, res[i].median / 1e3, res[i].p99 / 1e3, res[i].mb_s);
+    }
+}
+
+/** One result object per line, so --compare can read it back without json
+ * parser.
+ */
+static int write_json(const char * path, const Result * res, uint32_t cnt, uint32_t reps) {
+    FILE * f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if(!f) {
+        fprintf(stderr, "failed to open \"%s\" for writing\n", path);
+        return 1;
+    }
+
+    fprintf(f, "{\n  \"reps\": %u,\n  \"kernels\": [\n", reps);
+    for(uint32_t i = 0; i < cnt; i++) {
+        fprintf(f, "    {\"name\": \"%s\", \"median_ns\": %.1f, \"p99_ns\": %.1f, \"mb_s\": %.2f}%s\n", res[i].name, res[i].median, res[i].p99, res[i].mb_s, i + 1 < cnt ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+
+    if(f != stdout) {
+        fclose(f);
+    }
+
+    return 0;
+}
+
+static int read_json(const char * path, Result * res, uint32_t * cnt) {
+    FILE * f = fopen(path, "r");
+    if(!f) {
+        fprintf(stderr, "failed to open \"%s\"\n", path);
+        return 1;
+    }
+
+    char line[512];
+    *cnt = 0;
+    while(fgets(line, sizeof(line), f) && *cnt < MAX_KERNELS) {
+        Result * r = &res[*cnt];
+        if(sscanf(line, " {\"name\": \"%31[^\"]\", \"median_ns\": %lf, \"p99_ns\": %lf, \"mb_s\": %lf}", r->name, &r->median, &r->p99, &r->mb_s) == 4) {
+            (*cnt)++;
+        }
+    }
+    fclose(f);
+
+    if(*cnt == 0) {
+        fprintf(stderr, "no results in \"%s\"\n", path);
+        return 1;
+    }
+
+    return 0;
+}
+
+/** Diffs medians of two runs, kernel slower by more than threshold percent
+ * is reported as regression and makes exit code non zero.
+ */
+static int compare(const char * old_path, const char * new_path, double threshold) {
+    Result old_res[MAX_KERNELS], new_res[MAX_KERNELS];
+    uint32_t old_cnt, new_cnt;
+
+    if(read_json(old_path, old_res, &old_cnt) || read_json(new_path, new_res, &new_cnt)) {
+        return 1;
+    }
+
+    uint32_t regressions = 0;
+
+    printf("%-20s %14s %14s %9s\n", "kernel", "old [us]", "new [us]", "delta");
+    for(uint32_t i = 0; i < new_cnt; i++) {
+        const Result * o = NULL;
+        for(uint32_t x = 0; x < old_cnt; x++) {
+            if(strcmp(old_res[x].name, new_res[i].name) == 0) {
+                o = &old_res[x];
+            }
+        }
+
+        if(!o || o->median <= 0) {
+            printf("%-20s %14s %14.2f %9s\n", new_res[i].name, "-", new_res[i].median / 1e3, "new");
+            continue;
+        }
+
+        double delta = (new_res[i].median - o->median) * 100.0 / o->median;
+        uint8_t regressed = delta > threshold;
+        regressions += regressed;
+
+        printf("%-20s %14.2f %14.2f %+8.1f%%%s\n", new_res[i].name, o->median / 1e3, new_res[i].median / 1e3, delta, regressed ? "  REGRESSION" : "");
+    }
+
+    return regressions ? 1 : 0;
+}
+
+static void usage(const char * name) {
+    fprintf(stderr, "usage: %s [--reps N] [--warmup N] [--filter name] [--json file]\n", name);
+    fprintf(stderr, "       %s --compare <old.json> <new.json> [--threshold pct]\n", name);
+}
+
+int main(int argc, char ** argv) {
+    uint32_t reps = 50;
+    uint32_t warmup = 5;
+    const char * filter = NULL;
+    const char * json = NULL;
+    const char * cmp_old = NULL;
+    const char * cmp_new = NULL;
+    double threshold = 5.0;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = strtoul(argv[++i], NULL, 0);
+        } else if(strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            warmup = strtoul(argv[++i], NULL, 0);
+        } else if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if(strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json = argv[++i];
+        } else if(strcmp(argv[i], "--compare") == 0 && i + 2 < argc) {
+            cmp_old = argv[++i];
+            cmp_new = argv[++i];
+        } else if(strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = strtod(argv[++i], NULL);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(cmp_old) {
+        return compare(cmp_old, cmp_new, threshold);
+    }
+
+    if(reps == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Inputs in;
+    inputs_init(&in);
+
+    Result res[KERNEL_CNT];
+    uint32_t res_cnt = 0;
+
+    for(uint32_t i = 0; i < KERNEL_CNT; i++) {
+        if(filter && !strstr(kernels[i].name, filter)) {
+            continue;
+        }
+
+        bench_kernel(&kernels[i], &in, warmup, reps, &res[res_cnt++]);
+    }
+
+    inputs_free(&in);
+
+    // json on stdout replaces table
+    if(!json || strcmp(json, "-") != 0) {
+        print_results(res, res_cnt);
+    }
+
+    if(json) {
+        return write_json(json, res, res_cnt, reps);
+    }
+
+    return 0;
+}
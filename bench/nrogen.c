@@ -0,0 +1,310 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * Generator of synthetic obfuscated nro images used by make bench.
+ *
+ * Text segment is filled with random words, read only segment with random
+ * bytes. Records are then placed at regular intervals, each one being one of
+ * string types described in README:
+ *
+ *  - full strings >= 16 B xored into read only segment, 8 B aligned, with
+ *    MOV + 3x MOVK key materialization in code
+ *  - partials of 9..15 B, first 8 B in read only segment, tail emitted as
+ *    ADRP / LDR / MOVZ... / BL sequence accepted by match_a_collect
+ *  - short strings <= 8 B built only from MOVZ / MOVK immediates
+ *
+ * Keys come from get_key(), record n uses seed 10 + n. Dictionary and
+ * language file matching generated strings are written next to nro.
+ *
+ * usage: nrogen <out.nro> <dict.txt> <lang.txt> [size MB] [rng seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "v2/keys.h"
+
+#define MB                  (1024 * 1024)
+#define TEXT_OFFSET         0x1000
+#define RECORD_SPACING      1024
+#define RECORD_MAX_CODE     256
+#define RECORD_MAX_RO       512
+#define SEED_BASE           10
+
+#define NOP                 0xD503201F
+#define BL                  0x94000010
+
+typedef struct {
+    uint8_t * img;
+    uint32_t tp;
+    uint32_t ro;
+    uint64_t rng;
+} Gen;
+
+static const char * words_en[] = {
+    "Install", "title", "from", "SD", "card", "Cannot", "open", "file", "Error",
+    "reading", "ticket", "Copying", "Done", "Free", "space", "Network", "not",
+    "available",
+};
+
+static const char * words_ru[] = {
+    "Установка", "файл", "Ошибка", "чтения", "билет", "Готово", "Свободно",
+    "место", "Сеть", "недоступна", "открыть",
+};
+
+// partial prefix has to be exactly 8 B, so cyrillic tail never gets cut
+static const char * partial_en[] = { "Install", "Cannot", "open", "ticket", "Done", "SD", };
+static const char * partial_ru[] = { "Сеть", "файл", };
+
+static const char * shorts[] = { "OK", "Да", "Нет", "Yes", "Cancel", "Back", };
+
+#define ARRLEN(a)   (sizeof(a) / sizeof(*(a)))
+
+static uint64_t rng_next(Gen * g) {
+    // splitmix64
+    uint64_t z = (g->rng += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint32_t rng_range(Gen * g, uint32_t lo, uint32_t hi) {
+    return lo + (uint32_t)(rng_next(g) % (hi - lo + 1));
+}
+
+static void emit(Gen * g, uint32_t w) {
+    memcpy(g->img + g->tp, &w, 4);
+    g->tp += 4;
+}
+
+static uint32_t movz(uint32_t rd, uint32_t imm, uint32_t hw, uint32_t sf) {
+    return (sf << 31) | (0x2 << 29) | (0x25 << 23) | (hw << 21) | (imm << 5) | rd;
+}
+
+static uint32_t movk(uint32_t rd, uint32_t imm, uint32_t hw, uint32_t sf) {
+    return (sf << 31) | (0x3 << 29) | (0x25 << 23) | (hw << 21) | (imm << 5) | rd;
+}
+
+static uint32_t adrp(uint32_t rd, uint32_t pc, uint32_t target) {
+    uint32_t off = ((target & ~0xFFFu) - (pc & ~0xFFFu)) >> 12;
+    return 0x90000000 | ((off & 3) << 29) | (((off >> 2) & 0x7FFFF) << 5) | rd;
+}
+
+static uint32_t ldr_d(uint32_t rt, uint32_t rn, uint32_t off) {
+    return 0xFD400000 | ((off / 8) << 10) | (rn << 5) | rt;
+}
+
+static void emit_keymat(Gen * g, uint64_t key) {
+    emit(g, movz(8, key & 0xFFFF, 0, 1));
+    for(uint32_t h = 1; h < 4; h++) {
+        emit(g, movk(8, (key >> (16 * h)) & 0xFFFF, h, 1));
+    }
+}
+
+static void emit_nops(Gen * g, uint32_t cnt) {
+    for(uint32_t i = 0; i < cnt; i++) {
+        emit(g, NOP);
+    }
+}
+
+static void xor_into(uint8_t * dst, const char * src, uint32_t len, uint64_t key) {
+    for(uint32_t i = 0; i < len; i++) {
+        dst[i] = (uint8_t)src[i] ^ ((key >> ((i & 7) * 8)) & 0xFF);
+    }
+}
+
+/** Length of translated text, shortened by up to two characters without
+ * splitting utf8 sequence. First character is always kept.
+ */
+static uint32_t lang_len(const char * txt, uint32_t len) {
+    for(uint32_t drop = 0; drop < 2 && len > 0; drop++) {
+        uint32_t start = len - 1;
+        while(start > 0 && ((uint8_t)txt[start] & 0xC0) == 0x80) {
+            start--;
+        }
+
+        if(start == 0) {
+            break;
+        }
+        len = start;
+    }
+
+    return len;
+}
+
+static uint32_t gen_full(Gen * g, char * txt, uint8_t ru, uint64_t key) {
+    const char ** words = ru ? words_ru : words_en;
+    uint32_t word_cnt = ru ? ARRLEN(words_ru) : ARRLEN(words_en);
+    uint32_t len = 0;
+
+    uint32_t cnt = rng_range(g, 3, 8);
+    for(uint32_t i = 0; i < cnt; i++) {
+        len += sprintf(txt + len, "%s%s", i ? " " : "", words[rng_next(g) % word_cnt]);
+    }
+
+    if(len + 1 < 16) {
+        len += sprintf(txt + len, " long enough");
+    }
+
+    uint8_t enc[RECORD_MAX_RO];
+    xor_into(enc, txt, len + 1, key);
+    memcpy(g->img + g->ro, enc, len + 1);
+    g->ro += (len + 1 + 7) / 8 * 8 + 8 * rng_range(g, 0, 3);
+
+    emit_nops(g, rng_range(g, 2, 6));
+    emit_keymat(g, key);
+
+    return len;
+}
+
+static uint32_t gen_partial(Gen * g, char * txt, uint8_t ru, uint64_t key) {
+    const char * base = ru ? partial_ru[rng_next(g) % ARRLEN(partial_ru)] : partial_en[rng_next(g) % ARRLEN(partial_en)];
+    uint32_t len = rng_range(g, 9, 14);
+
+    snprintf(txt, len + 1, "%sabcdefghijklmnop", base);
+
+    uint8_t enc[16] = {0};
+    xor_into(enc, txt, len + 1, key);
+    memcpy(g->img + g->ro, enc, 8);
+
+    emit_nops(g, 3);
+    emit_keymat(g, key);
+
+    emit(g, adrp(0, g->tp, g->ro));
+    emit(g, NOP);
+    emit(g, ldr_d(31, 0, g->ro & 0xFFF));
+
+    // tail including terminator, padded to whole MOV
+    for(uint32_t i = 8; i < len + 1; i += 2) {
+        emit(g, movz(0, enc[i] | (enc[i + 1] << 8), 0, 0));
+        emit(g, NOP);
+    }
+    emit(g, BL);
+
+    g->ro += 16;
+
+    return len;
+}
+
+static uint32_t gen_short(Gen * g, char * txt, uint64_t key) {
+    uint32_t len = sprintf(txt, "%s", shorts[rng_next(g) % ARRLEN(shorts)]);
+
+    uint8_t enc[8] = {0};
+    xor_into(enc, txt, len + 1, key);
+
+    emit_nops(g, 3);
+    emit_keymat(g, key);
+
+    for(uint32_t i = 0; i < len + 1; i += 2) {
+        uint32_t imm = enc[i] | (enc[i + 1] << 8);
+        emit(g, i == 0 ? movz(1, imm, 0, 0) : movk(1, imm, (i / 2) % 2, 0));
+    }
+    emit(g, BL);
+
+    return len;
+}
+
+int main(int argc, char ** argv) {
+    if(argc < 4 || argc > 6) {
+        fprintf(stderr, "usage: %s <out.nro> <dict.txt> <lang.txt> [size MB] [rng seed]\n", argc ? argv[0] : "nrogen");
+        return 1;
+    }
+
+    uint32_t size_mb = argc > 4 ? strtoul(argv[4], NULL, 0) : 10;
+    if(size_mb < 1 || size_mb > 1024) {
+        fprintf(stderr, "size has to be between 1 and 1024 MB\n");
+        return 1;
+    }
+
+    Gen g = {
+        .rng = argc > 5 ? strtoull(argv[5], NULL, 0) : 1,
+    };
+
+    // nro is mapped flat, text takes 5/8 and read only data rest of image
+    uint32_t size = size_mb * MB;
+    uint32_t text_len = (size / 8 * 5) & ~0xFFFu;
+    uint32_t ro_offset = TEXT_OFFSET + text_len;
+    uint32_t ro_len = size - ro_offset;
+
+    g.img = malloc(size);
+    if(!g.img) {
+        fprintf(stderr, "failed to allocate %u MB\n", size_mb);
+        return 1;
+    }
+
+    for(uint32_t i = 0; i < size; i += 8) {
+        uint64_t r = rng_next(&g);
+        memcpy(g.img + i, &r, 8);
+    }
+
+    memset(g.img, 0, TEXT_OFFSET);
+    memcpy(g.img + 0x10, "NRO0", 4);
+    uint32_t header[] = { 0, size, 0, TEXT_OFFSET, text_len, ro_offset, ro_len, size, 0 };
+    memcpy(g.img + 0x14, header, sizeof(header));
+
+    FILE * dict = fopen(argv[2], "w");
+    FILE * lang = fopen(argv[3], "w");
+    if(!dict || !lang) {
+        fprintf(stderr, "failed to open dictionary or language file for writing\n");
+        return 1;
+    }
+
+    uint32_t record_cnt = text_len / RECORD_SPACING;
+    uint32_t type_cnt[3] = {0};
+    char txt[RECORD_MAX_RO];
+
+    g.ro = ro_offset + 0x100;
+
+    for(uint32_t n = 0; n < record_cnt; n++) {
+        if(g.ro + RECORD_MAX_RO > ro_offset + ro_len) {
+            break;
+        }
+
+        g.tp = TEXT_OFFSET + n * RECORD_SPACING + rng_range(&g, 0, (RECORD_SPACING - RECORD_MAX_CODE) / 4) * 4;
+
+        uint64_t seed = SEED_BASE + n;
+        uint64_t key = get_key(seed);
+        uint8_t ru = n % 2;
+        uint32_t len;
+
+        switch(n % 4) {
+            case 0:
+            case 1:
+                len = gen_full(&g, txt, ru, key);
+                type_cnt[0]++;
+                break;
+            case 2:
+                len = gen_partial(&g, txt, ru, key);
+                type_cnt[1]++;
+                break;
+            default:
+                len = gen_short(&g, txt, key);
+                type_cnt[2]++;
+                break;
+        }
+
+        fprintf(dict, "STR%06u;%" PRIu64 ";%s\n", n, seed, txt);
+        fprintf(lang, "STR%06u=%.*s\n", n, lang_len(txt, len), txt);
+    }
+
+    fclose(dict);
+    fclose(lang);
+
+    FILE * f = fopen(argv[1], "wb");
+    if(!f || fwrite(g.img, 1, size, f) != size || fclose(f) != 0) {
+        fprintf(stderr, "failed to write \"%s\"\n", argv[1]);
+        return 1;
+    }
+    free(g.img);
+
+    printf("%s: %u MB, %u full, %u partial, %u short strings\n", argv[1], size_mb, type_cnt[0], type_cnt[1], type_cnt[2]);
+
+    return 0;
+}
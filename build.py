@@ -12,6 +12,7 @@ import sys
 import re
 import subprocess
 import argparse
+import ctypes
 from pathlib import Path
 
 # Printing statements have been moved to the top of the script
@@ -50,6 +51,7 @@ TRANSLATE_DIR = PROJECT_ROOT / "translate"
 BLUEPRINTS_DIR = TRANSLATE_DIR / "blueprints"
 BIN_DIR = PROJECT_ROOT / "bin"
 OUTPUT_DIR = PROJECT_ROOT / "output"  # Output directory for generated files
+MANIFEST_PATH = OUTPUT_DIR / "build.manifest"  # Input of --build-matrix, state is kept next to it
 
 # Determine dbipatcher executable name based on operating system
 if sys.platform.startswith('win'):
@@ -57,15 +59,25 @@ if sys.platform.startswith('win'):
 else:
     DBIPATCHER_EXE = BIN_DIR / "dbipatcher"
 
+# libdbipatcher built by 'make lib', used in-process instead of spawning dbipatcher
+if sys.platform.startswith('win'):
+    DBIPATCHER_LIB = BIN_DIR / "libdbipatcher.dll"
+elif sys.platform == 'darwin':
+    DBIPATCHER_LIB = BIN_DIR / "libdbipatcher.dylib"
+else:
+    DBIPATCHER_LIB = BIN_DIR / "libdbipatcher.so"
+
 # Ensure paths are in string format (compatible with Windows)
 DBIPATCHER_EXE = str(DBIPATCHER_EXE)
+DBIPATCHER_LIB = str(DBIPATCHER_LIB)
 DBI_DIR = str(DBI_DIR)
 BLUEPRINTS_DIR = str(BLUEPRINTS_DIR)
 TRANSLATE_DIR = str(TRANSLATE_DIR)
 OUTPUT_DIR = str(OUTPUT_DIR)  # Add output directory to string conversion
+MANIFEST_PATH = str(MANIFEST_PATH)
 
 # Check if dbipatcher tool exists
-if not os.path.exists(DBIPATCHER_EXE):
+if not os.path.exists(DBIPATCHER_EXE) and not os.path.exists(DBIPATCHER_LIB):
     # Try other possible locations
     alternative_paths = [
         os.path.join(os.getcwd(), "bin", "dbipatcher.exe"),
@@ -160,7 +172,41 @@ def get_language_files():
     return lang_files
 
 
-def run_dbipatcher(blueprint_path, nro_path, lang_path, output_path):
+class DbiLibrary:
+    """
+    Thin ctypes wrapper of libdbipatcher, see src/inc/dbipatcher.h
+    """
+
+    def __init__(self, path):
+        self.lib = ctypes.CDLL(path)
+        self.lib.dbi_init.restype = ctypes.c_void_p
+        self.lib.dbi_free.argtypes = [ctypes.c_void_p]
+        self.lib.dbi_patch.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p]
+        self.lib.dbi_patch.restype = ctypes.c_int
+        self.ctx = self.lib.dbi_init()
+
+    def patch(self, blueprint_path, nro_path, lang_path, output_path):
+        args = [os.fsencode(p) for p in (blueprint_path, nro_path, lang_path, output_path)]
+        return self.lib.dbi_patch(self.ctx, *args)
+
+    def close(self):
+        self.lib.dbi_free(self.ctx)
+
+
+def load_library():
+    """
+    Load libdbipatcher if it was built, None means falling back to dbipatcher executable
+    """
+    if not os.path.exists(DBIPATCHER_LIB):
+        return None
+    try:
+        return DbiLibrary(DBIPATCHER_LIB)
+    except OSError as e:
+        print(f"Warning: failed to load {DBIPATCHER_LIB}: {e}")
+        return None
+
+
+def run_dbipatcher(blueprint_path, nro_path, lang_path, output_path, library=None):
     """
     Run dbipatcher tool to generate the target language version NRO file
     """
@@ -175,20 +221,27 @@ def run_dbipatcher(blueprint_path, nro_path, lang_path, output_path):
         ]
         
         print(f"\n正在构建: {os.path.basename(output_path)}")
-        print(f"命令: {' '.join(cmd)}")
         
         # 确保输出目录存在
         os.makedirs(os.path.dirname(output_path), exist_ok=True)
         
-        # 执行命令，不捕获输出以避免编码问题，直接输出到控制台
-        process = subprocess.Popen(cmd)
-        process.wait()
+        if library:
+            # 在进程内调用库，不再为每个组合启动新进程
+            sys.stdout.flush()
+            returncode = library.patch(blueprint_path, nro_path, lang_path, output_path)
+        else:
+            print(f"命令: {' '.join(cmd)}")
+            
+            # 执行命令，不捕获输出以避免编码问题，直接输出到控制台
+            process = subprocess.Popen(cmd)
+            process.wait()
+            returncode = process.returncode
         
         # 主要检查文件是否存在且大小合理（即使返回非零代码）
         if os.path.exists(output_path):
             file_size = os.path.getsize(output_path)
             if file_size > 1024:  # 确保文件大小合理（大于1KB）
-                if process.returncode == 0:
+                if returncode == 0:
                     print(f"✓ 成功: {os.path.basename(output_path)} (大小: {file_size:,} 字节)")
                 else:
                     print(f"⚠ 部分成功: {os.path.basename(output_path)} (有警告，但文件已创建) (大小: {file_size:,} 字节)")
@@ -198,13 +251,66 @@ def run_dbipatcher(blueprint_path, nro_path, lang_path, output_path):
                 return False
         else:
             print(f"✗ 失败: {os.path.basename(output_path)} 文件未创建")
-            print(f"  退出代码: {process.returncode}")
+            print(f"  退出代码: {returncode}")
             return False
     except Exception as e:
         print(f"✗ 执行命令时出错: {e}")
         return False
 
 
+def write_manifest(versions, russian_nros, blueprints, language_files):
+    """
+    Write manifest of --build-matrix, forward slashes are understood on every platform
+    """
+    with open(MANIFEST_PATH, "w", encoding="utf-8") as f:
+        f.write("# generated by build.py\n")
+        for version in sorted(versions):
+            f.write(f"nro.{version}={Path(russian_nros[version]).as_posix()}\n")
+            f.write(f"blueprint.{version}={Path(blueprints[version]).as_posix()}\n")
+        for lang_code, lang_path in language_files.items():
+            f.write(f"lang.{lang_code}={Path(lang_path).as_posix()}\n")
+        f.write("out=DBI.{version}.{lang}.nro\n")
+
+
+def run_build_matrix(versions, russian_nros, blueprints, language_files):
+    """
+    Build everything by single dbipatcher process, outputs with unchanged inputs are skipped
+    Returns (successful, total)
+    """
+    write_manifest(versions, russian_nros, blueprints, language_files)
+
+    cmd = [DBIPATCHER_EXE, "--build-matrix", MANIFEST_PATH]
+    print(f"命令: {' '.join(cmd)}")
+
+    try:
+        process = subprocess.run(cmd, stdout=subprocess.PIPE)
+    except Exception as e:
+        print(f"✗ 执行命令时出错: {e}")
+        return 0, len(versions) * len(language_files)
+
+    successful = 0
+    total = 0
+    for line in process.stdout.decode("utf-8", "replace").splitlines():
+        parts = line.split(None, 2)
+        if len(parts) < 3:
+            continue
+        status, output_path = parts[0], parts[2]
+        total += 1
+        if status == "built":
+            print(f"✓ 成功: {os.path.basename(output_path)}")
+            successful += 1
+        elif status == "issues":
+            print(f"⚠ 部分成功: {os.path.basename(output_path)} (有警告，但文件已创建)")
+            successful += 1
+        elif status == "skipped":
+            print(f"= 未更改: {os.path.basename(output_path)}")
+            successful += 1
+        else:
+            print(f"✗ 失败: {os.path.basename(output_path)}")
+
+    return successful, total
+
+
 def main():
     """
     Main function
@@ -213,6 +319,7 @@ def main():
     parser = argparse.ArgumentParser(description='DBI Multi-language Auto-Build Script')
     parser.add_argument('--version', '-v', help='Filter specific DBI version (e.g., "845")')
     parser.add_argument('--language', '-l', help='Filter specific language code (e.g., "en", "zhcn")')
+    parser.add_argument('--rebuild', action='store_true', help='Rebuild outputs even if their inputs did not change')
     args = parser.parse_args()
     
     print("=" * 60)
@@ -223,8 +330,11 @@ def main():
     os.makedirs(OUTPUT_DIR, exist_ok=True)
     print(f"Output directory: {OUTPUT_DIR}")
     
-    # Check if dbipatcher tool exists
-    if not os.path.exists(DBIPATCHER_EXE):
+    # Check if dbipatcher tool exists, library is only needed without executable
+    library = None if os.path.exists(DBIPATCHER_EXE) else load_library()
+    if library:
+        print(f"Using library: {DBIPATCHER_LIB}")
+    elif not os.path.exists(DBIPATCHER_EXE):
         print(f"Error: dbipatcher tool not found: {DBIPATCHER_EXE}")
         print("Please run 'make' command to compile the project first")
         return 1
@@ -273,6 +383,14 @@ def main():
     total_builds = len(common_versions) * len(language_files)
     successful_builds = 0
     
+    if args.rebuild and os.path.exists(MANIFEST_PATH + ".state"):
+        os.remove(MANIFEST_PATH + ".state")
+    
+    if os.path.exists(DBIPATCHER_EXE):
+        # 单个进程构建全部组合，未更改的输出会被跳过
+        successful_builds, total_builds = run_build_matrix(common_versions, russian_nros, blueprints, language_files)
+        common_versions = []
+    
     for version in sorted(common_versions):
         for lang_code, lang_path in language_files.items():
             # Build output filename
@@ -280,9 +398,12 @@ def main():
             output_path = os.path.join(OUTPUT_DIR, output_filename)
             
             # 调用dbipatcher
-            if run_dbipatcher(blueprints[version], russian_nros[version], lang_path, output_path):
+            if run_dbipatcher(blueprints[version], russian_nros[version], lang_path, output_path, library):
                 successful_builds += 1
     
+    if library:
+        library.close()
+    
     # Output statistics
     print("\n" + "-" * 60)
     print(f"Build completed: {successful_builds}/{total_builds} successful")
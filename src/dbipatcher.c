@@ -0,0 +1,159 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbipatcher.h"
+#include "memfile.h"
+#include "utils.h"
+#include "log.h"
+#include "stats.h"
+#include "v2/context.h"
+#include "v2/keys.h"
+#include "v2/strings.h"
+#include "v2/patch.h"
+#include "v2/delta.h"
+
+/** Everything single library call needs, opened in the same way as main does.
+ */
+typedef struct {
+    DbiContext * prev;
+    MemFile * mf;
+    FILE * out;
+} DbiCall;
+
+static int dbi_call_begin(DbiCall * call, DbiContext * ctx, const char * nro, const char * out) {
+    memset(call, 0, sizeof(*call));
+    call->prev = dbi_context_bind(ctx);
+    call->out = stdout;
+    
+    stats_reset();
+    
+    call->mf = mf_init_path(nro);
+    if(!call->mf) {
+        lf_e("failed to load \"%s\"", nro);
+        return EXIT_FAILURE;
+    }
+    
+    if(out) {
+        if(mkpath(0755, "%s", out) != 0 || !(call->out = fopen(out, "w+b"))) {
+            call->out = stdout;
+            lf_e("failed to open \"%s\" for writing", out);
+            return EXIT_FAILURE;
+        }
+    }
+    
+    return EXIT_SUCCESS;
+}
+
+static int dbi_call_end(DbiCall * call, int ret) {
+    if(call->out != stdout) {
+        if(fclose(call->out) != 0) {
+            ret = EXIT_FAILURE;
+        }
+    } else {
+        fflush(stdout);
+    }
+    
+    mf_free(call->mf);
+    dbi_context_bind(call->prev);
+    
+    return ret;
+}
+
+DbiContext * dbi_init(void) {
+    return dbi_context_init();
+}
+
+void dbi_free(DbiContext * ctx) {
+    dbi_context_free(ctx);
+}
+
+int dbi_set_keygen(DbiContext * ctx, const char * path) {
+    return load_keygen(ctx, path);
+}
+
+void dbi_set_cache(DbiContext * ctx, int enabled) {
+    ctx->no_cache = !enabled;
+}
+
+int dbi_find_str(DbiContext * ctx, const char * nro, const char * needle, uint32_t key_cnt, const char * out) {
+    DbiCall call;
+    if(dbi_call_begin(&call, ctx, nro, out) != EXIT_SUCCESS) {
+        return dbi_call_end(&call, EXIT_FAILURE);
+    }
+    
+    ScanStringArgs args = {
+        .dbi_mf = call.mf,
+        .lookup = needle,
+        .out = call.out,
+        .key_cnt = key_cnt,
+    };
+    
+    return dbi_call_end(&call, scan_string(&args));
+}
+
+int dbi_blueprint(DbiContext * ctx, const char * nro, const char * dict, uint32_t key_window, const char * out) {
+    DbiCall call;
+    if(dbi_call_begin(&call, ctx, nro, out) != EXIT_SUCCESS) {
+        return dbi_call_end(&call, EXIT_FAILURE);
+    }
+    
+    ScanBlueprintArgs args = {
+        .dbi_mf = call.mf,
+        .keys = dict,
+        .out = call.out,
+        .key_window = key_window,
+    };
+    
+    return dbi_call_end(&call, scan_blueprint(&args));
+}
+
+int dbi_patch(DbiContext * ctx, const char * blueprint, const char * nro, const char * lang, const char * out) {
+    return dbi_patch_delta(ctx, blueprint, nro, lang, NULL, out);
+}
+
+int dbi_patch_delta(DbiContext * ctx, const char * blueprint, const char * nro, const char * lang, const char * format, const char * out) {
+    DeltaFormat delta = DELTA_FORMAT_NONE;
+    if(format && delta_parse_format(format, &delta) != 0) {
+        lf_e("unknown delta format \"%s\"", format);
+        return EXIT_FAILURE;
+    }
+    
+    DbiCall call;
+    if(dbi_call_begin(&call, ctx, nro, out) != EXIT_SUCCESS) {
+        return dbi_call_end(&call, EXIT_FAILURE);
+    }
+    
+    PatchArgs args = {
+        .dbi_mf = call.mf,
+        .translation = lang,
+        .blueprint = blueprint,
+        .out = call.out,
+        .delta = delta,
+    };
+    
+    return dbi_call_end(&call, patch(&args));
+}
+
+int dbi_apply_delta(DbiContext * ctx, const char * delta, const char * nro, const char * out) {
+    DbiCall call;
+    
+    // output is replaced by apply_delta once delta applies
+    if(dbi_call_begin(&call, ctx, nro, NULL) != EXIT_SUCCESS) {
+        return dbi_call_end(&call, EXIT_FAILURE);
+    }
+    
+    ApplyDeltaArgs args = {
+        .dbi_mf = call.mf,
+        .delta = delta,
+        .out = out,
+    };
+    
+    return dbi_call_end(&call, apply_delta(&args));
+}
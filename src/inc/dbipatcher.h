@@ -0,0 +1,68 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   dbipatcher.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef DBIPATCHER_H
+#define DBIPATCHER_H
+
+#include <stdint.h>
+
+/* Public interface of libdbipatcher.
+ * 
+ * Every operation gets context holding configuration otherwise given on
+ * command line, worker threads of operation use the same one. Context must not
+ * be reconfigured while operation using it runs.
+ * 
+ * Operations may run concurrently from any threads as long as each one uses
+ * its own context, progress reporting, statistics and perf counters are kept
+ * per context. See test/concurrent.c.
+ * 
+ * Paths are the same as command line ones, NULL output path means stdout.
+ * Operations return 0 on success.
+ */
+
+typedef struct _DbiContext DbiContext;
+
+DbiContext * dbi_init(void);
+
+void dbi_free(DbiContext * ctx);
+
+/** Alternate key sequence, same as --keygen.
+ */
+int dbi_set_keygen(DbiContext * ctx, const char * path);
+
+/** Per nro analysis cache is enabled by default, same as --no-cache.
+ */
+void dbi_set_cache(DbiContext * ctx, int enabled);
+
+/** Same as --find-str <needle> --nro <nro> --keys <key_cnt> --out <out>.
+ */
+int dbi_find_str(DbiContext * ctx, const char * nro, const char * needle, uint32_t key_cnt, const char * out);
+
+/** Same as --scan --nro <nro> --dict <dict> --key-window <key_window> --out <out>.
+ */
+int dbi_blueprint(DbiContext * ctx, const char * nro, const char * dict, uint32_t key_window, const char * out);
+
+/** Same as --patch <blueprint> --nro <nro> --lang <lang> --out <out>.
+ */
+int dbi_patch(DbiContext * ctx, const char * blueprint, const char * nro, const char * lang, const char * out);
+
+/** Same as dbi_patch with --emit-delta <format> ("ips" or "native"), NULL
+ * format writes whole nro.
+ */
+int dbi_patch_delta(DbiContext * ctx, const char * blueprint, const char * nro, const char * lang, const char * format, const char * out);
+
+/** Same as --apply-delta <delta> --nro <nro> --out <out>.
+ */
+int dbi_apply_delta(DbiContext * ctx, const char * delta, const char * nro, const char * out);
+
+#endif /* DBIPATCHER_H */
+
@@ -26,20 +26,29 @@ typedef enum {
     LOG_ERROR,
 } LogLevel;
 
+// messages below this level are dropped before their arguments are evaluated
+extern LogLevel log_level;
+
 void log_init(const char * app);
 
 void log_close(void);
 
-#define lf_t(fmt,...) lf_s(LOG_TRACE, (fmt), ##__VA_ARGS__)
-#define lf_d(fmt,...) lf_s(LOG_DEBUG, (fmt), ##__VA_ARGS__)
-#define lf_i(fmt,...) lf_s(LOG_INFO, (fmt), ##__VA_ARGS__)
-#define lf_n(fmt,...) lf_s(LOG_NOTICE, (fmt), ##__VA_ARGS__)
-#define lf_w(fmt,...) lf_s(LOG_WARNING, (fmt), ##__VA_ARGS__)
-//#define lf_e(fmt,...) lf_s(LOG_ERROR, (fmt), ##__VA_ARGS__)
+void log_set_level(LogLevel level);
 
-void __attribute__ ((format (printf, 2, 3))) lf_s(LogLevel level, const char * fmt, ...);
+int log_parse_level(const char * name, LogLevel * level);
+
+void log_set_time(uint8_t enable);
 
-void lf_e(const char * fmt, ...);
+#define lf_l(level,fmt,...) ((level) >= log_level ? lf_s((level), (fmt), ##__VA_ARGS__) : (void)0)
+
+#define lf_t(fmt,...) lf_l(LOG_TRACE, (fmt), ##__VA_ARGS__)
+#define lf_d(fmt,...) lf_l(LOG_DEBUG, (fmt), ##__VA_ARGS__)
+#define lf_i(fmt,...) lf_l(LOG_INFO, (fmt), ##__VA_ARGS__)
+#define lf_n(fmt,...) lf_l(LOG_NOTICE, (fmt), ##__VA_ARGS__)
+#define lf_w(fmt,...) lf_l(LOG_WARNING, (fmt), ##__VA_ARGS__)
+#define lf_e(fmt,...) lf_l(LOG_ERROR, (fmt), ##__VA_ARGS__)
+
+void __attribute__ ((format (printf, 2, 3))) lf_s(LogLevel level, const char * fmt, ...);
 
 #endif /* LOG_H */
 
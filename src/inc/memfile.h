@@ -18,6 +18,9 @@
 typedef struct {
     uint8_t * data;
     uint32_t len;
+    
+    // hex sha256 of data, filled lazily by analysis cache
+    char * hash;
 } MemFile;
 
 MemFile * mf_init_path(const char * path);
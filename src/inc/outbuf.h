@@ -0,0 +1,78 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   outbuf.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define OB_CHUNK_SIZE       (64 * 1024)
+#define OB_CHUNKS           16
+
+/** Output sink for large reports. Text is formatted straight into chunks,
+ * which are written by single writev once all of them are filled.
+ */
+typedef struct {
+    FILE * f;
+    char * chunk[OB_CHUNKS];
+    uint32_t chunk_len[OB_CHUNKS];
+    uint32_t cur;
+    uint8_t failed;
+} OutBuf;
+
+void ob_init(OutBuf * ob, FILE * f);
+
+/** Writes out everything buffered, returns 0 on success. Any earlier write
+ * failure is reported here as well.
+ */
+int ob_flush(OutBuf * ob);
+
+/** Flushes and releases chunks, FILE stays open.
+ */
+int ob_close(OutBuf * ob);
+
+/** Returns space for at most len (<= OB_CHUNK_SIZE) bytes, ob_commit then
+ * tells how many were actually used. When no chunk can be allocated
+ * returns NULL, text is then dropped and ob_flush reports failure.
+ */
+char * ob_reserve(OutBuf * ob, uint32_t len);
+
+void ob_commit(OutBuf * ob, uint32_t len);
+
+void ob_write(OutBuf * ob, const void * data, uint32_t len);
+
+void ob_str(OutBuf * ob, const char * str);
+
+/** Like %-*s.
+ */
+void ob_str_pad(OutBuf * ob, const char * str, uint32_t width);
+
+/** Like %-*u.
+ */
+void ob_u32(OutBuf * ob, uint32_t val, uint32_t width);
+
+/** Zero padded hex without 0x, like %0*X or %0*x.
+ */
+void ob_hex(OutBuf * ob, uint64_t val, uint32_t digits, uint8_t upper);
+
+/** Bytes from last to first as upper case hex, how little endian immediates
+ * are printed.
+ */
+void ob_hex_rev(OutBuf * ob, const uint8_t * data, uint32_t len);
+
+void __attribute__ ((format (printf, 2, 3))) ob_printf(OutBuf * ob, const char * fmt, ...);
+
+#define ob_lit(ob, lit)     ob_write((ob), (lit), sizeof(lit) - 1)
+
+#endif /* OUTBUF_H */
+
@@ -0,0 +1,48 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/* 
+ * File:   perf.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+
+typedef enum {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_CNT,
+} PerfCounter;
+
+extern const char * perf_counter_names[PERF_CNT];
+
+/** Opens hardware counter group for calling thread, user space only, does
+ * nothing when thread already has one. Group is closed when thread exits.
+ * Returns -1 when counters are not available (no PMU, perf_event_paranoid,
+ * seccomp in containers, not linux), reason is then in perf_error and thread
+ * does not try again.
+ */
+int perf_open(void);
+
+/** Reads counters of calling thread. Returns -1 when counters are not open or
+ * got descheduled by PMU multiplexing.
+ */
+int perf_read(uint64_t values[PERF_CNT]);
+
+void perf_close(void);
+
+/** Reason of last failure of perf_open in calling thread.
+ */
+const char * perf_error(void);
+
+#endif /* PERF_H */
+
@@ -0,0 +1,57 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/* 
+ * File:   progress.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// seconds between two progress lines
+#define PROGRESS_INTERVAL   2
+
+/** Reporter of single operation, kept in its context.
+ */
+typedef struct {
+    uint8_t active;
+    const char * what;
+    uint64_t total_bytes;
+    uint64_t bytes;
+    uint64_t keys;
+    uint64_t started;
+    uint8_t stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Progress;
+
+#define PROGRESS_INITIALIZER    { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER }
+
+void progress_init(Progress * p);
+
+void progress_destroy(Progress * p);
+
+/** Starts reporter thread printing bytes scanned, MB/s, keys/s and ETA to
+ * stderr. Reporter belongs to context bound by calling thread, so concurrent
+ * operations report separately. Does nothing when stderr is not a terminal,
+ * then progress_add is a single branch.
+ */
+void progress_start(const char * what, uint64_t total_bytes);
+
+/** Called from scan loops, preferably once per batch of slots.
+ */
+void progress_add(uint64_t bytes, uint64_t keys);
+
+void progress_stop(void);
+
+#endif /* PROGRESS_H */
+
@@ -0,0 +1,39 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   sha256.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+
+#define SHA256_LEN      32
+#define SHA256_HEX_LEN  (SHA256_LEN * 2 + 1)
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t len;
+    uint8_t buf[64];
+    uint32_t buf_len;
+} Sha256;
+
+void sha256_init(Sha256 * ctx);
+
+void sha256_update(Sha256 * ctx, const void * data, uint32_t len);
+
+void sha256_final(Sha256 * ctx, uint8_t out[SHA256_LEN]);
+
+void sha256(const void * data, uint32_t len, uint8_t out[SHA256_LEN]);
+
+void sha256_hex(const uint8_t hash[SHA256_LEN], char out[SHA256_HEX_LEN]);
+
+#endif /* SHA256_H */
+
@@ -0,0 +1,113 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/* 
+ * File:   stats.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+#include "perf.h"
+
+/** Phases are accumulated, so phase entered repeatedly (per reference
+ * lookups) reports total time and number of calls. Totals are exclusive,
+ * phase nested in other one on the same thread (imm_lookup inside
+ * match_partial) is subtracted from the outer one.
+ */
+typedef enum {
+    STATS_PHASE_LOAD_NRO = 0,
+    STATS_PHASE_LOAD_DICT,
+    STATS_PHASE_ANALYSIS,
+    // full decoding sweep of analysis feeding partial pattern parser (and
+    // xref builder sharing the sweep)
+    STATS_PHASE_PARSE_PATTERNS,
+    STATS_PHASE_MATCH_FULL,
+    STATS_PHASE_MATCH_PARTIAL,
+    STATS_PHASE_IMM_LOOKUP,
+    STATS_PHASE_DUPLICATES,
+    STATS_PHASE_SCAN,
+    STATS_PHASE_OUTPUT,
+    STATS_PHASE_CNT,
+} StatsPhase;
+
+typedef enum {
+    STATS_SLOTS_VISITED = 0,
+    STATS_KEYS_TRIED,
+    STATS_DECODE_CALLS,
+    STATS_CANDIDATES_VALIDATED,
+    STATS_IMM_LOOKUPS,
+    // artifacts taken from resident or cached analysis instead of decoding
+    STATS_ANALYSIS_REUSED,
+    STATS_COUNTER_CNT,
+} StatsCounter;
+
+typedef enum {
+    PERF_STATE_OFF = 0,
+    PERF_STATE_ON,
+    PERF_STATE_UNAVAILABLE,
+} PerfState;
+
+typedef struct {
+    uint64_t ns;
+    uint64_t calls;
+    uint64_t perf[PERF_CNT];
+    uint64_t perf_calls;
+} PhaseTotal;
+
+/** Everything collected for single operation. Kept in context of operation,
+ * so operations running concurrently with separate contexts do not mix.
+ */
+typedef struct {
+    PhaseTotal phases[STATS_PHASE_CNT];
+    uint64_t counters[STATS_COUNTER_CNT];
+    uint64_t started;
+    PerfState perf_state;
+    char perf_error[128];
+} Stats;
+
+/** Start of phase, hardware counters are only sampled when enabled.
+ */
+typedef struct {
+    uint64_t ns;
+    uint64_t perf[PERF_CNT];
+    uint8_t perf_valid;
+} StatsMark;
+
+/** Clears statistics of context bound by calling thread.
+ */
+void stats_reset(void);
+
+/** Opens hardware counters for calling thread and enables them for context,
+ * worker threads open their own on first phase they enter. Phases then also
+ * accumulate counter deltas, samples of phase tell how many of its calls were
+ * counted. Returns -1 when unavailable.
+ */
+int stats_perf_enable(void);
+
+/** Monotonic clock in ns.
+ */
+uint64_t stats_now(void);
+
+StatsMark stats_phase_begin(void);
+
+void stats_phase_end(StatsPhase phase, const StatsMark * start);
+
+/** Counters are shared by all threads of operation, hot loops should count
+ * locally and add once.
+ */
+void stats_add(StatsCounter counter, uint64_t cnt);
+
+uint64_t stats_peak_rss(void);
+
+int stats_write(const char * path, const char * command, int ret);
+
+#endif /* STATS_H */
+
@@ -14,11 +14,14 @@
 #define UTILS_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <sys/stat.h>
 
 #define ARRLEN(arr)     (sizeof(arr)/sizeof(*arr))
 
 int mkpath(mode_t mode, const char* fmt, ...);
 
+int parse_address(const char * line, uint32_t * addr);
+
 #endif /* UTILS_H */
 
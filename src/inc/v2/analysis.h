@@ -0,0 +1,63 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   analysis.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stdint.h>
+
+#include "../memfile.h"
+#include "inst.h"
+#include "imm.h"
+#include "keys.h"
+#include "xref.h"
+
+/** Receives every decoded instruction of .text in ascending order.
+ */
+typedef void (*AnalysisStep)(void * ctx, const arm64_instr_t * d, uint32_t raw, uint32_t pc);
+
+typedef struct {
+    AnalysisStep step;
+    void * ctx;
+    
+    // only MOV family matters, other instructions may be skipped (see
+    // INSTR_MOV_CANDIDATE), consumer has to treat gap in pc as such
+    uint8_t mov_only;
+} AnalysisConsumer;
+
+#define ANALYSIS_KEYS       0x01    // KeySet with sites, same as get_key_set
+#define ANALYSIS_PARTIALS   0x02    // partial immediates, same as imm_scan
+#define ANALYSIS_STREAM     0x04    // ImmStream for immediate lookups
+#define ANALYSIS_XREFS      0x08    // ADRP + ADD / LDR references
+
+typedef struct {
+    KeySet * keys;
+    ImmResult * partials;
+    ImmStream * stream;
+    XrefIndex * xrefs;
+    
+    // artifacts owned by resident analysis, not freed by code_analysis_free
+    uint32_t borrowed;
+} CodeAnalysis;
+
+void code_analysis_run(const MemFile * mf, const AnalysisConsumer * consumers, uint32_t consumer_cnt);
+
+CodeAnalysis * code_analysis_init(const MemFile * mf, uint32_t what);
+
+void code_analysis_free(CodeAnalysis * ca);
+
+void code_analysis_retain(const MemFile * mf, uint32_t what);
+
+void code_analysis_release(const MemFile * mf);
+
+#endif /* ANALYSIS_H */
+
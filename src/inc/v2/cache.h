@@ -0,0 +1,31 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   cache.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+#include "../memfile.h"
+#include "analysis.h"
+
+// bump whenever analysis results or file layout change
+#define CACHE_VERSION   1
+
+void analysis_cache_disable(void);
+
+uint32_t analysis_cache_load(const MemFile * mf, CodeAnalysis * ca, uint32_t what);
+
+void analysis_cache_store(const MemFile * mf, const CodeAnalysis * ca, uint32_t what);
+
+#endif /* CACHE_H */
+
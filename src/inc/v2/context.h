@@ -0,0 +1,58 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   context.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stdint.h>
+
+#include "stats.h"
+#include "progress.h"
+
+/** Configuration and instrumentation of operation running on behalf of single
+ * caller.
+ * 
+ * Configuration is only read while operation runs, so context may be bound by
+ * all its worker threads at once. Statistics and progress are updated
+ * atomically by them.
+ * Operations running concurrently need separate contexts. Scratch buffers of
+ * formatting helpers are kept per thread instead.
+ */
+typedef struct _DbiContext {
+    // alternate key sequence, see --keygen
+    uint64_t * keygen;
+    uint32_t keygen_len;
+    
+    uint8_t no_cache;
+    
+    Stats stats;
+    Progress progress;
+} DbiContext;
+
+DbiContext * dbi_context_init(void);
+
+void dbi_context_free(DbiContext * ctx);
+
+DbiContext * dbi_context_default(void);
+
+const DbiContext * dbi_context_current(void);
+
+DbiContext * dbi_context_bound(void);
+
+DbiContext * dbi_context_bind(DbiContext * ctx);
+
+Stats * dbi_context_stats(void);
+
+Progress * dbi_context_progress(void);
+
+#endif /* CONTEXT_H */
+
@@ -0,0 +1,51 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   delta.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../memfile.h"
+
+typedef enum {
+    DELTA_FORMAT_NONE = 0,
+    // classic IPS, no checksums and offsets limited to 16 MiB
+    DELTA_FORMAT_IPS,
+    // DBID, carries sha256 of source and target
+    DELTA_FORMAT_NATIVE,
+} DeltaFormat;
+
+// changed ranges closer than this are merged into single record
+#define DELTA_MERGE_GAP     8
+
+int delta_parse_format(const char * name, DeltaFormat * format);
+
+/** Writes difference of src and dst (both len B) in given format.
+ */
+int delta_write(FILE * out, DeltaFormat format, const uint8_t * src, const uint8_t * dst, uint32_t len);
+
+typedef struct {
+    MemFile * dbi_mf;
+    const char * delta;
+    // NULL writes stdout
+    const char * out;
+} ApplyDeltaArgs;
+
+/** Applies IPS or DBID delta to nro, DBID source and target checksums have
+ * to match. Output is only replaced once whole delta applies.
+ */
+int apply_delta(const ApplyDeltaArgs * args);
+
+#endif /* DELTA_H */
+
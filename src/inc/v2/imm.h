@@ -16,6 +16,9 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "inst.h"
+#include "../outbuf.h"
+
 typedef struct {
     const void * data;
     uint32_t len;
@@ -41,17 +44,60 @@ typedef struct _ImmResult {
    ImmResult * next;
 } ImmResult;
 
+#define IMM_CLASS_NONE      0
+#define IMM_CLASS_MOV       1   // MOV / MOVZ / MOVK
+#define IMM_CLASS_MOVN      2
+
+#define IMM_STREAM_CLASS(w) ((w) >> 16)
+#define IMM_STREAM_IMM(w)   ((w) & 0xFFFF)
+
+/** Instructions decoded once into (class << 16) | imm16 words, so repeated
+ * immediate lookups do not need to decode whole binary again.
+ */
+typedef struct {
+    uint32_t * words;
+    uint32_t cnt;
+} ImmStream;
+
+/** Partial immediate pattern parser fed instruction by instruction, see
+ * analysis.h.
+ */
+typedef struct _ImmParser ImmParser;
+
+ImmParser * imm_parser_init(void);
+
+void imm_parser_step(void * ctx, const arm64_instr_t * d, uint32_t raw, uint32_t pc);
+
+ImmResult * imm_parser_finish(ImmParser * P);
+
 ImmResult * imm_scan(const void * data, uint32_t len);
 
+ImmStream * imm_stream_init(const void * data, uint32_t len);
+
+ImmStream * imm_stream_alloc(uint32_t len);
+
+void imm_stream_step(void * ctx, const arm64_instr_t * d, uint32_t raw, uint32_t pc);
+
+void imm_stream_free(ImmStream * stream);
+
+ImmResult * imm_stream_lookup(const ImmStream * stream, ImmDefine * imm, uint32_t tolerance);
+
+/** Resolves cnt lookups by single pass over stream, returns array of cnt
+ * results ordered as imms.
+ */
+ImmResult ** imm_stream_lookup_batch(const ImmStream * stream, ImmDefine * imms, uint32_t cnt, uint32_t tolerance);
+
+ImmResult * imm_stream_lookup_ranges(const ImmStream * stream, ImmDefine * imm, uint32_t tolerance, const uint32_t * ranges, uint32_t range_cnt);
+
 void imm_match_free(ImmMatch * iter);
 
 void imm_result_free(ImmResult * res);
 
 ImmResult * imm_lookup(const void * data, uint32_t len, ImmDefine * imm, uint32_t tolerance);
 
-void imm_print(FILE * f, const ImmDefine * def, const ImmResult * res);
+void imm_print(OutBuf * ob, const ImmDefine * def, const ImmResult * res);
 
-void imm_print_dummy(FILE * f, const ImmDefine * def);
+void imm_print_dummy(OutBuf * ob, const ImmDefine * def);
 
 #endif /* IMMEDIATES_H */
 
@@ -80,6 +80,15 @@ int instr_decode(uint32_t insn, arm64_instr_t *d, uint64_t pc);
 
 const char * instr_to_string(const arm64_instr_t *d, uint32_t raw, uint64_t pc);
 
+/** Words which may decode to MOV / MOVZ / MOVN / MOVK, no other word ever
+ * decodes to any of those types.
+ */
+#define INSTR_MOV_WIDE(i)       (((i) & 0x1F800000) == 0x12800000)
+#define INSTR_MOV_ORR(i)        (((i) & 0xFFC00000) == 0x52000000 || ((i) & 0xFFC00000) == 0xAA000000)
+#define INSTR_MOV_CANDIDATE(i)  (INSTR_MOV_WIDE(i) || INSTR_MOV_ORR(i))
+
+void instr_mov_candidates(const void * code, uint32_t cnt, uint64_t * mask);
+
 #define ERR_MOV_OK               0   // Successfully patched
 #define ERR_MOV_NOT_MOV         -1   // Not a MOVx instruction with immediate
 #define ERR_MOV_IMM_MISMATCH    -2   // Immediate value doesn't match imm_old
@@ -16,22 +16,52 @@
 #include <stdint.h>
 
 #include "memfile.h"
+#include "inst.h"
+#include "context.h"
+
+// MOV + 3x MOVK
+#define KEY_SITE_LEN    16
+
+/** Address of MOV/MOVK sequence materializing key in code.
+ */
+typedef struct {
+    uint64_t key;
+    uint32_t offset;
+} KeySite;
 
 typedef struct {
     uint64_t * keys;
     uint32_t key_cnt;
+    
+    // sorted by key and offset, only filled by get_key_set
+    KeySite * sites;
+    uint32_t site_cnt;
 } KeySet;
 
+/** Incremental key recovery fed instruction by instruction, see analysis.h.
+ */
+typedef struct _KeyCollector KeyCollector;
+
 void free_key_set(KeySet * ks);
 
 int set_keygen(const char * path);
 
-int set_keygen(const char * path);
+int load_keygen(DbiContext * ctx, const char * path);
+
+KeyCollector * key_collector_init(void);
+
+void key_collector_step(void * ctx, const arm64_instr_t * d, uint32_t raw, uint32_t pc);
 
-KeySet * get_key_set(MemFile * mf);
+KeySet * key_collector_finish(KeyCollector * kc);
+
+KeySet * get_key_set(const MemFile * mf);
+
+const KeySite * key_set_sites(const KeySet * ks, uint64_t key, uint32_t * cnt);
 
 uint64_t get_key(uint64_t seed);
 
+void key_xor(void * data, uint32_t start, uint32_t end, uint64_t key);
+
 KeySet * gen_key_set(uint32_t max);
 
 #endif /* KEYS_H */
@@ -0,0 +1,31 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   keysearch.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef KEYSEARCH_H
+#define KEYSEARCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../memfile.h"
+
+typedef struct {
+    MemFile * dbi_mf;
+    const char * known;
+    FILE * out;
+    uint32_t seed_cnt;
+} SearchKeygenArgs;
+
+int search_keygen(const SearchKeygenArgs * args);
+
+#endif /* KEYSEARCH_H */
+
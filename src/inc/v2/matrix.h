@@ -0,0 +1,47 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   matrix.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stdio.h>
+
+#include "delta.h"
+
+#define MATRIX_OUT_DEFAULT      "DBI.{version}.{lang}.nro"
+#define MATRIX_STATE_SUFFIX     ".state"
+
+typedef struct {
+    const char * manifest;
+    DeltaFormat delta;
+    FILE * out;
+} BuildMatrixArgs;
+
+/** Patches every version of manifest with every language. Outputs whose nro,
+ * blueprint and language hashes match state file of previous run are
+ * skipped, the rest is built in parallel. Each output is reported as
+ * built, issues, skipped or failed; outputs with issues are kept in state
+ * as patching them again would give the same result.
+ *
+ * Manifest uses key=value lines, relative paths are relative to manifest:
+ *
+ *   nro.<version>=<file>
+ *   blueprint.<version>=<file>
+ *   lang.<code>=<file>
+ *   out=<template>      {version} and {lang} are substituted, MATRIX_OUT_DEFAULT
+ *   state=<file>        <manifest>.state by default
+ *   jobs=<count>        number of processors by default
+ */
+int build_matrix(const BuildMatrixArgs * args);
+
+#endif /* MATRIX_H */
+
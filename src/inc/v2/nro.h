@@ -0,0 +1,39 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   nro.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef NRO_H
+#define NRO_H
+
+#include <stdint.h>
+
+#include "../memfile.h"
+
+#define NRO_SEG_TEXT    0
+#define NRO_SEG_RO      1
+#define NRO_SEG_DATA    2
+#define NRO_SEG_CNT     3
+
+/** Segment of nro, nro is mapped flat so offset is both file offset and
+ * address.
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+} NroSegment;
+
+/** Reads segment table from nro header. When file does not look like nro,
+ * every segment covers whole file and -1 is returned.
+ */
+int nro_segments(const MemFile * mf, NroSegment seg[NRO_SEG_CNT]);
+
+#endif /* NRO_H */
+
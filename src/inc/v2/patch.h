@@ -17,15 +17,45 @@
 #include <stdio.h>
 
 #include "../memfile.h"
+#include "delta.h"
+#include "blueprint.h"
 
 typedef struct {
     const MemFile * dbi_mf;
     FILE * out;
     const char * blueprint;
+    // already loaded blueprint, shared by build matrix jobs instead of loading blueprint path
+    const BlueprintRecord * bp;
     const char * translation;
+    // write only changed ranges instead of whole nro
+    DeltaFormat delta;
+    // when set receives count of records with issues, which then do not fail
+    // patch as output is still complete
+    uint32_t * issues;
 } PatchArgs;
 
 int patch(const PatchArgs * args);
 
+// translation base was built from, kept next to it
+#define PATCH_SIDECAR_SUFFIX    ".lang"
+
+typedef struct {
+    // original nro, never modified
+    const MemFile * dbi_mf;
+    const char * blueprint;
+    const char * translation;
+    // previous output, updated in place
+    const char * base;
+    // repatch whenever translation is saved
+    uint8_t watch;
+} PatchIncrementalArgs;
+
+/** Patches only keys whose translation differs from sidecar of base, writing
+ * just their locations into base. Missing base, base built from other nro
+ * or blueprint, or base modified since, per hash kept in sidecar, is patched
+ * whole.
+ */
+int patch_incremental(const PatchIncrementalArgs * args);
+
 #endif /* PATCH_H */
 
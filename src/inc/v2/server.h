@@ -0,0 +1,37 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   server.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+#include "../memfile.h"
+
+// runs single command line, same as main would
+typedef int (*ServeRun)(int argc, char ** argv);
+
+typedef struct {
+    const char * socket;
+    const char * nro_path;
+    MemFile * nro_mf;
+    ServeRun run;
+} ServeArgs;
+
+int serve(const ServeArgs * args);
+
+int serve_client(const char * socket, int argc, char ** argv);
+
+MemFile * serve_nro_get(const char * path);
+
+#endif /* SERVER_H */
+
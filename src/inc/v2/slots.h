@@ -0,0 +1,43 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   slots.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef SLOTS_H
+#define SLOTS_H
+
+#include <stdint.h>
+
+#include "../memfile.h"
+
+#define SLOT_NONE   UINT32_MAX
+
+/** Hash index over all 8 B aligned words of nro. Each word is masked by mask
+ * before hashing, so prefixes shorter than 8 B may be looked up as well.
+ */
+typedef struct {
+    const uint8_t * data;
+    uint32_t slot_cnt;
+    uint64_t mask;
+    uint32_t bucket_mask;
+    uint32_t * buckets;
+    uint32_t * chain;
+} SlotIndex;
+
+SlotIndex * slot_index_init(const MemFile * mf, uint64_t mask);
+
+void slot_index_free(SlotIndex * idx);
+
+uint32_t slot_index_find(const SlotIndex * idx, uint64_t value);
+
+uint32_t slot_index_next(const SlotIndex * idx, uint32_t offset, uint64_t value);
+
+#endif /* SLOTS_H */
+
@@ -26,10 +26,28 @@ typedef enum {
 typedef struct {
     const MemFile * dbi_mf;
     const char * lookup;
+    const char * lookup_file;
     FILE * out;
     uint32_t key_cnt;
 } ScanStringArgs;
 
+typedef struct {
+    const MemFile * dbi_mf;
+    const char * lookup;
+    const char * lookup_file;
+    FILE * out;
+    uint32_t key_cnt;
+} ScanImmediateArgs;
+
+typedef struct {
+    const MemFile * dbi_mf;
+    uint32_t addr;
+    const char * addr_file;
+    FILE * out;
+    uint32_t key_cnt;
+    uint8_t xref;
+} ScanDecodeArgs;
+
 typedef struct {
     ScanType type;
     const MemFile * dbi_mf;
@@ -37,6 +55,7 @@ typedef struct {
     FILE * out;
     uint32_t min_match;
     uint32_t key_cnt;
+    uint8_t xref;
 } ScanTypeArgs;
 
 typedef struct {
@@ -45,18 +64,40 @@ typedef struct {
     FILE * out;
 } ScanPartialsArgs;
 
+// immediates of short strings are searched this far from their key
+#define KEY_WINDOW_DEFAULT  4096
+
 typedef struct {
     MemFile * dbi_mf;
     const char * keys;
     FILE * out;
+    uint32_t key_window;
 } ScanBlueprintArgs;
 
+/** Escapes control characters of src (up to len or terminator, UINT32_MAX
+ * for whole string) into dst, which is always terminated. Returns length
+ * written, escapes are never truncated.
+ */
+uint32_t string_encode_into(char * dst, uint32_t dst_size, const char * src, uint32_t len);
+
+/** string_encode_into thread local buffer, valid until next call.
+ */
 const char * string_encode(const char * src, uint32_t len);
 
 void string_decode(void * data, uint32_t len);
 
 int scan_string(const ScanStringArgs * args);
 
+void scan_string_retain(const MemFile * mf, const char * lookup);
+
+int scan_string_retained(const MemFile * mf, const char * lookup);
+
+void scan_string_release(const MemFile * mf);
+
+int scan_immediate(const ScanImmediateArgs * args);
+
+int scan_decode(const ScanDecodeArgs * args);
+
 int scan_strings_type(const ScanTypeArgs * args);
 
 int scan_partials(const ScanPartialsArgs * args);
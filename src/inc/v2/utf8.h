@@ -27,9 +27,21 @@ typedef struct {
     uint32_t next_offset;
 } utf8_char_validity;
 
+#define UTF8_NO_NUL UINT32_MAX
+
+typedef struct {
+    uint32_t valid_len;     // may exceed len when last character straddles it
+    uint32_t nul_offset;    // == valid_len when stopped at NUL, UTF8_NO_NUL otherwise
+    uint32_t cyrillic;
+    uint32_t letters;
+    uint32_t numbers;
+} utf8_prefix;
+
 utf8_char_validity utf8_check_char(const char* str, uint32_t offset);
 
 utf8_char_validity utf8_check_char_unchecked(const char* str, uint32_t offset);
 
+void utf8_validate_prefix(const char* str, uint32_t len, uint8_t unchecked, utf8_prefix* res);
+
 #endif /* UTF8_H */
 
@@ -0,0 +1,58 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * File:   xref.h
+ *
+ * Created on 19. října 2026, 9:05
+ */
+
+#ifndef XREF_H
+#define XREF_H
+
+#include <stdint.h>
+
+#include "../memfile.h"
+#include "inst.h"
+
+// ADRP is paired with ADD / LDR at most this many instructions later
+#define XREF_WINDOW     32
+
+typedef struct {
+    uint32_t target;
+    uint32_t from;      // ADD / LDR completing the address
+    uint32_t adrp;
+} XrefEntry;
+
+/** Addresses referenced from .text through ADRP + ADD / LDR pairs, sorted by
+ * target address.
+ */
+typedef struct {
+    XrefEntry * entries;
+    uint32_t cnt;
+} XrefIndex;
+
+/** Incremental index construction fed instruction by instruction, see
+ * analysis.h.
+ */
+typedef struct _XrefBuilder XrefBuilder;
+
+XrefBuilder * xref_builder_init(void);
+
+void xref_builder_step(void * ctx, const arm64_instr_t * d, uint32_t raw, uint32_t pc);
+
+XrefIndex * xref_builder_finish(XrefBuilder * xb);
+
+XrefIndex * xref_index_init(const MemFile * mf);
+
+void xref_index_free(XrefIndex * idx);
+
+const XrefEntry * xref_index_find(const XrefIndex * idx, uint32_t target, uint32_t * cnt);
+
+uint32_t xref_index_next(const XrefIndex * idx, uint32_t target);
+
+#endif /* XREF_H */
+
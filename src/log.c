@@ -4,11 +4,32 @@
  * and open the template in the editor.
  */
 
+/*
+ * Messages are formatted by calling thread into its own ring buffer, single
+ * writer thread started by log_init merges all rings by sequence number and
+ * writes them to stderr in large chunks. Producers never take lock, when
+ * their ring is full they only wait for writer to catch up.
+ *
+ * Lines of single thread keep their order. Lines of different threads are
+ * only ordered by the time they were queued, line which another thread is
+ * still publishing may be written after later ones.
+ *
+ * Without writer (library users never calling log_init, forked server
+ * workers, after log_close) every line goes directly to stderr by single
+ * write, so lines of concurrent threads still never mix.
+ */
+
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "log.h"
 #include "utils.h"
@@ -17,9 +38,51 @@
 #define LOG_SUFFIX      ESC "[0m"
 #define LOG_BUFFER      4096
 
-#define LF_CLI          0x01
+// per thread, power of two
+#define LOG_RING_SIZE   (64 * 1024)
+#define LOG_OUT_BUFFER  (32 * 1024)
+// upper bound of latency when writer misses wakeup
+#define LOG_WAIT_MS     50
+
+typedef struct LogRing {
+    struct LogRing * next;
+    uint8_t owned;
+
+    // consumed by writer, produced by owning thread
+    uint64_t head;
+    uint64_t tail;
+
+    uint8_t data[LOG_RING_SIZE];
+} LogRing;
+
+typedef struct {
+    uint64_t seq;
+    uint32_t len;
+} LogRecord;
 
-static const char * app_name = NULL;
+LogLevel log_level = LOG_INFO;
+
+// library users may never call log_init
+static const char * app_name = "dbipatcher";
+static uint8_t log_time = 0;
+
+static uint8_t log_async = 0;
+static uint8_t log_forked = 0;
+static uint8_t log_stop = 0;
+static uint8_t log_wake = 0;
+static uint64_t log_seq = 0;
+// producers between checking log_async and publishing their line
+static uint32_t log_producers = 0;
+
+// rings are only ever pushed, so writer can walk list without locking
+static LogRing * log_rings = NULL;
+static __thread LogRing * log_ring = NULL;
+
+static pthread_t log_writer;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static pthread_key_t log_ring_key;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
 
 static const char * log_get_prefix(LogLevel lvl) {
     switch(lvl) {
@@ -28,7 +91,7 @@ static const char * log_get_prefix(LogLevel lvl) {
         case LOG_INFO:      return ESC "[0m";
         case LOG_NOTICE:    return ESC "[0;32m";
         case LOG_WARNING:   return ESC "[1;33m";
-        case LOG_ERROR:     
+        case LOG_ERROR:
         default:            return ESC "[1;31m";
     }
 }
@@ -40,65 +103,315 @@ static const char * log_get_level(LogLevel lvl) {
         case LOG_INFO:      return "INFO";
         case LOG_NOTICE:    return "NOTICE";
         case LOG_WARNING:   return "WARNING";
-        case LOG_ERROR:     
+        case LOG_ERROR:
         default:            return "ERROR";
     }
 }
 
 static const char * log_get_time(void) {
-    static char timebuff[10];
-    
+    static __thread char timebuff[10];
+
     time_t t;
     struct tm tm;
-    
+
     t = time(NULL);
-    tm = *localtime(&t);
+    localtime_r(&t, &tm);
 
     snprintf(timebuff, sizeof(timebuff), "%02d:%02d:%02d ", tm.tm_hour, tm.tm_min, tm.tm_sec);
-    
+
     return timebuff;
 }
 
-static void log_write(uint8_t flags, const char * str) {    
-    if(flags & LF_CLI) {
-        fprintf(stdout, "%s", str);
+static void log_write(const char * str, size_t len) {
+    while(len) {
+        ssize_t n = write(STDERR_FILENO, str, len);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        } else if(n <= 0) {
+            return;
+        }
+
+        str += n;
+        len -= n;
     }
 }
 
-void lf_e(const char * fmt, ...) {
-    char tmp[LOG_BUFFER];
-    va_list args;
-    va_start(args, fmt);
-    vsnprintf(tmp, sizeof(tmp), fmt, args);
-    va_end(args);
-    
-    fprintf(stderr, "%s: %s%s%s" CRLF, app_name, log_get_prefix(LOG_ERROR), tmp, LOG_SUFFIX);
+//////////// rings
+
+static void ring_put(LogRing * ring, uint64_t pos, const void * src, uint32_t len) {
+    uint32_t off = pos & (LOG_RING_SIZE - 1);
+    uint32_t first = len < LOG_RING_SIZE - off ? len : LOG_RING_SIZE - off;
+
+    memcpy(ring->data + off, src, first);
+    memcpy(ring->data, (const uint8_t*)src + first, len - first);
+}
+
+static void ring_get(const LogRing * ring, uint64_t pos, void * dst, uint32_t len) {
+    uint32_t off = pos & (LOG_RING_SIZE - 1);
+    uint32_t first = len < LOG_RING_SIZE - off ? len : LOG_RING_SIZE - off;
+
+    memcpy(dst, ring->data + off, first);
+    memcpy((uint8_t*)dst + first, ring->data, len - first);
+}
+
+static void ring_release(void * ptr) {
+    LogRing * ring = ptr;
+    __atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+/** Ring of calling thread, rings of finished threads are reused.
+ */
+static LogRing * ring_get_own(void) {
+    if(log_ring) {
+        return log_ring;
+    }
+
+    LogRing * ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+    for(; ring; ring = ring->next) {
+        uint8_t expected = 0;
+        if(__atomic_compare_exchange_n(&ring->owned, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if(!ring) {
+        ring = calloc(1, sizeof(*ring));
+        if(!ring) {
+            return NULL;
+        }
+
+        ring->owned = 1;
+        ring->next = __atomic_load_n(&log_rings, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&log_rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    pthread_setspecific(log_ring_key, ring);
+    log_ring = ring;
+
+    return ring;
+}
+
+/** Writes out everything published so far, lines of all rings merged by
+ * sequence number. Caller holds log_lock.
+ */
+static void log_drain(void) {
+    static char out[LOG_OUT_BUFFER];
+    size_t out_len = 0;
+
+    for(;;) {
+        LogRing * best = NULL;
+        LogRecord best_rec = {0};
+
+        for(LogRing * ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+            uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+            if(ring->head == tail) {
+                continue;
+            }
+
+            LogRecord rec;
+            ring_get(ring, ring->head, &rec, sizeof(rec));
+
+            if(!best || rec.seq < best_rec.seq) {
+                best = ring;
+                best_rec = rec;
+            }
+        }
+
+        if(!best) {
+            break;
+        }
+
+        if(out_len + best_rec.len > sizeof(out)) {
+            log_write(out, out_len);
+            out_len = 0;
+        }
+
+        ring_get(best, best->head + sizeof(best_rec), out + out_len, best_rec.len);
+        out_len += best_rec.len;
+
+        __atomic_store_n(&best->head, best->head + sizeof(best_rec) + best_rec.len, __ATOMIC_RELEASE);
+    }
+
+    log_write(out, out_len);
+}
+
+static void log_wakeup(void) {
+    if(!__atomic_exchange_n(&log_wake, 1, __ATOMIC_ACQ_REL)) {
+        pthread_cond_signal(&log_cond);
+    }
+}
+
+static void * log_writer_thread(void * arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&log_lock);
+
+    while(!__atomic_load_n(&log_stop, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&log_wake, 0, __ATOMIC_RELEASE);
+        log_drain();
+
+        if(!__atomic_load_n(&log_wake, __ATOMIC_ACQUIRE)) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += LOG_WAIT_MS * 1000000L;
+            if(ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+
+            pthread_cond_timedwait(&log_cond, &log_lock, &ts);
+        }
+    }
+
+    log_drain();
+
+    pthread_mutex_unlock(&log_lock);
+
+    return NULL;
+}
+
+static void log_emit(const char * line, uint32_t len) {
+    LogRing * ring;
+
+    // log_close waits for producers which already saw writer running
+    __atomic_fetch_add(&log_producers, 1, __ATOMIC_SEQ_CST);
+
+    if(!__atomic_load_n(&log_async, __ATOMIC_SEQ_CST) || !(ring = ring_get_own())) {
+        __atomic_fetch_sub(&log_producers, 1, __ATOMIC_RELEASE);
+        log_write(line, len);
+        return;
+    }
+
+    uint32_t need = sizeof(LogRecord) + len;
+
+    while(LOG_RING_SIZE - (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) < need) {
+        if(!__atomic_load_n(&log_async, __ATOMIC_ACQUIRE)) {
+            __atomic_fetch_sub(&log_producers, 1, __ATOMIC_RELEASE);
+            log_write(line, len);
+            return;
+        }
+
+        log_wakeup();
+        sched_yield();
+    }
+
+    LogRecord rec = {
+        .seq = __atomic_fetch_add(&log_seq, 1, __ATOMIC_RELAXED),
+        .len = len,
+    };
+
+    ring_put(ring, ring->tail, &rec, sizeof(rec));
+    ring_put(ring, ring->tail + sizeof(rec), line, len);
+
+    __atomic_store_n(&ring->tail, ring->tail + need, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&log_producers, 1, __ATOMIC_RELEASE);
+
+    log_wakeup();
+}
+
+//////////// fork
+
+static void log_fork_prepare(void) {
+    pthread_mutex_lock(&log_lock);
+    log_drain();
+}
+
+static void log_fork_parent(void) {
+    pthread_mutex_unlock(&log_lock);
+}
+
+/** Writer thread does not exist in child and server workers leave by _exit,
+ * so child writes synchronously.
+ */
+static void log_fork_child(void) {
+    log_forked = 1;
+    log_async = 0;
+    log_producers = 0;
+    pthread_mutex_unlock(&log_lock);
+}
+
+static void log_once_init(void) {
+    pthread_key_create(&log_ring_key, ring_release);
+    pthread_atfork(log_fork_prepare, log_fork_parent, log_fork_child);
 }
 
+//////////// api
+
 void log_init(const char * app) {
     app_name = app;
+
+    // server calls log_init for every request
+    if(log_async || log_forked) {
+        return;
+    }
+
+    pthread_once(&log_once, log_once_init);
+
+    __atomic_store_n(&log_stop, 0, __ATOMIC_RELEASE);
+    if(pthread_create(&log_writer, NULL, log_writer_thread, NULL) == 0) {
+        __atomic_store_n(&log_async, 1, __ATOMIC_RELEASE);
+    }
 }
 
 void log_close(void) {
-    
+    if(!log_async) {
+        return;
+    }
+
+    __atomic_store_n(&log_async, 0, __ATOMIC_SEQ_CST);
+
+    // new lines go directly to stderr, those being queued must reach final
+    // drain of writer
+    while(__atomic_load_n(&log_producers, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&log_lock);
+    __atomic_store_n(&log_stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&log_cond);
+    pthread_mutex_unlock(&log_lock);
+
+    pthread_join(log_writer, NULL);
+}
+
+void log_set_level(LogLevel level) {
+    log_level = level;
+}
+
+int log_parse_level(const char * name, LogLevel * level) {
+    for(LogLevel lvl = LOG_TRACE; lvl <= LOG_ERROR; lvl++) {
+        if(strcasecmp(name, log_get_level(lvl)) == 0) {
+            *level = lvl;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void log_set_time(uint8_t enable) {
+    log_time = enable;
 }
 
 void lf_s(LogLevel lvl, const char * fmt, ...) {
-    char tmp[LOG_BUFFER];
+    // whole line is emitted at once, so lines of concurrent threads never mix
+    char line[LOG_BUFFER + 256];
+
+    int head_max = sizeof(line) - LOG_BUFFER - sizeof(LOG_SUFFIX CRLF);
+    int len = snprintf(line, head_max, "%s: %s%s", app_name, log_time ? log_get_time() : "", log_get_prefix(lvl));
+    if(len >= head_max) {
+        len = head_max - 1;
+    }
+
     va_list args;
     va_start(args, fmt);
-    
-    log_write(LF_CLI, app_name);
-    log_write(LF_CLI, ": ");
-    
-    log_write(LF_CLI, log_get_prefix(lvl));
-    
-    vsnprintf(tmp, sizeof(tmp), fmt, args);
-    
-    log_write(LF_CLI, tmp);
-    
-    log_write(LF_CLI, LOG_SUFFIX);
-    log_write(LF_CLI, CRLF);
-    
+    int msg_len = vsnprintf(line + len, LOG_BUFFER, fmt, args);
     va_end(args);
-}
\ No newline at end of file
+
+    len += msg_len < 0 ? 0 : msg_len < LOG_BUFFER ? msg_len : LOG_BUFFER - 1;
+
+    memcpy(line + len, LOG_SUFFIX CRLF, sizeof(LOG_SUFFIX CRLF));
+    len += sizeof(LOG_SUFFIX CRLF) - 1;
+
+    log_emit(line, len);
+}
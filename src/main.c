@@ -18,9 +18,12 @@
 #include <inttypes.h>
 #include <sys/param.h>
 #include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
 
 #include "log.h"
 #include "utils.h"
+#include "stats.h"
 #include "v2/keys.h"
 #include "v2/strings.h"
 #include "v2/inst.h"
@@ -28,7 +31,12 @@
 #include "v2/blueprint.h"
 #include "v2/merge.h"
 #include "v2/patch.h"
+#include "v2/delta.h"
+#include "v2/matrix.h"
 #include "v2/utf8.h"
+#include "v2/keysearch.h"
+#include "v2/cache.h"
+#include "v2/server.h"
 
 #define APP         "dbipatcher"
 #define ARRLEN(arr) (sizeof(arr)/sizeof(*arr))
@@ -37,26 +45,42 @@ typedef enum {
     CMD_NONE = 0,
     CMD_FIND_IMM,
     CMD_FIND_STR,
+    CMD_FIND_IMM_FILE,
+    CMD_FIND_STR_FILE,
     CMD_FIND_KEYS,
+    CMD_SEARCH_KEYGEN,
     CMD_NEW_EN,
     CMD_NEW_RU,
     CMD_PARTIALS,
     CMD_DECODE,
+    CMD_DECODE_FILE,
     CMD_MERGE,
     CMD_SCAN,
     CMD_PATCH,
+    CMD_PATCH_INCREMENTAL,
+    CMD_APPLY_DELTA,
+    CMD_BUILD_MATRIX,
+    CMD_SERVE,
 } Command;
 
 typedef struct {
     Command command;
     char * command_name;
     char * needle;
+    char * needle_path;
+    char * addr_path;
     char * nro_path;
     char * dict_path;
     char * output_path;
     char * lang_path;
     char * blueprint_path;
+    char * delta_path;
+    char * manifest_path;
+    char * base_path;
     char * keygen_path;
+    char * known_path;
+    char * socket_path;
+    char * stats_path;
     
     FILE * output_file;
     MemFile * nro_mf;
@@ -64,6 +88,12 @@ typedef struct {
     int64_t keys;
     int64_t min_length;
     int64_t decode_addr;
+    int64_t key_window;
+    uint8_t xref;
+    uint8_t no_cache;
+    uint8_t perf_counters;
+    uint8_t watch;
+    DeltaFormat delta_format;
     uint8_t help;
 } Args;
 
@@ -73,15 +103,26 @@ typedef enum {
     // no shortop
     ARG_TYPE_FIND_IMM = 1000,
     ARG_TYPE_FIND_STR,
+    ARG_TYPE_FIND_IMM_FILE,
+    ARG_TYPE_FIND_STR_FILE,
     ARG_TYPE_FIND_KEYS,
     ARG_TYPE_KEYGEN,
+    ARG_TYPE_SEARCH_KEYGEN,
+    ARG_TYPE_KNOWN,
     ARG_TYPE_NEW_EN,
     ARG_TYPE_NEW_RU,
     ARG_TYPE_PARTIALS,
     ARG_TYPE_DECODE,
+    ARG_TYPE_DECODE_FILE,
     ARG_TYPE_MERGE,
     ARG_TYPE_SCAN,
     ARG_TYPE_PATCH,
+    ARG_TYPE_PATCH_INCREMENTAL,
+    ARG_TYPE_BASE,
+    ARG_TYPE_WATCH,
+    ARG_TYPE_EMIT_DELTA,
+    ARG_TYPE_APPLY_DELTA,
+    ARG_TYPE_BUILD_MATRIX,
     ARG_TYPE_NRO,
     ARG_TYPE_KEYS,
     ARG_TYPE_DICT,
@@ -89,28 +130,58 @@ typedef enum {
     ARG_TYPE_MIN,
     ARG_TYPE_MAX,
     ARG_TYPE_LANG,
+    ARG_TYPE_KEY_WINDOW,
+    ARG_TYPE_XREF,
+    ARG_TYPE_NO_CACHE,
+    ARG_TYPE_SERVE,
+    ARG_TYPE_STATS,
+    ARG_TYPE_PERF_COUNTERS,
+    ARG_TYPE_LOG_LEVEL,
+    ARG_TYPE_LOG_TIME,
 } ArgType;
 
 static Args args;
 
+// set while executing request of --serve
+static uint8_t in_server = 0;
+
 static struct option long_options[] = {
     {"find-imm", required_argument, 0, ARG_TYPE_FIND_IMM },
     {"find-str", required_argument, 0, ARG_TYPE_FIND_STR },
+    {"find-imm-file", required_argument, 0, ARG_TYPE_FIND_IMM_FILE },
+    {"find-str-file", required_argument, 0, ARG_TYPE_FIND_STR_FILE },
     {"find-keys", no_argument, 0, ARG_TYPE_FIND_KEYS },
     {"new-en", no_argument, 0, ARG_TYPE_NEW_EN },
     {"new-ru", no_argument, 0, ARG_TYPE_NEW_RU },
     {"partials", no_argument, 0, ARG_TYPE_PARTIALS },
     {"decode", required_argument, 0, ARG_TYPE_DECODE },
+    {"decode-file", required_argument, 0, ARG_TYPE_DECODE_FILE },
     {"merge", required_argument, 0, ARG_TYPE_MERGE },
     {"scan", no_argument, 0, ARG_TYPE_SCAN },
     {"patch", required_argument, 0, ARG_TYPE_PATCH },
+    {"patch-incremental", required_argument, 0, ARG_TYPE_PATCH_INCREMENTAL },
+    {"base", required_argument, 0, ARG_TYPE_BASE },
+    {"watch", no_argument, 0, ARG_TYPE_WATCH },
+    {"emit-delta", required_argument, 0, ARG_TYPE_EMIT_DELTA },
+    {"apply-delta", required_argument, 0, ARG_TYPE_APPLY_DELTA },
+    {"build-matrix", required_argument, 0, ARG_TYPE_BUILD_MATRIX },
     {"nro", required_argument, 0, ARG_TYPE_NRO },
     {"keys", required_argument, 0, ARG_TYPE_KEYS },
     {"dict", required_argument, 0, ARG_TYPE_DICT },
     {"out", required_argument, 0, ARG_TYPE_OUT },
     {"min", required_argument, 0, ARG_TYPE_MIN },
     {"lang", required_argument, 0, ARG_TYPE_LANG },
+    {"key-window", required_argument, 0, ARG_TYPE_KEY_WINDOW },
+    {"xref", no_argument, 0, ARG_TYPE_XREF },
+    {"no-cache", no_argument, 0, ARG_TYPE_NO_CACHE },
+    {"serve", required_argument, 0, ARG_TYPE_SERVE },
+    {"stats", required_argument, 0, ARG_TYPE_STATS },
+    {"perf-counters", no_argument, 0, ARG_TYPE_PERF_COUNTERS },
+    {"log-level", required_argument, 0, ARG_TYPE_LOG_LEVEL },
+    {"log-time", no_argument, 0, ARG_TYPE_LOG_TIME },
     {"keygen", required_argument, 0, ARG_TYPE_KEYGEN },
+    {"search-keygen", no_argument, 0, ARG_TYPE_SEARCH_KEYGEN },
+    {"known", required_argument, 0, ARG_TYPE_KNOWN },
     {"help", no_argument, 0, ARG_TYPE_HELP },
     {0, 0, 0, 0},
 };
@@ -120,18 +191,39 @@ void print_help(const char *program_name) {
     printf(CRLF "Options:" CRLF);
     printf("  --find-imm <needle> --nro <file> --keys <count>" CRLF);
     printf("  --find-str <needle> --nro <file> --keys <count>" CRLF);
+    printf("  --find-imm-file <file> --nro <file> --keys <count>" CRLF);
+    printf("  --find-str-file <file> --nro <file> --keys <count>" CRLF);
     printf("  --find-keys <needle> --nro <file>" CRLF);
-    printf("  --new-en --nro <file> --min <len> --keys <count> --dict <file>" CRLF);
-    printf("  --new-ru --nro <file> --min <len> --keys <count> --dict <file>" CRLF);
+    printf("  --search-keygen --nro <file> --keys <count> [--known <file>]" CRLF);
+    printf("  --new-en --nro <file> --min <len> --keys <count> --dict <file> [--xref]" CRLF);
+    printf("  --new-ru --nro <file> --min <len> --keys <count> --dict <file> [--xref]" CRLF);
     printf("  --partials --nro <file> --dict <file>" CRLF);
-    printf("  --decode <addr> --nro <file> --keys <count>" CRLF);
+    printf("  --decode <addr> --nro <file> --keys <count> [--xref]" CRLF);
+    printf("  --decode-file <file> --nro <file> --keys <count> [--xref]" CRLF);
     printf("  --merge <file> --dict <file>" CRLF);
-    printf("  --scan --nro <file> --dict <file>" CRLF);
-    printf("  --patch <blueprint> --nro <file> --lang <file> --out <file>"CRLF);
+    printf("  --scan --nro <file> --dict <file> [--key-window <bytes>]" CRLF);
+    printf("  --patch <blueprint> --nro <file> --lang <file> --out <file> [--emit-delta <ips|native>]"CRLF);
+    printf("  --patch-incremental <blueprint> --nro <file> --lang <file> --base <file> [--watch]" CRLF);
+    printf("  --apply-delta <file> --nro <file> --out <file>" CRLF);
+    printf("  --build-matrix <manifest> [--emit-delta <ips|native>]" CRLF);
+    printf("  --serve <socket> [--nro <file>]" CRLF);
+    printf("  --client <socket> <command...>" CRLF);
     printf("  --help" CRLF);
     printf(CRLF);
     printf("  --out <file> is supported by all commands to redirect output to file" CRLF);
     printf("  --keygen <file> is supported by all commands to provide alternate key sequence (--find-keys output)" CRLF);
+    printf("  --key-window <bytes> limits short/partial immediate search around key sites, 0 searches whole nro (default %u)" CRLF, KEY_WINDOW_DEFAULT);
+    printf("  --xref shows ADRP references of decoded address, --new-en / --new-ru check only referenced addresses" CRLF);
+    printf("  --no-cache disables per nro analysis cache ($XDG_CACHE_HOME or ~/.cache/dbipatcher)" CRLF);
+    printf("  --stats <file> is supported by all commands to write phase timings, counters and peak memory as JSON" CRLF);
+    printf("  --perf-counters adds cycles, instructions, cache and branch misses of each phase to --stats (linux only)" CRLF);
+    printf("  --log-level <trace|debug|info|notice|warning|error> hides less important messages (default info)" CRLF);
+    printf("  --log-time prefixes messages with time" CRLF);
+    printf("  --emit-delta makes --patch write only changed bytes, as IPS or native format with sha256 of source and target" CRLF);
+    printf("  --patch-incremental updates previous output --base in place, rewriting only keys changed since its <base>%s" CRLF, PATCH_SIDECAR_SUFFIX);
+    printf("  --watch repeats --patch-incremental whenever language file is saved (linux only)" CRLF);
+    printf("  --build-matrix patches every nro.<version> of manifest with every lang.<code>, skipping outputs whose inputs did not change" CRLF);
+    printf("  --serve keeps nro state resident and executes commands sent by --client, which must be first argument" CRLF);
 }
 
 static void free_args(Args * args) {
@@ -143,6 +235,14 @@ static void free_args(Args * args) {
         free(args->needle);
     }
     
+    if(args->needle_path) {
+        free(args->needle_path);
+    }
+    
+    if(args->addr_path) {
+        free(args->addr_path);
+    }
+    
     if(args->nro_path) {
         free(args->nro_path);
     }
@@ -151,6 +251,10 @@ static void free_args(Args * args) {
         free(args->keygen_path);
     }
     
+    if(args->known_path) {
+        free(args->known_path);
+    }
+    
     if(args->dict_path) {
         free(args->dict_path);
     }
@@ -167,6 +271,26 @@ static void free_args(Args * args) {
         free(args->blueprint_path);
     }
     
+    if(args->delta_path) {
+        free(args->delta_path);
+    }
+    
+    if(args->manifest_path) {
+        free(args->manifest_path);
+    }
+    
+    if(args->base_path) {
+        free(args->base_path);
+    }
+    
+    if(args->socket_path) {
+        free(args->socket_path);
+    }
+    
+    if(args->stats_path) {
+        free(args->stats_path);
+    }
+    
     memset(args, 0, sizeof(*args));
     
     if(args->output_file) {
@@ -183,18 +307,62 @@ static void free_args(Args * args) {
     }
 }
 
-int main(int argc, char** argv) {    
+/** Parses decimal or 0x prefixed number, the whole string must be consumed
+ * and value must not exceed max.
+ */
+static int parse_number(const char * str, uint64_t max, uint64_t * out) {
+    int base = 10;
+    char * end;
+    
+    if(strncmp(str, "0x", 2) == 0 || strncmp(str, "0X", 2) == 0) {
+        str += 2;
+        base = 16;
+    }
+    
+    // strtoull happily wraps negative numbers
+    if(*str < '0' || *str > '9') {
+        if(base != 16 || !isxdigit((unsigned char)*str)) {
+            return -1;
+        }
+    }
+    
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, base);
+    if(errno != 0 || *end != '\0' || value > max) {
+        return -1;
+    }
+    
+    *out = value;
+    return 0;
+}
+
+static int run_served(int argc, char** argv);
+
+static void write_stats(int ret) {
+    if(args.stats_path) {
+        if(stats_write(args.stats_path, args.command_name, ret) != 0) {
+            lf_e("failed to write stats to \"%s\"", args.stats_path);
+        }
+    }
+}
+
+static int run(int argc, char** argv) {    
     int ret = EXIT_SUCCESS;
         
     memset(&args, 0, sizeof(args));
     args.decode_addr = -1;
+    args.key_window = -1;
     args.keys = -1;
     args.min_length = -1;
     args.output_file = stdout;
     
+    stats_reset();
+    
     const char * program_name = argc ? argv[0] : APP;
     
     log_init(program_name);
+    log_set_level(LOG_INFO);
+    log_set_time(0);
     
     char short_options[ARRLEN(long_options) * 2 + 1];
     char * short_ptr = short_options;
@@ -210,6 +378,14 @@ int main(int argc, char** argv) {
         }
     }
     
+    // server executes many command lines within single process
+#ifdef __GLIBC__
+    optind = 0;
+#else
+    optreset = 1;
+    optind = 1;
+#endif
+    
     int opt_cnt = 0;
     int opt;
     int opt_idx = 0;
@@ -229,10 +405,28 @@ int main(int argc, char** argv) {
                 args.needle  = strdup(optarg);               
                 break;
                 
+            case ARG_TYPE_FIND_IMM_FILE:   
+                args.command = CMD_FIND_IMM_FILE;
+                args.needle_path  = strdup(optarg);               
+                break;
+                
+            case ARG_TYPE_FIND_STR_FILE:   
+                args.command = CMD_FIND_STR_FILE;
+                args.needle_path  = strdup(optarg);               
+                break;
+                
             case ARG_TYPE_KEYGEN:   
                 args.keygen_path  = strdup(optarg);               
                 break;
                 
+            case ARG_TYPE_SEARCH_KEYGEN:   
+                args.command = CMD_SEARCH_KEYGEN;           
+                break;
+                
+            case ARG_TYPE_KNOWN:   
+                args.known_path  = strdup(optarg);               
+                break;
+                
             case ARG_TYPE_FIND_KEYS:   
                 args.command = CMD_FIND_KEYS;           
                 break;
@@ -258,6 +452,11 @@ int main(int argc, char** argv) {
                 }
                 break;
                 
+            case ARG_TYPE_DECODE_FILE:   
+                args.command = CMD_DECODE_FILE;
+                args.addr_path  = strdup(optarg);               
+                break;
+                
             case ARG_TYPE_MERGE:   
                 args.command = CMD_MERGE;
                 args.lang_path  = strdup(optarg);               
@@ -272,6 +471,36 @@ int main(int argc, char** argv) {
                 args.blueprint_path  = strdup(optarg);               
                 break;
                 
+            case ARG_TYPE_PATCH_INCREMENTAL:   
+                args.command = CMD_PATCH_INCREMENTAL;
+                args.blueprint_path  = strdup(optarg);               
+                break;
+                
+            case ARG_TYPE_BASE:   
+                args.base_path  = strdup(optarg);               
+                break;
+                
+            case ARG_TYPE_WATCH:   
+                args.watch = 1;               
+                break;
+                
+            case ARG_TYPE_EMIT_DELTA:   
+                if(delta_parse_format(optarg, &args.delta_format) != 0) {
+                    lf_e("unknown delta format \"%s\"", optarg);
+                    goto exit_failure;
+                }
+                break;
+                
+            case ARG_TYPE_APPLY_DELTA:   
+                args.command = CMD_APPLY_DELTA;
+                args.delta_path  = strdup(optarg);               
+                break;
+                
+            case ARG_TYPE_BUILD_MATRIX:   
+                args.command = CMD_BUILD_MATRIX;
+                args.manifest_path  = strdup(optarg);               
+                break;
+                
             case ARG_TYPE_NRO:   
                 args.nro_path  = strdup(optarg);               
                 break;
@@ -300,10 +529,55 @@ int main(int argc, char** argv) {
                 }             
                 break;
                 
+            case ARG_TYPE_KEY_WINDOW: {
+                uint64_t window;
+                if(parse_number(optarg, UINT32_MAX, &window) != 0) {
+                    lf_e("invalid key window \"%s\"", optarg);
+                    goto exit_failure;
+                }
+                args.key_window = window;
+                break;
+            }
+                
             case ARG_TYPE_LANG:   
                 args.lang_path  = strdup(optarg);               
                 break;
                 
+            case ARG_TYPE_XREF:   
+                args.xref = 1;               
+                break;
+                
+            case ARG_TYPE_NO_CACHE:   
+                args.no_cache = 1;               
+                break;
+                
+            case ARG_TYPE_SERVE:   
+                args.command = CMD_SERVE;
+                args.socket_path  = strdup(optarg);               
+                break;
+                
+            case ARG_TYPE_STATS:   
+                args.stats_path  = strdup(optarg);               
+                break;
+                
+            case ARG_TYPE_PERF_COUNTERS:   
+                args.perf_counters = 1;               
+                break;
+                
+            case ARG_TYPE_LOG_LEVEL: {
+                LogLevel level;
+                if(log_parse_level(optarg, &level) != 0) {
+                    lf_e("unknown log level \"%s\"", optarg);
+                    goto exit_failure;
+                }
+                log_set_level(level);
+                break;
+            }
+                
+            case ARG_TYPE_LOG_TIME:   
+                log_set_time(1);               
+                break;
+                
             case ARG_TYPE_HELP:   
                 
             case '?':
@@ -342,7 +616,8 @@ int main(int argc, char** argv) {
         goto exit;
     }
     
-    if(args.output_path) {
+    // --apply-delta replaces output by itself once delta applies
+    if(args.output_path && args.command != CMD_APPLY_DELTA) {
         FILE * tmp = args.output_file;
         
         if(mkpath(0755, "%s", args.output_path) != 0) {
@@ -364,6 +639,31 @@ int main(int argc, char** argv) {
         args.output_file = stdout;
     }
     
+    if(args.no_cache) {
+        analysis_cache_disable();
+    }
+    
+    if(args.delta_format != DELTA_FORMAT_NONE && args.command != CMD_PATCH && args.command != CMD_BUILD_MATRIX) {
+        lf_e("--emit-delta can only be used with --patch or --build-matrix");
+        goto exit_failure;
+    }
+    
+    if(args.watch && args.command != CMD_PATCH_INCREMENTAL) {
+        lf_e("--watch can only be used with --patch-incremental");
+        goto exit_failure;
+    }
+    
+    if(args.perf_counters) {
+        if(!args.stats_path) {
+            lf_e("--perf-counters requires --stats");
+            goto exit_failure;
+        }
+        
+        if(stats_perf_enable() != 0) {
+            lf_w("hardware counters unavailable: %s", perf_error());
+        }
+    }
+    
     if(args.keygen_path) {
         if(set_keygen(args.keygen_path) != 0) {
             lf_e("failed to load \"%s\"", args.keygen_path);
@@ -374,7 +674,14 @@ int main(int argc, char** argv) {
     }
     
     if(args.nro_path) {
-        args.nro_mf = mf_init_path(args.nro_path);
+        // resident nro of server must not be reloaded
+        args.nro_mf = in_server ? serve_nro_get(args.nro_path) : NULL;
+        
+        if(!args.nro_mf) {
+            StatsMark t_load = stats_phase_begin();
+            args.nro_mf = mf_init_path(args.nro_path);
+            stats_phase_end(STATS_PHASE_LOAD_NRO, &t_load);
+        }
         
         if(args.nro_mf == NULL) {
             lf_e("failed to load \"%s\"", args.nro_path);
@@ -394,56 +701,15 @@ int main(int argc, char** argv) {
                 if(args.command == CMD_FIND_IMM) { 
                     uint32_t needle_len = strlen(args.needle);
                     if(needle_len < 8) {
-                        lf_i("searching for immediate \"%s\" using %u keys", args.needle, (uint32_t)args.keys);
-                        uint32_t cnt_total = 0;
-                        
-                        MemFile * mf = args.nro_mf;
+                        ScanImmediateArgs scan_args = {
+                            .dbi_mf = args.nro_mf,
+                            .lookup = args.needle,
+                            .out = args.output_file,
+                            .key_cnt = args.keys,
+                        };
                         
-                        const char * encode = string_encode(args.needle, needle_len);
-                        
-                        fprintf(args.output_file, "// %-47s [%-3u]: '%s'\n", "lookup immediate", needle_len + 1, args.needle);
-                                                
-                        // dont forgot to handle 0 as well as special case
-                        for(uint32_t i = args.keys ? 1 : 0; i <= args.keys; i++) {
-                            uint32_t cnt_matches = 0;
-                            
-                            ImmDefine d = {
-                                .key = get_key(i),
-                                .data = args.needle,
-                                .len = needle_len,
-                                .offset = 0,
-                            };
-
-                            ImmResult * iter_start = imm_lookup(mf->data, mf->len, &d, 10);
-                            ImmResult * iter = iter_start;
-
-                            if(iter->matches_cnt != 0) {
-                                while(iter) {
-                                    ImmMatch * m = iter->matches;
-                                    while(m) {
-                                        char buf[256];
-                                        snprintf(buf, sizeof(buf), "   at 0x%08X key 0x%016" PRIx64 " / %-3u", m->offsets[0], d.key, i);
-                                        fprintf(args.output_file, "%-50s [%-3u]: '%s'\n", buf, needle_len + 1, encode);
-                                        
-                                        cnt_matches++;
-                                        m = m->next;
-                                    }
-                                    iter = iter->next;
-                                }
-                            }
-                            
-                            imm_result_free(iter_start);
-                            
-                            if(cnt_matches) {
-                                cnt_total += cnt_matches;
-                                lf_i("found %u matches using key %u", cnt_matches, i);
-                            }
-                        }
-                                                
-                        if(cnt_total) {
-                            lf_i("found total of %u matches", cnt_total);
-                        } else {
-                            lf_e("no matches found");
+                        lf_i("searching for immediate \"%s\" using %u keys", args.needle, (uint32_t)args.keys);
+                        if(scan_immediate(&scan_args) != EXIT_SUCCESS) {
                             goto exit_failure;
                         }
                     } else {
@@ -464,6 +730,36 @@ int main(int argc, char** argv) {
             }
             break;
             
+        case CMD_FIND_IMM_FILE:
+        case CMD_FIND_STR_FILE:
+            if (!args.needle_path || !args.nro_mf || args.keys < 0) {
+                lf_e("--%s requires --nro, and --keys", args.command_name);
+                goto exit_failure;
+            } else {
+                if(args.command == CMD_FIND_IMM_FILE) { 
+                    ScanImmediateArgs scan_args = {
+                        .dbi_mf = args.nro_mf,
+                        .lookup_file = args.needle_path,
+                        .out = args.output_file,
+                        .key_cnt = args.keys,
+                    };
+
+                    lf_i("searching for immediates using %u keys", (uint32_t)args.keys);
+                    ret = scan_immediate(&scan_args);
+                } else {
+                    ScanStringArgs scan_args = {
+                        .dbi_mf = args.nro_mf,
+                        .lookup_file = args.needle_path,
+                        .out = args.output_file,
+                        .key_cnt = args.keys,
+                    };
+                    
+                    lf_i("searching for strings using %u keys", (uint32_t)args.keys);
+                    ret = scan_string(&scan_args);
+                }
+            }
+            break;
+            
         case CMD_FIND_KEYS:
             if (!args.nro_path) {
                 lf_e("--%s requires --nro", args.command_name);
@@ -486,6 +782,23 @@ int main(int argc, char** argv) {
             }
             break;
             
+        case CMD_SEARCH_KEYGEN:
+            if (!args.nro_path || args.keys < 0) {
+                lf_e("--%s requires --nro, and --keys", args.command_name);
+                goto exit_failure;
+            } else {
+                SearchKeygenArgs search_args = {
+                    .dbi_mf = args.nro_mf,
+                    .known = args.known_path,
+                    .out = args.output_file,
+                    .seed_cnt = args.keys,
+                };
+                
+                lf_i("searching for key generator");
+                ret = search_keygen(&search_args);
+            }
+            break;
+            
         case CMD_NEW_EN:
         case CMD_NEW_RU:
             if (!args.nro_path || args.min_length < 0 || args.keys < 0 || !args.dict_path) {
@@ -507,6 +820,7 @@ int main(int argc, char** argv) {
                     .out = args.output_file,
                     .key_cnt = args.keys,
                     .min_match = args.min_length,
+                    .xref = args.xref,
                 };
                 
                 lf_i("searching for new %s strings >= %u characters using %u keys", scan_lang, (uint32_t)args.min_length, (uint32_t)args.keys);
@@ -535,64 +849,36 @@ int main(int argc, char** argv) {
                 lf_e("--%s requires valid address, --nro, and --keys", args.command_name);
                 goto exit_failure;
             } else {
-                char tmp[2048];
-                MemFile * mf = args.nro_mf;
+                ScanDecodeArgs scan_args = {
+                    .dbi_mf = args.nro_mf,
+                    .addr = args.decode_addr,
+                    .out = args.output_file,
+                    .key_cnt = args.keys,
+                    .xref = args.xref,
+                };
                 
                 lf_i("decoding string at 0x%08X using %u keys", (uint32_t)args.decode_addr, (uint32_t)args.keys);
-                fprintf(args.output_file, "// decoding string at 0x%08X" CRLF, (uint32_t)args.decode_addr);
-                
-                if(mf->len <= args.decode_addr) {
-                    lf_e("provided address out of range");
+                if(scan_decode(&scan_args) != EXIT_SUCCESS) {
                     goto exit_failure;
                 }
+            }
+            break;
+            
+        case CMD_DECODE_FILE:
+            if (!args.addr_path || !args.nro_mf || args.keys < 0) {
+                lf_e("--%s requires address file, --nro, and --keys", args.command_name);
+                goto exit_failure;
+            } else {
+                ScanDecodeArgs scan_args = {
+                    .dbi_mf = args.nro_mf,
+                    .addr_file = args.addr_path,
+                    .out = args.output_file,
+                    .key_cnt = args.keys,
+                    .xref = args.xref,
+                };
                 
-                uint32_t cnt_total = 0;
-                uint32_t len = mf->len - args.decode_addr;
-                len = MIN(len, sizeof(tmp));
-                
-                KeySet * ks = gen_key_set(args.keys);
-                
-                for(uint32_t i = args.keys > 0 ? 1 : 0; i < ks->key_cnt; i++) {
-                    uint64_t key = ks->keys[i];
-                    
-                    memcpy(tmp, mf->data + args.decode_addr, len);
-                    
-                    for(uint32_t x = 0; x < len; x++) {
-                        uint8_t xor = (key >> ((x & 7) * 8)) & 0xFF;
-                        tmp[x] ^= xor;
-                    }
-                    
-                    uint32_t offset = 0;
-                    while(offset < len) {
-                        utf8_char_validity val = utf8_check_char_unchecked(tmp, offset);
-                        if(val.valid) {
-                            offset = val.next_offset;
-                        } else {
-                            break;
-                        }
-                    }
-                    
-                    if(offset < len && offset != 0 && tmp[offset] == 0) {
-                        const char * encode = string_encode(tmp, offset);
-                        
-                        if(tmp[offset] == 0) {
-                            offset++;
-                        }
-                        
-                        char buf[256];
-                        snprintf(buf, sizeof(buf), "   at 0x%08X key 0x%016" PRIx64 " / %-3u", (uint32_t)args.decode_addr, key, i);
-                        fprintf(args.output_file, "%-50s [%-3u]: '%s'\n", buf, offset, encode);
-
-                        cnt_total++;
-                    }
-                }
-                
-                if(cnt_total) {
-                    lf_i("found total of %u matches", cnt_total);
-                } else {
-                    lf_e("no matches found");
-                    goto exit_failure;
-                }
+                lf_i("decoding strings using %u keys", (uint32_t)args.keys);
+                ret = scan_decode(&scan_args);
             }
             break;
             
@@ -621,6 +907,7 @@ int main(int argc, char** argv) {
                     .dbi_mf = args.nro_mf,
                     .keys = args.dict_path,
                     .out = args.output_file,
+                    .key_window = args.key_window < 0 ? KEY_WINDOW_DEFAULT : args.key_window,
                 };
 
                 lf_i("creating blueprint");
@@ -638,27 +925,128 @@ int main(int argc, char** argv) {
                     .translation = args.lang_path,
                     .blueprint = args.blueprint_path,
                     .out = args.output_file,
+                    .delta = args.delta_format,
                 };
 
                 lf_i("patching nro");
                 ret = patch(&patch_args);
             }
             break;
+            
+        case CMD_PATCH_INCREMENTAL:
+            if (!args.blueprint_path || !args.nro_path || !args.lang_path || !args.base_path) {
+                lf_e("--%s requires blueprint, --nro, --lang and --base", args.command_name);
+                goto exit_failure;
+            } else if (args.watch && in_server) {
+                lf_e("--watch can not be requested from client");
+                goto exit_failure;
+            } else {
+                PatchIncrementalArgs patch_args = {
+                    .dbi_mf = args.nro_mf,
+                    .blueprint = args.blueprint_path,
+                    .translation = args.lang_path,
+                    .base = args.base_path,
+                    .watch = args.watch,
+                };
+
+                lf_i("patching \"%s\" incrementally", args.base_path);
+                ret = patch_incremental(&patch_args);
+            }
+            break;
+            
+        case CMD_APPLY_DELTA:
+            if (!args.delta_path || !args.nro_path || !args.output_path) {
+                lf_e("--%s requires delta, --nro and --out", args.command_name);
+                goto exit_failure;
+            } else {
+                ApplyDeltaArgs apply_args = {
+                    .dbi_mf = args.nro_mf,
+                    .delta = args.delta_path,
+                    .out = args.output_path,
+                };
+
+                lf_i("applying delta \"%s\"", args.delta_path);
+                ret = apply_delta(&apply_args);
+            }
+            break;
+            
+        case CMD_BUILD_MATRIX:
+            if (!args.manifest_path) {
+                lf_e("--%s requires manifest", args.command_name);
+                goto exit_failure;
+            } else {
+                BuildMatrixArgs matrix_args = {
+                    .manifest = args.manifest_path,
+                    .delta = args.delta_format,
+                    .out = args.output_file,
+                };
+
+                lf_i("building matrix of \"%s\"", args.manifest_path);
+                ret = build_matrix(&matrix_args);
+            }
+            break;
+
+        case CMD_SERVE:
+            if (in_server) {
+                lf_e("--%s can not be requested from client", args.command_name);
+                goto exit_failure;
+            } else {
+                ServeArgs serve_args = {
+                    .socket = args.socket_path,
+                    .nro_path = args.nro_path,
+                    .nro_mf = args.nro_mf,
+                    .run = run_served,
+                };
+                
+                // owned by server from now on
+                args.nro_mf = NULL;
+                
+                ret = serve(&serve_args);
+            }
+            break;
 
         default:
             lf_e("command not specified");
             goto exit_failure;
     }
    
+    write_stats(ret);
+    
     fflush(stdout);
-    sleep(1);
+    if(!in_server) {
+        sleep(1);
+    }
     
 exit:
     free_args(&args);
     return ret;
     
 exit_failure:
+    write_stats(EXIT_FAILURE);
     free_args(&args);
     return (EXIT_FAILURE);
 }
 
+static int run_served(int argc, char** argv) {
+    in_server = 1;
+    return run(argc, argv);
+}
+
+int main(int argc, char** argv) {
+    // thin client of --serve, whole command line is executed by server
+    if(argc > 2 && strcmp(argv[1], "--client") == 0) {
+        log_init(argv[0]);
+        
+        char * sock = argv[2];
+        argv[2] = argv[0];
+        
+        int ret = serve_client(sock, argc - 2, argv + 2);
+        log_close();
+        return ret;
+    }
+    
+    int ret = run(argc, argv);
+    log_close();
+    
+    return ret;
+}
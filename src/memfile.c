@@ -24,6 +24,7 @@ MemFile * mf_init_path(const char * path) {
     MemFile * mf = malloc(sizeof(MemFile));
     mf->data = malloc(len);
     mf->len = len;
+    mf->hash = NULL;
 
     fread(mf->data, 1, mf->len, f);
     fclose(f);
@@ -39,6 +40,7 @@ MemFile * mf_init_mem(const void * data, uint32_t len) {
     MemFile * mf = malloc(sizeof(MemFile));
     mf->data = malloc(len);
     mf->len = len;
+    mf->hash = NULL;
     
     memcpy(mf->data, data, len);
     
@@ -51,6 +53,7 @@ void mf_free(MemFile * mf) {
             free(mf->data);
         }
         
+        free(mf->hash);
         free(mf);
     }
 }
@@ -0,0 +1,271 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "outbuf.h"
+
+// most of lines fit, longer ones are formatted again
+#define OB_PRINTF_RESERVE   256
+
+static const char hex_upper[] = "0123456789ABCDEF";
+static const char hex_lower[] = "0123456789abcdef";
+
+void ob_init(OutBuf * ob, FILE * f) {
+    memset(ob, 0, sizeof(*ob));
+    ob->f = f;
+}
+
+static int ob_writev(int fd, struct iovec * iov, int cnt) {
+    while(cnt) {
+        ssize_t n = writev(fd, iov, cnt);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        } else if(n <= 0) {
+            return -1;
+        }
+
+        // skip whatever got written, partial writes are rare but legal
+        while(cnt && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+
+        if(cnt) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+int ob_flush(OutBuf * ob) {
+    struct iovec iov[OB_CHUNKS];
+    int cnt = 0;
+
+    for(uint32_t i = 0; i <= ob->cur && i < OB_CHUNKS; i++) {
+        if(ob->chunk_len[i]) {
+            iov[cnt].iov_base = ob->chunk[i];
+            iov[cnt].iov_len = ob->chunk_len[i];
+            cnt++;
+        }
+        ob->chunk_len[i] = 0;
+    }
+    ob->cur = 0;
+
+    if(!cnt) {
+        return ob->failed ? -1 : 0;
+    }
+
+    // anything already buffered by FILE has to go first, memory streams have
+    // no descriptor
+    int fd = fflush(ob->f) == 0 ? fileno(ob->f) : -1;
+
+    if(fd >= 0) {
+        if(ob_writev(fd, iov, cnt) != 0) {
+            ob->failed = 1;
+        }
+    } else {
+        for(int i = 0; i < cnt; i++) {
+            if(fwrite(iov[i].iov_base, 1, iov[i].iov_len, ob->f) != iov[i].iov_len) {
+                ob->failed = 1;
+            }
+        }
+    }
+
+    return ob->failed ? -1 : 0;
+}
+
+int ob_close(OutBuf * ob) {
+    int ret = ob_flush(ob);
+
+    for(uint32_t i = 0; i < OB_CHUNKS; i++) {
+        free(ob->chunk[i]);
+        ob->chunk[i] = NULL;
+    }
+
+    return ret;
+}
+
+char * ob_reserve(OutBuf * ob, uint32_t len) {
+    if(ob->chunk_len[ob->cur] + len > OB_CHUNK_SIZE) {
+        if(ob->cur + 1 == OB_CHUNKS) {
+            ob_flush(ob);
+        } else {
+            ob->cur++;
+        }
+    }
+
+    if(!ob->chunk[ob->cur]) {
+        ob->chunk[ob->cur] = malloc(OB_CHUNK_SIZE);
+
+        // out of memory, write out chunks buffered so far and reuse first one
+        if(!ob->chunk[ob->cur] && ob->cur) {
+            ob_flush(ob);
+        } else if(!ob->chunk[ob->cur]) {
+            ob->failed = 1;
+            return NULL;
+        }
+    }
+
+    return ob->chunk[ob->cur] + ob->chunk_len[ob->cur];
+}
+
+void ob_commit(OutBuf * ob, uint32_t len) {
+    if(ob->chunk[ob->cur]) {
+        ob->chunk_len[ob->cur] += len;
+    }
+}
+
+void ob_write(OutBuf * ob, const void * data, uint32_t len) {
+    while(len) {
+        uint32_t part = len < OB_CHUNK_SIZE ? len : OB_CHUNK_SIZE;
+        char * dst = ob_reserve(ob, part);
+
+        if(!dst) {
+            return;
+        }
+
+        memcpy(dst, data, part);
+        ob_commit(ob, part);
+
+        data = (const char*)data + part;
+        len -= part;
+    }
+}
+
+void ob_str(OutBuf * ob, const char * str) {
+    ob_write(ob, str, strlen(str));
+}
+
+void ob_str_pad(OutBuf * ob, const char * str, uint32_t width) {
+    uint32_t len = strlen(str);
+    ob_write(ob, str, len);
+
+    if(len < width) {
+        uint32_t pad = width - len;
+        char * dst = ob_reserve(ob, pad);
+
+        if(dst) {
+            memset(dst, ' ', pad);
+            ob_commit(ob, pad);
+        }
+    }
+}
+
+void ob_u32(OutBuf * ob, uint32_t val, uint32_t width) {
+    char tmp[10];
+    uint32_t len = 0;
+
+    do {
+        tmp[sizeof(tmp) - ++len] = '0' + val % 10;
+        val /= 10;
+    } while(val);
+
+    uint32_t total = len < width ? width : len;
+    char * dst = ob_reserve(ob, total);
+
+    if(!dst) {
+        return;
+    }
+
+    memcpy(dst, tmp + sizeof(tmp) - len, len);
+    memset(dst + len, ' ', total - len);
+
+    ob_commit(ob, total);
+}
+
+void ob_hex(OutBuf * ob, uint64_t val, uint32_t digits, uint8_t upper) {
+    const char * hex = upper ? hex_upper : hex_lower;
+    char * dst = ob_reserve(ob, digits);
+
+    if(!dst) {
+        return;
+    }
+
+    for(uint32_t i = digits; i --> 0;) {
+        dst[i] = hex[val & 0xF];
+        val >>= 4;
+    }
+
+    ob_commit(ob, digits);
+}
+
+void ob_hex_rev(OutBuf * ob, const uint8_t * data, uint32_t len) {
+    char * dst = ob_reserve(ob, len * 2);
+
+    if(!dst) {
+        return;
+    }
+
+    for(uint32_t j = len; j --> 0;) {
+        *(dst++) = hex_upper[data[j] >> 4];
+        *(dst++) = hex_upper[data[j] & 0xF];
+    }
+
+    ob_commit(ob, len * 2);
+}
+
+/** Formats straight into rest of current chunk, only line which does not fit
+ * there is formatted again.
+ */
+void ob_printf(OutBuf * ob, const char * fmt, ...) {
+    char * dst = ob_reserve(ob, OB_PRINTF_RESERVE);
+    if(!dst) {
+        return;
+    }
+
+    uint32_t room = OB_CHUNK_SIZE - ob->chunk_len[ob->cur];
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(dst, room, fmt, args);
+    va_end(args);
+
+    if(len < 0) {
+        ob->failed = 1;
+        return;
+    } else if((uint32_t)len < room) {
+        ob_commit(ob, len);
+        return;
+    }
+
+    // fits next chunk
+    if(len < OB_CHUNK_SIZE) {
+        dst = ob_reserve(ob, len + 1);
+        if(!dst) {
+            return;
+        }
+
+        va_start(args, fmt);
+        vsnprintf(dst, len + 1, fmt, args);
+        va_end(args);
+
+        ob_commit(ob, len);
+        return;
+    }
+
+    // does not fit single chunk, format on heap and write in parts
+    char * tmp = malloc(len + 1);
+    if(!tmp) {
+        ob->failed = 1;
+        return;
+    }
+
+    va_start(args, fmt);
+    vsnprintf(tmp, len + 1, fmt, args);
+    va_end(args);
+
+    ob_write(ob, tmp, len);
+    free(tmp);
+}
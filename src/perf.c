@@ -0,0 +1,144 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "perf.h"
+
+const char * perf_counter_names[PERF_CNT] = {
+    [PERF_CYCLES]           = "cycles",
+    [PERF_INSTRUCTIONS]     = "instructions",
+    [PERF_CACHE_MISSES]     = "cache_misses",
+    [PERF_BRANCH_MISSES]    = "branch_misses",
+};
+
+// counters only count thread which opened them, so every thread has own group
+static __thread int perf_fds[PERF_CNT] = { -1, -1, -1, -1 };
+static __thread uint8_t perf_failed = 0;
+static __thread char perf_err[128] = "not enabled";
+
+#ifdef __linux__
+
+static const uint64_t perf_configs[PERF_CNT] = {
+    [PERF_CYCLES]           = PERF_COUNT_HW_CPU_CYCLES,
+    [PERF_INSTRUCTIONS]     = PERF_COUNT_HW_INSTRUCTIONS,
+    [PERF_CACHE_MISSES]     = PERF_COUNT_HW_CACHE_MISSES,
+    [PERF_BRANCH_MISSES]    = PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static pthread_key_t perf_key;
+static pthread_once_t perf_key_once = PTHREAD_ONCE_INIT;
+
+static void perf_thread_exit(void * arg) {
+    perf_close();
+}
+
+static void perf_key_init(void) {
+    pthread_key_create(&perf_key, perf_thread_exit);
+}
+
+int perf_open(void) {
+    if(perf_fds[0] >= 0) {
+        return 0;
+    }
+    
+    // do not retry syscall on every phase of thread which cannot count
+    if(perf_failed) {
+        return -1;
+    }
+    
+    for(uint32_t i = 0; i < PERF_CNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = perf_configs[i];
+        attr.disabled = i == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : perf_fds[0], 0);
+        if(fd < 0) {
+            snprintf(perf_err, sizeof(perf_err), "perf_event_open %s: %s", perf_counter_names[i], strerror(errno));
+            perf_close();
+            perf_failed = 1;
+            return -1;
+        }
+        
+        perf_fds[i] = fd;
+    }
+    
+    ioctl(perf_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    
+    // any non NULL value, so group is closed when thread exits
+    pthread_once(&perf_key_once, perf_key_init);
+    pthread_setspecific(perf_key, perf_fds);
+    
+    return 0;
+}
+
+int perf_read(uint64_t values[PERF_CNT]) {
+    if(perf_fds[0] < 0) {
+        return -1;
+    }
+    
+    // nr, time_enabled, time_running, values
+    uint64_t buf[3 + PERF_CNT];
+    if(read(perf_fds[0], buf, sizeof(buf)) != sizeof(buf) || buf[0] != PERF_CNT) {
+        return -1;
+    }
+    
+    // group was never scheduled on PMU
+    if(buf[2] == 0) {
+        return -1;
+    }
+    
+    memcpy(values, buf + 3, sizeof(uint64_t) * PERF_CNT);
+    return 0;
+}
+
+void perf_close(void) {
+    for(uint32_t i = PERF_CNT; i --> 0;) {
+        if(perf_fds[i] >= 0) {
+            close(perf_fds[i]);
+            perf_fds[i] = -1;
+        }
+    }
+}
+
+#else
+
+int perf_open(void) {
+    snprintf(perf_err, sizeof(perf_err), "perf_event_open is linux only");
+    return -1;
+}
+
+int perf_read(uint64_t values[PERF_CNT]) {
+    return -1;
+}
+
+void perf_close(void) {
+}
+
+#endif
+
+const char * perf_error(void) {
+    return perf_err;
+}
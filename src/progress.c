@@ -0,0 +1,118 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "progress.h"
+#include "stats.h"
+#include "v2/context.h"
+
+void progress_init(Progress * p) {
+    memset(p, 0, sizeof(*p));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+}
+
+void progress_destroy(Progress * p) {
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+}
+
+static void progress_print(const Progress * progress) {
+    uint64_t bytes = __atomic_load_n(&progress->bytes, __ATOMIC_RELAXED);
+    uint64_t keys = __atomic_load_n(&progress->keys, __ATOMIC_RELAXED);
+    double elapsed = (stats_now() - progress->started) / 1e9;
+    
+    double mb_s = elapsed > 0 ? bytes / 1048576.0 / elapsed : 0;
+    double keys_s = elapsed > 0 ? keys / elapsed : 0;
+    
+    char eta[32] = "-";
+    if(bytes && progress->total_bytes > bytes) {
+        uint32_t rem = (uint32_t)((progress->total_bytes - bytes) * elapsed / bytes);
+        snprintf(eta, sizeof(eta), "%u:%02u:%02u", rem / 3600, rem / 60 % 60, rem % 60);
+    }
+    
+    double pct = progress->total_bytes ? bytes * 100.0 / progress->total_bytes : 0;
+    
+    fprintf(stderr, "\r\x1B[K%s: %.1f / %.1f MB (%.1f %%)  %.2f MB/s  %.0f keys/s  ETA %s", 
+            progress->what, bytes / 1048576.0, progress->total_bytes / 1048576.0, pct, mb_s, keys_s, eta);
+    fflush(stderr);
+}
+
+static void * progress_run(void * arg) {
+    Progress * progress = arg;
+    
+    pthread_mutex_lock(&progress->lock);
+    
+    while(!progress->stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += PROGRESS_INTERVAL;
+        
+        if(pthread_cond_timedwait(&progress->cond, &progress->lock, &ts) == ETIMEDOUT && !progress->stop) {
+            progress_print(progress);
+        }
+    }
+    
+    pthread_mutex_unlock(&progress->lock);
+    return NULL;
+}
+
+void progress_start(const char * what, uint64_t total_bytes) {
+    Progress * progress = dbi_context_progress();
+    
+    if(progress->active || !isatty(STDERR_FILENO)) {
+        return;
+    }
+    
+    progress->what = what;
+    progress->total_bytes = total_bytes;
+    progress->bytes = 0;
+    progress->keys = 0;
+    progress->started = stats_now();
+    progress->stop = 0;
+    
+    if(pthread_create(&progress->thread, NULL, progress_run, progress) == 0) {
+        progress->active = 1;
+    }
+}
+
+void progress_add(uint64_t bytes, uint64_t keys) {
+    Progress * progress = dbi_context_progress();
+    
+    if(progress->active) {
+        __atomic_fetch_add(&progress->bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&progress->keys, keys, __ATOMIC_RELAXED);
+    }
+}
+
+void progress_stop(void) {
+    Progress * progress = dbi_context_progress();
+    
+    if(!progress->active) {
+        return;
+    }
+    
+    pthread_mutex_lock(&progress->lock);
+    progress->stop = 1;
+    pthread_cond_signal(&progress->cond);
+    pthread_mutex_unlock(&progress->lock);
+    
+    pthread_join(progress->thread, NULL);
+    progress->active = 0;
+    
+    // only clear line when something was printed over it
+    if((stats_now() - progress->started) / 1000000000ull >= PROGRESS_INTERVAL) {
+        fprintf(stderr, "\r\x1B[K");
+        fflush(stderr);
+    }
+}
@@ -0,0 +1,219 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "stats.h"
+#include "utils.h"
+#include "v2/context.h"
+
+static const char * phase_names[STATS_PHASE_CNT] = {
+    [STATS_PHASE_LOAD_NRO]      = "load_nro",
+    [STATS_PHASE_LOAD_DICT]     = "load_dict",
+    [STATS_PHASE_ANALYSIS]      = "analysis",
+    [STATS_PHASE_PARSE_PATTERNS] = "parse_with_patterns",
+    [STATS_PHASE_MATCH_FULL]    = "match_full",
+    [STATS_PHASE_MATCH_PARTIAL] = "match_partial",
+    [STATS_PHASE_IMM_LOOKUP]    = "imm_lookup",
+    [STATS_PHASE_DUPLICATES]    = "duplicates",
+    [STATS_PHASE_SCAN]          = "scan",
+    [STATS_PHASE_OUTPUT]        = "output",
+};
+
+static const char * counter_names[STATS_COUNTER_CNT] = {
+    [STATS_SLOTS_VISITED]           = "slots_visited",
+    [STATS_KEYS_TRIED]              = "keys_tried",
+    [STATS_DECODE_CALLS]            = "decode_calls",
+    [STATS_CANDIDATES_VALIDATED]    = "candidates_validated",
+    [STATS_IMM_LOOKUPS]             = "imm_lookups",
+    [STATS_ANALYSIS_REUSED]         = "analysis_reused",
+};
+
+// deepest nesting of phases whose time is subtracted from outer one
+#define STATS_NESTED_MAX    8
+
+/** Time and counters spent in phases nested in currently open phase.
+ */
+typedef struct {
+    uint64_t ns;
+    uint64_t perf[PERF_CNT];
+} StatsNested;
+
+static __thread StatsNested nested[STATS_NESTED_MAX];
+static __thread uint32_t nested_depth = 0;
+
+void stats_reset(void) {
+    Stats * s = dbi_context_stats();
+    
+    memset(s, 0, sizeof(*s));
+    s->started = stats_now();
+}
+
+int stats_perf_enable(void) {
+    Stats * s = dbi_context_stats();
+    
+    if(perf_open() != 0) {
+        snprintf(s->perf_error, sizeof(s->perf_error), "%s", perf_error());
+        s->perf_state = PERF_STATE_UNAVAILABLE;
+        return -1;
+    }
+    
+    s->perf_state = PERF_STATE_ON;
+    return 0;
+}
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+StatsMark stats_phase_begin(void) {
+    StatsMark mark;
+    
+    mark.perf_valid = dbi_context_stats()->perf_state == PERF_STATE_ON && perf_open() == 0 && perf_read(mark.perf) == 0;
+    
+    if(nested_depth < STATS_NESTED_MAX) {
+        memset(&nested[nested_depth], 0, sizeof(nested[0]));
+    }
+    nested_depth++;
+    
+    mark.ns = stats_now();
+    
+    return mark;
+}
+
+void stats_phase_end(StatsPhase phase, const StatsMark * start) {
+    PhaseTotal * p = &dbi_context_stats()->phases[phase];
+    uint64_t ns = stats_now() - start->ns;
+    
+    uint64_t perf[PERF_CNT];
+    uint8_t perf_valid = start->perf_valid && perf_read(perf) == 0;
+    
+    for(uint32_t i = 0; perf_valid && i < PERF_CNT; i++) {
+        perf[i] -= start->perf[i];
+    }
+    
+    nested_depth--;
+    
+    uint64_t inner_ns = 0;
+    uint64_t inner_perf[PERF_CNT] = { 0 };
+    if(nested_depth < STATS_NESTED_MAX) {
+        inner_ns = nested[nested_depth].ns;
+        memcpy(inner_perf, nested[nested_depth].perf, sizeof(inner_perf));
+    }
+    
+    __atomic_fetch_add(&p->ns, ns - inner_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&p->calls, 1, __ATOMIC_RELAXED);
+    
+    if(perf_valid) {
+        for(uint32_t i = 0; i < PERF_CNT; i++) {
+            __atomic_fetch_add(&p->perf[i], perf[i] - inner_perf[i], __ATOMIC_RELAXED);
+        }
+        __atomic_fetch_add(&p->perf_calls, 1, __ATOMIC_RELAXED);
+    }
+    
+    // whole phase including its nested ones is excluded from outer phase
+    if(nested_depth && nested_depth - 1 < STATS_NESTED_MAX) {
+        StatsNested * outer = &nested[nested_depth - 1];
+        outer->ns += ns;
+        
+        for(uint32_t i = 0; perf_valid && i < PERF_CNT; i++) {
+            outer->perf[i] += perf[i];
+        }
+    }
+}
+
+static void stats_write_perf(FILE * f, const PhaseTotal * p) {
+    fprintf(f, ", \"perf\": {\"samples\": %" PRIu64, p->perf_calls);
+    
+    for(uint32_t i = 0; i < PERF_CNT; i++) {
+        fprintf(f, ", \"%s\": %" PRIu64, perf_counter_names[i], p->perf[i]);
+    }
+    
+    double ipc = p->perf[PERF_CYCLES] ? (double)p->perf[PERF_INSTRUCTIONS] / p->perf[PERF_CYCLES] : 0;
+    fprintf(f, ", \"ipc\": %.3f}", ipc);
+}
+
+void stats_add(StatsCounter counter, uint64_t cnt) {
+    __atomic_fetch_add(&dbi_context_stats()->counters[counter], cnt, __ATOMIC_RELAXED);
+}
+
+/** Peak resident set size in bytes.
+ */
+uint64_t stats_peak_rss(void) {
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF, &ru) != 0) {
+        return 0;
+    }
+    
+#ifdef __APPLE__
+    return ru.ru_maxrss;
+#else
+    return (uint64_t)ru.ru_maxrss * 1024;
+#endif
+}
+
+/** Dumps everything collected since stats_reset as single JSON object.
+ */
+int stats_write(const char * path, const char * command, int ret) {
+    const Stats * s = dbi_context_stats();
+    
+    if(mkpath(0755, "%s", path) != 0) {
+        return -1;
+    }
+    
+    FILE * f = fopen(path, "w");
+    if(!f) {
+        return -1;
+    }
+    
+    fprintf(f, "{\n");
+    fprintf(f, "  \"command\": \"%s\",\n", command ? command : "");
+    fprintf(f, "  \"exit_code\": %d,\n", ret);
+    fprintf(f, "  \"wall_ns\": %" PRIu64 ",\n", stats_now() - s->started);
+    fprintf(f, "  \"peak_rss\": %" PRIu64 ",\n", stats_peak_rss());
+    
+    if(s->perf_state == PERF_STATE_ON) {
+        fprintf(f, "  \"perf_counters\": \"available\",\n");
+    } else if(s->perf_state == PERF_STATE_UNAVAILABLE) {
+        fprintf(f, "  \"perf_counters\": \"unavailable\",\n");
+        fprintf(f, "  \"perf_error\": \"%s\",\n", s->perf_error);
+    }
+    
+    // decode_calls of 0 would otherwise look like missing instrumentation
+    if(!s->counters[STATS_DECODE_CALLS] && s->counters[STATS_ANALYSIS_REUSED]) {
+        fprintf(f, "  \"decode_skipped\": \"analysis reused from resident nro or cache\",\n");
+    }
+    
+    fprintf(f, "  \"phase_times\": \"exclusive\",\n");
+    fprintf(f, "  \"phases\": {\n");
+    for(uint32_t i = 0; i < STATS_PHASE_CNT; i++) {
+        fprintf(f, "    \"%s\": {\"ns\": %" PRIu64 ", \"calls\": %" PRIu64, phase_names[i], s->phases[i].ns, s->phases[i].calls);
+        
+        if(s->perf_state == PERF_STATE_ON) {
+            stats_write_perf(f, &s->phases[i]);
+        }
+        
+        fprintf(f, "}%s\n", i + 1 < STATS_PHASE_CNT ? "," : "");
+    }
+    fprintf(f, "  },\n");
+    
+    fprintf(f, "  \"counters\": {\n");
+    for(uint32_t i = 0; i < STATS_COUNTER_CNT; i++) {
+        fprintf(f, "    \"%s\": %" PRIu64 "%s\n", counter_names[i], s->counters[i], i + 1 < STATS_COUNTER_CNT ? "," : "");
+    }
+    fprintf(f, "  }\n");
+    fprintf(f, "}\n");
+    
+    return fclose(f) == 0 ? 0 : -1;
+}
@@ -8,6 +8,8 @@
 #include <sys/stat.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <ctype.h>
+#include <stdint.h>
 
 #include "utils.h"
 
@@ -36,4 +38,39 @@ int mkpath(mode_t mode, const char* fmt, ...) {
     int ret = _mkpath(path, mode);
     free(path);
     return ret;
+}
+
+/** Parses hex (0x prefixed) or decimal address, surrounding whitespace is
+ * ignored. Returns 0 on success.
+ */
+int parse_address(const char * line, uint32_t * addr) {
+    char * end;
+    unsigned long val;
+    
+    while(isspace((uint8_t)*line)) {
+        line++;
+    }
+    
+    if(strncmp(line, "0x", 2) == 0 || strncmp(line, "0X", 2) == 0) {
+        val = strtoul(line + 2, &end, 16);
+        if(end == line + 2) {
+            return -1;
+        }
+    } else {
+        val = strtoul(line, &end, 10);
+        if(end == line) {
+            return -1;
+        }
+    }
+    
+    while(isspace((uint8_t)*end)) {
+        end++;
+    }
+    
+    if(*end != 0 || val > UINT32_MAX) {
+        return -1;
+    }
+    
+    *addr = val;
+    return 0;
 }
\ No newline at end of file
@@ -0,0 +1,296 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "v2/analysis.h"
+#include "v2/nro.h"
+#include "v2/cache.h"
+#include "log.h"
+#include "stats.h"
+
+typedef struct _ResidentAnalysis ResidentAnalysis;
+
+typedef struct _ResidentAnalysis {
+    const MemFile * mf;
+    CodeAnalysis * ca;
+    ResidentAnalysis * next;
+} ResidentAnalysis;
+
+static ResidentAnalysis * resident = NULL;
+static pthread_mutex_t resident_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t resident_once = PTHREAD_ONCE_INIT;
+
+static ResidentAnalysis * resident_find(const MemFile * mf) {
+    for(ResidentAnalysis * iter = resident; iter; iter = iter->next) {
+        if(iter->mf == mf) {
+            return iter;
+        }
+    }
+    
+    return NULL;
+}
+
+static void code_analysis_dispatch(const MemFile * mf, const AnalysisConsumer * consumers, uint32_t consumer_cnt, uint32_t pc) {
+    uint32_t raw;
+    memcpy(&raw, mf->data + pc, 4);
+
+    arm64_instr_t d;
+    instr_decode(raw, &d, pc);
+
+    for(uint32_t i = 0; i < consumer_cnt; i++) {
+        consumers[i].step(consumers[i].ctx, &d, raw, pc);
+    }
+}
+
+/** Decodes every instruction of .text exactly once and hands it to all
+ * consumers, so they do not need to walk and decode binary on their own.
+ * 
+ * When no consumer needs anything but MOV family, only words passing the
+ * vectorized prefilter are decoded at all.
+ */
+void code_analysis_run(const MemFile * mf, const AnalysisConsumer * consumers, uint32_t consumer_cnt) {
+    NroSegment seg[NRO_SEG_CNT];
+    nro_segments(mf, seg);
+
+    uint32_t start = seg[NRO_SEG_TEXT].offset;
+    uint32_t end = start + (seg[NRO_SEG_TEXT].len / 4) * 4;
+    
+    uint8_t mov_only = 1;
+    for(uint32_t i = 0; i < consumer_cnt; i++) {
+        mov_only &= consumers[i].mov_only;
+    }
+    
+    if(mov_only) {
+        uint32_t cnt = (end - start) / 4;
+        uint64_t * mask = malloc(sizeof(*mask) * ((cnt + 63) / 64 + 1));
+        
+        instr_mov_candidates(mf->data + start, cnt, mask);
+        
+        uint64_t decoded = 0;
+        for(uint32_t w = 0; w < (cnt + 63) / 64; w++) {
+            for(uint64_t bits = mask[w]; bits; bits &= bits - 1) {
+                uint32_t idx = w * 64 + __builtin_ctzll(bits);
+                code_analysis_dispatch(mf, consumers, consumer_cnt, start + idx * 4);
+                decoded++;
+            }
+        }
+        
+        stats_add(STATS_DECODE_CALLS, decoded);
+        free(mask);
+        return;
+    }
+
+    StatsMark t_start = stats_phase_begin();
+
+    for(uint32_t pc = start; pc < end; pc += 4) {
+        uint32_t raw;
+        memcpy(&raw, mf->data + pc, 4);
+
+        arm64_instr_t d;
+        instr_decode(raw, &d, pc);
+
+        for(uint32_t i = 0; i < consumer_cnt; i++) {
+            consumers[i].step(consumers[i].ctx, &d, raw, pc);
+        }
+    }
+    
+    stats_add(STATS_DECODE_CALLS, (end - start) / 4);
+    stats_phase_end(STATS_PHASE_PARSE_PATTERNS, &t_start);
+}
+
+/** Fills requested artifacts, taking those already computed for the same nro
+ * from cache and running single sweep for the rest.
+ */
+static void code_analysis_build(const MemFile * mf, CodeAnalysis * ca, uint32_t what) {
+    uint32_t cached = analysis_cache_load(mf, ca, what);
+    
+    stats_add(STATS_ANALYSIS_REUSED, __builtin_popcount(cached));
+    what &= ~cached;
+    if(!what) {
+        return;
+    }
+
+    AnalysisConsumer consumers[4];
+    uint32_t consumer_cnt = 0;
+
+    KeyCollector * kc = NULL;
+    ImmParser * parser = NULL;
+    XrefBuilder * xb = NULL;
+
+    if(what & ANALYSIS_KEYS) {
+        kc = key_collector_init();
+        consumers[consumer_cnt++] = (AnalysisConsumer){ key_collector_step, kc, 1 };
+    }
+
+    if(what & ANALYSIS_PARTIALS) {
+        parser = imm_parser_init();
+        consumers[consumer_cnt++] = (AnalysisConsumer){ imm_parser_step, parser, 0 };
+    }
+
+    if(what & ANALYSIS_STREAM) {
+        ca->stream = imm_stream_alloc(mf->len);
+        consumers[consumer_cnt++] = (AnalysisConsumer){ imm_stream_step, ca->stream, 1 };
+    }
+
+    if(what & ANALYSIS_XREFS) {
+        xb = xref_builder_init();
+        consumers[consumer_cnt++] = (AnalysisConsumer){ xref_builder_step, xb, 0 };
+    }
+
+    code_analysis_run(mf, consumers, consumer_cnt);
+
+    if(kc) {
+        ca->keys = key_collector_finish(kc);
+    }
+
+    if(parser) {
+        ca->partials = imm_parser_finish(parser);
+    }
+
+    if(xb) {
+        ca->xrefs = xref_builder_finish(xb);
+    }
+    
+    analysis_cache_store(mf, ca, what);
+}
+
+/** Returns requested artifacts, resident ones are borrowed, rest is built.
+ */
+CodeAnalysis * code_analysis_init(const MemFile * mf, uint32_t what) {
+    StatsMark t_start = stats_phase_begin();
+    CodeAnalysis * ca = calloc(1, sizeof(*ca));
+    
+    pthread_mutex_lock(&resident_lock);
+    
+    ResidentAnalysis * res = resident_find(mf);
+    if(res) {
+        ca->borrowed = what & res->ca->borrowed;
+        
+        if(ca->borrowed & ANALYSIS_KEYS)        ca->keys = res->ca->keys;
+        if(ca->borrowed & ANALYSIS_PARTIALS)    ca->partials = res->ca->partials;
+        if(ca->borrowed & ANALYSIS_STREAM)      ca->stream = res->ca->stream;
+        if(ca->borrowed & ANALYSIS_XREFS)       ca->xrefs = res->ca->xrefs;
+        
+        what &= ~ca->borrowed;
+        stats_add(STATS_ANALYSIS_REUSED, __builtin_popcount(ca->borrowed));
+    }
+    
+    pthread_mutex_unlock(&resident_lock);
+    
+    if(what) {
+        code_analysis_build(mf, ca, what);
+    }
+    
+    stats_phase_end(STATS_PHASE_ANALYSIS, &t_start);
+    return ca;
+}
+
+void code_analysis_free(CodeAnalysis * ca) {
+    if(ca) {
+        if(!(ca->borrowed & ANALYSIS_KEYS))     free_key_set(ca->keys);
+        if(!(ca->borrowed & ANALYSIS_PARTIALS)) imm_result_free(ca->partials);
+        if(!(ca->borrowed & ANALYSIS_STREAM))   imm_stream_free(ca->stream);
+        if(!(ca->borrowed & ANALYSIS_XREFS))    xref_index_free(ca->xrefs);
+        free(ca);
+    }
+}
+
+static void resident_fork_prepare(void) {
+    pthread_mutex_lock(&resident_lock);
+}
+
+static void resident_fork_release(void) {
+    pthread_mutex_unlock(&resident_lock);
+}
+
+/** Server forks workers while its warm thread may be retaining, lock is held
+ * across fork so child never inherits it locked.
+ */
+static void resident_once_init(void) {
+    pthread_atfork(resident_fork_prepare, resident_fork_release, resident_fork_release);
+}
+
+/** Keeps requested artifacts of mf in memory for rest of process lifetime,
+ * later code_analysis_init calls only borrow them. Used by server, so forked
+ * workers start with everything already computed.
+ */
+void code_analysis_retain(const MemFile * mf, uint32_t what) {
+    pthread_once(&resident_once, resident_once_init);
+    
+    pthread_mutex_lock(&resident_lock);
+    
+    ResidentAnalysis * res = resident_find(mf);
+    
+    // resident artifacts are marked borrowed, so they are never freed
+    if(res) {
+        what &= ~res->ca->borrowed;
+    }
+    
+    pthread_mutex_unlock(&resident_lock);
+    
+    if(!what) {
+        return;
+    }
+    
+    // built without lock, so forks are not held up by analysis
+    CodeAnalysis * ca = calloc(1, sizeof(*ca));
+    code_analysis_build(mf, ca, what);
+    
+    pthread_mutex_lock(&resident_lock);
+    
+    res = resident_find(mf);
+    if(!res) {
+        res = calloc(1, sizeof(*res));
+        res->mf = mf;
+        res->ca = calloc(1, sizeof(*res->ca));
+        res->next = resident;
+        resident = res;
+    }
+    
+    // somebody else may have retained same artifacts meanwhile
+    ca->borrowed = res->ca->borrowed;
+    what &= ~res->ca->borrowed;
+    
+    if(what & ANALYSIS_KEYS)        { res->ca->keys = ca->keys;            ca->keys = NULL; }
+    if(what & ANALYSIS_PARTIALS)    { res->ca->partials = ca->partials;    ca->partials = NULL; }
+    if(what & ANALYSIS_STREAM)      { res->ca->stream = ca->stream;        ca->stream = NULL; }
+    if(what & ANALYSIS_XREFS)       { res->ca->xrefs = ca->xrefs;          ca->xrefs = NULL; }
+    
+    res->ca->borrowed |= what;
+    
+    pthread_mutex_unlock(&resident_lock);
+    
+    ca->borrowed = 0;
+    code_analysis_free(ca);
+}
+
+/** Drops everything retained for mf, used when server notices file behind mf
+ * has changed. Nothing may still borrow the artifacts.
+ */
+void code_analysis_release(const MemFile * mf) {
+    pthread_mutex_lock(&resident_lock);
+    
+    ResidentAnalysis * res = NULL;
+    for(ResidentAnalysis ** iter = &resident; *iter; iter = &(*iter)->next) {
+        if((*iter)->mf == mf) {
+            res = *iter;
+            *iter = res->next;
+            break;
+        }
+    }
+    
+    pthread_mutex_unlock(&resident_lock);
+    
+    if(res) {
+        res->ca->borrowed = 0;
+        code_analysis_free(res->ca);
+        free(res);
+    }
+}
@@ -0,0 +1,437 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "v2/cache.h"
+#include "v2/context.h"
+#include "sha256.h"
+#include "utils.h"
+#include "log.h"
+
+/* Derived data of every nro is stored in its own directory named by sha256
+ * of nro contents, one file per artifact:
+ * 
+ *   <cache>/dbipatcher/<sha256>/keys.bin
+ *                              /partials.bin
+ *                              /stream.bin
+ *                              /xrefs.bin
+ * 
+ * Each file is CacheHeader followed by little endian payload made of plain
+ * u32 / u64 arrays, so it may be mapped and read in place.
+ */
+
+#define CACHE_MAGIC     "DBIC"
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t kind;
+    uint32_t cnt;
+    uint32_t cnt2;
+    uint32_t size;
+} CacheHeader;
+
+typedef struct {
+    const uint8_t * data;
+    size_t len;
+    size_t pos;
+} CacheReader;
+
+typedef struct {
+    uint32_t kind;
+    const char * name;
+} CacheArtifact;
+
+static const CacheArtifact artifacts[] = {
+    { ANALYSIS_KEYS,        "keys" },
+    { ANALYSIS_PARTIALS,    "partials" },
+    { ANALYSIS_STREAM,      "stream" },
+    { ANALYSIS_XREFS,       "xrefs" },
+};
+
+// distinguishes temporary files of threads storing the same artifact
+static uint32_t tmp_seq = 0;
+
+void analysis_cache_disable(void) {
+    dbi_context_default()->no_cache = 1;
+}
+
+/** Hash is remembered in mf, so repeated lookups of the same nro do not rehash
+ * it. Threads racing on the same nro keep whichever hash was stored first.
+ */
+static const char * cache_hash(const MemFile * mf) {
+    char * hash = __atomic_load_n(&mf->hash, __ATOMIC_ACQUIRE);
+    if(hash) {
+        return hash;
+    }
+    
+    uint8_t digest[SHA256_LEN];
+    sha256(mf->data, mf->len, digest);
+    
+    hash = malloc(SHA256_HEX_LEN);
+    sha256_hex(digest, hash);
+    
+    char * expected = NULL;
+    if(!__atomic_compare_exchange_n(&((MemFile*)mf)->hash, &expected, hash, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(hash);
+        hash = expected;
+    }
+    
+    return hash;
+}
+
+static int cache_dir(const MemFile * mf, char * dir, uint32_t dir_len) {
+    if(dbi_context_current()->no_cache) {
+        return -1;
+    }
+    
+    const char * xdg = getenv("XDG_CACHE_HOME");
+    const char * home = getenv("HOME");
+    
+    const char * hashed_hex = cache_hash(mf);
+    
+    int len;
+    if(xdg && *xdg) {
+        len = snprintf(dir, dir_len, "%s/dbipatcher/%s", xdg, hashed_hex);
+    } else if(home && *home) {
+        len = snprintf(dir, dir_len, "%s/.cache/dbipatcher/%s", home, hashed_hex);
+    } else {
+        return -1;
+    }
+    
+    return len > 0 && (uint32_t)len < dir_len ? 0 : -1;
+}
+
+static const void * cache_read(CacheReader * r, size_t len) {
+    if(r->pos > r->len || len > r->len - r->pos) {
+        return NULL;
+    }
+    
+    const void * res = r->data + r->pos;
+    r->pos += len;
+    
+    return res;
+}
+
+/** Reads cnt elements of size each, count comes from file so it is checked
+ * against what is left before multiplying.
+ */
+static const void * cache_read_array(CacheReader * r, uint32_t cnt, size_t size) {
+    if(r->pos > r->len || cnt > (r->len - r->pos) / size) {
+        return NULL;
+    }
+    
+    return cache_read(r, cnt * size);
+}
+
+static int cache_read_u32(CacheReader * r, uint32_t * val) {
+    const void * p = cache_read(r, sizeof(*val));
+    if(!p) {
+        return -1;
+    }
+    
+    memcpy(val, p, sizeof(*val));
+    return 0;
+}
+
+static int cache_load_keys(CacheReader * r, const CacheHeader * hdr, CodeAnalysis * ca) {
+    const void * keys = cache_read_array(r, hdr->cnt, sizeof(uint64_t));
+    const uint8_t * sites = cache_read_array(r, hdr->cnt2, 16);
+    
+    if(!keys || !sites || hdr->cnt == 0) {
+        return -1;
+    }
+    
+    KeySet * ks = calloc(1, sizeof(*ks));
+    ks->key_cnt = hdr->cnt;
+    ks->keys = malloc(sizeof(*ks->keys) * hdr->cnt);
+    memcpy(ks->keys, keys, sizeof(*ks->keys) * hdr->cnt);
+    
+    ks->site_cnt = hdr->cnt2;
+    ks->sites = malloc(sizeof(*ks->sites) * (hdr->cnt2 + 1));
+    for(uint32_t i = 0; i < hdr->cnt2; i++) {
+        memcpy(&ks->sites[i].key, sites + i * 16, 8);
+        memcpy(&ks->sites[i].offset, sites + i * 16 + 8, 4);
+    }
+    
+    ca->keys = ks;
+    return 0;
+}
+
+static int cache_load_stream(CacheReader * r, const CacheHeader * hdr, const MemFile * mf, CodeAnalysis * ca) {
+    const void * words = cache_read_array(r, hdr->cnt, sizeof(uint32_t));
+    
+    if(!words || hdr->cnt != mf->len / 4) {
+        return -1;
+    }
+    
+    ImmStream * stream = imm_stream_alloc(mf->len);
+    memcpy(stream->words, words, sizeof(*stream->words) * hdr->cnt);
+    
+    ca->stream = stream;
+    return 0;
+}
+
+static int cache_load_xrefs(CacheReader * r, const CacheHeader * hdr, CodeAnalysis * ca) {
+    const void * entries = cache_read_array(r, hdr->cnt, sizeof(XrefEntry));
+    
+    if(!entries) {
+        return -1;
+    }
+    
+    XrefIndex * idx = calloc(1, sizeof(*idx));
+    idx->cnt = hdr->cnt;
+    idx->entries = malloc(sizeof(*idx->entries) * (hdr->cnt + 1));
+    memcpy(idx->entries, entries, sizeof(*idx->entries) * hdr->cnt);
+    
+    ca->xrefs = idx;
+    return 0;
+}
+
+static int cache_load_partials(CacheReader * r, const CacheHeader * hdr, CodeAnalysis * ca) {
+    ImmResult * first = NULL;
+    ImmResult ** tail = &first;
+    
+    for(uint32_t i = 0; i < hdr->cnt; i++) {
+        uint32_t raw_len, match_cnt;
+        if(cache_read_u32(r, &raw_len) || cache_read_u32(r, &match_cnt)) {
+            goto fail;
+        }
+        
+        ImmResult * res = calloc(1, sizeof(*res));
+        *tail = res;
+        tail = &res->next;
+        
+        ImmMatch ** match_tail = &res->matches;
+        for(uint32_t m = 0; m < match_cnt; m++) {
+            uint32_t cnt;
+            const void * offsets;
+            if(cache_read_u32(r, &cnt) || !(offsets = cache_read_array(r, cnt, sizeof(uint32_t)))) {
+                goto fail;
+            }
+            
+            ImmMatch * match = calloc(1, sizeof(*match));
+            match->cnt = cnt;
+            match->offsets = malloc(sizeof(*match->offsets) * ((size_t)cnt + 1));
+            memcpy(match->offsets, offsets, sizeof(*match->offsets) * cnt);
+            
+            *match_tail = match;
+            match_tail = &match->next;
+            res->matches_cnt++;
+        }
+        
+        const void * raw = cache_read(r, ((size_t)raw_len + 3) & ~(size_t)3);
+        if(!raw) {
+            goto fail;
+        }
+        
+        res->raw_len = raw_len;
+        res->raw = malloc((size_t)raw_len + 1);
+        memcpy(res->raw, raw, raw_len);
+    }
+    
+    ca->partials = first;
+    return 0;
+    
+fail:
+    imm_result_free(first);
+    return -1;
+}
+
+static int cache_load_file(const char * path, uint32_t kind, const MemFile * mf, CodeAnalysis * ca) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return -1;
+    }
+    
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheHeader) || st.st_size > UINT32_MAX) {
+        close(fd);
+        return -1;
+    }
+    
+    void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    
+    if(map == MAP_FAILED) {
+        return -1;
+    }
+    
+    CacheHeader hdr;
+    memcpy(&hdr, map, sizeof(hdr));
+    
+    CacheReader r = {
+        .data = (const uint8_t*)map + sizeof(hdr),
+        .len = st.st_size - sizeof(hdr),
+    };
+    
+    int ret = -1;
+    if(memcmp(hdr.magic, CACHE_MAGIC, 4) == 0 && hdr.version == CACHE_VERSION && hdr.kind == kind && hdr.size == r.len) {
+        switch(kind) {
+            case ANALYSIS_KEYS:     ret = cache_load_keys(&r, &hdr, ca);        break;
+            case ANALYSIS_PARTIALS: ret = cache_load_partials(&r, &hdr, ca);    break;
+            case ANALYSIS_STREAM:   ret = cache_load_stream(&r, &hdr, mf, ca);  break;
+            case ANALYSIS_XREFS:    ret = cache_load_xrefs(&r, &hdr, ca);       break;
+        }
+    }
+    
+    munmap(map, st.st_size);
+    return ret;
+}
+
+/** Fills requested artifacts of ca from cache, returns mask of those which
+ * were found. Broken or outdated files are silently ignored.
+ */
+uint32_t analysis_cache_load(const MemFile * mf, CodeAnalysis * ca, uint32_t what) {
+    char dir[FILENAME_MAX];
+    if(cache_dir(mf, dir, sizeof(dir)) != 0) {
+        return 0;
+    }
+    
+    uint32_t loaded = 0;
+    for(uint32_t i = 0; i < ARRLEN(artifacts); i++) {
+        if(!(what & artifacts[i].kind)) {
+            continue;
+        }
+        
+        char path[FILENAME_MAX + 32];
+        snprintf(path, sizeof(path), "%s/%s.bin", dir, artifacts[i].name);
+        
+        if(cache_load_file(path, artifacts[i].kind, mf, ca) == 0) {
+            lf_d("loaded %s from cache \"%s\"", artifacts[i].name, dir);
+            loaded |= artifacts[i].kind;
+        }
+    }
+    
+    return loaded;
+}
+
+static void cache_write_u32(FILE * f, uint32_t val) {
+    fwrite(&val, sizeof(val), 1, f);
+}
+
+static uint32_t cache_store_keys(FILE * f, const KeySet * ks, CacheHeader * hdr) {
+    hdr->cnt = ks->key_cnt;
+    hdr->cnt2 = ks->site_cnt;
+    
+    fwrite(ks->keys, sizeof(*ks->keys), ks->key_cnt, f);
+    
+    for(uint32_t i = 0; i < ks->site_cnt; i++) {
+        fwrite(&ks->sites[i].key, 8, 1, f);
+        cache_write_u32(f, ks->sites[i].offset);
+        cache_write_u32(f, 0);
+    }
+    
+    return ks->key_cnt * 8 + ks->site_cnt * 16;
+}
+
+static uint32_t cache_store_partials(FILE * f, const ImmResult * res, CacheHeader * hdr) {
+    static const uint8_t pad[4];
+    uint32_t size = 0;
+    
+    for(; res; res = res->next) {
+        cache_write_u32(f, res->raw_len);
+        cache_write_u32(f, res->matches_cnt);
+        size += 8;
+        
+        for(const ImmMatch * m = res->matches; m; m = m->next) {
+            cache_write_u32(f, m->cnt);
+            fwrite(m->offsets, sizeof(*m->offsets), m->cnt, f);
+            size += 4 + m->cnt * 4;
+        }
+        
+        uint32_t raw_len = (res->raw_len + 3) & ~3;
+        fwrite(res->raw, 1, res->raw_len, f);
+        fwrite(pad, 1, raw_len - res->raw_len, f);
+        size += raw_len;
+        
+        hdr->cnt++;
+    }
+    
+    return size;
+}
+
+static uint32_t cache_store_stream(FILE * f, const ImmStream * stream, CacheHeader * hdr) {
+    hdr->cnt = stream->cnt;
+    fwrite(stream->words, sizeof(*stream->words), stream->cnt, f);
+    
+    return stream->cnt * sizeof(*stream->words);
+}
+
+static uint32_t cache_store_xrefs(FILE * f, const XrefIndex * idx, CacheHeader * hdr) {
+    hdr->cnt = idx->cnt;
+    fwrite(idx->entries, sizeof(*idx->entries), idx->cnt, f);
+    
+    return idx->cnt * sizeof(*idx->entries);
+}
+
+/** Writes requested artifacts of ca to cache. Files are written under
+ * temporary name and renamed, so concurrent runs never see partial file.
+ */
+void analysis_cache_store(const MemFile * mf, const CodeAnalysis * ca, uint32_t what) {
+    char dir[FILENAME_MAX];
+    if(!what || cache_dir(mf, dir, sizeof(dir)) != 0) {
+        return;
+    }
+    
+    if(mkpath(0755, "%s/", dir) != 0) {
+        lf_w("failed to create cache directory \"%s\"", dir);
+        return;
+    }
+    
+    for(uint32_t i = 0; i < ARRLEN(artifacts); i++) {
+        uint32_t kind = artifacts[i].kind;
+        if(!(what & kind)) {
+            continue;
+        }
+        
+        char path[FILENAME_MAX + 32];
+        char path_tmp[FILENAME_MAX + 64];
+        snprintf(path, sizeof(path), "%s/%s.bin", dir, artifacts[i].name);
+        snprintf(path_tmp, sizeof(path_tmp), "%s.%d.%u.tmp", path, (int)getpid(), __atomic_fetch_add(&tmp_seq, 1, __ATOMIC_RELAXED));
+        
+        FILE * f = fopen(path_tmp, "wb");
+        if(!f) {
+            lf_w("failed to write cache file \"%s\"", path_tmp);
+            continue;
+        }
+        
+        CacheHeader hdr = {
+            .magic = CACHE_MAGIC,
+            .version = CACHE_VERSION,
+            .kind = kind,
+        };
+        fwrite(&hdr, sizeof(hdr), 1, f);
+        
+        switch(kind) {
+            case ANALYSIS_KEYS:     hdr.size = cache_store_keys(f, ca->keys, &hdr);             break;
+            case ANALYSIS_PARTIALS: hdr.size = cache_store_partials(f, ca->partials, &hdr);     break;
+            case ANALYSIS_STREAM:   hdr.size = cache_store_stream(f, ca->stream, &hdr);         break;
+            case ANALYSIS_XREFS:    hdr.size = cache_store_xrefs(f, ca->xrefs, &hdr);           break;
+        }
+        
+        fseek(f, 0, SEEK_SET);
+        fwrite(&hdr, sizeof(hdr), 1, f);
+        
+        int err = ferror(f);
+        if(fclose(f) != 0) {
+            err = 1;
+        }
+        
+        if(err || rename(path_tmp, path) != 0) {
+            lf_w("failed to write cache file \"%s\"", path);
+            unlink(path_tmp);
+        }
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "v2/context.h"
+
+// used by command line and by threads which never bound any context
+static DbiContext default_context = {
+    .progress = PROGRESS_INITIALIZER,
+};
+
+static __thread DbiContext * bound_context = NULL;
+
+DbiContext * dbi_context_init(void) {
+    DbiContext * ctx = calloc(1, sizeof(DbiContext));
+    progress_init(&ctx->progress);
+    
+    return ctx;
+}
+
+void dbi_context_free(DbiContext * ctx) {
+    if(ctx && ctx != &default_context) {
+        progress_destroy(&ctx->progress);
+        free(ctx->keygen);
+        free(ctx);
+    }
+}
+
+DbiContext * dbi_context_default(void) {
+    return &default_context;
+}
+
+const DbiContext * dbi_context_current(void) {
+    return bound_context ? bound_context : &default_context;
+}
+
+/** Returns context bound by calling thread, NULL when it uses default one.
+ * Worker threads bind the same one as thread which started them.
+ */
+DbiContext * dbi_context_bound(void) {
+    return bound_context;
+}
+
+/** Makes given context current for calling thread, NULL restores default one.
+ * Returns previously bound context, so calls may nest.
+ */
+DbiContext * dbi_context_bind(DbiContext * ctx) {
+    DbiContext * prev = bound_context;
+    bound_context = ctx;
+    
+    return prev;
+}
+
+/** Statistics of current context, written by instrumentation of operation.
+ */
+Stats * dbi_context_stats(void) {
+    return bound_context ? &bound_context->stats : &default_context.stats;
+}
+
+Progress * dbi_context_progress(void) {
+    return bound_context ? &bound_context->progress : &default_context.progress;
+}
@@ -0,0 +1,411 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * Patched nro differs from original only in string bytes and MOV
+ * immediates, so only changed ranges are written out.
+ *
+ * IPS, all integers big endian:
+ *   "PATCH" { u24 offset, u16 len, len B | u24 offset, u16 0, u16 run, u8 value } "EOF"
+ *
+ * DBID, all integers little endian:
+ *   "DBID" u32 version, u32 src_len, u32 dst_len, src sha256, dst sha256,
+ *   u32 record_cnt, record_cnt x { u32 offset, u32 len, len B }
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+#include "v2/delta.h"
+#include "sha256.h"
+#include "log.h"
+#include "utils.h"
+
+#define IPS_MAGIC           "PATCH"
+#define IPS_EOF             "EOF"
+#define IPS_MAX_OFFSET      0xFFFFFF
+#define IPS_MAX_RECORD      0xFFFF
+// record starting here would be read as end of patch
+#define IPS_EOF_OFFSET      0x454F46
+
+#define DBID_MAGIC          "DBID"
+#define DBID_VERSION        1
+#define DBID_HEADER_LEN     (4 + 4 + 4 + 4 + SHA256_LEN * 2 + 4)
+
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+} DeltaRange;
+
+int delta_parse_format(const char * name, DeltaFormat * format) {
+    if(strcasecmp(name, "ips") == 0) {
+        *format = DELTA_FORMAT_IPS;
+    } else if(strcasecmp(name, "native") == 0 || strcasecmp(name, "dbid") == 0) {
+        *format = DELTA_FORMAT_NATIVE;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/** Changed ranges of dst, equal runs shorter than DELTA_MERGE_GAP are kept
+ * inside range as they are cheaper than another record header.
+ */
+static uint32_t delta_ranges(const uint8_t * src, const uint8_t * dst, uint32_t len, DeltaRange ** ranges) {
+    DeltaRange * res = NULL;
+    uint32_t cnt = 0, cap = 0;
+
+    uint32_t i = 0;
+    while(i < len) {
+        // nearly whole image is equal, so compare whole words first
+        while(i + 8 <= len) {
+            uint64_t a, b;
+            memcpy(&a, src + i, sizeof(a));
+            memcpy(&b, dst + i, sizeof(b));
+            if(a != b) {
+                break;
+            }
+            i += 8;
+        }
+
+        while(i < len && src[i] == dst[i]) {
+            i++;
+        }
+
+        if(i >= len) {
+            break;
+        }
+
+        uint32_t end = i + 1;
+        for(uint32_t j = end; j < len && j - end < DELTA_MERGE_GAP; j++) {
+            if(src[j] != dst[j]) {
+                end = j + 1;
+            }
+        }
+
+        if(cnt == cap) {
+            cap = cap ? cap * 2 : 64;
+            res = realloc(res, cap * sizeof(*res));
+        }
+
+        res[cnt++] = (DeltaRange){ .offset = i, .len = end - i };
+        i = end;
+    }
+
+    *ranges = res;
+    return cnt;
+}
+
+static void put_be(FILE * out, uint32_t val, uint32_t bytes) {
+    for(uint32_t i = bytes; i --> 0;) {
+        fputc((val >> (i * 8)) & 0xFF, out);
+    }
+}
+
+static void put_le(FILE * out, uint32_t val) {
+    for(uint32_t i = 0; i < 4; i++) {
+        fputc((val >> (i * 8)) & 0xFF, out);
+    }
+}
+
+static uint32_t get_be(const uint8_t * src, uint32_t bytes) {
+    uint32_t val = 0;
+    for(uint32_t i = 0; i < bytes; i++) {
+        val = (val << 8) | src[i];
+    }
+    return val;
+}
+
+static uint32_t get_le(const uint8_t * src) {
+    return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static int delta_write_ips(FILE * out, const uint8_t * dst, const DeltaRange * ranges, uint32_t cnt) {
+    fwrite(IPS_MAGIC, 1, strlen(IPS_MAGIC), out);
+
+    for(uint32_t i = 0; i < cnt; i++) {
+        uint32_t offset = ranges[i].offset;
+        uint32_t len = ranges[i].len;
+
+        while(len) {
+            // start one byte earlier, it is rewritten by its own value
+            uint32_t start = offset == IPS_EOF_OFFSET ? offset - 1 : offset;
+            uint32_t part = MIN(len, IPS_MAX_RECORD - (offset - start));
+            uint32_t size = part + (offset - start);
+
+            // only record start is addressed by 24 bits, its data may go past
+            if(start > IPS_MAX_OFFSET) {
+                lf_e("change at 0x%08X is beyond 16 MiB reachable by IPS, use native format", offset);
+                return EXIT_FAILURE;
+            }
+
+            put_be(out, start, 3);
+            put_be(out, size, 2);
+            fwrite(dst + start, 1, size, out);
+
+            offset += part;
+            len -= part;
+        }
+    }
+
+    fwrite(IPS_EOF, 1, strlen(IPS_EOF), out);
+
+    return EXIT_SUCCESS;
+}
+
+static int delta_write_native(FILE * out, const uint8_t * src, const uint8_t * dst, uint32_t len, const DeltaRange * ranges, uint32_t cnt) {
+    uint8_t hash[SHA256_LEN];
+
+    fwrite(DBID_MAGIC, 1, strlen(DBID_MAGIC), out);
+    put_le(out, DBID_VERSION);
+    put_le(out, len);
+    put_le(out, len);
+
+    sha256(src, len, hash);
+    fwrite(hash, 1, sizeof(hash), out);
+    sha256(dst, len, hash);
+    fwrite(hash, 1, sizeof(hash), out);
+
+    put_le(out, cnt);
+
+    for(uint32_t i = 0; i < cnt; i++) {
+        put_le(out, ranges[i].offset);
+        put_le(out, ranges[i].len);
+        fwrite(dst + ranges[i].offset, 1, ranges[i].len, out);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int delta_write(FILE * out, DeltaFormat format, const uint8_t * src, const uint8_t * dst, uint32_t len) {
+    DeltaRange * ranges;
+    uint32_t cnt = delta_ranges(src, dst, len, &ranges);
+
+    uint64_t bytes = 0;
+    for(uint32_t i = 0; i < cnt; i++) {
+        bytes += ranges[i].len;
+    }
+
+    int ret;
+    switch(format) {
+        case DELTA_FORMAT_IPS:
+            ret = delta_write_ips(out, dst, ranges, cnt);
+            break;
+        case DELTA_FORMAT_NATIVE:
+            ret = delta_write_native(out, src, dst, len, ranges, cnt);
+            break;
+        default:
+            lf_e("unknown delta format");
+            ret = EXIT_FAILURE;
+            break;
+    }
+
+    free(ranges);
+
+    if(ret == EXIT_SUCCESS) {
+        if(fflush(out) != 0 || ferror(out)) {
+            lf_e("failed to write delta");
+            return EXIT_FAILURE;
+        }
+
+        lf_i("delta of %u records, %" PRIu64 " B changed", cnt, bytes);
+    }
+
+    return ret;
+}
+
+//////////// apply
+
+static int apply_ips(MemFile * dbi, const MemFile * delta) {
+    const uint8_t * ptr = delta->data + strlen(IPS_MAGIC);
+    const uint8_t * end = delta->data + delta->len;
+    uint32_t cnt = 0;
+
+    for(;;) {
+        if(end - ptr >= 3 && memcmp(ptr, IPS_EOF, 3) == 0) {
+            break;
+        }
+
+        if(end - ptr < 5) {
+            lf_e("truncated IPS record %u", cnt);
+            return EXIT_FAILURE;
+        }
+
+        uint32_t offset = get_be(ptr, 3);
+        uint32_t size = get_be(ptr + 3, 2);
+        ptr += 5;
+
+        uint32_t run = 0;
+        if(size == 0) {
+            if(end - ptr < 3) {
+                lf_e("truncated IPS record %u", cnt);
+                return EXIT_FAILURE;
+            }
+
+            run = get_be(ptr, 2);
+        } else if((uint32_t)(end - ptr) < size) {
+            lf_e("truncated IPS record %u", cnt);
+            return EXIT_FAILURE;
+        }
+
+        // nro never grows by patching
+        if((uint64_t)offset + (size ? size : run) > dbi->len) {
+            lf_e("IPS record %u at 0x%06X is beyond end of nro", cnt, offset);
+            return EXIT_FAILURE;
+        }
+
+        if(size) {
+            memcpy(dbi->data + offset, ptr, size);
+            ptr += size;
+        } else {
+            memset(dbi->data + offset, ptr[2], run);
+            ptr += 3;
+        }
+
+        cnt++;
+    }
+
+    lf_i("applied %u IPS records", cnt);
+
+    return EXIT_SUCCESS;
+}
+
+static int apply_native(MemFile * dbi, const MemFile * delta) {
+    const uint8_t * ptr = delta->data;
+    const uint8_t * end = delta->data + delta->len;
+
+    if(delta->len < DBID_HEADER_LEN) {
+        lf_e("truncated DBID header");
+        return EXIT_FAILURE;
+    }
+
+    uint32_t version = get_le(ptr + 4);
+    uint32_t src_len = get_le(ptr + 8);
+    uint32_t dst_len = get_le(ptr + 12);
+    const uint8_t * src_hash = ptr + 16;
+    const uint8_t * dst_hash = src_hash + SHA256_LEN;
+    uint32_t cnt = get_le(dst_hash + SHA256_LEN);
+    ptr += DBID_HEADER_LEN;
+
+    if(version != DBID_VERSION) {
+        lf_e("unsupported DBID version %u", version);
+        return EXIT_FAILURE;
+    }
+
+    if(src_len != dst_len) {
+        lf_e("DBID changing nro size is not supported");
+        return EXIT_FAILURE;
+    }
+
+    uint8_t hash[SHA256_LEN];
+    char hex[SHA256_HEX_LEN];
+
+    sha256(dbi->data, dbi->len, hash);
+    if(src_len != dbi->len || memcmp(hash, src_hash, SHA256_LEN) != 0) {
+        sha256_hex(src_hash, hex);
+        lf_e("delta was created for different nro (sha256 %s)", hex);
+        return EXIT_FAILURE;
+    }
+
+    for(uint32_t i = 0; i < cnt; i++) {
+        if(end - ptr < 8) {
+            lf_e("truncated DBID record %u", i);
+            return EXIT_FAILURE;
+        }
+
+        uint32_t offset = get_le(ptr);
+        uint32_t len = get_le(ptr + 4);
+        ptr += 8;
+
+        if((uint32_t)(end - ptr) < len || (uint64_t)offset + len > dbi->len) {
+            lf_e("invalid DBID record %u at 0x%08X", i, offset);
+            return EXIT_FAILURE;
+        }
+
+        memcpy(dbi->data + offset, ptr, len);
+        ptr += len;
+    }
+
+    sha256(dbi->data, dbi->len, hash);
+    if(memcmp(hash, dst_hash, SHA256_LEN) != 0) {
+        lf_e("patched nro does not match checksum of delta");
+        return EXIT_FAILURE;
+    }
+
+    lf_i("applied %u DBID records, checksums match", cnt);
+
+    return EXIT_SUCCESS;
+}
+
+/** Patched nro is written to temporary file renamed over out, so failed write
+ * never leaves partial output behind.
+ */
+static int apply_write(const char * out, const MemFile * dbi) {
+    if(!out) {
+        return fwrite(dbi->data, 1, dbi->len, stdout) == dbi->len && fflush(stdout) == 0 ? 0 : -1;
+    }
+    
+    size_t tmp_len = strlen(out) + 5;
+    char * tmp = malloc(tmp_len);
+    snprintf(tmp, tmp_len, "%s.tmp", out);
+    
+    FILE * f = NULL;
+    if(mkpath(0755, "%s", tmp) == 0) {
+        f = fopen(tmp, "wb");
+    }
+    
+    int ret = -1;
+    if(f) {
+        uint8_t written = fwrite(dbi->data, 1, dbi->len, f) == dbi->len;
+        
+        if(fclose(f) == 0 && written && rename(tmp, out) == 0) {
+            ret = 0;
+        } else {
+            unlink(tmp);
+        }
+    }
+    
+    free(tmp);
+    
+    return ret;
+}
+
+int apply_delta(const ApplyDeltaArgs * args) {
+    MemFile * dbi = args->dbi_mf;
+    if(!dbi) {
+        return EXIT_FAILURE;
+    }
+
+    MemFile * delta = mf_init_path(args->delta);
+    if(!delta) {
+        lf_e("failed to load \"%s\"", args->delta);
+        return EXIT_FAILURE;
+    }
+
+    int ret;
+    if(delta->len >= strlen(IPS_MAGIC) && memcmp(delta->data, IPS_MAGIC, strlen(IPS_MAGIC)) == 0) {
+        ret = apply_ips(dbi, delta);
+    } else if(delta->len >= strlen(DBID_MAGIC) && memcmp(delta->data, DBID_MAGIC, strlen(DBID_MAGIC)) == 0) {
+        ret = apply_native(dbi, delta);
+    } else {
+        lf_e("\"%s\" is neither IPS nor DBID delta", args->delta);
+        ret = EXIT_FAILURE;
+    }
+
+    mf_free(delta);
+
+    if(ret == EXIT_SUCCESS && apply_write(args->out, dbi) != 0) {
+        lf_e("failed to write patched nro");
+        ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
@@ -31,7 +31,27 @@ void imm_result_free(ImmResult * iter) {
     }
 }
 
-void imm_print(FILE * f, const ImmDefine * def, const ImmResult * res) {
+static void imm_print_at(OutBuf * ob, uint32_t start, uint32_t diff) {
+    ob_lit(ob, "// at 0x");
+    ob_hex(ob, start, 8, 1);
+    ob_lit(ob, " diff=");
+    ob_u32(ob, diff, 0);
+    ob_lit(ob, CRLF);
+}
+
+static void imm_print_mov(OutBuf * ob, uint32_t addr, uint32_t offset, const uint8_t * raw, uint32_t len) {
+    ob_lit(ob, "\tmov=0x");
+    ob_hex(ob, addr, 8, 1);
+    ob_lit(ob, ";offset=");
+    ob_u32(ob, offset, 0);
+    ob_lit(ob, ";len=");
+    ob_u32(ob, len, 0);
+    ob_lit(ob, ";imm=0x");
+    ob_hex_rev(ob, raw, len);
+    ob_lit(ob, CRLF);
+}
+
+void imm_print(OutBuf * ob, const ImmDefine * def, const ImmResult * res) {
     ImmMatch * iter = res->matches;
     while(iter) {
 
@@ -47,26 +67,21 @@ void imm_print(FILE * f, const ImmDefine * def, const ImmResult * res) {
                 end = iter->offsets[i];
             }
         }
-        fprintf(f, "// at 0x%08X diff=%u" CRLF, start, end - start);
+        imm_print_at(ob, start, end - start);
 
         for(uint32_t i = 0; i < iter->cnt; i++) {
             uint32_t raw_idx = i * 2;
             uint32_t rem = res->raw_len - raw_idx;
             rem = MIN(rem, 2);
 
-            fprintf(f, "\tmov=0x%08X;offset=%u;len=%u;imm=0x", iter->offsets[i], raw_idx + def->offset, rem);
-
-            for(uint32_t j = rem; j --> 0;) {
-                fprintf(f, "%02X", res->raw[raw_idx + j]);
-            }
-            fprintf(f, CRLF);
+            imm_print_mov(ob, iter->offsets[i], raw_idx + def->offset, res->raw + raw_idx, rem);
         }
 
         iter = iter->next;
     }
 }
 
-void imm_print_dummy(FILE * f, const ImmDefine * def) {
+void imm_print_dummy(OutBuf * ob, const ImmDefine * def) {
 
     uint32_t raw_len = (def->len - def->offset);
     uint32_t iter_cnt = (raw_len + 1) / 2;
@@ -80,18 +95,13 @@ void imm_print_dummy(FILE * f, const ImmDefine * def) {
         *(dst++) = src[x] ^ xor;
     }
     
-    fprintf(f, "// at 0x%08X diff=%u" CRLF, UINT32_MAX, 0);
+    imm_print_at(ob, UINT32_MAX, 0);
 
     for(uint32_t i = 0; i < iter_cnt; i++) {
         uint32_t raw_idx = i * 2;
         uint32_t rem = raw_len - raw_idx;
         rem = MIN(rem, 2);
 
-        fprintf(f, "\tmov=0x%08X;offset=%u;len=%u;imm=0x", UINT32_MAX, raw_idx + def->offset, rem);
-
-        for(uint32_t j = rem; j --> 0;) {
-            fprintf(f, "%02X", raw[raw_idx + j]);
-        }
-        fprintf(f, CRLF);
+        imm_print_mov(ob, UINT32_MAX, raw_idx + def->offset, raw + raw_idx, rem);
     }
 }
\ No newline at end of file
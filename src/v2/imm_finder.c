@@ -9,11 +9,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#define MAX_CANDIDATES  32
+#define MAX_CANDIDATES  256
 
 #include "v2/imm.h"
 #include "v2/inst.h"
 #include "log.h"
+#include "stats.h"
 
 static void imm_append(ImmResult * res, ImmMatch * imm) {
     imm->next = res->matches;
@@ -51,124 +52,527 @@ static ImmResult * imm_result_init(ImmDefine * def) {
     return res;
 }
 
-ImmResult * imm_lookup(const void * data, uint32_t len, ImmDefine * imm, uint32_t tolerance) {
+static uint32_t imm_stream_word(const arm64_instr_t * inst) {
+    switch(inst->type) {
+        case INSTR_MOV:
+        case INSTR_MOVZ:
+        case INSTR_MOVK:
+            return (IMM_CLASS_MOV << 16) | (inst->imm & 0xFFFF);
+        case INSTR_MOVN:
+            return (IMM_CLASS_MOVN << 16) | (inst->imm & 0xFFFF);
+        default:
+            return IMM_CLASS_NONE << 16;
+    }
+}
+
+/** Stream covering len bytes with every word empty, to be filled by
+ * imm_stream_step.
+ */
+ImmStream * imm_stream_alloc(uint32_t len) {
+    ImmStream * stream = malloc(sizeof(*stream));
+    memset(stream, 0, sizeof(*stream));
+    
+    stream->cnt = len / 4;
+    stream->words = calloc(stream->cnt + 1, sizeof(*stream->words));
+    
+    return stream;
+}
+
+void imm_stream_step(void * ctx, const arm64_instr_t * d, uint32_t raw, uint32_t pc) {
+    ImmStream * stream = ctx;
+    
+    if(pc / 4 < stream->cnt) {
+        stream->words[pc / 4] = imm_stream_word(d);
+    }
+}
+
+/** Only words passing MOV family prefilter are decoded, rest of stream stays
+ * empty.
+ */
+ImmStream * imm_stream_init(const void * data, uint32_t len) {
     const uint8_t * data_u8 = data;
-    len = (len / 4) * 4;
     
-    uint32_t cand_cnt = ((imm->len - imm->offset) + 1) / 2;
-    cand_cnt = MIN(MAX_CANDIDATES, cand_cnt);
+    ImmStream * stream = imm_stream_alloc(len);
     
-    ImmResult * res = imm_result_init(imm);
-    ImmMatch * match = imm_match_init(cand_cnt);
+    uint64_t * mask = malloc(sizeof(*mask) * ((stream->cnt + 63) / 64 + 1));
+    instr_mov_candidates(data_u8, stream->cnt, mask);
+    
+    for(uint32_t w = 0; w < (stream->cnt + 63) / 64; w++) {
+        for(uint64_t bits = mask[w]; bits; bits &= bits - 1) {
+            uint32_t i = w * 64 + __builtin_ctzll(bits);
+            
+            uint32_t inst_raw;
+            memcpy(&inst_raw, data_u8 + i * 4, 4);
+            
+            arm64_instr_t inst;
+            instr_decode(inst_raw, &inst, i * 4);
+            imm_stream_step(stream, &inst, inst_raw, i * 4);
+        }
+    }
+    
+    free(mask);
+    
+    return stream;
+}
+
+void imm_stream_free(ImmStream * stream) {
+    if(stream) {
+        free(stream->words);
+        free(stream);
+    }
+}
+
+// every candidate remembers this many unconsumed occurrences, which is enough
+// for few copies of the same string being built interleaved, oldest ones are
+// dropped first
+#define CAND_PENDING    4
+
+#define CAND_NONE       UINT16_MAX
+
+/** Matcher state of single lookup. Candidates are 16 bit chunks of decoded
+ * string, candidate with pending occurrence has its bit set in pending, so
+ * complete match is detected by comparing whole words of bitset.
+ */
+typedef struct {
+    uint32_t cand_cnt;
+    uint16_t * cand;
+    
+    // last candidate of odd length string only compares low byte
+    uint8_t last_masked;
+    
+    // bit per low 6 bits of every candidate, rejects most immediates at once
+    uint64_t filter;
+    
+    // value -> first candidate, duplicates chained in ascending order
+    uint16_t * bucket;
+    uint32_t bucket_mask;
+    uint16_t * chain;
+    
+    // ring of pending occurrences per candidate
+    uint32_t * queue;
+    uint8_t * queue_head;
+    uint8_t * queue_cnt;
+    
+    uint64_t * pending;
+    uint32_t word_cnt;
+} ImmMatcher;
+
+static inline uint32_t imm_matcher_hash(uint16_t value, uint32_t mask) {
+    return ((value * 0x9E37U) >> 4) & mask;
+}
+
+static void imm_matcher_init(ImmMatcher * m, const ImmDefine * imm) {
+    memset(m, 0, sizeof(*m));
     
-    uint16_t cand_z[cand_cnt];
-    memset(cand_z, 0, sizeof(cand_z));
+    uint32_t len = imm->len - imm->offset;
     
-    uint16_t cand_n[cand_cnt];
-    memset(cand_n, 0xFF, sizeof(cand_n));
+    m->cand_cnt = MIN(MAX_CANDIDATES, (len + 1) / 2);
+    m->last_masked = (len % 2) && m->cand_cnt == (len + 1) / 2;
+    m->cand = calloc(m->cand_cnt + 1, sizeof(*m->cand));
     
-    const uint8_t * cand = (const uint8_t*)imm->data;
-    uint8_t * cand_u8_z = (uint8_t*)cand_z;
-    uint8_t * cand_u8_n = (uint8_t*)cand_n;
-    for(uint32_t x = imm->offset; x < imm->len; x++) {
+    const uint8_t * src = (const uint8_t*)imm->data;
+    uint8_t * cand_u8 = (uint8_t*)m->cand;
+    for(uint32_t x = imm->offset; x < imm->len && x - imm->offset < m->cand_cnt * 2; x++) {
         uint8_t xor = (imm->key >> ((x & 7) * 8)) & 0xFF;
-        cand_u8_z[x - imm->offset] = cand[x] ^ xor;
-        cand_u8_n[x - imm->offset] = cand[x] ^ xor;
-    }
-    
-    uint32_t match_mask = (1UL << cand_cnt) - 1;
-    
-    uint32_t state_match = 0;
-    uint32_t state_mismtach = 0;
-    uint32_t state_start = 0;
-    
-    arm64_instr_t inst;
-    uint32_t inst_raw;
-    uint16_t inst_imm;
-    for(uint32_t i = 0; i < len;) {
-        memcpy(&inst_raw, data_u8 + i, 4);
-        
-        instr_decode(inst_raw, &inst, i);
-        
-        uint8_t matched = 0;
-        switch(inst.type) {
-            case INSTR_MOV:
-            case INSTR_MOVZ:
-            case INSTR_MOVK:
-                inst_imm = inst.imm & 0xFFFF;
-                
-                for(uint32_t x = 0; x < cand_cnt; x++) {
-                    uint32_t cand_mask = 0xFFFF;
-                    if(x + 1 == cand_cnt && imm->len % 2) {
-                        cand_mask = 0xFF;
-                    }
-                    
-                    if((cand_z[x] & cand_mask) == (inst_imm & cand_mask)) {
-                        state_match |= (1 << x);
-                        match->offsets[x] = i;
-                        matched = 1;
-                        break;
-                    }
-                }
-                break;
-                    
-            case INSTR_MOVN:
-                inst_imm = inst.imm & 0xFFFF;
-                
-                for(uint32_t x = 0; x < cand_cnt; x++) {
-                    uint32_t cand_mask = 0xFFFF;
-                    if(x + 1 == cand_cnt && imm->len % 2) {
-                        cand_mask = 0xFF;
-                    }
-                    
-                    if((cand_n[x] & cand_mask) == (inst_imm & cand_mask)) {
-                        state_match |= (1 << x);
-                        match->offsets[x] = i;
-                        matched = 1;
-                        break;
-                    }
-                }
-                break;
-                
-            default:
-                break;
-        }
-        
-        if(matched) {
-            if(state_match == match_mask) {
-                // matched
-                //lf_e("matched at 0x%08X", state_start);
-                
-                imm_append(res, match);
-                match = imm_match_init(cand_cnt);
-                
-                state_match = 0;
-                state_mismtach = 0;
-                
-                state_start = i + 4;
-                i = state_start;
-                continue;
-            } else {
-                state_mismtach = 0;
+        cand_u8[x - imm->offset] = src[x] ^ xor;
+    }
+    
+    uint32_t bucket_cnt = 16;
+    while(bucket_cnt < m->cand_cnt * 2) {
+        bucket_cnt *= 2;
+    }
+    
+    m->bucket_mask = bucket_cnt - 1;
+    m->bucket = malloc(sizeof(*m->bucket) * bucket_cnt);
+    memset(m->bucket, 0xFF, sizeof(*m->bucket) * bucket_cnt);
+    m->chain = malloc(sizeof(*m->chain) * (m->cand_cnt + 1));
+    
+    for(uint32_t x = 0; x < m->cand_cnt; x++) {
+        m->filter |= 1ULL << (m->cand[x] & 63);
+    }
+    
+    // masked candidate can not be hashed by its whole value
+    uint32_t hashed_cnt = m->cand_cnt - m->last_masked;
+    
+    for(uint32_t x = hashed_cnt; x --> 0;) {
+        uint32_t b = imm_matcher_hash(m->cand[x], m->bucket_mask);
+        
+        while(m->bucket[b] != CAND_NONE && m->cand[m->bucket[b]] != m->cand[x]) {
+            b = (b + 1) & m->bucket_mask;
+        }
+        
+        m->chain[x] = m->bucket[b];
+        m->bucket[b] = x;
+    }
+    
+    m->queue = malloc(sizeof(*m->queue) * m->cand_cnt * CAND_PENDING);
+    m->queue_head = calloc(m->cand_cnt + 1, 1);
+    m->queue_cnt = calloc(m->cand_cnt + 1, 1);
+    
+    m->word_cnt = (m->cand_cnt + 63) / 64;
+    m->pending = calloc(m->word_cnt + 1, sizeof(*m->pending));
+}
+
+static void imm_matcher_free(ImmMatcher * m) {
+    free(m->cand);
+    free(m->bucket);
+    free(m->chain);
+    free(m->queue);
+    free(m->queue_head);
+    free(m->queue_cnt);
+    free(m->pending);
+}
+
+static void imm_matcher_reset(ImmMatcher * m) {
+    memset(m->queue_cnt, 0, m->cand_cnt);
+    memset(m->pending, 0, sizeof(*m->pending) * m->word_cnt);
+}
+
+static uint8_t imm_matcher_complete(const ImmMatcher * m) {
+    for(uint32_t w = 0; w + 1 < m->word_cnt; w++) {
+        if(m->pending[w] != UINT64_MAX) {
+            return 0;
+        }
+    }
+    
+    uint32_t rem = m->cand_cnt - (m->word_cnt - 1) * 64;
+    uint64_t last = rem == 64 ? UINT64_MAX : (1ULL << rem) - 1;
+    
+    return m->pending[m->word_cnt - 1] == last;
+}
+
+/** Candidate given immediate belongs to, among candidates of equal value the
+ * one with least pending occurrences is picked, so repeated chunks are filled
+ * in order.
+ */
+static uint32_t imm_matcher_find(const ImmMatcher * m, uint16_t value) {
+    uint32_t best = CAND_NONE;
+    
+    uint32_t b = imm_matcher_hash(value, m->bucket_mask);
+    while(m->bucket[b] != CAND_NONE && m->cand[m->bucket[b]] != value) {
+        b = (b + 1) & m->bucket_mask;
+    }
+    
+    for(uint32_t x = m->bucket[b]; x != CAND_NONE; x = m->chain[x]) {
+        if(best == CAND_NONE || m->queue_cnt[x] < m->queue_cnt[best]) {
+            best = x;
+        }
+    }
+    
+    if(m->last_masked) {
+        uint32_t x = m->cand_cnt - 1;
+        
+        if((m->cand[x] & 0xFF) == (value & 0xFF) && (best == CAND_NONE || m->queue_cnt[x] < m->queue_cnt[best])) {
+            best = x;
+        }
+    }
+    
+    return best;
+}
+
+static void imm_matcher_push(ImmMatcher * m, uint32_t x, uint32_t offset) {
+    uint32_t * queue = m->queue + x * CAND_PENDING;
+    
+    if(m->queue_cnt[x] == CAND_PENDING) {
+        // oldest occurrence is the least likely one to be completed
+        m->queue_head[x] = (m->queue_head[x] + 1) % CAND_PENDING;
+        m->queue_cnt[x]--;
+    }
+    
+    queue[(m->queue_head[x] + m->queue_cnt[x]) % CAND_PENDING] = offset;
+    m->queue_cnt[x]++;
+    
+    m->pending[x / 64] |= 1ULL << (x % 64);
+}
+
+/** Consumes latest pending occurrence of every candidate, so single sequence
+ * is reported by the instructions closest to each other. Older occurrences
+ * stay pending for interleaved copies.
+ */
+static ImmMatch * imm_matcher_take(ImmMatcher * m) {
+    ImmMatch * match = imm_match_init(m->cand_cnt);
+    
+    for(uint32_t x = 0; x < m->cand_cnt; x++) {
+        uint32_t last = (m->queue_head[x] + m->queue_cnt[x] - 1) % CAND_PENDING;
+        match->offsets[x] = m->queue[x * CAND_PENDING + last];
+        
+        if(--m->queue_cnt[x] == 0) {
+            m->pending[x / 64] &= ~(1ULL << (x % 64));
+        }
+    }
+    
+    return match;
+}
+
+/** Runs matcher over [start, end) of stream in single pass, matches are
+ * prepended to res.
+ * 
+ * Every candidate has to be materialized by some MOV family instruction, with
+ * less than tolerance other instructions between consecutive materializing
+ * ones. Sequences may be interleaved or overlap, as each occurrence is only
+ * consumed by single match. Nothing pending is carried over from previous run,
+ * so separate windows never combine.
+ */
+static void imm_matcher_run(ImmMatcher * m, const ImmStream * stream, uint32_t tolerance, uint32_t start, uint32_t end, ImmResult * res) {
+    imm_matcher_reset(m);
+    
+    uint32_t gap = 0;
+    
+    for(uint32_t i = start; i < end; i += 4) {
+        uint32_t word = stream->words[i / 4];
+        uint32_t x = CAND_NONE;
+        
+        // MOVN is compared by its encoded immediate, same as MOV family
+        if(IMM_STREAM_CLASS(word) != IMM_CLASS_NONE && (m->filter >> (word & 63)) & 1) {
+            x = imm_matcher_find(m, IMM_STREAM_IMM(word));
+        }
+        
+        if(x == CAND_NONE) {
+            if(++gap == tolerance) {
+                imm_matcher_reset(m);
+                gap = 0;
             }
-        } else {            
-            if(!state_match) {
-                state_start = i;
+            continue;
+        }
+        
+        gap = 0;
+        imm_matcher_push(m, x, i);
+        
+        if(imm_matcher_complete(m)) {
+            imm_append(res, imm_matcher_take(m));
+        }
+    }
+}
+
+static void imm_stream_match(const ImmStream * stream, ImmDefine * imm, uint32_t tolerance, uint32_t start, uint32_t end, ImmResult * res) {
+    ImmMatcher m;
+    imm_matcher_init(&m, imm);
+    imm_matcher_run(&m, stream, tolerance, start, end, res);
+    imm_matcher_free(&m);
+}
+
+ImmResult * imm_stream_lookup(const ImmStream * stream, ImmDefine * imm, uint32_t tolerance) {
+    StatsMark t_start = stats_phase_begin();
+    
+    ImmResult * res = imm_result_init(imm);
+    imm_stream_match(stream, imm, tolerance, 0, stream->cnt * 4, res);
+    
+    stats_add(STATS_IMM_LOOKUPS, 1);
+    stats_phase_end(STATS_PHASE_IMM_LOOKUP, &t_start);
+    
+    return res;
+}
+
+/** Same as imm_stream_lookup, but only [start, end) byte ranges given as
+ * pairs are searched. Ranges have to be sorted and must not overlap, then
+ * results are ordered the same way as full lookup would order them.
+ */
+ImmResult * imm_stream_lookup_ranges(const ImmStream * stream, ImmDefine * imm, uint32_t tolerance, const uint32_t * ranges, uint32_t range_cnt) {
+    StatsMark t_start = stats_phase_begin();
+    
+    ImmResult * res = imm_result_init(imm);
+    
+    // matcher is built once and only reset between windows
+    ImmMatcher m;
+    imm_matcher_init(&m, imm);
+    
+    for(uint32_t i = 0; i < range_cnt; i++) {
+        uint32_t start = ranges[i * 2] & ~3;
+        uint32_t end = MIN(ranges[i * 2 + 1], stream->cnt * 4);
+        
+        if(start < end) {
+            imm_matcher_run(&m, stream, tolerance, start, end, res);
+        }
+    }
+    
+    imm_matcher_free(&m);
+    
+    stats_add(STATS_IMM_LOOKUPS, 1);
+    stats_phase_end(STATS_PHASE_IMM_LOOKUP, &t_start);
+    
+    return res;
+}
+
+// short lookups fit into few candidates, so their matcher state is inline
+#define BATCH_CANDS     4
+
+/** Matcher of single define inside batch, same rules as ImmMatcher.
+ */
+typedef struct {
+    uint16_t cand[BATCH_CANDS];
+    uint8_t cand_cnt;
+    uint8_t last_masked;
+    uint8_t queue_head[BATCH_CANDS];
+    uint8_t queue_cnt[BATCH_CANDS];
+    uint32_t queue[BATCH_CANDS][CAND_PENDING];
+    
+    // word index of last hit and of last word handled, UINT32_MAX if none
+    uint32_t last_hit;
+    uint32_t last_word;
+    
+    ImmResult * res;
+} BatchMatcher;
+
+static void batch_matcher_push(BatchMatcher * m, uint32_t x, uint32_t offset) {
+    if(m->queue_cnt[x] == CAND_PENDING) {
+        m->queue_head[x] = (m->queue_head[x] + 1) % CAND_PENDING;
+        m->queue_cnt[x]--;
+    }
+    
+    m->queue[x][(m->queue_head[x] + m->queue_cnt[x]) % CAND_PENDING] = offset;
+    m->queue_cnt[x]++;
+    
+    for(uint32_t i = 0; i < m->cand_cnt; i++) {
+        if(!m->queue_cnt[i]) {
+            return;
+        }
+    }
+    
+    ImmMatch * match = imm_match_init(m->cand_cnt);
+    
+    for(uint32_t i = 0; i < m->cand_cnt; i++) {
+        uint32_t last = (m->queue_head[i] + m->queue_cnt[i] - 1) % CAND_PENDING;
+        match->offsets[i] = m->queue[i][last];
+        m->queue_cnt[i]--;
+    }
+    
+    imm_append(m->res, match);
+}
+
+static void batch_matcher_hit(BatchMatcher * m, uint16_t value, uint32_t word, uint32_t tolerance) {
+    // reachable by both full value and masked low byte
+    if(m->last_word == word) {
+        return;
+    }
+    m->last_word = word;
+    
+    // tolerance of instructions without any candidate resets whole state
+    if(m->last_hit != UINT32_MAX && word - m->last_hit - 1 >= tolerance) {
+        memset(m->queue_cnt, 0, sizeof(m->queue_cnt));
+    }
+    
+    uint32_t best = CAND_NONE;
+    for(uint32_t x = 0; x < m->cand_cnt; x++) {
+        uint8_t masked = m->last_masked && x == m->cand_cnt - 1u;
+        uint8_t equal = masked ? (m->cand[x] & 0xFF) == (value & 0xFF) : m->cand[x] == value;
+        
+        if(equal && (best == CAND_NONE || m->queue_cnt[x] < m->queue_cnt[best])) {
+            best = x;
+        }
+    }
+    
+    m->last_hit = word;
+    batch_matcher_push(m, best, word * 4);
+}
+
+/** Resolves many lookups by single pass over stream. Every candidate value of
+ * every define is put into table indexed by immediate, so each MOV family
+ * word only visits defines it belongs to. Results are the same as calling
+ * imm_stream_lookup for each define.
+ */
+ImmResult ** imm_stream_lookup_batch(const ImmStream * stream, ImmDefine * imms, uint32_t cnt, uint32_t tolerance) {
+    StatsMark t_start = stats_phase_begin();
+    
+    ImmResult ** res = malloc(sizeof(*res) * (cnt + 1));
+    BatchMatcher * m = calloc(cnt + 1, sizeof(*m));
+    
+    // value -> defines, low byte -> defines with masked last candidate
+    uint32_t * full_first = calloc(0x10000 + 1, sizeof(*full_first));
+    uint32_t * masked_first = calloc(0x100 + 1, sizeof(*masked_first));
+    uint32_t full_cnt = 0, masked_cnt = 0;
+    
+    for(uint32_t i = 0; i < cnt; i++) {
+        ImmDefine * imm = &imms[i];
+        uint32_t len = imm->len - imm->offset;
+        
+        res[i] = imm_result_init(imm);
+        m[i].res = res[i];
+        m[i].last_hit = UINT32_MAX;
+        m[i].last_word = UINT32_MAX;
+        
+        if(!len || (len + 1) / 2 > BATCH_CANDS) {
+            continue;
+        }
+        
+        m[i].cand_cnt = (len + 1) / 2;
+        m[i].last_masked = len % 2;
+        memcpy(m[i].cand, res[i]->raw, len);
+        
+        for(uint32_t x = 0; x < m[i].cand_cnt; x++) {
+            if(m[i].last_masked && x == m[i].cand_cnt - 1u) {
+                masked_first[m[i].cand[x] & 0xFF]++;
+                masked_cnt++;
+            } else {
+                full_first[m[i].cand[x]]++;
+                full_cnt++;
             }
-            
-            if(++state_mismtach == tolerance) {
-                state_match = 0;
-                state_mismtach = 0;
-                
-                state_start += 4;
-                i = state_start;
-                continue;
+        }
+    }
+    
+    // counts to end offsets, filling walks them back to start offsets
+    for(uint32_t v = 1; v <= 0x10000; v++) {
+        full_first[v] += full_first[v - 1];
+    }
+    for(uint32_t v = 1; v <= 0x100; v++) {
+        masked_first[v] += masked_first[v - 1];
+    }
+    
+    uint32_t * full = malloc(sizeof(*full) * (full_cnt + 1));
+    uint32_t * masked = malloc(sizeof(*masked) * (masked_cnt + 1));
+    
+    for(uint32_t i = cnt; i --> 0;) {
+        for(uint32_t x = m[i].cand_cnt; x --> 0;) {
+            // repeated value of the same define is skipped by batch_matcher_hit
+            if(m[i].last_masked && x == m[i].cand_cnt - 1u) {
+                masked[--masked_first[m[i].cand[x] & 0xFF]] = i;
+            } else {
+                full[--full_first[m[i].cand[x]]] = i;
             }
         }
+    }
+    
+    for(uint32_t w = 0; w < stream->cnt; w++) {
+        uint32_t word = stream->words[w];
+        if(IMM_STREAM_CLASS(word) == IMM_CLASS_NONE) {
+            continue;
+        }
+        
+        uint16_t value = IMM_STREAM_IMM(word);
+        
+        for(uint32_t j = full_first[value]; j < full_first[value + 1]; j++) {
+            batch_matcher_hit(&m[full[j]], value, w, tolerance);
+        }
         
-        i += 4;
+        for(uint32_t j = masked_first[value & 0xFF]; j < masked_first[(value & 0xFF) + 1]; j++) {
+            batch_matcher_hit(&m[masked[j]], value, w, tolerance);
+        }
     }
     
-    imm_match_free(match);
+    // longer lookups keep using full matcher
+    for(uint32_t i = 0; i < cnt; i++) {
+        uint32_t len = imms[i].len - imms[i].offset;
+        
+        if(len && (len + 1) / 2 > BATCH_CANDS) {
+            imm_stream_match(stream, &imms[i], tolerance, 0, stream->cnt * 4, res[i]);
+        }
+    }
+    
+    free(full_first);
+    free(masked_first);
+    free(full);
+    free(masked);
+    free(m);
+    
+    stats_add(STATS_IMM_LOOKUPS, cnt);
+    stats_phase_end(STATS_PHASE_IMM_LOOKUP, &t_start);
+    
+    return res;
+}
+
+ImmResult * imm_lookup(const void * data, uint32_t len, ImmDefine * imm, uint32_t tolerance) {
+    ImmStream * stream = imm_stream_init(data, len);
+    ImmResult * res = imm_stream_lookup(stream, imm, tolerance);
+    imm_stream_free(stream);
+    
     return res;
 }
@@ -7,6 +7,7 @@
 #include <stddef.h>
 #include <sys/param.h>
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 
 #include "v2/imm.h"
@@ -75,7 +76,7 @@ typedef struct {
     uint8_t matched;
 } ImmState;
 
-typedef struct {
+struct _ImmParser {
     const ImmStep * init;
     const ImmStep * collect;
     const ImmStep * end;
@@ -92,7 +93,7 @@ typedef struct {
     
     ImmResult * result;
     uint32_t match_cnt;
-} ImmParser;
+};
 
 static const ImmStep match_a_init[] = {
     { IT_MATCH,{
@@ -298,169 +299,164 @@ static ImmMatch * imm_match_init(uint32_t len) {
     return res;
 }
 
-// Outer loop using your step_state
-void parse_with_patterns(ImmParser *P, uint32_t *insts, size_t n, uint64_t base_pc) {
-    // Initialize states
+/** Feeds single decoded instruction to INIT / COLLECT / END patterns.
+ */
+void imm_parser_step(void * ctx, const arm64_instr_t * d, uint32_t raw, uint32_t pc) {
+    ImmParser * P = ctx;
+    
     ImmState si = P->state_init;
     ImmState sc = P->state_collect;
     ImmState se = P->state_end;
     
-    for (size_t i = 0; i < n; i++) {
-        uint32_t pc = base_pc + i * 4;
-        arm64_instr_t d;
-        instr_decode(insts[i], &d, pc);
-
-        // check if we have overlaping INIT
-        ImmState ni;
-        imm_state_reset(&ni, P->init);
-        ni = step_state(P->init, ni, &d);
+    // check if we have overlaping INIT
+    ImmState ni;
+    imm_state_reset(&ni, P->init);
+    ni = step_state(P->init, ni, d);
+    
+    uint8_t si_reached = 0;
+    if(ni.cur) {
+        //lf_e("INIT overlap");
         
-        uint8_t si_reached = 0;
-        if(ni.cur) {
-            //lf_e("INIT overlap");
-            
-            // INIT overlaps, treat as first match
-            si = ni;
-            
-            // now, matching single instruction from INIT does not neccessarily 
-            // mean that COLLECT should fail, but for now its good enough
-            imm_state_reset(&sc, P->collect);
-            imm_immediate_reset(P);
-            
-            P->immediate_start = pc;
-            
-            if (si.cur->type == IT_NULL) {
-                si_reached = 1;
-                //lf_w("INIT done 0x%08X [%s]", pc, instr_to_string(&d, insts[i], pc));
-            }
-        } else if(si.cur->type != IT_NULL) {
-            // only handle if INIT not done yet
-            si = step_state(P->init, si, &d);
-            
-            if(!si.cur) {
-                // failed to match, reset
-                imm_state_reset(&si, P->init);
-            }
-            
-            if (si.cur && si.cur->type == IT_NULL) {
-                si_reached = 1;
-                //lf_w("INIT done 0x%08X [%s]", pc, instr_to_string(&d, insts[i], pc));
-            }
-        }
+        // INIT overlaps, treat as first match
+        si = ni;
         
-        if(si_reached) {
-            // do something
-            //lf_e("INIT start");
-        }
+        // now, matching single instruction from INIT does not neccessarily 
+        // mean that COLLECT should fail, but for now its good enough
+        imm_state_reset(&sc, P->collect);
+        imm_immediate_reset(P);
         
-        if(si.cur->type == IT_NULL) {
-            //lf_t("is init");
-        } else {
-            //lf_e("is not init");
-        }
+        P->immediate_start = pc;
         
-        // INIT done, advance COLLECT
-        if(si.cur->type == IT_NULL) {
-                        
-            ImmState nc = step_state(P->collect, sc, &d);
-             
-            // either failed, or ended without matching END pattern
-            if (!nc.cur || nc.cur->type == IT_NULL) {
-                // matched end, reset all
-                imm_state_reset(&si, P->init);
-                imm_state_reset(&sc, P->collect);
-                imm_state_reset(&se, P->end);
-                imm_immediate_reset(P);
-            } else {
-                if(nc.collect) {                   
-                    uint16_t imm = d.imm & 0xFFFF;
-                                        
-                    if(P->offsets_idx != ARRLEN(P->offsets)) {
-                        //lf_e("offset %u=0x%08x", P->offsets_idx, pc);
-                        P->offsets[P->offsets_idx++] = pc;
-                    }
-                    
-                    for(uint32_t i = 0; i < sizeof(imm); i++) {
-                        if(P->raw_idx != ARRLEN(P->raw)) {
-                            P->raw[P->raw_idx++] = imm & 0xFF;
-                            imm >>= 8;
-                        }
-                    }
-                }
-                
-                sc = nc;
-            }   
+        if (si.cur->type == IT_NULL) {
+            si_reached = 1;
+            //lf_w("INIT done 0x%08X [%s]", pc, instr_to_string(d, raw, pc));
         }
+    } else if(si.cur->type != IT_NULL) {
+        // only handle if INIT not done yet
+        si = step_state(P->init, si, d);
         
-        // check if we have overlaping END
-        ImmState ne;
-        imm_state_reset(&ne, P->end);
-        ne = step_state(P->end, ne, &d);
-        
-        uint8_t se_reached = 0;
-        if(ne.cur) {
-            // END overlaps, treat as first match
-            se = ne;
-            
-            if(se.cur->type == IT_NULL) {
-                se_reached = 1;
-            }
-        } else if(se.cur->type != IT_NULL) {
-            se = step_state(P->end, se, &d);
-                
-            if(!se.cur) {
-                // failed to match, reset END
-                imm_state_reset(&se, P->end);
-            }
-            
-            if(se.cur->type == IT_NULL) {
-                se_reached = 1;
-            }
+        if(!si.cur) {
+            // failed to match, reset
+            imm_state_reset(&si, P->init);
         }
         
-        if(se_reached) {
-            //lf_e("END reached");
-            // was previously INIT
-            if(si.cur->type == IT_NULL) {
-                //lf_e("was init");
-                // TODO: check if immediate was previously found and 
-                // perform callback
-
-                if(P->raw_idx) {
-                    //printf("collected %-3u 0x%08X [%u]\n", P->raw_idx, P->immediate_start, (uint32_t)(pc - P->immediate_start));
-                    ImmResult * res = malloc(sizeof(*res));
-                    memset(res, 0, sizeof(*res));
-                    
-                    ImmMatch * match = malloc(sizeof(*match));
-                    memset(match, 0, sizeof(*match));
-                    
-                    uint32_t offsets_len = sizeof(*match->offsets) * P->offsets_idx;
-                    match->cnt = P->offsets_idx;
-                    match->offsets = malloc(offsets_len);
-                    memcpy(match->offsets, P->offsets, offsets_len);
-                    
-                    res->matches_cnt = 1;
-                    res->matches = match;
-                    res->raw_len = P->raw_idx;
-                    res->raw = malloc(P->raw_idx);
-                    
-                    memcpy(res->raw, P->raw, P->raw_idx);
-                    
-                    if(P->result) {
-                        res->next = P->result;
-                    } 
+        if (si.cur && si.cur->type == IT_NULL) {
+            si_reached = 1;
+            //lf_w("INIT done 0x%08X [%s]", pc, instr_to_string(d, raw, pc));
+        }
+    }
+    
+    if(si_reached) {
+        // do something
+        //lf_e("INIT start");
+    }
+    
+    if(si.cur->type == IT_NULL) {
+        //lf_t("is init");
+    } else {
+        //lf_e("is not init");
+    }
+    
+    // INIT done, advance COLLECT
+    if(si.cur->type == IT_NULL) {
                     
-                    P->result = res;
-                }
-            }
-
+        ImmState nc = step_state(P->collect, sc, d);
+         
+        // either failed, or ended without matching END pattern
+        if (!nc.cur || nc.cur->type == IT_NULL) {
             // matched end, reset all
             imm_state_reset(&si, P->init);
             imm_state_reset(&sc, P->collect);
             imm_state_reset(&se, P->end);
             imm_immediate_reset(P);
+        } else {
+            if(nc.collect) {                   
+                uint16_t imm = d->imm & 0xFFFF;
+                                    
+                if(P->offsets_idx != ARRLEN(P->offsets)) {
+                    //lf_e("offset %u=0x%08x", P->offsets_idx, pc);
+                    P->offsets[P->offsets_idx++] = pc;
+                }
+                
+                for(uint32_t i = 0; i < sizeof(imm); i++) {
+                    if(P->raw_idx != ARRLEN(P->raw)) {
+                        P->raw[P->raw_idx++] = imm & 0xFF;
+                        imm >>= 8;
+                    }
+                }
+            }
+            
+            sc = nc;
+        }   
+    }
+    
+    // check if we have overlaping END
+    ImmState ne;
+    imm_state_reset(&ne, P->end);
+    ne = step_state(P->end, ne, d);
+    
+    uint8_t se_reached = 0;
+    if(ne.cur) {
+        // END overlaps, treat as first match
+        se = ne;
+        
+        if(se.cur->type == IT_NULL) {
+            se_reached = 1;
+        }
+    } else if(se.cur->type != IT_NULL) {
+        se = step_state(P->end, se, d);
+            
+        if(!se.cur) {
+            // failed to match, reset END
+            imm_state_reset(&se, P->end);
+        }
+        
+        if(se.cur->type == IT_NULL) {
+            se_reached = 1;
+        }
+    }
+    
+    if(se_reached) {
+        //lf_e("END reached");
+        // was previously INIT
+        if(si.cur->type == IT_NULL) {
+            //lf_e("was init");
+            // TODO: check if immediate was previously found and 
+            // perform callback
+
+            if(P->raw_idx) {
+                //printf("collected %-3u 0x%08X [%u]\n", P->raw_idx, P->immediate_start, (uint32_t)(pc - P->immediate_start));
+                ImmResult * res = malloc(sizeof(*res));
+                memset(res, 0, sizeof(*res));
+                
+                ImmMatch * match = malloc(sizeof(*match));
+                memset(match, 0, sizeof(*match));
+                
+                uint32_t offsets_len = sizeof(*match->offsets) * P->offsets_idx;
+                match->cnt = P->offsets_idx;
+                match->offsets = malloc(offsets_len);
+                memcpy(match->offsets, P->offsets, offsets_len);
+                
+                res->matches_cnt = 1;
+                res->matches = match;
+                res->raw_len = P->raw_idx;
+                res->raw = malloc(P->raw_idx);
+                
+                memcpy(res->raw, P->raw, P->raw_idx);
+                
+                if(P->result) {
+                    res->next = P->result;
+                } 
+                
+                P->result = res;
+            }
         }
 
+        // matched end, reset all
+        imm_state_reset(&si, P->init);
+        imm_state_reset(&sc, P->collect);
+        imm_state_reset(&se, P->end);
+        imm_immediate_reset(P);
     }
     
     P->state_init = si;
@@ -476,35 +472,42 @@ void parse_with_patterns(ImmParser *P, uint32_t *insts, size_t n, uint64_t base_
  * Might use it for language code matching, but I have a feeling it will be 
  * doable with finder.
  */
-ImmResult * imm_scan(const void * data, uint32_t len) {
-    const uint8_t * data_u8 = data;
+ImmParser * imm_parser_init(void) {
+    ImmParser * P = calloc(1, sizeof(*P));
     
-    ImmParser P = {
-        .init = match_a_init,
-        .collect = match_a_collect,
-        .end = match_a_commit,
-    };
+    P->init = match_a_init;
+    P->collect = match_a_collect;
+    P->end = match_a_commit;
         
-    imm_state_reset(&P.state_init, P.init);
-    imm_state_reset(&P.state_collect, P.collect);
-    imm_state_reset(&P.state_end, P.end);
-    imm_immediate_reset(&P);
+    imm_state_reset(&P->state_init, P->init);
+    imm_state_reset(&P->state_collect, P->collect);
+    imm_state_reset(&P->state_end, P->end);
+    imm_immediate_reset(P);
     
-    uint32_t offset = 0;
+    return P;
+}
+
+ImmResult * imm_parser_finish(ImmParser * P) {
+    ImmResult * res = P->result;
+    free(P);
     
-    while(len) {
-        uint32_t tmp[256];
-        uint32_t mod = MIN(sizeof(tmp), len);
-        len -= mod;
-        
-        memcpy(tmp, data_u8, mod);
-        data_u8 += mod;
+    return res;
+}
+
+ImmResult * imm_scan(const void * data, uint32_t len) {
+    const uint8_t * data_u8 = data;
+    ImmParser * P = imm_parser_init();
+    
+    for(uint32_t pc = 0; pc + 4 <= len; pc += 4) {
+        uint32_t raw;
+        memcpy(&raw, data_u8 + pc, 4);
         
-        parse_with_patterns(&P, tmp, (mod / sizeof(*tmp)), offset);
-        offset += mod;
+        arm64_instr_t d;
+        instr_decode(raw, &d, pc);
+        imm_parser_step(P, &d, raw, pc);
     }
 
-    return P.result;
+    return imm_parser_finish(P);
 }
 
 
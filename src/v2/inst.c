@@ -26,7 +26,7 @@ static const char *instr_type_names[] = {
 #define REG_ZR_FLAG   (1 << 9)  // ZR/WZR if set
 
 static const char *get_reg_name(arm64_reg_t r) {
-    static char buf[4];
+    static __thread char buf[4];
     int n = REG_NUM(r);
     if(REG_IS_SP(r)) return REG_IS_32(r) ? "wsp" : "sp";
     if(REG_IS_ZR(r)) return REG_IS_32(r) ? "wzr" : "xzr";
@@ -266,10 +266,126 @@ static int dec_stp(uint32_t i, arm64_instr_t*d, uint64_t pc) {
     return 0;
 }
 
+// MOV family prefilter
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define INSTR_HAS_SIMD 1
+#endif
+
+static uint32_t instr_mov_block_scalar(const uint8_t * code) {
+    uint32_t res = 0;
+    
+    for(uint32_t i = 0; i < 16; i++) {
+        uint32_t raw;
+        memcpy(&raw, code + i * 4, 4);
+        
+        if(INSTR_MOV_CANDIDATE(raw)) {
+            res |= 1U << i;
+        }
+    }
+    
+    return res;
+}
+
+#ifdef INSTR_HAS_SIMD
+
+static uint32_t instr_mov_block_sse2(const uint8_t * code) {
+    const __m128i wide_mask = _mm_set1_epi32(0x1F800000);
+    const __m128i wide = _mm_set1_epi32(0x12800000);
+    const __m128i orr_mask = _mm_set1_epi32((int32_t)0xFFC00000);
+    const __m128i orr_w = _mm_set1_epi32(0x52000000);
+    const __m128i orr_x = _mm_set1_epi32((int32_t)0xAA000000);
+    
+    uint32_t res = 0;
+    
+    for(uint32_t i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(code + i * 16));
+        __m128i top = _mm_and_si128(v, orr_mask);
+        
+        __m128i hit = _mm_cmpeq_epi32(_mm_and_si128(v, wide_mask), wide);
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi32(top, orr_w));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi32(top, orr_x));
+        
+        res |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(hit)) << (i * 4);
+    }
+    
+    return res;
+}
+
+__attribute__((target("avx2")))
+static uint32_t instr_mov_block_avx2(const uint8_t * code) {
+    const __m256i wide_mask = _mm256_set1_epi32(0x1F800000);
+    const __m256i wide = _mm256_set1_epi32(0x12800000);
+    const __m256i orr_mask = _mm256_set1_epi32((int32_t)0xFFC00000);
+    const __m256i orr_w = _mm256_set1_epi32(0x52000000);
+    const __m256i orr_x = _mm256_set1_epi32((int32_t)0xAA000000);
+    
+    uint32_t res = 0;
+    
+    for(uint32_t i = 0; i < 2; i++) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(code + i * 32));
+        __m256i top = _mm256_and_si256(v, orr_mask);
+        
+        __m256i hit = _mm256_cmpeq_epi32(_mm256_and_si256(v, wide_mask), wide);
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi32(top, orr_w));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi32(top, orr_x));
+        
+        res |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(hit)) << (i * 8);
+    }
+    
+    return res;
+}
+
+#endif
+
+typedef uint32_t (*instr_mov_block_fn)(const uint8_t*);
+
+static instr_mov_block_fn instr_mov_block_select(void) {
+#ifdef INSTR_HAS_SIMD
+    static instr_mov_block_fn fn = NULL;
+    
+    if(!fn) {
+        __builtin_cpu_init();
+        fn = __builtin_cpu_supports("avx2") ? instr_mov_block_avx2 : instr_mov_block_sse2;
+    }
+    
+    return fn;
+#else
+    return instr_mov_block_scalar;
+#endif
+}
+
+/** Marks every word of code which is INSTR_MOV_CANDIDATE in mask, which has
+ * to hold (cnt + 63) / 64 words. Blocks of 16 words are compared at once, so
+ * callers only need to decode marked words.
+ */
+void instr_mov_candidates(const void * code, uint32_t cnt, uint64_t * mask) {
+    const uint8_t * code_u8 = code;
+    instr_mov_block_fn block = instr_mov_block_select();
+    
+    memset(mask, 0, sizeof(*mask) * ((cnt + 63) / 64));
+    
+    uint32_t i = 0;
+    for(; i + 16 <= cnt; i += 16) {
+        mask[i / 64] |= (uint64_t)block(code_u8 + i * 4) << (i % 64);
+    }
+    
+    for(; i < cnt; i++) {
+        uint32_t raw;
+        memcpy(&raw, code_u8 + i * 4, 4);
+        
+        if(INSTR_MOV_CANDIDATE(raw)) {
+            mask[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+}
+
 // Print helper
 
 const char *instr_to_string(const arm64_instr_t *d, uint32_t raw, uint64_t pc) {
-    static char buf[128];
+    static __thread char buf[128];
     int pos = snprintf(buf, sizeof (buf), "0x%08" PRIx64 ": 0x%08" PRIx32 " %-5s ",
                        pc, raw, instr_type_names[d->type]);
     switch(d->type) {
@@ -14,6 +14,8 @@
 #include "utils.h"
 #include "log.h"
 #include "v2/keys.h"
+#include "v2/analysis.h"
+#include "v2/context.h"
 
 
 /* 
@@ -24,28 +26,8 @@
 
 #define MAX_KEYS        (1024 * 1024)
       
-#define INST_MOV        0xD2800000
-#define INST_MOV_MASK   0xFFE00000
-
-#define INST_MOVK       0xF2800000
-#define INST_MOVK_MASK  0xFF800000
-
-typedef enum {
-    IT_NONE = 0,
-    IT_MOV,
-    IT_MOVK,
-} InstructionType;
-
-typedef struct {
-    InstructionType type;
-    
-    uint16_t immediate;
-    uint8_t reg;
-    uint8_t shift;
-} Arm64Instruction;
-
 typedef struct {
-    InstructionType type;
+    arm64_instr_type_t type;
     uint8_t shift;
 } InstructionSequence;
 
@@ -57,47 +39,41 @@ typedef struct {
 // get the keys, translate at least long/partial strings. Short would require
 // manual key recovery?
 static const InstructionSequence key_instructions[] = {
-    { IT_MOV,   0 },
-    { IT_MOVK,  16 },
-    { IT_MOVK,  32 },
-    { IT_MOVK,  48 },
+    { INSTR_MOVZ,   0 },
+    { INSTR_MOVK,  16 },
+    { INSTR_MOVK,  32 },
+    { INSTR_MOVK,  48 },
 };
 
-static uint64_t * keygen = NULL;
-static uint32_t keygen_len = 0;
-
-static Arm64Instruction decode_instruction(uint32_t raw) {
-    if((raw & INST_MOV_MASK) == INST_MOV) {
-        return (Arm64Instruction){
-            .type = IT_MOV,
-            .immediate = (raw >> 5) & 0xFFFF,
-            .reg = raw & 0x1F,
-            .shift = 0,
-        };
-    }
+struct _KeyCollector {
+    uint64_t * keys;
+    uint64_t * key_ptr;
     
-    if((raw & INST_MOVK_MASK) == INST_MOVK) {
-        return (Arm64Instruction){
-            .type = IT_MOVK,
-            .immediate = (raw >> 5) & 0xFFFF,
-            .reg = raw & 0x1F,
-            .shift = ((raw >> 21) & 0x3) * 16,
-        };
-    }
+    KeySite * sites;
+    uint32_t site_cnt;
+    uint32_t site_max;
     
-    return (Arm64Instruction){
-        .type = IT_NONE,
-    };
-}
+    const InstructionSequence * state;
+    uint64_t key;
+    arm64_reg_t reg;
+    
+    // skipped instructions break sequence as well
+    uint32_t pc_next;
+};
 
 void free_key_set(KeySet * ks) {
     if(ks) {
         free(ks->keys);
+        free(ks->sites);
         free(ks);
     }
 }
 
 int set_keygen(const char * path) {
+    return load_keygen(dbi_context_default(), path);
+}
+
+int load_keygen(DbiContext * ctx, const char * path) {
     FILE *fp = fopen(path, "r");
     if (!fp) {
         return EXIT_FAILURE;
@@ -127,79 +103,183 @@ int set_keygen(const char * path) {
         }
     }
     
-    keygen = keys;
-    keygen_len = key_ptr - keys;
+    free(ctx->keygen);
+    ctx->keygen = keys;
+    ctx->keygen_len = key_ptr - keys;
 
     fclose(fp);
     return EXIT_SUCCESS;
 }
 
-KeySet * get_key_set(MemFile * mf) {
+static int key_site_compare(const void * a, const void * b) {
+    const KeySite * sa = a;
+    const KeySite * sb = b;
+    
+    if(sa->key != sb->key) {
+        return sa->key < sb->key ? -1 : 1;
+    }
+    
+    if(sa->offset != sb->offset) {
+        return sa->offset < sb->offset ? -1 : 1;
+    }
+    
+    return 0;
+}
+
+KeyCollector * key_collector_init(void) {
+    KeyCollector * kc = calloc(1, sizeof(*kc));
+    
     // yea, I know, just wanted to quickly check
-    uint64_t * keys = calloc(MAX_KEYS, sizeof(uint64_t));
-    uint64_t * key_ptr = keys;
-    *(key_ptr++) = 0;
-        
-    const InstructionSequence * state = key_instructions;
-    uint64_t key = 0;
-    uint8_t reg = 0;
-    
-    uint32_t max_len = (mf->len / 4) * 4;
-    for(uint32_t i = 0; i < max_len; i += 4) {
-        uint32_t cur;
-        memcpy(&cur, mf->data + i, 4);
-        
-        Arm64Instruction inst = decode_instruction(cur);
-        if(inst.type == state->type && inst.shift == state->shift) {
-            key |= (uint64_t)inst.immediate << inst.shift;
-            
-            if(state == key_instructions) {
-                reg = inst.reg;
-            } else if(reg != inst.reg) {
-                goto skip;
-            }
-            
-            if(++state - key_instructions == ARRLEN(key_instructions)) {
-
-                uint64_t * iter = keys;
-                while(iter != key_ptr) {
-                    if(*iter == key) {
-                        break;
-                    }
-                    iter++;
-                }
-                
-                if(iter == key_ptr) {
-                    if(key_ptr - keys != MAX_KEYS) {
-                        *(key_ptr++) = key;
-                        
-                        //lf_i("found key %u: 0x%016" PRIx64 " @ 0x%08X", key_ptr - keys, key, i - 12);
-                    }
-                }
-
-                state = key_instructions;
-                key = 0;
-            }
-        } else {
-        skip:
-            if(state != key_instructions) {
-                i -= (state - key_instructions) * 4;
-                
-                state = key_instructions;
-                key = 0;
-            }
+    kc->keys = calloc(MAX_KEYS, sizeof(uint64_t));
+    kc->key_ptr = kc->keys;
+    *(kc->key_ptr++) = 0;
+    
+    kc->site_max = 1024;
+    kc->sites = malloc(sizeof(*kc->sites) * kc->site_max);
+    
+    kc->state = key_instructions;
+    
+    return kc;
+}
+
+static void key_collector_add(KeyCollector * kc, uint32_t pc) {
+    // every site is kept, same key is often built in many places
+    if(kc->site_cnt == kc->site_max) {
+        kc->site_max *= 2;
+        kc->sites = realloc(kc->sites, sizeof(*kc->sites) * kc->site_max);
+    }
+
+    kc->sites[kc->site_cnt++] = (KeySite) {
+        .key = kc->key,
+        .offset = pc - (ARRLEN(key_instructions) - 1) * 4,
+    };
+
+    uint64_t * iter = kc->keys;
+    while(iter != kc->key_ptr) {
+        if(*iter == kc->key) {
+            break;
+        }
+        iter++;
+    }
+
+    if(iter == kc->key_ptr) {
+        if(kc->key_ptr - kc->keys != MAX_KEYS) {
+            *(kc->key_ptr++) = kc->key;
         }
     }
+}
+
+static uint8_t key_collector_match(KeyCollector * kc, const arm64_instr_t * d, uint32_t pc) {
+    // only 64 bit forms are used for keys
+    if(d->type != kc->state->type || d->shift != kc->state->shift || (d->rd & REG_W_FLAG)) {
+        return 0;
+    }
     
+    if(kc->state == key_instructions) {
+        kc->reg = d->rd;
+    } else if(kc->reg != d->rd) {
+        return 0;
+    }
+    
+    kc->key |= (d->imm & 0xFFFF) << d->shift;
+    
+    if(++kc->state - key_instructions == ARRLEN(key_instructions)) {
+        key_collector_add(kc, pc);
+        
+        kc->state = key_instructions;
+        kc->key = 0;
+    }
+    
+    return 1;
+}
+
+/** Instructions of key sequence are never MOVZ with zero shift except the
+ * first one, so on mismatch only current instruction needs to be retried as
+ * possible start of new sequence.
+ */
+void key_collector_step(void * ctx, const arm64_instr_t * d, uint32_t raw, uint32_t pc) {
+    KeyCollector * kc = ctx;
+    
+    if(pc != kc->pc_next) {
+        kc->state = key_instructions;
+        kc->key = 0;
+    }
+    kc->pc_next = pc + 4;
+    
+    if(!key_collector_match(kc, d, pc) && kc->state != key_instructions) {
+        kc->state = key_instructions;
+        kc->key = 0;
+        
+        key_collector_match(kc, d, pc);
+    }
+}
+
+KeySet * key_collector_finish(KeyCollector * kc) {
     KeySet * ks = malloc(sizeof(KeySet));
     memset(ks, 0, sizeof(*ks));
     
-    ks->keys = keys;
-    ks->key_cnt = key_ptr - keys;
+    ks->keys = kc->keys;
+    ks->key_cnt = kc->key_ptr - kc->keys;
+    
+    qsort(kc->sites, kc->site_cnt, sizeof(*kc->sites), key_site_compare);
+    ks->sites = kc->sites;
+    ks->site_cnt = kc->site_cnt;
+    
+    free(kc);
+    
+    return ks;
+}
+
+KeySet * get_key_set(const MemFile * mf) {
+    CodeAnalysis * ca = code_analysis_init(mf, ANALYSIS_KEYS);
+    KeySet * ks = ca->keys;
+    
+    // caller owns result, resident one has to be copied
+    if(ca->borrowed & ANALYSIS_KEYS) {
+        ks = calloc(1, sizeof(*ks));
+        ks->key_cnt = ca->keys->key_cnt;
+        ks->keys = malloc(sizeof(*ks->keys) * ks->key_cnt);
+        memcpy(ks->keys, ca->keys->keys, sizeof(*ks->keys) * ks->key_cnt);
+        
+        ks->site_cnt = ca->keys->site_cnt;
+        ks->sites = malloc(sizeof(*ks->sites) * (ks->site_cnt + 1));
+        memcpy(ks->sites, ca->keys->sites, sizeof(*ks->sites) * ks->site_cnt);
+    } else {
+        ca->keys = NULL;
+    }
+    
+    code_analysis_free(ca);
     
     return ks;
 }
 
+/** Returns all sites of given key in ascending order, or NULL when key was
+ * never seen materialized in code.
+ */
+const KeySite * key_set_sites(const KeySet * ks, uint64_t key, uint32_t * cnt) {
+    uint32_t lo = 0;
+    uint32_t hi = ks->site_cnt;
+    
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        
+        if(ks->sites[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    uint32_t end = lo;
+    while(end < ks->site_cnt && ks->sites[end].key == key) {
+        end++;
+    }
+    
+    *cnt = end - lo;
+    
+    return *cnt ? &ks->sites[lo] : NULL;
+}
+
 // NOTE 810+:
 // https://github.com/adamyaxley/Obfuscate/blob/master/obfuscate.h
 // NOTE 846+: something else or better seed
@@ -209,9 +289,11 @@ uint64_t get_key(uint64_t seed) {
         return 0;
     }
     
-    if(keygen_len != 0) {
-        if(seed < keygen_len) {
-            return keygen[seed];
+    const DbiContext * ctx = dbi_context_current();
+    
+    if(ctx->keygen_len != 0) {
+        if(seed < ctx->keygen_len) {
+            return ctx->keygen[seed];
         }
     }
     
@@ -229,6 +311,33 @@ uint64_t get_key(uint64_t seed) {
     return key;
 }
 
+/** XORs bytes [start, end) of data by key, byte x uses byte x & 7 of key, so
+ * data is expected to start at beginning of encrypted string.
+ */
+void key_xor(void * data, uint32_t start, uint32_t end, uint64_t key) {
+    uint8_t * bytes = data;
+    uint32_t x = start;
+    
+    while(x < end && (x & 7)) {
+        bytes[x] ^= (key >> ((x & 7) * 8)) & 0xFF;
+        x++;
+    }
+    
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // aligned to key, so whole words are xored at once
+    for(; x + 8 <= end; x += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + x, 8);
+        word ^= key;
+        memcpy(bytes + x, &word, 8);
+    }
+#endif
+    
+    for(; x < end; x++) {
+        bytes[x] ^= (key >> ((x & 7) * 8)) & 0xFF;
+    }
+}
+
 KeySet * gen_key_set(uint32_t max) {
     KeySet * ks = malloc(sizeof(KeySet));
     memset(ks, 0, sizeof(*ks));
@@ -0,0 +1,673 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#include "log.h"
+#include "utils.h"
+#include "v2/keys.h"
+#include "v2/keysearch.h"
+#include "v2/strings.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define SEARCH_HAS_AVX2 1
+#endif
+
+#define SEARCH_CHUNK        (1 << 20)
+#define SEARCH_BATCH        256
+#define SEARCH_KEYGEN_MAX   (1024 * 1024)
+#define SEARCH_NONE         UINT32_MAX
+
+#define GOLDEN_GAMMA        0x9e3779b97f4a7c15ULL
+
+// NOTE: 846+: generator is not the obfuscate.h one anymore. All common 64 bit
+// finalizers share xor-shift / multiply / xor-shift / multiply / xor-shift
+// shape, they only differ in constants, so one kernel covers all of them.
+typedef struct {
+    const char * name;
+    uint8_t s1;
+    uint64_t m1;
+    uint8_t s2;
+    uint64_t m2;
+    uint8_t s3;
+} Mixer;
+
+static const Mixer mixers[] = {
+    { "murmur3",    33, 0xff51afd7ed558ccdULL, 33, 0xc4ceb9fe1a85ec53ULL, 33 },
+    { "splitmix",   30, 0xbf58476d1ce4e5b9ULL, 27, 0x94d049bb133111ebULL, 31 },
+    { "xxh64",      33, 0xc2b2ae3d27d4eb4fULL, 29, 0x165667b19e3779f9ULL, 32 },
+    { "moremur",    27, 0x3c79ac492ba7b653ULL, 33, 0x1c69b3f74ac4ae35ULL, 27 },
+    { "lea64",      32, 0xdaba0b6eb09322e3ULL, 32, 0xdaba0b6eb09322e3ULL, 32 },
+    { "degski64",   32, 0xd6e8feb86659fd93ULL, 32, 0xd6e8feb86659fd93ULL, 32 },
+};
+
+typedef enum {
+    SEED_PLAIN = 0,
+    SEED_GAMMA,
+    SEED_GAMMA_NEXT,
+    SEED_HIGH,
+    SEED_TRANSFORM_CNT,
+} SeedTransform;
+
+static const char * seed_transform_names[SEED_TRANSFORM_CNT] = {
+    "s",
+    "s*gamma",
+    "(s+1)*gamma",
+    "s<<32",
+};
+
+// names have to stay free of hex prefix, output doubles as --keygen file
+typedef struct {
+    const char * name;
+    uint64_t bits;
+} Fixup;
+
+static const Fixup fixups[] = {
+    { "none",   0 },
+    { "or-01",  0x0101010101010101ULL },
+    { "or-80",  0x8080808080808080ULL },
+};
+
+#define MIXER_CNT       ARRLEN(mixers)
+#define FIXUP_CNT       ARRLEN(fixups)
+#define COMBO_CNT       (MIXER_CNT * SEED_TRANSFORM_CNT * FIXUP_CNT)
+
+typedef struct {
+    uint64_t key;
+    uint32_t id;
+    uint8_t known;
+} KeyTarget;
+
+typedef struct {
+    KeyTarget * targets;
+    uint32_t target_cnt;
+    uint32_t target_max;
+
+    uint64_t * slot_keys;
+    uint32_t * slot_idx;
+    uint32_t slot_shift;
+} TargetSet;
+
+typedef struct {
+    uint32_t combo;
+    uint32_t target;
+    uint64_t seed;
+} SearchHit;
+
+typedef void (*HashBatchFn)(const Mixer * m, SeedTransform t, uint64_t seed, uint32_t cnt, uint64_t * out);
+
+typedef struct {
+    const TargetSet * set;
+    HashBatchFn hash_batch;
+    uint64_t seed_end;
+    uint64_t next;
+} SearchState;
+
+typedef struct {
+    pthread_t thread;
+    SearchState * st;
+    SearchHit * hits;
+    uint32_t hit_cnt;
+    uint32_t hit_max;
+} SearchWorker;
+
+static inline uint64_t mix(const Mixer * m, uint64_t x) {
+    x ^= x >> m->s1;
+    x *= m->m1;
+    x ^= x >> m->s2;
+    x *= m->m2;
+    x ^= x >> m->s3;
+
+    return x;
+}
+
+static inline uint64_t seed_transform(SeedTransform t, uint64_t seed) {
+    switch(t) {
+        case SEED_GAMMA:        return seed * GOLDEN_GAMMA;
+        case SEED_GAMMA_NEXT:   return (seed + 1) * GOLDEN_GAMMA;
+        case SEED_HIGH:         return seed << 32;
+        case SEED_PLAIN:
+        default:                return seed;
+    }
+}
+
+static void hash_batch_scalar(const Mixer * m, SeedTransform t, uint64_t seed, uint32_t cnt, uint64_t * out) {
+    for(uint32_t i = 0; i < cnt; i++) {
+        out[i] = mix(m, seed_transform(t, seed + i));
+    }
+}
+
+#ifdef SEARCH_HAS_AVX2
+
+// avx2 has no 64 bit multiply, compose it from 32x32 -> 64 products
+__attribute__((target("avx2")))
+static inline __m256i mul64_avx2(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i xorshift_avx2(__m256i x, __m128i shift) {
+    return _mm256_xor_si256(x, _mm256_srl_epi64(x, shift));
+}
+
+__attribute__((target("avx2")))
+static void hash_batch_avx2(const Mixer * m, SeedTransform t, uint64_t seed, uint32_t cnt, uint64_t * out) {
+    __m128i s1 = _mm_cvtsi32_si128(m->s1);
+    __m128i s2 = _mm_cvtsi32_si128(m->s2);
+    __m128i s3 = _mm_cvtsi32_si128(m->s3);
+    __m256i m1 = _mm256_set1_epi64x(m->m1);
+    __m256i m2 = _mm256_set1_epi64x(m->m2);
+    __m256i gamma = _mm256_set1_epi64x(GOLDEN_GAMMA);
+    __m256i step = _mm256_set1_epi64x(4);
+    __m256i x_seed = _mm256_set_epi64x(seed + 3, seed + 2, seed + 1, seed);
+
+    if(t == SEED_GAMMA_NEXT) {
+        x_seed = _mm256_add_epi64(x_seed, _mm256_set1_epi64x(1));
+    }
+
+    uint32_t i = 0;
+    for(; i + 4 <= cnt; i += 4) {
+        __m256i x = x_seed;
+
+        switch(t) {
+            case SEED_GAMMA:
+            case SEED_GAMMA_NEXT:   x = mul64_avx2(x, gamma);           break;
+            case SEED_HIGH:         x = _mm256_slli_epi64(x, 32);       break;
+            default:                                                    break;
+        }
+
+        x = xorshift_avx2(x, s1);
+        x = mul64_avx2(x, m1);
+        x = xorshift_avx2(x, s2);
+        x = mul64_avx2(x, m2);
+        x = xorshift_avx2(x, s3);
+
+        _mm256_storeu_si256((__m256i*)(out + i), x);
+        x_seed = _mm256_add_epi64(x_seed, step);
+    }
+
+    hash_batch_scalar(m, t, seed + i, cnt - i, out + i);
+}
+
+#endif
+
+static HashBatchFn hash_batch_select(void) {
+#ifdef SEARCH_HAS_AVX2
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        lf_i("using avx2 hashing");
+        return hash_batch_avx2;
+    }
+#endif
+    return hash_batch_scalar;
+}
+
+static inline uint32_t target_slot(const TargetSet * set, uint64_t key) {
+    return (key * GOLDEN_GAMMA) >> set->slot_shift;
+}
+
+static void target_set_add(TargetSet * set, uint64_t key, uint32_t id, uint8_t known) {
+    for(uint32_t i = 0; i < set->target_cnt; i++) {
+        KeyTarget * t = &set->targets[i];
+
+        if(t->key == key) {
+            if(id != SEARCH_NONE) {
+                t->id = id;
+            }
+            t->known |= known;
+            return;
+        }
+    }
+
+    if(set->target_cnt == set->target_max) {
+        set->target_max = set->target_max ? set->target_max * 2 : 256;
+        set->targets = realloc(set->targets, sizeof(*set->targets) * set->target_max);
+    }
+
+    set->targets[set->target_cnt++] = (KeyTarget) {
+        .key = key,
+        .id = id,
+        .known = known,
+    };
+}
+
+/** Builds open addressing table over targets, kept at most 1/4 full so misses,
+ * which is pretty much every probe, end on first empty slot.
+ */
+static void target_set_build(TargetSet * set) {
+    uint32_t bits = 10;
+    while((1u << bits) < set->target_cnt * 4) {
+        bits++;
+    }
+
+    uint32_t slot_cnt = 1u << bits;
+    set->slot_shift = 64 - bits;
+    set->slot_keys = calloc(slot_cnt, sizeof(*set->slot_keys));
+    set->slot_idx = malloc(sizeof(*set->slot_idx) * slot_cnt);
+    memset(set->slot_idx, 0xFF, sizeof(*set->slot_idx) * slot_cnt);
+
+    for(uint32_t i = 0; i < set->target_cnt; i++) {
+        uint32_t slot = target_slot(set, set->targets[i].key);
+
+        while(set->slot_idx[slot] != SEARCH_NONE) {
+            slot = (slot + 1) & (slot_cnt - 1);
+        }
+
+        set->slot_keys[slot] = set->targets[i].key;
+        set->slot_idx[slot] = i;
+    }
+}
+
+static inline uint32_t target_set_find(const TargetSet * set, uint64_t key) {
+    uint32_t mask = (1u << (64 - set->slot_shift)) - 1;
+    uint32_t slot = target_slot(set, key);
+
+    while(set->slot_idx[slot] != SEARCH_NONE) {
+        if(set->slot_keys[slot] == key) {
+            return set->slot_idx[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return SEARCH_NONE;
+}
+
+static void target_set_free(TargetSet * set) {
+    free(set->targets);
+    free(set->slot_keys);
+    free(set->slot_idx);
+}
+
+/** Loads known plaintext in "<addr>;<id>;<text>" format, id may be empty.
+ * Key is recovered by xoring first 8 B of nro at addr with the text.
+ */
+static int known_load(const char * file, const MemFile * mf, TargetSet * set) {
+    FILE * f = fopen(file, "r");
+    if(!f) {
+        return EXIT_FAILURE;
+    }
+
+    uint32_t cnt = 0;
+    char * line = NULL;
+    size_t line_len = 0;
+    ssize_t ret;
+    while((ret = getline(&line, &line_len, f)) > 0) {
+        line[strcspn(line, "\r\n")] = 0;
+
+        char * end_addr = strchr(line, ';');
+        char * end_id = end_addr ? strchr(end_addr + 1, ';') : NULL;
+
+        if(!end_id) {
+            continue;
+        }
+
+        *end_addr = 0;
+        *end_id = 0;
+
+        uint32_t addr;
+        if(parse_address(line, &addr) != 0) {
+            lf_w("skipping invalid address \"%s\"", line);
+            continue;
+        }
+
+        uint32_t id = SEARCH_NONE;
+        if(end_addr[1] != 0) {
+            id = strtoul(end_addr + 1, NULL, 10);
+        }
+
+        char * text = end_id + 1;
+        string_decode(text, strlen(text));
+
+        // need whole block including terminator to get full key
+        if(strlen(text) + 1 < 8) {
+            lf_w("skipping \"%s\", known text needs at least 7 characters", text);
+            continue;
+        }
+
+        if(addr > mf->len || mf->len - addr < 8) {
+            lf_w("skipping address 0x%08X out of range", addr);
+            continue;
+        }
+
+        uint64_t key = 0;
+        for(uint32_t x = 0; x < 8; x++) {
+            key |= (uint64_t)(mf->data[addr + x] ^ (uint8_t)text[x]) << (x * 8);
+        }
+
+        target_set_add(set, key, id, 1);
+        cnt++;
+    }
+
+    if(line) {
+        free(line);
+    }
+    fclose(f);
+
+    lf_i("loaded %u known plaintext keys", cnt);
+
+    return EXIT_SUCCESS;
+}
+
+static void worker_hit(SearchWorker * w, uint32_t combo, uint32_t target, uint64_t seed) {
+    if(w->hit_cnt == w->hit_max) {
+        w->hit_max = w->hit_max ? w->hit_max * 2 : 1024;
+        w->hits = realloc(w->hits, sizeof(*w->hits) * w->hit_max);
+    }
+
+    w->hits[w->hit_cnt++] = (SearchHit) {
+        .combo = combo,
+        .target = target,
+        .seed = seed,
+    };
+}
+
+static void * worker_run(void * arg) {
+    SearchWorker * w = arg;
+    SearchState * st = w->st;
+    uint64_t batch[SEARCH_BATCH];
+
+    for(;;) {
+        uint64_t start = __atomic_fetch_add(&st->next, SEARCH_CHUNK, __ATOMIC_RELAXED);
+        if(start >= st->seed_end) {
+            break;
+        }
+
+        uint64_t end = MIN(start + SEARCH_CHUNK, st->seed_end);
+
+        for(uint32_t m = 0; m < MIXER_CNT; m++) {
+            for(uint32_t t = 0; t < SEED_TRANSFORM_CNT; t++) {
+                uint32_t combo_base = (m * SEED_TRANSFORM_CNT + t) * FIXUP_CNT;
+
+                for(uint64_t seed = start; seed < end; seed += SEARCH_BATCH) {
+                    uint32_t cnt = MIN(end - seed, SEARCH_BATCH);
+                    st->hash_batch(&mixers[m], t, seed, cnt, batch);
+
+                    for(uint32_t i = 0; i < cnt; i++) {
+                        for(uint32_t f = 0; f < FIXUP_CNT; f++) {
+                            uint32_t target = target_set_find(st->set, batch[i] | fixups[f].bits);
+
+                            if(target != SEARCH_NONE) {
+                                worker_hit(w, combo_base + f, target, seed + i);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int search_hit_compare(const void * a, const void * b) {
+    const SearchHit * ha = a;
+    const SearchHit * hb = b;
+
+    if(ha->combo != hb->combo) {
+        return ha->combo < hb->combo ? -1 : 1;
+    }
+
+    if(ha->target != hb->target) {
+        return ha->target < hb->target ? -1 : 1;
+    }
+
+    if(ha->seed != hb->seed) {
+        return ha->seed < hb->seed ? -1 : 1;
+    }
+
+    return 0;
+}
+
+typedef struct {
+    uint32_t combo;
+    uint32_t matched;
+    uint32_t known;
+    uint64_t seed_min;
+    uint64_t seed_max;
+    SearchHit * hits;
+    uint32_t hit_cnt;
+} ComboResult;
+
+static int combo_result_compare(const void * a, const void * b) {
+    const ComboResult * ra = a;
+    const ComboResult * rb = b;
+
+    if(ra->matched != rb->matched) {
+        return ra->matched > rb->matched ? -1 : 1;
+    }
+
+    return ra->combo < rb->combo ? -1 : (ra->combo > rb->combo);
+}
+
+static void combo_describe(uint32_t combo, char * buf, uint32_t len) {
+    uint32_t f = combo % FIXUP_CNT;
+    uint32_t t = (combo / FIXUP_CNT) % SEED_TRANSFORM_CNT;
+    uint32_t m = combo / FIXUP_CNT / SEED_TRANSFORM_CNT;
+
+    snprintf(buf, len, "%-10s %-12s %-6s", mixers[m].name, seed_transform_names[t], fixups[f].name);
+}
+
+static uint64_t combo_key(uint32_t combo, uint64_t seed) {
+    uint32_t f = combo % FIXUP_CNT;
+    uint32_t t = (combo / FIXUP_CNT) % SEED_TRANSFORM_CNT;
+    uint32_t m = combo / FIXUP_CNT / SEED_TRANSFORM_CNT;
+
+    if(seed == 0) {
+        return 0;
+    }
+
+    return mix(&mixers[m], seed_transform(t, seed)) | fixups[f].bits;
+}
+
+/** Reports how seeds relate to ids of known plaintext, the most common
+ * seed - id delta wins. Returns 0 and stores delta only when every id agrees
+ * with it.
+ */
+static int print_seed_mapping(FILE * out, const TargetSet * set, const ComboResult * res, int64_t * delta_out) {
+    int64_t best_delta = 0;
+    uint32_t best_cnt = 0;
+    uint32_t id_cnt = 0;
+
+    for(uint32_t i = 0; i < res->hit_cnt; i++) {
+        const KeyTarget * ti = &set->targets[res->hits[i].target];
+        if(ti->id == SEARCH_NONE) {
+            continue;
+        }
+
+        id_cnt++;
+        int64_t delta = (int64_t)res->hits[i].seed - ti->id;
+        uint32_t cnt = 0;
+
+        for(uint32_t x = 0; x < res->hit_cnt; x++) {
+            const KeyTarget * tx = &set->targets[res->hits[x].target];
+            if(tx->id != SEARCH_NONE && (int64_t)res->hits[x].seed - tx->id == delta) {
+                cnt++;
+            }
+        }
+
+        if(cnt > best_cnt) {
+            best_cnt = cnt;
+            best_delta = delta;
+        }
+    }
+
+    if(id_cnt == 0) {
+        fprintf(out, "// no ids in known plaintext, seed mapping unknown" CRLF);
+    } else if(best_cnt == id_cnt) {
+        fprintf(out, "// seed = id %c %" PRIu64 " for all %u ids" CRLF, best_delta < 0 ? '-' : '+', (uint64_t)(best_delta < 0 ? -best_delta : best_delta), id_cnt);
+
+        *delta_out = best_delta;
+        return 0;
+    } else {
+        fprintf(out, "// seed = id %c %" PRIu64 " for %u of %u ids" CRLF, best_delta < 0 ? '-' : '+', (uint64_t)(best_delta < 0 ? -best_delta : best_delta), best_cnt, id_cnt);
+    }
+
+    return -1;
+}
+
+int search_keygen(const SearchKeygenArgs * args) {
+    FILE * out = stdout;
+
+    if(args->out != NULL) {
+        out = args->out;
+    }
+
+    TargetSet set;
+    memset(&set, 0, sizeof(set));
+
+    KeySet * ks = get_key_set(args->dbi_mf);
+    for(uint32_t i = 0; i < ks->key_cnt; i++) {
+        if(ks->keys[i] != 0) {
+            target_set_add(&set, ks->keys[i], SEARCH_NONE, 0);
+        }
+    }
+    lf_i("using %u recovered keys", set.target_cnt);
+    free_key_set(ks);
+
+    if(args->known) {
+        if(known_load(args->known, args->dbi_mf, &set) != EXIT_SUCCESS) {
+            lf_e("failed to load \"%s\"", args->known);
+            target_set_free(&set);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(set.target_cnt == 0) {
+        lf_e("no keys to match against");
+        target_set_free(&set);
+        return EXIT_FAILURE;
+    }
+
+    target_set_build(&set);
+
+    SearchState st = {
+        .set = &set,
+        .hash_batch = hash_batch_select(),
+        .seed_end = (uint64_t)args->seed_cnt + 1,
+        .next = 1,
+    };
+
+    long thread_cnt = sysconf(_SC_NPROCESSORS_ONLN);
+    if(thread_cnt < 1) {
+        thread_cnt = 1;
+    }
+
+    lf_i("searching %u generators over seeds 1..%u using %ld threads", (uint32_t)COMBO_CNT, args->seed_cnt, thread_cnt);
+
+    SearchWorker * workers = calloc(thread_cnt, sizeof(*workers));
+    for(long i = 0; i < thread_cnt; i++) {
+        workers[i].st = &st;
+        pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+    }
+
+    uint32_t hit_cnt = 0;
+    for(long i = 0; i < thread_cnt; i++) {
+        pthread_join(workers[i].thread, NULL);
+        hit_cnt += workers[i].hit_cnt;
+    }
+
+    SearchHit * hits = malloc(sizeof(*hits) * (hit_cnt + 1));
+    hit_cnt = 0;
+    for(long i = 0; i < thread_cnt; i++) {
+        memcpy(hits + hit_cnt, workers[i].hits, sizeof(*hits) * workers[i].hit_cnt);
+        hit_cnt += workers[i].hit_cnt;
+        free(workers[i].hits);
+    }
+    free(workers);
+
+    // keep lowest seed per combo and target
+    qsort(hits, hit_cnt, sizeof(*hits), search_hit_compare);
+
+    uint32_t unique_cnt = 0;
+    for(uint32_t i = 0; i < hit_cnt; i++) {
+        if(unique_cnt && hits[unique_cnt - 1].combo == hits[i].combo && hits[unique_cnt - 1].target == hits[i].target) {
+            continue;
+        }
+        hits[unique_cnt++] = hits[i];
+    }
+
+    ComboResult * results = calloc(COMBO_CNT, sizeof(*results));
+    uint32_t result_cnt = 0;
+    for(uint32_t i = 0; i < unique_cnt;) {
+        ComboResult * res = &results[result_cnt++];
+        res->combo = hits[i].combo;
+        res->hits = &hits[i];
+        res->seed_min = UINT64_MAX;
+
+        while(i < unique_cnt && hits[i].combo == res->combo) {
+            res->matched++;
+            res->known += set.targets[hits[i].target].known;
+            res->seed_min = MIN(res->seed_min, hits[i].seed);
+            res->seed_max = MAX(res->seed_max, hits[i].seed);
+            res->hit_cnt++;
+            i++;
+        }
+    }
+
+    qsort(results, result_cnt, sizeof(*results), combo_result_compare);
+
+    int ret = EXIT_SUCCESS;
+
+    if(result_cnt) {
+        fprintf(out, "// %-10s %-12s %-6s %-15s %-9s seeds" CRLF, "generator", "seed", "fixup", "matched", "known");
+
+        for(uint32_t i = 0; i < result_cnt; i++) {
+            ComboResult * res = &results[i];
+            char buf[64];
+            combo_describe(res->combo, buf, sizeof(buf));
+
+            char matched[32];
+            snprintf(matched, sizeof(matched), "%u / %u", res->matched, set.target_cnt);
+
+            fprintf(out, "// %s %-15s %-9u %" PRIu64 "..%" PRIu64 CRLF, buf, matched, res->known, res->seed_min, res->seed_max);
+        }
+
+        ComboResult * best = &results[0];
+        char buf[64];
+        combo_describe(best->combo, buf, sizeof(buf));
+        lf_i("best generator %s matched %u of %u keys", buf, best->matched, set.target_cnt);
+
+        int64_t delta;
+
+        // lets make output directly usable as --keygen file, its lines are
+        // indexed by id, so seed = id + delta
+        if(print_seed_mapping(out, &set, best, &delta) != 0) {
+            fprintf(out, "// no consistent seed mapping, --keygen file not written" CRLF);
+        } else if((int64_t)best->seed_max - delta < SEARCH_KEYGEN_MAX) {
+            int64_t id_max = (int64_t)best->seed_max - delta;
+
+            for(int64_t id = 0; id <= id_max; id++) {
+                // id 0 is always unencrypted
+                int64_t seed = id ? id + delta : 0;
+
+                fprintf(out, "0x%016" PRIX64 CRLF, seed > 0 ? combo_key(best->combo, seed) : 0);
+            }
+        } else {
+            fprintf(out, "// seeds too large for --keygen file" CRLF);
+        }
+    } else {
+        lf_e("no generator reproduces any of the keys");
+        ret = EXIT_FAILURE;
+    }
+
+    free(results);
+    free(hits);
+    target_set_free(&set);
+
+    return ret;
+}
@@ -0,0 +1,641 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * Every output is identified by sha256 of its nro, blueprint, language file
+ * and delta format. State file remembers this hash for each output built,
+ * even with issues, so unchanged outputs are skipped and editing single
+ * language file rebuilds only outputs of that language. Issue count is kept
+ * next to the hash, so skipped output with issues is still reported as such.
+ * Paths are resolved against absolute manifest directory, so state does not
+ * depend on cwd.
+ *
+ * Nro and parsed blueprint of each version are loaded once and shared by
+ * all jobs of that version, every job patches its own copy of nro.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/param.h>
+
+#include "v2/matrix.h"
+#include "v2/patch.h"
+#include "v2/blueprint.h"
+#include "memfile.h"
+#include "sha256.h"
+#include "utils.h"
+#include "log.h"
+
+#define MATRIX_MAX_LINE     4096
+// first line of state file, also part of every output hash
+#define MATRIX_STATE_MAGIC  "dbipatcher-matrix 3"
+
+typedef struct {
+    char * name;
+    char * nro_path;
+    char * bp_path;
+
+    MemFile * nro;
+    BlueprintRecord * bp;
+
+    uint8_t nro_hash[SHA256_LEN];
+    uint8_t bp_hash[SHA256_LEN];
+} MatrixVersion;
+
+typedef struct {
+    char * name;
+    char * path;
+    uint8_t hash[SHA256_LEN];
+} MatrixLang;
+
+typedef struct {
+    MatrixVersion * ver;
+    MatrixLang * lang;
+    char * out_path;
+    char hash[SHA256_HEX_LEN];
+    uint8_t skip;
+    int ret;
+    // records which could not be patched, output is still written
+    uint32_t issues;
+} MatrixJob;
+
+typedef struct {
+    char * dir;
+    char * out_tmpl;
+    char * state_path;
+    uint32_t jobs;
+
+    MatrixVersion * vers;
+    uint32_t ver_cnt;
+    MatrixLang * langs;
+    uint32_t lang_cnt;
+} Manifest;
+
+typedef struct {
+    char * out_path;
+    char hash[SHA256_HEX_LEN];
+    uint32_t issues;
+} StateEntry;
+
+typedef struct {
+    MatrixJob ** queue;
+    uint32_t queue_len;
+    uint32_t next;
+    DeltaFormat delta;
+} MatrixState;
+
+//////////// manifest
+
+static char * matrix_path(const char * dir, const char * path) {
+    // drive letter makes path absolute on windows
+    if(!dir || path[0] == '/' || (path[0] && path[1] == ':')) {
+        return strdup(path);
+    }
+
+    size_t len = strlen(dir) + strlen(path) + 2;
+    char * res = malloc(len);
+    snprintf(res, len, "%s/%s", dir, path);
+
+    return res;
+}
+
+static MatrixVersion * manifest_version(Manifest * m, const char * name) {
+    for(uint32_t i = 0; i < m->ver_cnt; i++) {
+        if(strcmp(m->vers[i].name, name) == 0) {
+            return &m->vers[i];
+        }
+    }
+
+    m->vers = realloc(m->vers, (m->ver_cnt + 1) * sizeof(*m->vers));
+    MatrixVersion * ver = &m->vers[m->ver_cnt++];
+    memset(ver, 0, sizeof(*ver));
+    ver->name = strdup(name);
+
+    return ver;
+}
+
+static MatrixLang * manifest_lang(Manifest * m, const char * name) {
+    for(uint32_t i = 0; i < m->lang_cnt; i++) {
+        if(strcmp(m->langs[i].name, name) == 0) {
+            return &m->langs[i];
+        }
+    }
+
+    m->langs = realloc(m->langs, (m->lang_cnt + 1) * sizeof(*m->langs));
+    MatrixLang * lang = &m->langs[m->lang_cnt++];
+    memset(lang, 0, sizeof(*lang));
+    lang->name = strdup(name);
+
+    return lang;
+}
+
+static void manifest_set(char ** dst, char * value) {
+    free(*dst);
+    *dst = value;
+}
+
+static int manifest_load(const char * path, Manifest * m) {
+    char real[PATH_MAX];
+    FILE * f = realpath(path, real) ? fopen(real, "r") : NULL;
+    if(!f) {
+        lf_e("failed to open \"%s\"", path);
+        return -1;
+    }
+
+    const char * slash = strrchr(real, '/');
+    m->dir = slash == real ? strdup("/") : strndup(real, slash - real);
+
+    int ret = 0;
+    uint32_t line_no = 0;
+    char line[MATRIX_MAX_LINE];
+
+    while(fgets(line, sizeof(line), f)) {
+        line_no++;
+        line[strcspn(line, "\r\n")] = 0;
+
+        char * key = line + strspn(line, " \t");
+        if(!*key || *key == '#') {
+            continue;
+        }
+
+        char * val = strchr(key, '=');
+        if(!val) {
+            lf_e("%s:%u: expected key=value", path, line_no);
+            ret = -1;
+            break;
+        }
+        *(val++) = 0;
+
+        if(strncmp(key, "nro.", 4) == 0 && key[4]) {
+            manifest_set(&manifest_version(m, key + 4)->nro_path, matrix_path(m->dir, val));
+        } else if(strncmp(key, "blueprint.", 10) == 0 && key[10]) {
+            manifest_set(&manifest_version(m, key + 10)->bp_path, matrix_path(m->dir, val));
+        } else if(strncmp(key, "lang.", 5) == 0 && key[5]) {
+            manifest_set(&manifest_lang(m, key + 5)->path, matrix_path(m->dir, val));
+        } else if(strcmp(key, "out") == 0) {
+            manifest_set(&m->out_tmpl, matrix_path(m->dir, val));
+        } else if(strcmp(key, "state") == 0) {
+            manifest_set(&m->state_path, matrix_path(m->dir, val));
+        } else if(strcmp(key, "jobs") == 0) {
+            m->jobs = strtoul(val, NULL, 10);
+        } else {
+            lf_e("%s:%u: unknown key \"%s\"", path, line_no, key);
+            ret = -1;
+            break;
+        }
+    }
+
+    fclose(f);
+
+    if(ret != 0) {
+        return ret;
+    }
+
+    for(uint32_t i = 0; i < m->ver_cnt; i++) {
+        if(!m->vers[i].nro_path || !m->vers[i].bp_path) {
+            lf_e("version %s needs both nro.%s and blueprint.%s", m->vers[i].name, m->vers[i].name, m->vers[i].name);
+            return -1;
+        }
+    }
+
+    if(!m->ver_cnt || !m->lang_cnt) {
+        lf_e("\"%s\" needs at least one version and one language", path);
+        return -1;
+    }
+
+    if(!m->out_tmpl) {
+        m->out_tmpl = matrix_path(m->dir, MATRIX_OUT_DEFAULT);
+    }
+
+    if(!m->state_path) {
+        size_t len = strlen(real) + strlen(MATRIX_STATE_SUFFIX) + 1;
+        m->state_path = malloc(len);
+        snprintf(m->state_path, len, "%s%s", real, MATRIX_STATE_SUFFIX);
+    }
+
+    return 0;
+}
+
+static void manifest_free(Manifest * m) {
+    for(uint32_t i = 0; i < m->ver_cnt; i++) {
+        MatrixVersion * ver = &m->vers[i];
+
+        free(ver->name);
+        free(ver->nro_path);
+        free(ver->bp_path);
+
+        if(ver->nro) {
+            mf_free(ver->nro);
+        }
+
+        if(ver->bp) {
+            blueprint_free(ver->bp);
+        }
+    }
+
+    for(uint32_t i = 0; i < m->lang_cnt; i++) {
+        free(m->langs[i].name);
+        free(m->langs[i].path);
+    }
+
+    free(m->vers);
+    free(m->langs);
+    free(m->dir);
+    free(m->out_tmpl);
+    free(m->state_path);
+}
+
+static char * matrix_expand(const char * tmpl, const char * version, const char * lang) {
+    char * res;
+    size_t res_len;
+    FILE * f = open_memstream(&res, &res_len);
+
+    for(const char * ptr = tmpl; *ptr;) {
+        if(strncmp(ptr, "{version}", 9) == 0) {
+            fputs(version, f);
+            ptr += 9;
+        } else if(strncmp(ptr, "{lang}", 6) == 0) {
+            fputs(lang, f);
+            ptr += 6;
+        } else {
+            fputc(*(ptr++), f);
+        }
+    }
+
+    fclose(f);
+
+    return res;
+}
+
+static int matrix_hash_file(const char * path, uint8_t hash[SHA256_LEN], MemFile ** keep) {
+    MemFile * mf = mf_init_path(path);
+    if(!mf) {
+        lf_e("failed to load \"%s\"", path);
+        return -1;
+    }
+
+    sha256(mf->data, mf->len, hash);
+
+    if(keep) {
+        *keep = mf;
+    } else {
+        mf_free(mf);
+    }
+
+    return 0;
+}
+
+//////////// state
+
+static StateEntry * state_load(const char * path, uint32_t * cnt) {
+    *cnt = 0;
+
+    FILE * f = fopen(path, "r");
+    if(!f) {
+        // first build
+        return NULL;
+    }
+
+    StateEntry * res = NULL;
+    char line[MATRIX_MAX_LINE];
+
+    if(!fgets(line, sizeof(line), f) || strncmp(line, MATRIX_STATE_MAGIC, strlen(MATRIX_STATE_MAGIC)) != 0) {
+        lf_w("ignoring \"%s\" written by different version, rebuilding everything", path);
+        fclose(f);
+        return NULL;
+    }
+
+    while(fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+
+        // <hash> <issues> <output>
+        char * end;
+        if(strlen(line) < SHA256_HEX_LEN + 1 || line[SHA256_HEX_LEN - 1] != ' ') {
+            continue;
+        }
+
+        unsigned long issues = strtoul(line + SHA256_HEX_LEN, &end, 10);
+        if(end == line + SHA256_HEX_LEN || *end != ' ') {
+            continue;
+        }
+
+        res = realloc(res, (*cnt + 1) * sizeof(*res));
+        StateEntry * entry = &res[(*cnt)++];
+
+        memcpy(entry->hash, line, SHA256_HEX_LEN - 1);
+        entry->hash[SHA256_HEX_LEN - 1] = 0;
+        entry->issues = issues;
+        entry->out_path = strdup(end + 1);
+    }
+
+    fclose(f);
+
+    return res;
+}
+
+static const StateEntry * state_find(const StateEntry * state, uint32_t cnt, const char * out_path) {
+    for(uint32_t i = 0; i < cnt; i++) {
+        if(strcmp(state[i].out_path, out_path) == 0) {
+            return &state[i];
+        }
+    }
+
+    return NULL;
+}
+
+/** Written to temporary file renamed over state, so interrupted run never
+ * leaves it half written. Entries of outputs no longer in manifest are kept.
+ */
+static int state_write(const char * path, const StateEntry * state, uint32_t state_cnt, const MatrixJob * jobs, uint32_t job_cnt) {
+    size_t tmp_len = strlen(path) + 5;
+    char * tmp = malloc(tmp_len);
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+
+    FILE * f = NULL;
+    if(mkpath(0755, "%s", tmp) == 0) {
+        f = fopen(tmp, "w");
+    }
+
+    if(!f) {
+        free(tmp);
+        return -1;
+    }
+
+    fprintf(f, "%s\n", MATRIX_STATE_MAGIC);
+
+    for(uint32_t i = 0; i < job_cnt; i++) {
+        if(jobs[i].skip || jobs[i].ret == EXIT_SUCCESS) {
+            fprintf(f, "%s %u %s\n", jobs[i].hash, jobs[i].issues, jobs[i].out_path);
+        }
+    }
+
+    for(uint32_t i = 0; i < state_cnt; i++) {
+        uint8_t current = 0;
+        for(uint32_t j = 0; j < job_cnt && !current; j++) {
+            current = strcmp(jobs[j].out_path, state[i].out_path) == 0;
+        }
+
+        if(!current) {
+            fprintf(f, "%s %u %s\n", state[i].hash, state[i].issues, state[i].out_path);
+        }
+    }
+
+    int ret = fclose(f) == 0 && rename(tmp, path) == 0 ? 0 : -1;
+
+    free(tmp);
+
+    return ret;
+}
+
+//////////// build
+
+/** Output is written to temporary file renamed over it once complete, so
+ * failed build keeps previous output.
+ */
+static int matrix_build(MatrixJob * job, DeltaFormat delta) {
+    lf_i("building \"%s\"", job->out_path);
+
+    size_t tmp_len = strlen(job->out_path) + 5;
+    char * tmp = malloc(tmp_len);
+    snprintf(tmp, tmp_len, "%s.tmp", job->out_path);
+
+    FILE * out = NULL;
+    if(mkpath(0755, "%s", tmp) == 0) {
+        out = fopen(tmp, "w+b");
+    }
+
+    if(!out) {
+        lf_e("failed to open \"%s\" for writing", tmp);
+        free(tmp);
+        return EXIT_FAILURE;
+    }
+
+    // nro is patched in place
+    MemFile * mf = mf_init_mem(job->ver->nro->data, job->ver->nro->len);
+
+    PatchArgs patch_args = {
+        .dbi_mf = mf,
+        .bp = job->ver->bp,
+        .translation = job->lang->path,
+        .out = out,
+        .delta = delta,
+        .issues = &job->issues,
+    };
+
+    int ret = patch(&patch_args);
+
+    if(fclose(out) != 0 || (ret == EXIT_SUCCESS && rename(tmp, job->out_path) != 0)) {
+        lf_e("failed to write \"%s\"", job->out_path);
+        ret = EXIT_FAILURE;
+    }
+
+    if(ret != EXIT_SUCCESS) {
+        unlink(tmp);
+    }
+
+    free(tmp);
+    mf_free(mf);
+
+    if(ret == EXIT_SUCCESS && job->issues) {
+        lf_w("\"%s\" built with %u issues", job->out_path, job->issues);
+    }
+
+    return ret;
+}
+
+static void * matrix_worker(void * arg) {
+    MatrixState * st = arg;
+
+    for(;;) {
+        uint32_t idx = __atomic_fetch_add(&st->next, 1, __ATOMIC_RELAXED);
+        if(idx >= st->queue_len) {
+            break;
+        }
+
+        MatrixJob * job = st->queue[idx];
+        job->ret = matrix_build(job, st->delta);
+    }
+
+    return NULL;
+}
+
+int build_matrix(const BuildMatrixArgs * args) {
+    FILE * out = stdout;
+
+    if(args->out != NULL) {
+        out = args->out;
+    }
+
+    Manifest m;
+    memset(&m, 0, sizeof(m));
+
+    MatrixJob * jobs = NULL;
+    uint32_t job_cnt = 0;
+    StateEntry * state = NULL;
+    uint32_t state_cnt = 0;
+    MatrixJob ** queue = NULL;
+
+    int ret = EXIT_FAILURE;
+
+    if(manifest_load(args->manifest, &m) != 0) {
+        goto exit;
+    }
+
+    lf_i("hashing %u versions and %u languages", m.ver_cnt, m.lang_cnt);
+
+    for(uint32_t i = 0; i < m.ver_cnt; i++) {
+        MatrixVersion * ver = &m.vers[i];
+
+        if(matrix_hash_file(ver->nro_path, ver->nro_hash, &ver->nro) != 0 || matrix_hash_file(ver->bp_path, ver->bp_hash, NULL) != 0) {
+            goto exit;
+        }
+    }
+
+    for(uint32_t i = 0; i < m.lang_cnt; i++) {
+        if(matrix_hash_file(m.langs[i].path, m.langs[i].hash, NULL) != 0) {
+            goto exit;
+        }
+    }
+
+    state = state_load(m.state_path, &state_cnt);
+
+    job_cnt = m.ver_cnt * m.lang_cnt;
+    jobs = calloc(job_cnt, sizeof(*jobs));
+    queue = calloc(job_cnt, sizeof(*queue));
+
+    uint32_t queue_len = 0;
+    uint8_t delta = args->delta;
+
+    for(uint32_t i = 0; i < m.ver_cnt; i++) {
+        MatrixVersion * ver = &m.vers[i];
+        uint32_t ver_queued = 0;
+
+        for(uint32_t j = 0; j < m.lang_cnt; j++) {
+            MatrixJob * job = &jobs[i * m.lang_cnt + j];
+            job->ver = ver;
+            job->lang = &m.langs[j];
+            job->out_path = matrix_expand(m.out_tmpl, ver->name, job->lang->name);
+
+            for(MatrixJob * prev = jobs; prev < job; prev++) {
+                if(strcmp(prev->out_path, job->out_path) == 0) {
+                    lf_e("outputs of %s.%s and %s.%s are both \"%s\", use {version} and {lang} in out", prev->ver->name, prev->lang->name, ver->name, job->lang->name, job->out_path);
+                    job_cnt = job - jobs + 1;
+                    goto exit;
+                }
+            }
+
+            Sha256 ctx;
+            uint8_t hash[SHA256_LEN];
+            sha256_init(&ctx);
+            sha256_update(&ctx, MATRIX_STATE_MAGIC, strlen(MATRIX_STATE_MAGIC));
+            sha256_update(&ctx, ver->nro_hash, SHA256_LEN);
+            sha256_update(&ctx, ver->bp_hash, SHA256_LEN);
+            sha256_update(&ctx, job->lang->hash, SHA256_LEN);
+            sha256_update(&ctx, &delta, sizeof(delta));
+            sha256_final(&ctx, hash);
+            sha256_hex(hash, job->hash);
+
+            const StateEntry * entry = state_find(state, state_cnt, job->out_path);
+            if(entry && strcmp(entry->hash, job->hash) == 0 && access(job->out_path, F_OK) == 0) {
+                // not rebuilt, but still not clean
+                job->skip = 1;
+                job->issues = entry->issues;
+
+                if(job->issues) {
+                    lf_w("\"%s\" up to date, built with %u issues", job->out_path, job->issues);
+                }
+                continue;
+            }
+
+            if(!ver_queued && !(ver->bp = blueprint_load(ver->bp_path))) {
+                lf_e("failed to load \"%s\"", ver->bp_path);
+                job->ret = EXIT_FAILURE;
+                continue;
+            }
+
+            queue[queue_len++] = job;
+            ver_queued++;
+        }
+
+        // only versions with something to build keep their nro
+        if(!ver_queued) {
+            mf_free(ver->nro);
+            ver->nro = NULL;
+        }
+    }
+
+    long thread_cnt = m.jobs ? (long)m.jobs : sysconf(_SC_NPROCESSORS_ONLN);
+    thread_cnt = MIN(thread_cnt, (long)queue_len);
+    if(thread_cnt < 1) {
+        thread_cnt = 1;
+    }
+
+    lf_i("%u of %u outputs up to date, building %u using %ld threads", job_cnt - queue_len, job_cnt, queue_len, thread_cnt);
+
+    if(queue_len) {
+        MatrixState st = {
+            .queue = queue,
+            .queue_len = queue_len,
+            .delta = args->delta,
+        };
+
+        pthread_t threads[thread_cnt];
+        for(long i = 0; i < thread_cnt; i++) {
+            pthread_create(&threads[i], NULL, matrix_worker, &st);
+        }
+
+        for(long i = 0; i < thread_cnt; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    uint32_t cnt_built = 0, cnt_issues = 0, cnt_failed = 0;
+    for(uint32_t i = 0; i < job_cnt; i++) {
+        const char * status = "skipped";
+        if(!jobs[i].skip && jobs[i].ret != EXIT_SUCCESS) {
+            status = "failed";
+            cnt_failed++;
+        } else if(jobs[i].issues) {
+            status = "issues";
+            cnt_issues++;
+        } else if(!jobs[i].skip) {
+            status = "built";
+            cnt_built++;
+        }
+
+        fprintf(out, "%-8s %s.%s %s" CRLF, status, jobs[i].ver->name, jobs[i].lang->name, jobs[i].out_path);
+    }
+
+    if(state_write(m.state_path, state, state_cnt, jobs, job_cnt) != 0) {
+        lf_e("failed to write \"%s\"", m.state_path);
+        cnt_failed++;
+    }
+
+    lf_i("built %u, with issues %u, skipped %u, failed %u", cnt_built, cnt_issues, job_cnt - cnt_built - cnt_issues - cnt_failed, cnt_failed);
+
+    // same as --patch, outputs with issues are usable but not clean
+    ret = cnt_failed || cnt_issues ? EXIT_FAILURE : EXIT_SUCCESS;
+
+exit:
+    for(uint32_t i = 0; i < job_cnt; i++) {
+        free(jobs[i].out_path);
+    }
+    free(jobs);
+    free(queue);
+
+    for(uint32_t i = 0; i < state_cnt; i++) {
+        free(state[i].out_path);
+    }
+    free(state);
+
+    manifest_free(&m);
+
+    return ret;
+}
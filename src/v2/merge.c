@@ -109,19 +109,20 @@ static uint8_t parse_key_line(const char *line, KeyRecord *record) {
     temp[MAX_LINE - 1] = '\0';
 
     temp[strcspn(temp, "\r\n")] = '\0';
-    char *token = strtok(temp, ";");
+    char *save;
+    char *token = strtok_r(temp, ";", &save);
     if(!token) {
         return 0;
     }
     record->key = strdup(token);
 
-    token = strtok(NULL, ";");
+    token = strtok_r(NULL, ";", &save);
     if(!token) {
         return 0;
     }
     record->id = strtoul(token, NULL, 10);
 
-    token = strtok(NULL, "");
+    token = strtok_r(NULL, "", &save);
     if(!token) {
         return 0;
     }
@@ -137,6 +138,7 @@ static uint8_t parse_key_line(const char *line, KeyRecord *record) {
 static uint8_t parse_translation_line(const char *line, TranslationRecord *record) {
     char temp[MAX_LINE];
     char *token;
+    char *save;
     
     strncpy(temp, line, MAX_LINE - 1);
     temp[MAX_LINE - 1] = '\0';
@@ -172,19 +174,19 @@ static uint8_t parse_translation_line(const char *line, TranslationRecord *recor
 not_found:
     
     // Check for key.txt format: KEY;ID;VALUE
-    token = strtok(temp, ";");
+    token = strtok_r(temp, ";", &save);
     if (!token) return 0;
     record->key = strdup(token);
     
     // Second token: id
-    token = strtok(NULL, ";");
+    token = strtok_r(NULL, ";", &save);
     if (!token) {
         free(record->key);
         return 0;
     }
     
     // Third token: value (rest of string)
-    token = strtok(NULL, "");
+    token = strtok_r(NULL, "", &save);
     if (!token) {
         free(record->key);
         return 0;
@@ -480,7 +482,7 @@ int merge(const MergeArgs * args) {
     }
     
     if(issue_count) {
-        lf_e("found total of %u issues", issue_count);
+        lf_e("found total of %zu issues", issue_count);
         ret = EXIT_FAILURE;
     }
     
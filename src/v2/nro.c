@@ -0,0 +1,36 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "v2/nro.h"
+
+#define NRO_MAGIC_OFFSET    0x10
+#define NRO_SEGMENTS_OFFSET 0x20
+
+int nro_segments(const MemFile * mf, NroSegment seg[NRO_SEG_CNT]) {
+    for(uint32_t i = 0; i < NRO_SEG_CNT; i++) {
+        seg[i].offset = 0;
+        seg[i].len = mf->len;
+    }
+
+    if(mf->len < NRO_SEGMENTS_OFFSET + NRO_SEG_CNT * 8 || memcmp(mf->data + NRO_MAGIC_OFFSET, "NRO0", 4) != 0) {
+        return -1;
+    }
+
+    NroSegment tmp[NRO_SEG_CNT];
+    memcpy(tmp, mf->data + NRO_SEGMENTS_OFFSET, sizeof(tmp));
+
+    for(uint32_t i = 0; i < NRO_SEG_CNT; i++) {
+        if(tmp[i].offset > mf->len || tmp[i].len > mf->len - tmp[i].offset) {
+            return -1;
+        }
+    }
+
+    memcpy(seg, tmp, sizeof(tmp));
+    return 0;
+}
@@ -1,25 +1,65 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 #include "v2/patch.h"
 #include "v2/strings.h"
+#include "v2/keys.h"
 #include "memfile.h"
 #include "v2/blueprint.h"
 #include "log.h"
 #include "v2/inst.h"
+#include "sha256.h"
+#include "stats.h"
+#include "utils.h"
 
 #define MAX_LINE     2048
 
+// first line of base sidecar, followed by hash of base and translation base
+// was built from
+#define SIDECAR_MAGIC           "# dbipatcher base"
+#define SIDECAR_BASE            "# sha256 "
+// editors save in several steps, wait until translation is quiet
+#define WATCH_SETTLE_MS         100
+
 typedef struct _TranslationRecord TranslationRecord;
 
 typedef struct _TranslationRecord {
     char * key;
     char * value;
     char * value_raw;
+    uint32_t seq;
     TranslationRecord * next;
 } TranslationRecord;
 
+typedef struct {
+    TranslationRecord * head;
+    // sorted by key, only last definition of each key is kept
+    TranslationRecord ** sorted;
+    uint32_t cnt;
+} Translation;
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} PatchRange;
+
+typedef struct {
+    const PatchIncrementalArgs * args;
+    const BlueprintRecord * bp;
+    uint32_t bp_cnt;
+    char * sidecar;
+    char header[sizeof(SIDECAR_MAGIC) + SHA256_HEX_LEN * 2 + 2];
+} Repatch;
+
 static TranslationRecord * parse_translation_line(const char *line) {
     const char * eq = strchr(line, '=');
     if(!eq) {
@@ -56,7 +96,7 @@ static TranslationRecord * parse_translation_line(const char *line) {
 }
 
 static const char* data_to_hex(const void *data, uint32_t len) {
-    static char tmp[1024];
+    static __thread char tmp[1024];
     char * ptr = tmp;
     
     for(uint32_t i = 0; i < len; i++) {
@@ -66,178 +106,694 @@ static const char* data_to_hex(const void *data, uint32_t len) {
     return tmp;
 }
 
-int patch(const PatchArgs * args) {
-    
-    TranslationRecord * trans = NULL;
+static int translation_cmp(const void * a, const void * b) {
+    const TranslationRecord * ra = *(TranslationRecord * const *)a;
+    const TranslationRecord * rb = *(TranslationRecord * const *)b;
     
-    const MemFile * dbi = args->dbi_mf;
-    BlueprintRecord * bp = blueprint_load(args->blueprint);
-    FILE * trans_file = fopen(args->translation, "r");
-    
-    if(!trans_file || !bp || !dbi) {
-        if(bp) {
-            blueprint_free(bp);
-        }
-        
-        if(trans_file) {
-            fclose(trans_file);
-        }
-        return EXIT_FAILURE;
+    int res = strcmp(ra->key, rb->key);
+    if(res) {
+        return res;
     }
     
-    //blueprint_print(bp);
+    return ra->seq < rb->seq ? -1 : ra->seq > rb->seq;
+}
+
+static int translation_key_cmp(const void * key, const void * rec) {
+    return strcmp(key, (*(TranslationRecord * const *)rec)->key);
+}
+
+static void translation_load(Translation * tr, FILE * f) {
+    memset(tr, 0, sizeof(*tr));
     
     char line[MAX_LINE];
-    while(fgets(line, MAX_LINE, trans_file)) {
+    uint32_t seq = 0;
+    while(fgets(line, MAX_LINE, f)) {
         TranslationRecord * rec;
         if((rec = parse_translation_line(line)) != NULL) {
-            rec->next = trans;
-            trans = rec;
+            rec->seq = seq++;
+            rec->next = tr->head;
+            tr->head = rec;
         }
     }
     
-    uint32_t issue_count = 0;
+    if(!seq) {
+        return;
+    }
     
-    BlueprintRecord * bp_iter = bp;
-    while(bp_iter) {
-        BlueprintRecord * bp_cur = bp_iter;
-        bp_iter = bp_iter->next;
-        
-        if(!bp_cur->is_consistent) {
-            lf_e("not consistent %s;%s", bp_cur->id, bp_cur->plain_string);
-            continue;
-        }
-        
-        //lf_d("patching [%-4u] %s:%s", bp_cur->raw_len, bp_cur->id, bp_cur->plain_string);
-        
-        // 1. start with original unxored string
-        
-        
-        if(bp_cur->key != 0) {
-            memcpy(line, bp_cur->plain_string_raw, bp_cur->raw_len);
+    tr->sorted = malloc(seq * sizeof(*tr->sorted));
+    for(TranslationRecord * rec = tr->head; rec; rec = rec->next) {
+        tr->sorted[tr->cnt++] = rec;
+    }
+    
+    qsort(tr->sorted, tr->cnt, sizeof(*tr->sorted), translation_cmp);
+    
+    // duplicate keys, later line wins
+    uint32_t cnt = 0;
+    for(uint32_t i = 0; i < tr->cnt; i++) {
+        if(cnt && strcmp(tr->sorted[cnt - 1]->key, tr->sorted[i]->key) == 0) {
+            tr->sorted[cnt - 1] = tr->sorted[i];
         } else {
-            // those seem to parsed char by char, need to somehow hide unused chars
-            memset(line, '\x1a', bp_cur->raw_len);
-            line[bp_cur->raw_len - 1] = 0;
+            tr->sorted[cnt++] = tr->sorted[i];
         }
+    }
+    tr->cnt = cnt;
+}
 
-        TranslationRecord * trans_iter = trans;
-        while(trans_iter) {
-            if(strcmp(trans_iter->key, bp_cur->id) == 0) {
-                break;
-            }
-            trans_iter = trans_iter->next;
-        }
+static void translation_load_mem(Translation * tr, const uint8_t * data, uint32_t len) {
+    memset(tr, 0, sizeof(*tr));
+    
+    FILE * f = len ? fmemopen((void*)data, len, "r") : NULL;
+    if(f) {
+        translation_load(tr, f);
+        fclose(f);
+    }
+}
 
-        if(!trans_iter) {
-            lf_e("missing translation %s;%s", bp_cur->id, bp_cur->plain_string);
-            issue_count++;
-            continue;
-        }
+static const TranslationRecord * translation_find(const Translation * tr, const char * key) {
+    if(!tr->cnt) {
+        return NULL;
+    }
+    
+    TranslationRecord * const * res = bsearch(key, tr->sorted, tr->cnt, sizeof(*tr->sorted), translation_key_cmp);
+    
+    return res ? *res : NULL;
+}
+
+static void translation_free(Translation * tr) {
+    while(tr->head) {
+        TranslationRecord * rec = tr->head;
+        tr->head = tr->head->next;
         
-        // 2. overwrite with translation
-        int len = snprintf(line, sizeof(line), "%s", trans_iter->value_raw) + 1;
+        free(rec->key);
+        free(rec->value);
+        free(rec->value_raw);
+        free(rec);
+    }
+    
+    free(tr->sorted);
+    memset(tr, 0, sizeof(*tr));
+}
 
-        // 3. xor whole payload
-        for(uint32_t i = 0; i < bp_cur->raw_len; i++) {
-            uint8_t xor = (bp_cur->key >> ((i & 7) * 8)) & 0xFF;
-            line[i] ^= xor;
-        }
+/** Writes translation of single blueprint record into dbi, returns number of
+ * issues found.
+ */
+static uint32_t patch_record(const MemFile * dbi, const BlueprintRecord * bp_cur, const TranslationRecord * trans_rec) {
+    char line[MAX_LINE];
+    uint32_t issue_count = 0;
+    
+    if(!bp_cur->is_consistent) {
+        lf_e("not consistent %s;%s", bp_cur->id, bp_cur->plain_string);
+        return 0;
+    }
+    
+    //lf_d("patching [%-4u] %s:%s", bp_cur->raw_len, bp_cur->id, bp_cur->plain_string);
+    
+    // 1. start with original unxored string
+    
+    
+    if(bp_cur->key != 0) {
+        memcpy(line, bp_cur->plain_string_raw, bp_cur->raw_len);
+    } else {
+        // those seem to parsed char by char, need to somehow hide unused chars
+        memset(line, '\x1a', bp_cur->raw_len);
+        line[bp_cur->raw_len - 1] = 0;
+    }
 
-        if(len > bp_cur->raw_len) {
-            lf_e("translation too long [%-4u] %s;%s", bp_cur->raw_len, bp_cur->id, bp_cur->plain_string);
-            lf_e("                     [%-4u] %s;%s", len, bp_cur->id, trans_iter->value);
+    if(!trans_rec) {
+        lf_e("missing translation %s;%s", bp_cur->id, bp_cur->plain_string);
+        return 1;
+    }
+    
+    // 2. overwrite with translation
+    int len = snprintf(line, sizeof(line), "%s", trans_rec->value_raw) + 1;
+
+    // 3. xor whole payload
+    key_xor(line, 0, bp_cur->raw_len, bp_cur->key);
+
+    if(len > bp_cur->raw_len) {
+        lf_e("translation too long [%-4u] %s;%s", bp_cur->raw_len, bp_cur->id, bp_cur->plain_string);
+        lf_e("                     [%-4u] %s;%s", len, bp_cur->id, trans_rec->value);
+        
+        return 1;
+    }
+    
+    /*if(memcmp(line, bp_cur->encoded_string_raw, bp_cur->raw_len) == 0) {
+        lf_d("equals [%-4u] %s:%s", bp_cur->raw_len, bp_cur->id, bp_cur->plain_string);
+        continue;
+    }*/
+    
+    PatchLocation * patch_iter = bp_cur->patches;
+    while(patch_iter) {
+        PatchLocation * patch_cur = patch_iter;
+        patch_iter = patch_iter->next;
+        
+        if(patch_cur->address + patch_cur->len > dbi->len) {
+            lf_e("out of range %s;%s", bp_cur->id, bp_cur->plain_string);
             
             issue_count++;
             continue;
         }
         
-        /*if(memcmp(line, bp_cur->encoded_string_raw, bp_cur->raw_len) == 0) {
-            lf_d("equals [%-4u] %s:%s", bp_cur->raw_len, bp_cur->id, bp_cur->plain_string);
-            continue;
-        }*/
-        
-        PatchLocation * patch_iter = bp_cur->patches;
-        while(patch_iter) {
-            PatchLocation * patch_cur = patch_iter;
-            patch_iter = patch_iter->next;
-            
-            if(patch_cur->address + patch_cur->len > dbi->len) {
-                lf_e("out of range %s;%s", bp_cur->id, bp_cur->plain_string);
+        if(memcmp(bp_cur->encoded_string_raw + patch_cur->offset, line + patch_cur->offset, patch_cur->len) != 0) {
+            if(patch_cur->address == UINT32_MAX) {
+                lf_e("unpatchable difference %s  %s", data_to_hex(bp_cur->encoded_string_raw, bp_cur->raw_len), bp_cur->plain_string);
+                lf_e("                       %s  %s", data_to_hex(line,  bp_cur->raw_len), trans_rec->value);
                 
                 issue_count++;
                 continue;
             }
             
-            if(memcmp(bp_cur->encoded_string_raw + patch_cur->offset, line + patch_cur->offset, patch_cur->len) != 0) {
-                if(patch_cur->address == UINT32_MAX) {
-                    lf_e("unpatchable difference %s  %s", data_to_hex(bp_cur->encoded_string_raw, bp_cur->raw_len), bp_cur->plain_string);
-                    lf_e("                       %s  %s", data_to_hex(line,  bp_cur->raw_len), trans_iter->value);
+            // this can be patched, lets roll
+        } else {
+            continue;
+        }
+            
+        
+        switch(patch_cur->type) {
+            case PATCH_TYPE_DAT:
+                if(memcmp(dbi->data + patch_cur->address, bp_cur->encoded_string_raw + patch_cur->offset, patch_cur->len) != 0) {
+                    lf_e("dat patch mismatch %s", data_to_hex(dbi->data + patch_cur->address, patch_cur->len));
+                    lf_e("                   %s", data_to_hex(bp_cur->encoded_string_raw + patch_cur->offset, patch_cur->len));
                     
                     issue_count++;
                     continue;
                 }
                 
-                // this can be patched, lets roll
-            } else {
-                continue;
-            }
+                memcpy(dbi->data + patch_cur->address, line + patch_cur->offset, patch_cur->len);
+                break;
+            case PATCH_TYPE_MOV: {
+                uint32_t * instr = (uint32_t*)(dbi->data + patch_cur->address);
+                uint16_t imm_new = 0;
+                memcpy(&imm_new, line + patch_cur->offset, patch_cur->len);
                 
-            
-            switch(patch_cur->type) {
-                case PATCH_TYPE_DAT:
-                    if(memcmp(dbi->data + patch_cur->address, bp_cur->encoded_string_raw + patch_cur->offset, patch_cur->len) != 0) {
-                        lf_e("dat patch mismatch %s", data_to_hex(dbi->data + patch_cur->address, patch_cur->len));
-                        lf_e("                   %s", data_to_hex(bp_cur->encoded_string_raw + patch_cur->offset, patch_cur->len));
-                        
-                        issue_count++;
-                        continue;
-                    }
+                int ret_patch = inst_patch_mov(instr, patch_cur->imm, imm_new, patch_cur->len);
+                if(ret_patch != ERR_MOV_OK) {
+                    arm64_instr_t decoded;
+                    instr_decode(*instr, &decoded, 0);
+  
                     
-                    memcpy(dbi->data + patch_cur->address, line + patch_cur->offset, patch_cur->len);
-                    break;
-                case PATCH_TYPE_MOV: {
-                    uint32_t * instr = (uint32_t*)(dbi->data + patch_cur->address);
-                    uint16_t imm_new = 0;
-                    memcpy(&imm_new, line + patch_cur->offset, patch_cur->len);
+                    lf_e("imm patch error at 0x%08X [%d, expected=0x%04X] %s;%s", patch_cur->address, ret_patch, (uint16_t)patch_cur->imm, bp_cur->id, bp_cur->plain_string);
+                    lf_e("     %s", instr_to_string(&decoded, *instr, patch_cur->address));
                     
-                    int ret_patch = inst_patch_mov(instr, patch_cur->imm, imm_new, patch_cur->len);
-                    if(ret_patch != ERR_MOV_OK) {
-                        arm64_instr_t decoded;
-                        instr_decode(*instr, &decoded, 0);
-      
-                        
-                        lf_e("imm patch error at 0x%08X [%d, expected=0x%04X] %s;%s", patch_cur->address, ret_patch, (uint16_t)patch_cur->imm, bp_cur->id, bp_cur->plain_string);
-                        lf_e("     %s", instr_to_string(&decoded, *instr, patch_cur->address));
-                        
-                        issue_count++;
-                        continue;
-                    }
-                }   break;
-                default:
-                    lf_e("unknown patch type %s;%s", bp_cur->id, bp_cur->plain_string);
                     issue_count++;
                     continue;
-            }
+                }
+            }   break;
+            default:
+                lf_e("unknown patch type %s;%s", bp_cur->id, bp_cur->plain_string);
+                issue_count++;
+                continue;
+        }
+    }
+    
+    return issue_count;
+}
+
+int patch(const PatchArgs * args) {
+    
+    Translation trans;
+    
+    const MemFile * dbi = args->dbi_mf;
+    BlueprintRecord * bp_owned = args->bp ? NULL : blueprint_load(args->blueprint);
+    const BlueprintRecord * bp = args->bp ? args->bp : bp_owned;
+    FILE * trans_file = fopen(args->translation, "r");
+    
+    if(!trans_file || !bp || !dbi) {
+        if(bp_owned) {
+            blueprint_free(bp_owned);
         }
+        
+        if(trans_file) {
+            fclose(trans_file);
+        }
+        return EXIT_FAILURE;
     }
     
-    fwrite(dbi->data, 1, dbi->len, args->out);
+    //blueprint_print(bp);
+    
+    translation_load(&trans, trans_file);
+    
+    uint32_t issue_count = 0;
+    
+    // nro is patched in place, delta needs original to compare against
+    uint8_t * orig = NULL;
+    if(args->delta != DELTA_FORMAT_NONE) {
+        orig = malloc(dbi->len);
+        memcpy(orig, dbi->data, dbi->len);
+    }
+    
+    for(const BlueprintRecord * bp_cur = bp; bp_cur; bp_cur = bp_cur->next) {
+        issue_count += patch_record(dbi, bp_cur, translation_find(&trans, bp_cur->id));
+    }
+    
+    int ret = EXIT_SUCCESS;
+    
+    if(orig) {
+        ret = delta_write(args->out, args->delta, orig, dbi->data, dbi->len);
+        free(orig);
+    } else if(fwrite(dbi->data, 1, dbi->len, args->out) != dbi->len) {
+        lf_e("failed to write patched nro");
+        ret = EXIT_FAILURE;
+    }
          
-    if(bp) {
-        blueprint_free(bp);
+    if(bp_owned) {
+        blueprint_free(bp_owned);
     }
+    
+    translation_free(&trans);
 
     if(trans_file) {
         fclose(trans_file);
     }
     
+    if(args->issues) {
+        *args->issues = issue_count;
+    }
+    
     if(issue_count) {
         lf_e("found total of %u issues", issue_count);
+        return args->issues ? ret : EXIT_FAILURE;
+    } else if(ret == EXIT_SUCCESS) {
+        lf_i("done");
+    }
+    
+    return ret;
+}
+
+//////////// incremental
+
+static uint32_t location_size(const PatchLocation * loc) {
+    return loc->type == PATCH_TYPE_MOV ? sizeof(uint32_t) : loc->len;
+}
+
+static uint8_t location_overlaps(const PatchLocation * loc, const PatchRange * ranges, uint32_t cnt) {
+    uint32_t start = loc->address, end = loc->address + location_size(loc);
+    
+    for(uint32_t i = 0; i < cnt; i++) {
+        if(start < ranges[i].end && ranges[i].start < end) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+static uint32_t add_ranges(const BlueprintRecord * rec, PatchRange ** ranges, uint32_t cnt) {
+    for(const PatchLocation * loc = rec->patches; loc; loc = loc->next) {
+        if(loc->address == UINT32_MAX) {
+            continue;
+        }
+        
+        *ranges = realloc(*ranges, (cnt + 1) * sizeof(**ranges));
+        (*ranges)[cnt++] = (PatchRange){ .start = loc->address, .end = loc->address + location_size(loc) };
+    }
+    
+    return cnt;
+}
+
+static void base_hash(const MemFile * base, char out[SHA256_HEX_LEN]) {
+    uint8_t hash[SHA256_LEN];
+    
+    sha256(base->data, base->len, hash);
+    sha256_hex(hash, out);
+}
+
+static int repatch_full(const Repatch * rp, const Translation * tr, uint32_t * issues, char base_hex[SHA256_HEX_LEN]) {
+    const char * base = rp->args->base;
+    MemFile * work = mf_init_mem(rp->args->dbi_mf->data, rp->args->dbi_mf->len);
+    
+    for(const BlueprintRecord * bp_cur = rp->bp; bp_cur; bp_cur = bp_cur->next) {
+        *issues += patch_record(work, bp_cur, translation_find(tr, bp_cur->id));
+    }
+    
+    base_hash(work, base_hex);
+    
+    FILE * f = NULL;
+    if(mkpath(0755, "%s", base) == 0) {
+        f = fopen(base, "w+b");
+    }
+    
+    int ret = EXIT_SUCCESS;
+    if(!f) {
+        lf_e("failed to open \"%s\" for writing", base);
+        ret = EXIT_FAILURE;
+    } else if((fwrite(work->data, 1, work->len, f) != work->len) | (fclose(f) != 0)) {
+        lf_e("failed to write \"%s\"", base);
+        ret = EXIT_FAILURE;
+    }
+    
+    mf_free(work);
+    
+    return ret;
+}
+
+/** Only records whose translation differs from sidecar are applied to copy of
+ * original nro, then their locations are copied into base. Records sharing
+ * bytes with those are applied again too, so base ends up equal to full patch.
+ * Loaded base is updated along with file to hash its new content.
+ */
+static int repatch_changed(const Repatch * rp, const Translation * old, const Translation * tr, uint32_t * issues,
+        MemFile * base, char base_hex[SHA256_HEX_LEN]) {
+    const MemFile * dbi = rp->args->dbi_mf;
+    uint8_t * apply = calloc(rp->bp_cnt, 1);
+    PatchRange * ranges = NULL;
+    uint32_t range_cnt = 0, changed = 0;
+    
+    uint32_t i = 0;
+    for(const BlueprintRecord * bp_cur = rp->bp; bp_cur; bp_cur = bp_cur->next, i++) {
+        const TranslationRecord * rec_old = translation_find(old, bp_cur->id);
+        const TranslationRecord * rec_new = translation_find(tr, bp_cur->id);
+        
+        if(!rec_old != !rec_new || (rec_old && strcmp(rec_old->value_raw, rec_new->value_raw) != 0)) {
+            apply[i] = 1;
+            changed++;
+            range_cnt = add_ranges(bp_cur, &ranges, range_cnt);
+        }
+    }
+    
+    if(!changed) {
+        lf_i("translation did not change");
+        base_hash(base, base_hex);
+        free(apply);
+        return EXIT_SUCCESS;
+    }
+    
+    // whole rewrite is cheaper than checking overlaps of that many records
+    if(changed * 4 > rp->bp_cnt) {
+        lf_i("%u of %u keys changed, patching whole nro", changed, rp->bp_cnt);
+        free(apply);
+        free(ranges);
+        return repatch_full(rp, tr, issues, base_hex);
+    }
+    
+    uint32_t applied = changed;
+    for(uint32_t added = 1; added;) {
+        added = 0;
+        i = 0;
+        for(const BlueprintRecord * bp_cur = rp->bp; bp_cur; bp_cur = bp_cur->next, i++) {
+            if(apply[i]) {
+                continue;
+            }
+            
+            for(const PatchLocation * loc = bp_cur->patches; loc; loc = loc->next) {
+                if(loc->address != UINT32_MAX && location_overlaps(loc, ranges, range_cnt)) {
+                    apply[i] = 1;
+                    added++;
+                    range_cnt = add_ranges(bp_cur, &ranges, range_cnt);
+                    break;
+                }
+            }
+        }
+        applied += added;
+    }
+    
+    int fd = open(rp->args->base, O_RDWR);
+    if(fd < 0) {
+        lf_e("failed to open \"%s\" for writing", rp->args->base);
+        free(apply);
+        free(ranges);
+        return EXIT_FAILURE;
+    }
+    
+    MemFile * work = mf_init_mem(dbi->data, dbi->len);
+    int ret = EXIT_SUCCESS;
+    uint32_t written = 0;
+    
+    i = 0;
+    for(const BlueprintRecord * bp_cur = rp->bp; bp_cur && ret == EXIT_SUCCESS; bp_cur = bp_cur->next, i++) {
+        if(!apply[i]) {
+            continue;
+        }
+        
+        *issues += patch_record(work, bp_cur, translation_find(tr, bp_cur->id));
+        
+        // unchanged bytes are written as well, they may restore original
+        for(const PatchLocation * loc = bp_cur->patches; loc; loc = loc->next) {
+            uint32_t size = location_size(loc);
+            
+            if(loc->address == UINT32_MAX || (uint64_t)loc->address + size > work->len) {
+                continue;
+            }
+            
+            if(pwrite(fd, work->data + loc->address, size, loc->address) != (ssize_t)size) {
+                lf_e("failed to write \"%s\"", rp->args->base);
+                ret = EXIT_FAILURE;
+                break;
+            }
+            memcpy(base->data + loc->address, work->data + loc->address, size);
+            written++;
+        }
+    }
+    
+    if(close(fd) != 0) {
+        ret = EXIT_FAILURE;
+    }
+    
+    lf_i("%u changed keys, %u keys applied, %u locations written", changed, applied, written);
+    base_hash(base, base_hex);
+    
+    mf_free(work);
+    free(apply);
+    free(ranges);
+    
+    return ret;
+}
+
+static int sidecar_write(const Repatch * rp, const MemFile * lang, const char * base_hex) {
+    size_t tmp_len = strlen(rp->sidecar) + 5;
+    char * tmp = malloc(tmp_len);
+    snprintf(tmp, tmp_len, "%s.tmp", rp->sidecar);
+    
+    FILE * f = fopen(tmp, "wb");
+    int ret = -1;
+    
+    if(f) {
+        fputs(rp->header, f);
+        fprintf(f, "%s%s\n", SIDECAR_BASE, base_hex);
+        fwrite(lang->data, 1, lang->len, f);
+        
+        if(fclose(f) == 0 && rename(tmp, rp->sidecar) == 0) {
+            ret = 0;
+        }
+    }
+    
+    free(tmp);
+    
+    return ret;
+}
+
+static int repatch(const Repatch * rp) {
+    const PatchIncrementalArgs * args = rp->args;
+    uint64_t start = stats_now();
+    
+    MemFile * lang = mf_init_path(args->translation);
+    if(!lang) {
+        lf_e("failed to load \"%s\"", args->translation);
         return EXIT_FAILURE;
+    }
+    
+    Translation tr;
+    translation_load_mem(&tr, lang->data, lang->len);
+    
+    // sidecar is usable only for base built from the same nro and blueprint,
+    // which was not modified since
+    MemFile * sidecar = mf_init_path(rp->sidecar);
+    uint32_t header_len = strlen(rp->header);
+    uint32_t base_len = strlen(SIDECAR_BASE) + SHA256_HEX_LEN;
+    MemFile * base = NULL;
+    char base_hex[SHA256_HEX_LEN];
+    
+    uint8_t incremental = sidecar && sidecar->len >= header_len + base_len && memcmp(sidecar->data, rp->header, header_len) == 0 &&
+        (base = mf_init_path(args->base)) && base->len == args->dbi_mf->len;
+    
+    if(incremental) {
+        base_hash(base, base_hex);
+        
+        const char * line = (const char *)sidecar->data + header_len;
+        if(memcmp(line, SIDECAR_BASE, strlen(SIDECAR_BASE)) != 0 ||
+                memcmp(line + strlen(SIDECAR_BASE), base_hex, SHA256_HEX_LEN - 1) != 0 || line[base_len - 1] != '\n') {
+            lf_i("\"%s\" changed since last patch, patching whole nro", args->base);
+            incremental = 0;
+        }
     } else {
-        lf_i("done");
+        lf_i("no base matching nro and blueprint, patching whole nro");
     }
     
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    uint32_t issues = 0;
+    int ret;
+    
+    if(incremental) {
+        Translation old;
+        translation_load_mem(&old, sidecar->data + header_len + base_len, sidecar->len - header_len - base_len);
+        ret = repatch_changed(rp, &old, &tr, &issues, base, base_hex);
+        translation_free(&old);
+    } else {
+        ret = repatch_full(rp, &tr, &issues, base_hex);
+    }
+    
+    if(ret == EXIT_SUCCESS && sidecar_write(rp, lang, base_hex) != 0) {
+        lf_e("failed to write \"%s\"", rp->sidecar);
+        ret = EXIT_FAILURE;
+    }
+    
+    if(sidecar) {
+        mf_free(sidecar);
+    }
+    if(base) {
+        mf_free(base);
+    }
+    translation_free(&tr);
+    mf_free(lang);
+    
+    if(issues) {
+        lf_e("found total of %u issues", issues);
+        ret = EXIT_FAILURE;
+    }
+    
+    if(ret == EXIT_SUCCESS) {
+        lf_i("\"%s\" updated in %.1f ms", args->base, (stats_now() - start) / 1e6);
+    }
+    
+    return ret;
+}
+
+#ifdef __linux__
+
+static volatile sig_atomic_t watch_stop = 0;
+
+static void watch_signal(int sig) {
+    watch_stop = 1;
+}
+
+/** Returns 1 when event of translation file was read.
+ */
+static uint8_t watch_read(int fd, const char * name) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    uint8_t res = 0;
+    ssize_t len;
+    
+    while((len = read(fd, buf, sizeof(buf))) > 0) {
+        for(char * ptr = buf; ptr < buf + len;) {
+            const struct inotify_event * ev = (const struct inotify_event*)ptr;
+            
+            if(ev->len && strcmp(ev->name, name) == 0) {
+                res = 1;
+            }
+            
+            ptr += sizeof(*ev) + ev->len;
+        }
+    }
+    
+    return res;
+}
+
+static int repatch_watch(const Repatch * rp) {
+    const char * path = rp->args->translation;
+    const char * slash = strrchr(path, '/');
+    
+    // editors usually replace file, so directory is watched instead
+    char * dir = slash ? (slash == path ? strdup("/") : strndup(path, slash - path)) : strdup(".");
+    const char * name = slash ? slash + 1 : path;
+    
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        lf_e("failed to watch \"%s\"", dir);
+        if(fd >= 0) {
+            close(fd);
+        }
+        free(dir);
+        return EXIT_FAILURE;
+    }
+    
+    watch_stop = 0;
+    signal(SIGINT, watch_signal);
+    signal(SIGTERM, watch_signal);
+    
+    lf_i("watching \"%s\", stop with Ctrl+C", path);
+    
+    int ret = EXIT_SUCCESS;
+    while(!watch_stop) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        
+        if(poll(&pfd, 1, -1) <= 0 || !watch_read(fd, name)) {
+            continue;
+        }
+        
+        while(!watch_stop && poll(&pfd, 1, WATCH_SETTLE_MS) > 0) {
+            watch_read(fd, name);
+        }
+        
+        if(!watch_stop) {
+            ret = repatch(rp);
+        }
+    }
+    
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    
+    close(fd);
+    free(dir);
+    
+    return ret;
+}
+
+#else
+
+static int repatch_watch(const Repatch * rp) {
+    lf_e("--watch is supported only on linux");
+    return EXIT_FAILURE;
+}
+
+#endif
+
+int patch_incremental(const PatchIncrementalArgs * args) {
+    const MemFile * dbi = args->dbi_mf;
+    BlueprintRecord * bp = blueprint_load(args->blueprint);
+    MemFile * bp_mf = mf_init_path(args->blueprint);
+    
+    if(!dbi || !bp || !bp_mf) {
+        if(bp) {
+            blueprint_free(bp);
+        }
+        
+        if(bp_mf) {
+            mf_free(bp_mf);
+        }
+        return EXIT_FAILURE;
+    }
+    
+    Repatch rp = {
+        .args = args,
+        .bp = bp,
+    };
+    
+    for(const BlueprintRecord * bp_cur = bp; bp_cur; bp_cur = bp_cur->next) {
+        rp.bp_cnt++;
+    }
+    
+    uint8_t hash[SHA256_LEN];
+    char nro_hex[SHA256_HEX_LEN], bp_hex[SHA256_HEX_LEN];
+    
+    sha256(dbi->data, dbi->len, hash);
+    sha256_hex(hash, nro_hex);
+    sha256(bp_mf->data, bp_mf->len, hash);
+    sha256_hex(hash, bp_hex);
+    mf_free(bp_mf);
+    
+    snprintf(rp.header, sizeof(rp.header), "%s %s %s\n", SIDECAR_MAGIC, nro_hex, bp_hex);
+    
+    size_t sidecar_len = strlen(args->base) + strlen(PATCH_SIDECAR_SUFFIX) + 1;
+    rp.sidecar = malloc(sidecar_len);
+    snprintf(rp.sidecar, sidecar_len, "%s%s", args->base, PATCH_SIDECAR_SUFFIX);
+    
+    int ret = repatch(&rp);
+    
+    if(args->watch) {
+        ret = repatch_watch(&rp);
+    }
+    
+    free(rp.sidecar);
+    blueprint_free(bp);
+    
+    return ret;
+}
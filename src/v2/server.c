@@ -0,0 +1,1087 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "v2/server.h"
+#include "v2/analysis.h"
+#include "v2/strings.h"
+#include "log.h"
+
+/* Server keeps nro files and everything derived from them resident, each
+ * request is then executed by forked worker, which inherits all of it.
+ * 
+ * Protocol is one JSON object per line in both directions:
+ * 
+ *   -> {"cwd":"/home/user","argv":["dbipatcher","--decode","0x1234",...]}
+ *   <- {"exit":0,"stdout":"...","stderr":"..."}
+ * 
+ * Requests of single connection are answered in order, separate connections
+ * are served concurrently. Request needing something not resident yet is
+ * first handed to warm thread, so loading never blocks the loop. Resident nro
+ * is reloaded once its file changes.
+ */
+
+#define SERVER_MAX_CONN     64
+#define SERVER_MAX_ARGS     256
+#define SERVER_MAX_LINE     (1024 * 1024)
+// response carries whole output of command
+#define SERVER_MAX_RESPONSE (256 * 1024 * 1024)
+
+typedef struct _ResidentNro ResidentNro;
+
+typedef struct _ResidentNro {
+    char * path;
+    MemFile * mf;
+    
+    // file mf was loaded from, resident copy is stale once any differs
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    
+    ResidentNro * next;
+} ResidentNro;
+
+typedef struct {
+    char * cwd;
+    char * argv[SERVER_MAX_ARGS + 1];
+    int argc;
+} ServerRequest;
+
+typedef struct {
+    int fd;
+    pid_t busy;
+    // request waiting for warm thread
+    ServerRequest * warming;
+    char * buf;
+    uint32_t len;
+    uint32_t cap;
+} ServerConn;
+
+typedef struct _WarmJob WarmJob;
+
+typedef struct _WarmJob {
+    uint32_t conn;
+    ServerRequest * req;
+    char nro_path[PATH_MAX];
+    WarmJob * next;
+} WarmJob;
+
+static ResidentNro * resident_nro = NULL;
+static pthread_mutex_t resident_nro_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static WarmJob * warm_head = NULL;
+static WarmJob * warm_tail = NULL;
+static pthread_mutex_t warm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t warm_cond = PTHREAD_COND_INITIALIZER;
+// finished jobs are passed back to loop through pipe
+static int warm_pipe[2] = { -1, -1 };
+
+static volatile sig_atomic_t server_stop = 0;
+
+static void server_signal(int sig) {
+    server_stop = 1;
+}
+
+//////////// JSON
+
+static void json_write_string(FILE * f, const char * str, size_t len) {
+    fputc('"', f);
+    
+    for(size_t i = 0; i < len; i++) {
+        uint8_t c = str[i];
+        
+        switch(c) {
+            case '"':   fputs("\\\"", f);   break;
+            case '\\':  fputs("\\\\", f);   break;
+            case '\n':  fputs("\\n", f);    break;
+            case '\r':  fputs("\\r", f);    break;
+            case '\t':  fputs("\\t", f);    break;
+            default:
+                if(c < 0x20) {
+                    fprintf(f, "\\u%04x", c);
+                } else {
+                    fputc(c, f);
+                }
+        }
+    }
+    
+    fputc('"', f);
+}
+
+static const char * json_skip(const char * p) {
+    while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        p++;
+    }
+    return p;
+}
+
+static int json_hex4(const char * p, uint32_t * val) {
+    *val = 0;
+    for(uint32_t i = 0; i < 4; i++) {
+        char c = p[i];
+        *val <<= 4;
+        
+        if(c >= '0' && c <= '9')        *val |= c - '0';
+        else if(c >= 'a' && c <= 'f')   *val |= c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F')   *val |= c - 'A' + 10;
+        else                            return -1;
+    }
+    return 0;
+}
+
+/** Parses JSON string at *p, result is malloced and NUL terminated, its length
+ * (which may include NUL bytes) is stored to len.
+ */
+static char * json_read_string(const char ** p, size_t * len) {
+    const char * s = json_skip(*p);
+    if(*s != '"') {
+        return NULL;
+    }
+    s++;
+    
+    char * res = malloc(strlen(s) + 1);
+    size_t pos = 0;
+    
+    while(*s != '"') {
+        if(*s == 0) {
+            free(res);
+            return NULL;
+        }
+        
+        if(*s != '\\') {
+            res[pos++] = *(s++);
+            continue;
+        }
+        
+        s++;
+        switch(*s) {
+            case '"':   res[pos++] = '"';   break;
+            case '\\':  res[pos++] = '\\';  break;
+            case '/':   res[pos++] = '/';   break;
+            case 'b':   res[pos++] = '\b';  break;
+            case 'f':   res[pos++] = '\f';  break;
+            case 'n':   res[pos++] = '\n';  break;
+            case 'r':   res[pos++] = '\r';  break;
+            case 't':   res[pos++] = '\t';  break;
+            case 'u': {
+                uint32_t cp;
+                if(json_hex4(s + 1, &cp) != 0) {
+                    free(res);
+                    return NULL;
+                }
+                s += 4;
+                
+                // surrogate pair
+                uint32_t lo;
+                if(cp >= 0xD800 && cp < 0xDC00 && s[1] == '\\' && s[2] == 'u' && json_hex4(s + 3, &lo) == 0 && lo >= 0xDC00 && lo < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    s += 6;
+                }
+                
+                // encoded form is never longer than escape
+                if(cp < 0x80) {
+                    res[pos++] = cp;
+                } else if(cp < 0x800) {
+                    res[pos++] = 0xC0 | (cp >> 6);
+                    res[pos++] = 0x80 | (cp & 0x3F);
+                } else if(cp < 0x10000) {
+                    res[pos++] = 0xE0 | (cp >> 12);
+                    res[pos++] = 0x80 | ((cp >> 6) & 0x3F);
+                    res[pos++] = 0x80 | (cp & 0x3F);
+                } else {
+                    res[pos++] = 0xF0 | (cp >> 18);
+                    res[pos++] = 0x80 | ((cp >> 12) & 0x3F);
+                    res[pos++] = 0x80 | ((cp >> 6) & 0x3F);
+                    res[pos++] = 0x80 | (cp & 0x3F);
+                }
+            }   break;
+            default:
+                free(res);
+                return NULL;
+        }
+        s++;
+    }
+    
+    res[pos] = 0;
+    *len = pos;
+    *p = s + 1;
+    
+    return res;
+}
+
+static const char * json_skip_number(const char * p) {
+    p = json_skip(p);
+    if(*p == '-') {
+        p++;
+    }
+    while((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-') {
+        p++;
+    }
+    return p;
+}
+
+static void server_request_free(ServerRequest * req) {
+    free(req->cwd);
+    for(int i = 0; i < req->argc; i++) {
+        free(req->argv[i]);
+    }
+    memset(req, 0, sizeof(*req));
+}
+
+static int server_request_parse(const char * line, ServerRequest * req) {
+    memset(req, 0, sizeof(*req));
+    
+    const char * p = json_skip(line);
+    if(*(p++) != '{') {
+        return -1;
+    }
+    
+    p = json_skip(p);
+    while(*p != '}') {
+        size_t len;
+        char * key = json_read_string(&p, &len);
+        if(!key) {
+            goto fail;
+        }
+        
+        p = json_skip(p);
+        if(*(p++) != ':') {
+            free(key);
+            goto fail;
+        }
+        p = json_skip(p);
+        
+        if(strcmp(key, "cwd") == 0) {
+            free(req->cwd);
+            req->cwd = json_read_string(&p, &len);
+            if(!req->cwd) {
+                free(key);
+                goto fail;
+            }
+        } else if(strcmp(key, "argv") == 0 && *p == '[') {
+            p = json_skip(p + 1);
+            
+            while(*p != ']') {
+                char * arg = json_read_string(&p, &len);
+                if(!arg || req->argc == SERVER_MAX_ARGS) {
+                    free(arg);
+                    free(key);
+                    goto fail;
+                }
+                
+                req->argv[req->argc++] = arg;
+                
+                p = json_skip(p);
+                if(*p == ',') {
+                    p = json_skip(p + 1);
+                }
+            }
+            p++;
+        } else if(*p == '"') {
+            // unknown keys are ignored
+            free(json_read_string(&p, &len));
+        } else {
+            p = json_skip_number(p);
+        }
+        
+        free(key);
+        
+        p = json_skip(p);
+        if(*p == ',') {
+            p = json_skip(p + 1);
+        } else if(*p != '}') {
+            goto fail;
+        }
+    }
+    
+    if(req->argc == 0) {
+        goto fail;
+    }
+    
+    return 0;
+    
+fail:
+    server_request_free(req);
+    return -1;
+}
+
+//////////// resident state
+
+static void resident_nro_fork_prepare(void) {
+    pthread_mutex_lock(&resident_nro_lock);
+}
+
+static void resident_nro_fork_release(void) {
+    pthread_mutex_unlock(&resident_nro_lock);
+}
+
+/** Caller holds resident_nro_lock.
+ */
+static ResidentNro * serve_nro_find(const char * real) {
+    for(ResidentNro * iter = resident_nro; iter; iter = iter->next) {
+        if(strcmp(iter->path, real) == 0) {
+            return iter;
+        }
+    }
+    
+    return NULL;
+}
+
+static int serve_nro_fresh(const ResidentNro * res, const struct stat * st) {
+    return res->dev == st->st_dev && res->ino == st->st_ino && res->size == st->st_size &&
+           res->mtime.tv_sec == st->st_mtim.tv_sec && res->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/** Returns resident nro of given path, NULL when it was never loaded or its
+ * file has changed since.
+ */
+MemFile * serve_nro_get(const char * path) {
+    char real[PATH_MAX];
+    struct stat st;
+    if(!realpath(path, real) || stat(real, &st) != 0) {
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&resident_nro_lock);
+    
+    ResidentNro * res = serve_nro_find(real);
+    MemFile * mf = res && serve_nro_fresh(res, &st) ? res->mf : NULL;
+    
+    pthread_mutex_unlock(&resident_nro_lock);
+    
+    return mf;
+}
+
+static void serve_nro_free(ResidentNro * res) {
+    code_analysis_release(res->mf);
+    scan_string_release(res->mf);
+    mf_free(res->mf);
+    free(res->path);
+    free(res);
+}
+
+/** Makes nro resident, replacing stale copy. Only called before loop starts
+ * and from warm thread, so list is never modified concurrently.
+ */
+static MemFile * serve_nro_load(const char * path, MemFile * mf) {
+    char real[PATH_MAX];
+    struct stat st;
+    if(!realpath(path, real) || stat(real, &st) != 0) {
+        mf_free(mf);
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&resident_nro_lock);
+    
+    ResidentNro * res = serve_nro_find(real);
+    if(res && serve_nro_fresh(res, &st)) {
+        pthread_mutex_unlock(&resident_nro_lock);
+        mf_free(mf);
+        return res->mf;
+    }
+    
+    // workers forked earlier keep their own copy of stale one
+    if(res) {
+        ResidentNro ** iter = &resident_nro;
+        while(*iter != res) {
+            iter = &(*iter)->next;
+        }
+        *iter = res->next;
+    }
+    
+    pthread_mutex_unlock(&resident_nro_lock);
+    
+    if(res) {
+        lf_i("resident nro \"%s\" has changed", real);
+        serve_nro_free(res);
+    }
+    
+    if(!mf) {
+        mf = mf_init_path(real);
+        if(!mf) {
+            return NULL;
+        }
+    }
+    
+    lf_i("loading resident nro \"%s\"", real);
+    
+    code_analysis_retain(mf, ANALYSIS_KEYS | ANALYSIS_PARTIALS | ANALYSIS_STREAM | ANALYSIS_XREFS);
+    
+    // long lookups are compared by whole 8 B, index for those is always needed
+    scan_string_retain(mf, "        ");
+    
+    // published only once complete, until then requests wait for warm thread
+    res = calloc(1, sizeof(*res));
+    res->path = strdup(real);
+    res->mf = mf;
+    res->dev = st.st_dev;
+    res->ino = st.st_ino;
+    res->size = st.st_size;
+    res->mtime = st.st_mtim;
+    
+    pthread_mutex_lock(&resident_nro_lock);
+    res->next = resident_nro;
+    resident_nro = res;
+    pthread_mutex_unlock(&resident_nro_lock);
+    
+    return mf;
+}
+
+static const char * server_arg(const ServerRequest * req, const char * name, int * idx) {
+    size_t name_len = strlen(name);
+    
+    for(int i = *idx; i < req->argc; i++) {
+        const char * arg = req->argv[i];
+        
+        if(strncmp(arg, name, name_len) != 0) {
+            continue;
+        }
+        
+        if(arg[name_len] == '=') {
+            *idx = i + 1;
+            return arg + name_len + 1;
+        }
+        
+        if(arg[name_len] == 0 && i + 1 < req->argc) {
+            *idx = i + 2;
+            return req->argv[i + 1];
+        }
+    }
+    
+    return NULL;
+}
+
+/** Resolves path given by client relative to its cwd, server itself never
+ * changes directory as warm thread runs alongside loop.
+ */
+static int server_path(const ServerRequest * req, const char * path, char * real) {
+    char buf[PATH_MAX];
+    
+    if(path[0] != '/' && req->cwd) {
+        if(snprintf(buf, sizeof(buf), "%s/%s", req->cwd, path) >= (int)sizeof(buf)) {
+            return -1;
+        }
+        path = buf;
+    }
+    
+    return realpath(path, real) ? 0 : -1;
+}
+
+/** Tells whether request needs something which is not resident yet, resolved
+ * nro path is stored to real.
+ */
+static int server_needs_warm(const ServerRequest * req, char * real) {
+    int idx = 0;
+    const char * nro_path = server_arg(req, "--nro", &idx);
+    struct stat st;
+    
+    if(!nro_path || server_path(req, nro_path, real) != 0 || stat(real, &st) != 0) {
+        return 0;
+    }
+    
+    pthread_mutex_lock(&resident_nro_lock);
+    
+    ResidentNro * res = serve_nro_find(real);
+    int warm = !res || !serve_nro_fresh(res, &st);
+    
+    idx = 0;
+    const char * needle;
+    while(!warm && (needle = server_arg(req, "--find-str", &idx))) {
+        warm = !scan_string_retained(res->mf, needle);
+    }
+    
+    pthread_mutex_unlock(&resident_nro_lock);
+    
+    return warm;
+}
+
+/** Loads everything request is going to need into server itself, so it stays
+ * resident for following requests as well.
+ */
+static void server_warm(const WarmJob * job) {
+    MemFile * mf = serve_nro_load(job->nro_path, NULL);
+    if(!mf) {
+        return;
+    }
+    
+    int idx = 0;
+    const char * needle;
+    while((needle = server_arg(job->req, "--find-str", &idx))) {
+        scan_string_retain(mf, needle);
+    }
+}
+
+static void * server_warm_run(void * arg) {
+    for(;;) {
+        pthread_mutex_lock(&warm_lock);
+        while(!warm_head) {
+            pthread_cond_wait(&warm_cond, &warm_lock);
+        }
+        
+        WarmJob * job = warm_head;
+        warm_head = job->next;
+        if(!warm_head) {
+            warm_tail = NULL;
+        }
+        
+        pthread_mutex_unlock(&warm_lock);
+        
+        server_warm(job);
+        
+        if(write(warm_pipe[1], &job, sizeof(job)) != sizeof(job)) {
+            lf_e("failed to finish warm job");
+        }
+    }
+    
+    return NULL;
+}
+
+static void warm_fork_prepare(void) {
+    pthread_mutex_lock(&warm_lock);
+}
+
+static void warm_fork_release(void) {
+    pthread_mutex_unlock(&warm_lock);
+}
+
+static void server_warm_queue(uint32_t conn, ServerRequest * req, const char * nro_path) {
+    WarmJob * job = calloc(1, sizeof(*job));
+    job->conn = conn;
+    job->req = req;
+    snprintf(job->nro_path, sizeof(job->nro_path), "%s", nro_path);
+    
+    pthread_mutex_lock(&warm_lock);
+    
+    if(warm_tail) {
+        warm_tail->next = job;
+    } else {
+        warm_head = job;
+    }
+    warm_tail = job;
+    
+    pthread_cond_signal(&warm_cond);
+    pthread_mutex_unlock(&warm_lock);
+}
+
+//////////// worker
+
+static int write_all(int fd, const char * data, size_t len) {
+    while(len) {
+        ssize_t n = write(fd, data, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static char * read_fd(int fd, size_t * len) {
+    off_t size = lseek(fd, 0, SEEK_END);
+    if(size < 0) {
+        size = 0;
+    }
+    
+    char * res = malloc(size + 1);
+    *len = 0;
+    
+    while(*len < (size_t)size) {
+        ssize_t n = pread(fd, res + *len, size - *len, *len);
+        if(n <= 0) {
+            break;
+        }
+        *len += n;
+    }
+    
+    res[*len] = 0;
+    return res;
+}
+
+/** Runs request in forked worker, stdout and stderr of command are captured
+ * and sent back as single response line.
+ */
+static void server_worker(const ServeArgs * args, int fd, ServerRequest * req) {
+    FILE * out = tmpfile();
+    FILE * err = tmpfile();
+    
+    int ret = EXIT_FAILURE;
+    
+    if(!out || !err) {
+        lf_e("failed to capture output");
+    } else if(req->cwd && chdir(req->cwd) != 0) {
+        lf_e("failed to enter \"%s\"", req->cwd);
+    } else {
+        fflush(stdout);
+        fflush(stderr);
+        
+        dup2(fileno(out), STDOUT_FILENO);
+        dup2(fileno(err), STDERR_FILENO);
+        
+        ret = args->run(req->argc, req->argv);
+        
+        fflush(NULL);
+    }
+    
+    size_t out_len = 0, err_len = 0;
+    char * out_data = out ? read_fd(fileno(out), &out_len) : strdup("");
+    char * err_data = err ? read_fd(fileno(err), &err_len) : strdup("");
+    
+    char * resp;
+    size_t resp_len;
+    FILE * f = open_memstream(&resp, &resp_len);
+    
+    fprintf(f, "{\"exit\":%d,\"stdout\":", ret);
+    json_write_string(f, out_data, out_len);
+    fprintf(f, ",\"stderr\":");
+    json_write_string(f, err_data, err_len);
+    fprintf(f, "}\n");
+    fclose(f);
+    
+    write_all(fd, resp, resp_len);
+    
+    _exit(0);
+}
+
+static void server_reply_error(int fd, const char * msg) {
+    char * resp;
+    size_t resp_len;
+    FILE * f = open_memstream(&resp, &resp_len);
+    
+    fprintf(f, "{\"exit\":%d,\"stdout\":\"\",\"stderr\":", EXIT_FAILURE);
+    json_write_string(f, msg, strlen(msg));
+    fprintf(f, "}\n");
+    fclose(f);
+    
+    write_all(fd, resp, resp_len);
+    free(resp);
+}
+
+//////////// server loop
+
+static void server_conn_close(ServerConn * conn) {
+    close(conn->fd);
+    free(conn->buf);
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = -1;
+}
+
+/** Runs request in forked worker, request is freed.
+ */
+static void server_conn_run(const ServeArgs * args, int listen_fd, ServerConn * conns, ServerConn * conn, ServerRequest * req) {
+    fflush(stdout);
+    fflush(stderr);
+    
+    pid_t pid = fork();
+    if(pid == 0) {
+        close(listen_fd);
+        close(warm_pipe[0]);
+        close(warm_pipe[1]);
+        for(uint32_t i = 0; i < SERVER_MAX_CONN; i++) {
+            if(conns[i].fd >= 0 && &conns[i] != conn) {
+                close(conns[i].fd);
+            }
+        }
+        
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        
+        server_worker(args, conn->fd, req);
+    } else if(pid < 0) {
+        server_reply_error(conn->fd, "failed to start worker" CRLF);
+    } else {
+        conn->busy = pid;
+    }
+    
+    server_request_free(req);
+    free(req);
+}
+
+/** Dispatches next complete request of idle connection, if there is any.
+ */
+static void server_conn_dispatch(const ServeArgs * args, int listen_fd, ServerConn * conns, ServerConn * conn) {
+    if(conn->busy || conn->warming || conn->fd < 0) {
+        return;
+    }
+    
+    char * end = memchr(conn->buf, '\n', conn->len);
+    if(!end) {
+        return;
+    }
+    
+    *end = 0;
+    
+    ServerRequest * req = malloc(sizeof(*req));
+    char nro_path[PATH_MAX];
+    
+    if(server_request_parse(conn->buf, req) != 0) {
+        server_reply_error(conn->fd, "invalid request" CRLF);
+        free(req);
+    } else if(server_needs_warm(req, nro_path)) {
+        conn->warming = req;
+        server_warm_queue(conn - conns, req, nro_path);
+    } else {
+        server_conn_run(args, listen_fd, conns, conn, req);
+    }
+    
+    uint32_t used = end - conn->buf + 1;
+    memmove(conn->buf, conn->buf + used, conn->len - used);
+    conn->len -= used;
+}
+
+/** Runs requests whose warm up has finished, those of connections closed
+ * meanwhile are dropped.
+ */
+static void server_warm_done(const ServeArgs * args, int listen_fd, ServerConn * conns) {
+    WarmJob * job;
+    
+    while(read(warm_pipe[0], &job, sizeof(job)) == sizeof(job)) {
+        ServerConn * conn = &conns[job->conn];
+        
+        if(conn->warming == job->req) {
+            conn->warming = NULL;
+            server_conn_run(args, listen_fd, conns, conn, job->req);
+        } else {
+            server_request_free(job->req);
+            free(job->req);
+        }
+        
+        free(job);
+    }
+}
+
+static int server_listen(const char * path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        lf_e("socket path too long");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    
+    // stale socket of previous server
+    struct stat st;
+    if(stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+    
+    return fd;
+}
+
+int serve(const ServeArgs * args) {
+    // workers are forked while warm thread may be publishing
+    pthread_atfork(resident_nro_fork_prepare, resident_nro_fork_release, resident_nro_fork_release);
+    pthread_atfork(warm_fork_prepare, warm_fork_release, warm_fork_release);
+    
+    if(args->nro_mf && !serve_nro_load(args->nro_path, args->nro_mf)) {
+        lf_e("failed to load \"%s\"", args->nro_path);
+        return EXIT_FAILURE;
+    }
+    
+    pthread_t warm_thread;
+    if(pipe(warm_pipe) != 0 || fcntl(warm_pipe[0], F_SETFL, O_NONBLOCK) != 0 || pthread_create(&warm_thread, NULL, server_warm_run, NULL) != 0) {
+        lf_e("failed to start warm thread");
+        return EXIT_FAILURE;
+    }
+    pthread_detach(warm_thread);
+    
+    int listen_fd = server_listen(args->socket);
+    if(listen_fd < 0) {
+        lf_e("failed to listen on \"%s\"", args->socket);
+        return EXIT_FAILURE;
+    }
+    
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, server_signal);
+    signal(SIGTERM, server_signal);
+    
+    lf_i("listening on \"%s\"", args->socket);
+    
+    ServerConn conns[SERVER_MAX_CONN];
+    memset(conns, 0, sizeof(conns));
+    for(uint32_t i = 0; i < SERVER_MAX_CONN; i++) {
+        conns[i].fd = -1;
+    }
+    
+    while(!server_stop) {
+        struct pollfd fds[SERVER_MAX_CONN + 2];
+        ServerConn * fds_conn[SERVER_MAX_CONN + 2];
+        uint32_t fd_cnt = 0;
+        
+        fds[fd_cnt].fd = listen_fd;
+        fds[fd_cnt].events = POLLIN;
+        fds_conn[fd_cnt++] = NULL;
+        
+        fds[fd_cnt].fd = warm_pipe[0];
+        fds[fd_cnt].events = POLLIN;
+        fds_conn[fd_cnt++] = NULL;
+        
+        for(uint32_t i = 0; i < SERVER_MAX_CONN; i++) {
+            if(conns[i].fd >= 0) {
+                fds[fd_cnt].fd = conns[i].fd;
+                fds[fd_cnt].events = POLLIN;
+                fds_conn[fd_cnt++] = &conns[i];
+            }
+        }
+        
+        // timeout only drives reaping of finished workers
+        int n = poll(fds, fd_cnt, 50);
+        
+        pid_t pid;
+        while((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+            for(uint32_t i = 0; i < SERVER_MAX_CONN; i++) {
+                if(conns[i].busy == pid) {
+                    conns[i].busy = 0;
+                    server_conn_dispatch(args, listen_fd, conns, &conns[i]);
+                }
+            }
+        }
+        
+        if(n <= 0) {
+            continue;
+        }
+        
+        if(fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            
+            uint32_t i = 0;
+            while(i < SERVER_MAX_CONN && conns[i].fd >= 0) {
+                i++;
+            }
+            
+            if(fd >= 0 && i == SERVER_MAX_CONN) {
+                server_reply_error(fd, "too many connections" CRLF);
+                close(fd);
+            } else if(fd >= 0) {
+                conns[i].fd = fd;
+            }
+        }
+        
+        if(fds[1].revents & POLLIN) {
+            server_warm_done(args, listen_fd, conns);
+        }
+        
+        for(uint32_t f = 2; f < fd_cnt; f++) {
+            ServerConn * conn = fds_conn[f];
+            if(!(fds[f].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            
+            if(conn->len + 4096 > conn->cap) {
+                conn->cap = conn->cap ? conn->cap * 2 : 8192;
+                conn->buf = realloc(conn->buf, conn->cap);
+            }
+            
+            ssize_t len = read(conn->fd, conn->buf + conn->len, conn->cap - conn->len);
+            if(len <= 0 || conn->len + len > SERVER_MAX_LINE) {
+                // worker holds its own descriptor, so it still gets to reply
+                server_conn_close(conn);
+                continue;
+            }
+            
+            conn->len += len;
+            server_conn_dispatch(args, listen_fd, conns, conn);
+        }
+    }
+    
+    lf_i("shutting down");
+    
+    for(uint32_t i = 0; i < SERVER_MAX_CONN; i++) {
+        if(conns[i].fd >= 0) {
+            server_conn_close(&conns[i]);
+        }
+    }
+    
+    close(listen_fd);
+    unlink(args->socket);
+    
+    return EXIT_SUCCESS;
+}
+
+//////////// client
+
+/** Sends command line to server and prints its response as if command was
+ * executed locally. Returns exit code of command.
+ */
+int serve_client(const char * socket_path, int argc, char ** argv) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    
+    if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+        lf_e("socket path too long");
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, socket_path);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        lf_e("failed to connect to \"%s\"", socket_path);
+        if(fd >= 0) {
+            close(fd);
+        }
+        return EXIT_FAILURE;
+    }
+    
+    char cwd[PATH_MAX];
+    if(!getcwd(cwd, sizeof(cwd))) {
+        cwd[0] = 0;
+    }
+    
+    char * req;
+    size_t req_len;
+    FILE * f = open_memstream(&req, &req_len);
+    
+    fprintf(f, "{\"cwd\":");
+    json_write_string(f, cwd, strlen(cwd));
+    fprintf(f, ",\"argv\":[");
+    for(int i = 0; i < argc; i++) {
+        if(i) {
+            fputc(',', f);
+        }
+        json_write_string(f, argv[i], strlen(argv[i]));
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+    
+    int ret = write_all(fd, req, req_len);
+    free(req);
+    
+    if(ret != 0) {
+        lf_e("failed to send request");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    
+    // single response line
+    size_t cap = 65536, len = 0;
+    char * resp = malloc(cap);
+    
+    for(;;) {
+        if(len + 1 == cap) {
+            char * grown = cap < SERVER_MAX_RESPONSE ? realloc(resp, cap * 2) : NULL;
+            if(!grown) {
+                if(cap < SERVER_MAX_RESPONSE) {
+                    lf_e("out of memory reading response");
+                } else {
+                    lf_e("response exceeds %u MB", SERVER_MAX_RESPONSE >> 20);
+                }
+                free(resp);
+                close(fd);
+                return EXIT_FAILURE;
+            }
+            
+            resp = grown;
+            cap *= 2;
+        }
+        
+        ssize_t n = read(fd, resp + len, cap - len - 1);
+        if(n <= 0) {
+            break;
+        }
+        
+        len += n;
+        if(memchr(resp + len - n, '\n', n)) {
+            break;
+        }
+    }
+    
+    resp[len] = 0;
+    close(fd);
+    
+    int exit_code = EXIT_FAILURE;
+    uint8_t valid = 0;
+    
+    const char * p = json_skip(resp);
+    if(*p == '{') {
+        p = json_skip(p + 1);
+        valid = 1;
+        
+        while(*p && *p != '}') {
+            size_t key_len;
+            char * key = json_read_string(&p, &key_len);
+            
+            p = json_skip(p);
+            if(!key || *(p++) != ':') {
+                free(key);
+                valid = 0;
+                break;
+            }
+            p = json_skip(p);
+            
+            if(*p == '"') {
+                size_t val_len;
+                char * val = json_read_string(&p, &val_len);
+                if(!val) {
+                    free(key);
+                    valid = 0;
+                    break;
+                }
+                
+                if(strcmp(key, "stdout") == 0) {
+                    fwrite(val, 1, val_len, stdout);
+                } else if(strcmp(key, "stderr") == 0) {
+                    fwrite(val, 1, val_len, stderr);
+                }
+                free(val);
+            } else {
+                if(strcmp(key, "exit") == 0) {
+                    exit_code = atoi(p);
+                }
+                p = json_skip_number(p);
+            }
+            
+            free(key);
+            p = json_skip(p);
+            if(*p == ',') {
+                p = json_skip(p + 1);
+            }
+        }
+    }
+    
+    free(resp);
+    
+    if(!valid) {
+        lf_e("invalid response from server");
+        return EXIT_FAILURE;
+    }
+    
+    fflush(stdout);
+    return exit_code;
+}
@@ -0,0 +1,90 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "v2/slots.h"
+
+static inline uint32_t slot_hash(uint64_t value, uint32_t bucket_mask) {
+    value ^= (value >> 33);
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= (value >> 33);
+
+    return (uint32_t)value & bucket_mask;
+}
+
+static inline uint64_t slot_value(const SlotIndex * idx, uint32_t slot) {
+    uint64_t value;
+    memcpy(&value, idx->data + slot * 8, sizeof(value));
+
+    return value & idx->mask;
+}
+
+/** Builds chained hash table over every 8 B slot, so lookups of encoded
+ * strings are O(1) per key instead of walking whole nro.
+ */
+SlotIndex * slot_index_init(const MemFile * mf, uint64_t mask) {
+    SlotIndex * idx = malloc(sizeof(*idx));
+    memset(idx, 0, sizeof(*idx));
+
+    idx->data = mf->data;
+    idx->slot_cnt = mf->len / 8;
+    idx->mask = mask;
+
+    uint32_t bucket_cnt = 1024;
+    while(bucket_cnt < idx->slot_cnt * 2) {
+        bucket_cnt *= 2;
+    }
+
+    idx->bucket_mask = bucket_cnt - 1;
+    idx->buckets = malloc(sizeof(*idx->buckets) * bucket_cnt);
+    memset(idx->buckets, 0xFF, sizeof(*idx->buckets) * bucket_cnt);
+
+    idx->chain = malloc(sizeof(*idx->chain) * (idx->slot_cnt + 1));
+
+    // insert backwards, so chains are walked in ascending order
+    for(uint32_t i = idx->slot_cnt; i --> 0;) {
+        uint32_t bucket = slot_hash(slot_value(idx, i), idx->bucket_mask);
+
+        idx->chain[i] = idx->buckets[bucket];
+        idx->buckets[bucket] = i;
+    }
+
+    return idx;
+}
+
+void slot_index_free(SlotIndex * idx) {
+    if(idx) {
+        free(idx->buckets);
+        free(idx->chain);
+        free(idx);
+    }
+}
+
+static uint32_t slot_index_walk(const SlotIndex * idx, uint32_t slot, uint64_t value) {
+    while(slot != SLOT_NONE) {
+        if(slot_value(idx, slot) == value) {
+            return slot * 8;
+        }
+        slot = idx->chain[slot];
+    }
+
+    return SLOT_NONE;
+}
+
+uint32_t slot_index_find(const SlotIndex * idx, uint64_t value) {
+    value &= idx->mask;
+
+    return slot_index_walk(idx, idx->buckets[slot_hash(value, idx->bucket_mask)], value);
+}
+
+uint32_t slot_index_next(const SlotIndex * idx, uint32_t offset, uint64_t value) {
+    value &= idx->mask;
+
+    return slot_index_walk(idx, idx->chain[offset / 8], value);
+}
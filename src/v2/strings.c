@@ -13,16 +13,28 @@
 #include <inttypes.h>
 #include <sys/param.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "log.h"
 #include "v2/keys.h"
 #include "v2/utf8.h"
 #include "v2/imm.h"
 #include "v2/strings.h"
+#include "v2/slots.h"
+#include "v2/xref.h"
+#include "v2/analysis.h"
+#include "v2/context.h"
+#include "v2/inst.h"
 #include "utils.h"
+#include "stats.h"
+#include "progress.h"
 
 #define MAX_STRING_LEN      2048
 
+// slots between two progress updates of string scans
+#define PROGRESS_BATCH      1024
+
 typedef struct _DataRef DataRef;
 
 typedef struct _DataRef {
@@ -89,19 +101,50 @@ char nibble_to_char(uint8_t val) {
     }
 }
 
-const char * string_encode(const char * src, uint32_t len) {
+// non zero when any byte of x is below 0x20, which includes terminator
+#define HAS_CONTROL(x)      (((x) - 0x2020202020202020ULL) & ~(x) & 0x8080808080808080ULL)
+
+uint32_t string_encode_into(char * dst, uint32_t dst_size, const char * src, uint32_t len) {
     if(len == UINT32_MAX) {
         len = strlen(src);
     }
     
-    static char encode[MAX_STRING_LEN * 2];
-    char * ptr_w = encode;
+    char * ptr_w = dst;
+    char * ptr_end = dst + dst_size - 1;
+    uint32_t i = 0;
     
     // TODO: yea, would be better to handle all unprintable characters
-    for(uint32_t i = 0; i < len; i++) {
+    while(i < len) {
+        // printable runs are copied as whole, 8 B at time
+        uint32_t run = i;
+        while(run + 8 <= len) {
+            uint64_t word;
+            memcpy(&word, src + run, sizeof(word));
+            if(HAS_CONTROL(word)) {
+                break;
+            }
+            run += 8;
+        }
+        while(run < len && (uint8_t)src[run] >= 0x20) {
+            run++;
+        }
+        
+        uint32_t copy = MIN(run - i, (uint32_t)(ptr_end - ptr_w));
+        memcpy(ptr_w, src + i, copy);
+        ptr_w += copy;
+        i += copy;
+        
+        if(i >= len || i < run || src[i] == 0) {
+            break;
+        }
+        
+        // escape is never cut in half
+        uint32_t need = (src[i] == '\n' || src[i] == '\r') ? 2 : 4;
+        if((uint32_t)(ptr_end - ptr_w) < need) {
+            break;
+        }
+        
         switch(src[i]) {
-            case 0:
-                goto end;
             case '\n':
                 *(ptr_w++) = '\\';
                 *(ptr_w++) = 'n';
@@ -111,25 +154,25 @@ const char * string_encode(const char * src, uint32_t len) {
                 *(ptr_w++) = 'r';
                 break;
             default:
-                if((uint8_t)src[i] < 0x20) {
-                    *(ptr_w++) = '\\';
-                    *(ptr_w++) = 'x';
-                    *(ptr_w++) = nibble_to_char(src[i] >> 4);
-                    *(ptr_w++) = nibble_to_char(src[i] & 0xF);
-                } else {
-                    *(ptr_w++) = src[i];
-                }
+                *(ptr_w++) = '\\';
+                *(ptr_w++) = 'x';
+                *(ptr_w++) = nibble_to_char(src[i] >> 4);
+                *(ptr_w++) = nibble_to_char(src[i] & 0xF);
                 break;
         }
-    }
-    
-end:
-    if(ptr_w - encode == sizeof(encode)) {
-        --ptr_w;
+        i++;
     }
     
     *(ptr_w) = 0;
     
+    return ptr_w - dst;
+}
+
+const char * string_encode(const char * src, uint32_t len) {
+    static __thread char encode[MAX_STRING_LEN * 2];
+    
+    string_encode_into(encode, sizeof(encode), src, len);
+    
     return encode;
 }
 
@@ -226,6 +269,8 @@ static void text_reference_free(TextReference * ref, uint32_t ref_len) {
 }
 
 static int text_reference_load(const char * file, TextReference ** dst, uint32_t * len) {
+    StatsMark t_start = stats_phase_begin();
+    
     FILE * f = fopen(file, "r");
     if(!f) {
         return EXIT_FAILURE;
@@ -302,6 +347,7 @@ static int text_reference_load(const char * file, TextReference ** dst, uint32_t
     }
     fclose(f);
     
+    stats_phase_end(STATS_PHASE_LOAD_DICT, &t_start);
     return 0;
 }
 
@@ -359,6 +405,124 @@ uint32_t scan_get_matched_length(TextReference * matched, char * start, uint32_t
     return matched_len;
 }
 
+/** ImmResults which fit behind 8 B of partial, in scan order. Any of them
+ * may terminate the string, null may follow valid utf8 anywhere in the tail,
+ * so results are not filtered by length.
+ */
+typedef struct {
+    ImmResult ** results;
+    uint32_t cnt;
+} PartialTails;
+
+typedef struct {
+    const PartialTails * pt;
+    const TextReference * refs;
+    const uint32_t * todo;
+    uint32_t todo_cnt;
+    uint32_t next;
+    char ** out;
+    size_t * out_len;
+    uint32_t * matches;
+    // context of caller, thread locals are not inherited
+    DbiContext * ctx;
+} PartialState;
+
+typedef struct {
+    pthread_t thread;
+    PartialState * st;
+} PartialWorker;
+
+#define PARTIAL_MIN_THREADED    8
+
+static void partial_tails_init(PartialTails * pt, ImmResult * res) {
+    pt->cnt = 0;
+
+    for(ImmResult * iter = res; iter; iter = iter->next) {
+        if(iter->raw_len <= MAX_STRING_LEN - 8) {
+            pt->cnt++;
+        }
+    }
+
+    pt->results = malloc(sizeof(*pt->results) * (pt->cnt + 1));
+
+    pt->cnt = 0;
+    for(ImmResult * iter = res; iter; iter = iter->next) {
+        if(iter->raw_len <= MAX_STRING_LEN - 8) {
+            pt->results[pt->cnt++] = iter;
+        }
+    }
+}
+
+static void partial_tails_free(PartialTails * pt) {
+    free(pt->results);
+}
+
+/** Tries every ImmResult as tail of single partial reference and prints
+ * candidates to out, in the same order as scan found them.
+ */
+static uint32_t partial_resolve(FILE * out, const PartialTails * pt, const TextReference * ref) {
+    char tmp[MAX_STRING_LEN];
+    uint32_t matches = 0;
+    uint64_t candidates = 0;
+    uint8_t matched = 0;
+
+    memcpy(tmp, ref->text, 8);
+
+    fprintf(out, "%-16s key 0x%-20" PRIx64 " / %-5u [%-9u]: '%s'\n", ref->name, ref->key, ref->key_idx, ref->text_length, ref->text);
+
+    for(uint32_t r = 0; r < pt->cnt; r++) {
+        const ImmResult * iter = pt->results[r];
+        candidates++;
+
+        memcpy(tmp + 8, iter->raw, iter->raw_len);
+        uint32_t len = 8 + iter->raw_len;
+
+        key_xor(tmp, 8, len, ref->key);
+
+        utf8_prefix prefix;
+        utf8_validate_prefix(tmp, len, 0, &prefix);
+        uint32_t offset = prefix.valid_len;
+
+        if(offset < len && tmp[offset] == 0) {
+            matched = 1;
+            offset++;
+
+            // get rid of null terminator matching pretty much everything
+            if(ref->text_length <= 9 || tmp[8] != 0) {
+                fprintf(out, "%20s 0x%-20x   %5s [%-3u / %-3u]: '%s'\n", "at", iter->matches->offsets[0], "", offset, len, string_encode(tmp, offset));
+                matches++;
+            }
+        }
+    }
+
+    if(matched) {
+        fprintf(out, "\n");
+    }
+
+    stats_add(STATS_CANDIDATES_VALIDATED, candidates);
+    return matches;
+}
+
+static void * partial_worker_run(void * arg) {
+    PartialWorker * w = arg;
+    PartialState * st = w->st;
+
+    dbi_context_bind(st->ctx);
+
+    while(1) {
+        uint32_t i = __atomic_fetch_add(&st->next, 1, __ATOMIC_RELAXED);
+        if(i >= st->todo_cnt) {
+            break;
+        }
+
+        FILE * out = open_memstream(&st->out[i], &st->out_len[i]);
+        st->matches[i] = partial_resolve(out, st->pt, &st->refs[st->todo[i]]);
+        fclose(out);
+    }
+
+    return NULL;
+}
+
 /** This function is used to get full text of partial references. It requires
  * partial reference to be already present in key file - you may get that by
  * running scan_english / scan_russian and manually adding it.
@@ -369,67 +533,77 @@ uint32_t scan_get_matched_length(TextReference * matched, char * start, uint32_t
  * This function should catch vast majority of partial immediates, with minimum
  * false detects, because compiler seems to produce pretty consistent code for 
  * those.
+ * 
+ * References are resolved in parallel into private buffers, which are then
+ * printed in reference order.
  */
 int fscan_partials(FILE * f, const MemFile * mf, TextReference * refs, uint32_t ref_cnt) {
-    ImmResult * res = imm_scan(mf->data, mf->len);
-    char tmp[MAX_STRING_LEN];
+    CodeAnalysis * ca = code_analysis_init(mf, ANALYSIS_PARTIALS);
     
     uint32_t matches_total = 0;
     
     fprintf(f, "// scanning partials" CRLF);
-    
+
+    PartialTails pt;
+    partial_tails_init(&pt, ca->partials);
+
+    // dont want to rewrite it, there should be only partials with those
+    // length constraints anyway
+    uint32_t * todo = malloc(sizeof(*todo) * (ref_cnt + 1));
+    uint32_t todo_cnt = 0;
     for(uint32_t i = 0; i < ref_cnt; i++) {
-        TextReference * ref = &refs[i];
-        
-        // dont want to rewrite it, there should be only partials with those
-        // length constraints anyway
-        if(ref->match_partial && ref->text_length > 8 && ref->text_length < 16) {
-            memcpy(tmp, ref->text, 8);
-            
-            fprintf(f, "%-16s key 0x%-20" PRIx64 " / %-5u [%-9u]: '%s'\n", ref->name, ref->key, ref->key_idx, ref->text_length, ref->text);
-            
-            ImmResult * iter = res;
-            uint8_t matched = 0;
-            while(iter) {                
-                memcpy(tmp + 8, iter->raw, iter->raw_len);
-                uint32_t len = 8 + iter->raw_len;
-                
-                for(uint32_t x = 8; x < len; x++) {
-                    uint8_t xor = (ref->key >> ((x & 7) * 8)) & 0xFF;
-                    tmp[x] ^= xor;
-                }
-                
-                uint32_t offset = 0;
-                while(offset < len) {
-                    utf8_char_validity val = utf8_check_char(tmp, offset);
-                    if(val.valid) {
-                        offset = val.next_offset;
-                    } else {
-                        break;
-                    }
-                }
-                
-                if(tmp[offset] == 0) {
-                    matched = 1;
-                    offset++;
+        if(refs[i].match_partial && refs[i].text_length > 8 && refs[i].text_length < 16) {
+            todo[todo_cnt++] = i;
+        }
+    }
 
-                    // get rid of null terminator matching pretty much everything
-                    if(offset > 0 && (ref->text_length <= 9 || tmp[8] != 0)) {
-                        fprintf(f, "%20s 0x%-20x   %5s [%-3u / %-3u]: '%s'\n", "at", iter->matches->offsets[0], "", offset, len, string_encode(tmp, offset));
-                        matches_total++;
-                    }
-                }
+    long thread_cnt = sysconf(_SC_NPROCESSORS_ONLN);
+    if(thread_cnt > todo_cnt / PARTIAL_MIN_THREADED) {
+        thread_cnt = todo_cnt / PARTIAL_MIN_THREADED;
+    }
 
-                iter = iter->next;
-            }
-            
-            if(matched) {
-                fprintf(f, "\n");
-            }
-        } 
+    if(thread_cnt <= 1) {
+        for(uint32_t i = 0; i < todo_cnt; i++) {
+            matches_total += partial_resolve(f, &pt, &refs[todo[i]]);
+        }
+    } else {
+        PartialState st = {
+            .pt = &pt,
+            .refs = refs,
+            .todo = todo,
+            .todo_cnt = todo_cnt,
+            .next = 0,
+            .out = calloc(todo_cnt, sizeof(char *)),
+            .out_len = calloc(todo_cnt, sizeof(size_t)),
+            .matches = calloc(todo_cnt, sizeof(uint32_t)),
+            .ctx = dbi_context_bound(),
+        };
+
+        PartialWorker * workers = calloc(thread_cnt, sizeof(*workers));
+        for(long i = 0; i < thread_cnt; i++) {
+            workers[i].st = &st;
+            pthread_create(&workers[i].thread, NULL, partial_worker_run, &workers[i]);
+        }
+
+        for(long i = 0; i < thread_cnt; i++) {
+            pthread_join(workers[i].thread, NULL);
+        }
+        free(workers);
+
+        for(uint32_t i = 0; i < todo_cnt; i++) {
+            fwrite(st.out[i], 1, st.out_len[i], f);
+            matches_total += st.matches[i];
+            free(st.out[i]);
+        }
+
+        free(st.out);
+        free(st.out_len);
+        free(st.matches);
     }
-    
-    imm_result_free(res);
+
+    free(todo);
+    partial_tails_free(&pt);
+    code_analysis_free(ca);
     
     if(matches_total) {
         lf_i("found total of %u matches", matches_total);
@@ -446,20 +620,48 @@ int fscan_partials(FILE * f, const MemFile * mf, TextReference * refs, uint32_t
  * 
  * Found strings have to be manualy evaluated and added to key file.
  */
-int fscan_russian(FILE * out, const MemFile * mf, uint32_t min_cyrillic, uint32_t key_cnt, MemArea * mem_iter) {
+int fscan_russian(FILE * out, const MemFile * mf, uint32_t min_cyrillic, uint32_t key_cnt, MemArea * mem_iter, const XrefIndex * xrefs) {
     char tmp[MAX_STRING_LEN];
     
+    StatsMark t_start = stats_phase_begin();
+    uint64_t slots = 0;
+    uint64_t keys_tried = 0;
+    uint64_t candidates = 0;
+    uint64_t keys_reported = 0;
+    
     KeySet * ks = gen_key_set(key_cnt);
 
     uint32_t * matches = init_matches_cnt(ks->key_cnt);
     
+    uint64_t total = 0;
+    for(MemArea * iter = mem_iter; iter; iter = iter->next) {
+        total += iter->len;
+    }
+    progress_start("new-ru", total);
+    
     while(mem_iter) {
         fprintf(out, "// scanning 0x%08X to 0x%08X (%u B)" CRLF, (uint32_t)(mem_iter->start - mf->data), (uint32_t)((mem_iter->start - mf->data) + mem_iter->len), mem_iter->len);
 
         uint32_t mem_start = mem_iter->start - mf->data;
         uint32_t max_len = mem_start + (mem_iter->len / 8) * 8;
+        uint32_t progress_pos = mem_start;
 
         for(uint32_t i = mem_start; i < max_len;) {
+            // only slots code actually references are worth checking
+            if(xrefs) {
+                i = xref_index_next(xrefs, i);
+                if(i >= max_len) {
+                    break;
+                }
+                
+                // encrypted strings are word aligned, unaligned targets are
+                // byte loads into the middle of something else
+                if(i & 3) {
+                    i++;
+                    continue;
+                }
+            }
+            
             uint32_t matched_cyrillic = 0;
             uint64_t matched_key = 0;
             uint32_t matched_key_idx = 0;
@@ -467,6 +669,12 @@ int fscan_russian(FILE * out, const MemFile * mf, uint32_t min_cyrillic, uint32_
             uint32_t rem = max_len - i;
             uint32_t len = MIN(rem, MAX_STRING_LEN);
             char * start = (char*)(mf->data + i);
+            
+            if(++slots % PROGRESS_BATCH == 0) {
+                progress_add(i - progress_pos, keys_tried - keys_reported);
+                progress_pos = i;
+                keys_reported = keys_tried;
+            }
 
             for(uint32_t k = 0; k < ks->key_cnt; k++) {
                 memcpy(tmp, start, 8);
@@ -476,34 +684,17 @@ int fscan_russian(FILE * out, const MemFile * mf, uint32_t min_cyrillic, uint32_
                 if(key == 0 && key_cnt != 0) {
                     continue;
                 }
+                keys_tried++;
 
-                for(uint32_t x = 0; x < 8; x++) {
-                    uint8_t xor = (key >> ((x & 7) * 8)) & 0xFF;
-                    tmp[x] ^= xor;
-                }
+                key_xor(tmp, 0, 8, key);
 
                 if(tmp[0] == 0) {
                     continue;
                 }
 
-                uint32_t cur_cyrillic = 0;
-                uint32_t offset = 0;
-                while(offset < 8) {
-                    utf8_char_validity val = utf8_check_char(tmp, offset);
-                    if(val.valid) {
-                        offset = val.next_offset;
-
-                        if(val.valid == UT_CYRILLIC) {
-                            ++cur_cyrillic;
-                            break;
-                        }
-                    } else {
-                        if(tmp[offset] == 0) {
-                            offset++;
-                        }
-                        break;
-                    }
-                }
+                utf8_prefix prefix;
+                utf8_validate_prefix(tmp, 8, 0, &prefix);
+                uint32_t cur_cyrillic = prefix.cyrillic;
 
                 uint8_t is_space = 0;
                 if(isspace(tmp[0]) && isspace(tmp[1]) && isspace(tmp[2]) && isspace(tmp[3])) {
@@ -511,30 +702,17 @@ int fscan_russian(FILE * out, const MemFile * mf, uint32_t min_cyrillic, uint32_
                 }
 
                 if(cur_cyrillic || is_space) {
-                    cur_cyrillic = 0;
-
+                    candidates++;
                     memcpy(tmp, start, len);
 
-                    for(uint32_t x = 0; x < len; x++) {
-                        uint8_t xor = (key >> ((x & 7) * 8)) & 0xFF;
-                        tmp[x] ^= xor;
-                    }
+                    key_xor(tmp, 0, len, key);
 
-                    uint32_t offset = 0;
-                    while(offset < len) {
-                        utf8_char_validity val = utf8_check_char(tmp, offset);
-                        if(val.valid) {
-                            offset = val.next_offset;
-
-                            if(val.valid == UT_CYRILLIC) {
-                                ++cur_cyrillic;
-                            }
-                        } else {
-                            if(tmp[offset] == 0) {
-                                offset++;
-                            }
-                            break;
-                        }
+                    utf8_validate_prefix(tmp, len, 0, &prefix);
+                    cur_cyrillic = prefix.cyrillic;
+                    
+                    uint32_t offset = prefix.valid_len;
+                    if(prefix.nul_offset != UTF8_NO_NUL) {
+                        offset++;
                     }
 
                     if(cur_cyrillic >= min_cyrillic && cur_cyrillic > matched_cyrillic && offset >= 7) {
@@ -549,22 +727,14 @@ int fscan_russian(FILE * out, const MemFile * mf, uint32_t min_cyrillic, uint32_
                 memcpy(tmp, start, len);
                 uint64_t key = matched_key;
 
-                for(uint32_t x = 0; x < len; x++) {
-                    uint8_t xor = (key >> ((x & 7) * 8)) & 0xFF;
-                    tmp[x] ^= xor;
-                }
+                key_xor(tmp, 0, len, key);
 
-                uint32_t offset = 0;
-                while(offset < len) { 
-                    utf8_char_validity val = utf8_check_char(tmp, offset);
-                    if(val.valid) {
-                        offset = val.next_offset;
-                    } else {
-                        if(tmp[offset] == 0) {
-                            offset++;
-                        }
-                        break;
-                    }
+                utf8_prefix prefix;
+                utf8_validate_prefix(tmp, len, 0, &prefix);
+                
+                uint32_t offset = prefix.valid_len;
+                if(prefix.nul_offset != UTF8_NO_NUL) {
+                    offset++;
                 }
 
                 const char * encode = string_encode(tmp, offset);
@@ -584,9 +754,19 @@ int fscan_russian(FILE * out, const MemFile * mf, uint32_t min_cyrillic, uint32_
             }
         }
 
+        progress_add(max_len - progress_pos, keys_tried - keys_reported);
+        keys_reported = keys_tried;
+        
         mem_iter = mem_iter->next;
     }
+    
+    progress_stop();
 
+    stats_add(STATS_SLOTS_VISITED, slots);
+    stats_add(STATS_KEYS_TRIED, keys_tried);
+    stats_add(STATS_CANDIDATES_VALIDATED, candidates);
+    stats_phase_end(STATS_PHASE_SCAN, &t_start);
+    
     int ret = free_matches_cnt(matches, ks->key_cnt);
     free_key_set(ks);
     return ret;
@@ -598,9 +778,15 @@ int fscan_russian(FILE * out, const MemFile * mf, uint32_t min_cyrillic, uint32_
  * 
  * Found strings have to be manualy evaluated and added to key file.
  */
-int fscan_english(FILE * out, const MemFile * mf, uint32_t min_offset, uint32_t key_cnt, MemArea * mem_iter) {
+int fscan_english(FILE * out, const MemFile * mf, uint32_t min_offset, uint32_t key_cnt, MemArea * mem_iter, const XrefIndex * xrefs) {
     char tmp[MAX_STRING_LEN * 2];
     
+    StatsMark t_start = stats_phase_begin();
+    uint64_t slots = 0;
+    uint64_t keys_tried = 0;
+    uint64_t candidates = 0;
+    uint64_t keys_reported = 0;
+    
     KeySet * ks = gen_key_set(key_cnt);
     
     // get rid of keys producing mostly valid ascii
@@ -620,13 +806,35 @@ int fscan_english(FILE * out, const MemFile * mf, uint32_t min_offset, uint32_t
 
     uint32_t * matches = init_matches_cnt(ks->key_cnt);
     
+    uint64_t total = 0;
+    for(MemArea * iter = mem_iter; iter; iter = iter->next) {
+        total += iter->len;
+    }
+    progress_start("new-en", total);
+    
     while(mem_iter) {
         fprintf(out, "// scanning 0x%08X to 0x%08X (%u B)" CRLF, (uint32_t)(mem_iter->start - mf->data), (uint32_t)((mem_iter->start - mf->data) + mem_iter->len), mem_iter->len);
 
         uint32_t mem_start = mem_iter->start - mf->data;
         uint32_t max_len = mem_start + (mem_iter->len / 8) * 8;
+        uint32_t progress_pos = mem_start;
 
         for(uint32_t i = mem_start; i < max_len;) {
+            // only slots code actually references are worth checking
+            if(xrefs) {
+                i = xref_index_next(xrefs, i);
+                if(i >= max_len) {
+                    break;
+                }
+                
+                // encrypted strings are word aligned, unaligned targets are
+                // byte loads into the middle of something else
+                if(i & 3) {
+                    i++;
+                    continue;
+                }
+            }
+            
             uint32_t matched_offset = 0;
             uint64_t matched_key = 0;
             uint32_t matched_key_idx = 0;
@@ -634,6 +842,12 @@ int fscan_english(FILE * out, const MemFile * mf, uint32_t min_offset, uint32_t
             uint32_t rem = max_len - i;
             uint32_t len = MIN(rem, MAX_STRING_LEN);
             char * start = (char*)(mf->data + i);
+            
+            if(++slots % PROGRESS_BATCH == 0) {
+                progress_add(i - progress_pos, keys_tried - keys_reported);
+                progress_pos = i;
+                keys_reported = keys_tried;
+            }
 
             for(uint32_t k = 0; k < ks->key_cnt; k++) {
                 memcpy(tmp, start, 8);
@@ -643,27 +857,20 @@ int fscan_english(FILE * out, const MemFile * mf, uint32_t min_offset, uint32_t
                 if(key == 0 && key_cnt != 0) {
                     continue;
                 }
+                keys_tried++;
 
-                for(uint32_t x = 0; x < 8; x++) {
-                    uint8_t xor = (key >> ((x & 7) * 8)) & 0xFF;
-                    tmp[x] ^= xor;
-                }
+                key_xor(tmp, 0, 8, key);
 
                 if(tmp[0] == 0) {
                     continue;
                 }
 
-                uint32_t offset = 0;
-                while(offset < 8) {
-                    utf8_char_validity val = utf8_check_char(tmp, offset);
-                    if(val.valid) {
-                        offset = val.next_offset;
-                    } else {
-                        if(tmp[offset] == 0) {
-                            offset++;
-                        }
-                        break;
-                    }
+                utf8_prefix prefix;
+                utf8_validate_prefix(tmp, 8, 0, &prefix);
+                
+                uint32_t offset = prefix.valid_len;
+                if(prefix.nul_offset != UTF8_NO_NUL) {
+                    offset++;
                 }
 
                 uint8_t is_space = 0;
@@ -672,27 +879,18 @@ int fscan_english(FILE * out, const MemFile * mf, uint32_t min_offset, uint32_t
                 }
 
                 if(offset == 8 || is_space) {
+                    candidates++;
                     memcpy(tmp, start, len);
 
-                    for(uint32_t x = 0; x < len; x++) {
-                        uint8_t xor = (key >> ((x & 7) * 8)) & 0xFF;
-                        tmp[x] ^= xor;
-                    }
+                    key_xor(tmp, 0, len, key);
 
+                    utf8_validate_prefix(tmp, len, 0, &prefix);
+                    
                     uint8_t zero_term = 0;
-                    uint32_t offset = 0;
-                    while(offset < len) {
-                        utf8_char_validity val = utf8_check_char(tmp, offset);
-                        if(val.valid) {
-                            offset = val.next_offset;
-                        } else {
-                            if(tmp[offset] == 0) {
-                                zero_term = 1;
-                                offset++;
-                                break;
-                            }
-                            break;
-                        }
+                    uint32_t offset = prefix.valid_len;
+                    if(prefix.nul_offset != UTF8_NO_NUL) {
+                        zero_term = 1;
+                        offset++;
                     }
                     
                     // either possible partial or full
@@ -710,22 +908,14 @@ int fscan_english(FILE * out, const MemFile * mf, uint32_t min_offset, uint32_t
                 memcpy(tmp, start, len);
                 uint64_t key = matched_key;
 
-                for(uint32_t x = 0; x < len; x++) {
-                    uint8_t xor = (key >> ((x & 7) * 8)) & 0xFF;
-                    tmp[x] ^= xor;
-                }
+                key_xor(tmp, 0, len, key);
 
-                uint32_t offset = 0;
-                while(offset < len) { 
-                    utf8_char_validity val = utf8_check_char(tmp, offset);
-                    if(val.valid) {
-                        offset = val.next_offset;
-                    } else {
-                        if(tmp[offset] == 0) {
-                            offset++;
-                        }
-                        break;
-                    }
+                utf8_prefix prefix;
+                utf8_validate_prefix(tmp, len, 0, &prefix);
+                
+                uint32_t offset = prefix.valid_len;
+                if(prefix.nul_offset != UTF8_NO_NUL) {
+                    offset++;
                 }
 
                 const char * encode = string_encode(tmp, offset);
@@ -746,94 +936,513 @@ int fscan_english(FILE * out, const MemFile * mf, uint32_t min_offset, uint32_t
             }
         }
 
+        progress_add(max_len - progress_pos, keys_tried - keys_reported);
+        keys_reported = keys_tried;
+        
         mem_iter = mem_iter->next;
     }
+    
+    progress_stop();
+
+    stats_add(STATS_SLOTS_VISITED, slots);
+    stats_add(STATS_KEYS_TRIED, keys_tried);
+    stats_add(STATS_CANDIDATES_VALIDATED, candidates);
+    stats_phase_end(STATS_PHASE_SCAN, &t_start);
+    
+    int ret = free_matches_cnt(matches, ks->key_cnt);
+    free_key_set(ks);
+    return ret;
+}
+
+typedef struct {
+    uint32_t offset;
+    uint32_t key_idx;
+} SlotHit;
+
+static int slot_hit_compare(const void * a, const void * b) {
+    const SlotHit * ha = a;
+    const SlotHit * hb = b;
+    
+    if(ha->offset != hb->offset) {
+        return ha->offset < hb->offset ? -1 : 1;
+    }
+    
+    if(ha->key_idx != hb->key_idx) {
+        return ha->key_idx < hb->key_idx ? -1 : 1;
+    }
+    
+    return 0;
+}
+
+/** Looks up already decoded target in slot index, printing all hits ordered
+ * by address.
+ */
+static uint32_t fscan_string_indexed(FILE * f, const MemFile * mf, const KeySet * ks, uint32_t key_start, const SlotIndex * idx, const char * target, uint32_t * matches) {
+    char tmp[MAX_STRING_LEN];
+    
+    uint32_t max_len = (mf->len / 8) * 8;
+    
+    uint32_t tgt_len = strlen(target);
+    uint32_t tgt_len_compare = MIN(tgt_len, 8);
+    
+    uint64_t tgt_val = 0;
+    memcpy(&tgt_val, target, tgt_len_compare);
+    
+    uint32_t hit_cnt = 0;
+    uint32_t hit_max = 256;
+    SlotHit * hits = malloc(sizeof(*hits) * hit_max);
+    
+    stats_add(STATS_KEYS_TRIED, ks->key_cnt - key_start);
+    
+    for(uint32_t k = key_start; k < ks->key_cnt; k++) {
+        uint64_t needle = tgt_val ^ ks->keys[k];
+        
+        for(uint32_t i = slot_index_find(idx, needle); i != SLOT_NONE; i = slot_index_next(idx, i, needle)) {
+            if(hit_cnt == hit_max) {
+                hit_max *= 2;
+                hits = realloc(hits, sizeof(*hits) * hit_max);
+            }
+            
+            hits[hit_cnt++] = (SlotHit){ .offset = i, .key_idx = k };
+        }
+    }
+    
+    // keep output ordered by address, same as plain slot walk
+    qsort(hits, hit_cnt, sizeof(*hits), slot_hit_compare);
+    
+    for(uint32_t h = 0; h < hit_cnt; h++) {
+        uint32_t i = hits[h].offset;
+        uint32_t k = hits[h].key_idx;
+        uint64_t key = ks->keys[k];
+        
+        uint32_t rem = max_len - i;
+        uint32_t len = MIN(rem, MAX_STRING_LEN);
+        
+        memcpy(tmp, mf->data + i, len);
+
+        key_xor(tmp, 0, len, key);
+
+        uint32_t offset = 0;
+        while(offset < len) {
+            utf8_char_validity val = utf8_check_char_unchecked(tmp, offset);
+            if(val.valid) {
+                offset = val.next_offset;
+            } else {
+                if(tmp[offset] == 0) {
+                    offset++;
+                }
+                break;
+            }
+        }
+
+        const char * encode = string_encode(tmp, offset);
+
+        char buf[256];
+        snprintf(buf, sizeof(buf), "   at 0x%08X key 0x%016" PRIx64 " / %-3u", i, key, k);
+        fprintf(f, "%-50s [%-3u]: '%s'\n", buf, offset, encode);
+
+        matches[k]++;
+    }
+    
+    free(hits);
+    
+    return hit_cnt;
+}
+
+typedef struct _ResidentSlots ResidentSlots;
+
+typedef struct _ResidentSlots {
+    const MemFile * mf;
+    SlotIndex * slots[9];
+    ResidentSlots * next;
+} ResidentSlots;
+
+static ResidentSlots * resident_slots = NULL;
+static pthread_mutex_t resident_slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t resident_slots_once = PTHREAD_ONCE_INIT;
+
+static SlotIndex * slot_index_build(const MemFile * mf, uint32_t compare_len) {
+    uint64_t mask = 0;
+    memset(&mask, 0xFF, compare_len);
+    
+    return slot_index_init(mf, mask);
+}
+
+/** Slot indexes are masked by compared length, so keep one per length.
+ */
+static const SlotIndex * slot_index_get(SlotIndex ** cache, const MemFile * mf, const char * target) {
+    uint32_t compare_len = MIN(strlen(target), 8);
+    const SlotIndex * res = NULL;
+    
+    pthread_mutex_lock(&resident_slots_lock);
+    for(ResidentSlots * iter = resident_slots; iter && !res; iter = iter->next) {
+        if(iter->mf == mf) {
+            res = iter->slots[compare_len];
+        }
+    }
+    pthread_mutex_unlock(&resident_slots_lock);
+    
+    if(res) {
+        return res;
+    }
+    
+    if(!cache[compare_len]) {
+        cache[compare_len] = slot_index_build(mf, compare_len);
+    }
+    
+    return cache[compare_len];
+}
+
+static void resident_slots_fork_prepare(void) {
+    pthread_mutex_lock(&resident_slots_lock);
+}
+
+static void resident_slots_fork_release(void) {
+    pthread_mutex_unlock(&resident_slots_lock);
+}
+
+static void resident_slots_once_init(void) {
+    pthread_atfork(resident_slots_fork_prepare, resident_slots_fork_release, resident_slots_fork_release);
+}
+
+static uint32_t resident_slots_len(const char * lookup) {
+    char target[strlen(lookup) + 1];
+    snprintf(target, sizeof(target), "%s", lookup);
+    string_decode(target, sizeof(target));
+    
+    return MIN(strlen(target), 8);
+}
+
+static ResidentSlots * resident_slots_find(const MemFile * mf) {
+    ResidentSlots * res = resident_slots;
+    while(res && res->mf != mf) {
+        res = res->next;
+    }
+    
+    return res;
+}
+
+/** Keeps slot index needed to look up given string resident for rest of
+ * process lifetime, see code_analysis_retain.
+ */
+void scan_string_retain(const MemFile * mf, const char * lookup) {
+    uint32_t compare_len = resident_slots_len(lookup);
+    
+    if(scan_string_retained(mf, lookup)) {
+        return;
+    }
+    
+    pthread_once(&resident_slots_once, resident_slots_once_init);
+    
+    // built without lock, so forks are not held up by it
+    SlotIndex * slots = slot_index_build(mf, compare_len);
+    
+    pthread_mutex_lock(&resident_slots_lock);
+    
+    ResidentSlots * res = resident_slots_find(mf);
+    if(!res) {
+        res = calloc(1, sizeof(*res));
+        res->mf = mf;
+        res->next = resident_slots;
+        resident_slots = res;
+    }
+    
+    if(!res->slots[compare_len]) {
+        res->slots[compare_len] = slots;
+        slots = NULL;
+    }
+    
+    pthread_mutex_unlock(&resident_slots_lock);
+    
+    slot_index_free(slots);
+}
+
+/** Tells whether slot index for given string is already resident.
+ */
+int scan_string_retained(const MemFile * mf, const char * lookup) {
+    uint32_t compare_len = resident_slots_len(lookup);
+    
+    pthread_mutex_lock(&resident_slots_lock);
+    
+    ResidentSlots * res = resident_slots_find(mf);
+    int retained = res && res->slots[compare_len];
+    
+    pthread_mutex_unlock(&resident_slots_lock);
+    
+    return retained;
+}
+
+/** Drops slot indexes retained for mf, see code_analysis_release.
+ */
+void scan_string_release(const MemFile * mf) {
+    pthread_mutex_lock(&resident_slots_lock);
+    
+    ResidentSlots * res = NULL;
+    for(ResidentSlots ** iter = &resident_slots; *iter; iter = &(*iter)->next) {
+        if((*iter)->mf == mf) {
+            res = *iter;
+            *iter = res->next;
+            break;
+        }
+    }
+    
+    pthread_mutex_unlock(&resident_slots_lock);
+    
+    if(res) {
+        for(uint32_t i = 0; i <= 8; i++) {
+            slot_index_free(res->slots[i]);
+        }
+        free(res);
+    }
+}
+
+static void slot_index_cache_free(SlotIndex ** cache) {
+    for(uint32_t i = 0; i <= 8; i++) {
+        slot_index_free(cache[i]);
+        cache[i] = NULL;
+    }
+}
+
+/** This function is used to resolve specific string by trying all possible keys
+ * on each candidate slot.
+ * 
+ * Instead of decoding every slot with every key, first 8 B of target are 
+ * encoded by each key and looked up in slot index.
+ * 
+ * Reports all (at least partial) matches.
+ */
+int fscan_string(FILE * f, const MemFile * mf, uint32_t key_cnt, const char * target) {
+    fprintf(f, "// %-47s [%-3u]: '%s'\n", "lookup string", (uint32_t)strlen(target) + 1, target);
+    
+    char target2[strlen(target) + 1];
+    snprintf(target2, sizeof(target2), "%s", target);
+    string_decode(target2, sizeof(target2) + 1);
+    
+    KeySet * ks = gen_key_set(key_cnt);
+    ks->keys[0] = 0;
 
+    uint32_t * matches = init_matches_cnt(ks->key_cnt);
+    
+    SlotIndex * cache[9] = { 0 };
+    fscan_string_indexed(f, mf, ks, key_cnt ? 1 : 0, slot_index_get(cache, mf, target2), target2, matches);
+    slot_index_cache_free(cache);
+     
     int ret = free_matches_cnt(matches, ks->key_cnt);
     free_key_set(ks);
     return ret;
 }
 
-/** This function is used to resolve specific string by trying all possible keys
- * on each candidate slot.
- * 
- * Reports all (at least partial) matches.
+/** Same as fscan_string, but resolves whole list of targets sharing single
+ * key set and slot indexes. Output is grouped per target.
+ */
+int fscan_string_list(FILE * f, const MemFile * mf, uint32_t key_cnt, char ** targets, uint32_t target_cnt) {
+    KeySet * ks = gen_key_set(key_cnt);
+    ks->keys[0] = 0;
+    
+    uint32_t * matches = init_matches_cnt(ks->key_cnt);
+    
+    SlotIndex * cache[9] = { 0 };
+    uint32_t matches_total = 0;
+    
+    for(uint32_t i = 0; i < target_cnt; i++) {
+        const char * target = targets[i];
+        
+        fprintf(f, "// %-47s [%-3u]: '%s'\n", "lookup string", (uint32_t)strlen(target) + 1, target);
+        
+        char target2[strlen(target) + 1];
+        snprintf(target2, sizeof(target2), "%s", target);
+        string_decode(target2, sizeof(target2));
+        
+        uint32_t cnt = fscan_string_indexed(f, mf, ks, key_cnt ? 1 : 0, slot_index_get(cache, mf, target2), target2, matches);
+        
+        if(cnt) {
+            lf_i("found %u matches for \"%s\"", cnt, target);
+        } else {
+            lf_w("no matches found for \"%s\"", target);
+        }
+        
+        fprintf(f, "\n");
+        matches_total += cnt;
+    }
+    
+    slot_index_cache_free(cache);
+    free(matches);
+    free_key_set(ks);
+    
+    if(matches_total) {
+        lf_i("found total of %u matches", matches_total);
+    } else {
+        lf_e("no matches found");
+        return EXIT_FAILURE;
+    }
+    
+    return EXIT_SUCCESS;
+}
+
+typedef struct {
+    // already decoded
+    const char * needle;
+    uint32_t len;
+    const char * name;
+} ImmNeedle;
+
+// needle and key pairs resolved by single pass over stream, bounds matcher
+// state regardless of needle and key count
+#define IMM_BATCH_MAX   0x10000
+
+/** Tries to find short strings materialized by MOV immediates, trying all
+ * keys. Needle and key pairs are resolved IMM_BATCH_MAX at a time by single
+ * pass over stream each, output is grouped per needle in the same order,
+ * cnts receives matches of each needle. List separates needles by empty line
+ * instead of logging matches per key.
+ */
+static uint32_t fscan_immediate(FILE * f, const ImmStream * stream, uint32_t key_cnt, const ImmNeedle * needles, uint32_t needle_cnt, uint32_t * cnts, uint8_t list) {
+    uint32_t cnt_total = 0;
+    
+    // dont forgot to handle 0 as well as special case
+    uint32_t first = key_cnt ? 1 : 0;
+    uint64_t per_needle = (uint64_t)key_cnt - first + 1;
+    uint64_t cand_cnt = per_needle * needle_cnt;
+    uint64_t passes = (cand_cnt + IMM_BATCH_MAX - 1) / IMM_BATCH_MAX;
+    
+    ImmDefine * defs = malloc(sizeof(*defs) * MIN(cand_cnt, IMM_BATCH_MAX));
+    
+    stats_add(STATS_KEYS_TRIED, cand_cnt);
+    
+    progress_start("find-imm", (uint64_t)stream->cnt * 4 * passes);
+    
+    for(uint64_t base = 0; base < cand_cnt; base += IMM_BATCH_MAX) {
+        uint32_t batch = MIN(cand_cnt - base, IMM_BATCH_MAX);
+        
+        for(uint32_t c = 0; c < batch; c++) {
+            const ImmNeedle * needle = &needles[(base + c) / per_needle];
+            
+            defs[c] = (ImmDefine){
+                .key = get_key(first + (base + c) % per_needle),
+                .data = needle->needle,
+                .len = needle->len,
+                .offset = 0,
+            };
+        }
+        
+        ImmResult ** res = imm_stream_lookup_batch(stream, defs, batch, 10);
+        progress_add((uint64_t)stream->cnt * 4, batch);
+        
+        for(uint32_t c = 0; c < batch; c++) {
+            uint32_t n = (base + c) / per_needle;
+            uint32_t i = first + (base + c) % per_needle;
+            const ImmNeedle * needle = &needles[n];
+            
+            // needle may span passes, header and tail go with its first and last key
+            if(i == first) {
+                fprintf(f, "// %-47s [%-3u]: '%s'\n", "lookup immediate", needle->len + 1, needle->name);
+                cnts[n] = 0;
+            }
+            
+            uint32_t cnt_matches = 0;
+            ImmResult * iter_start = res[c];
+            ImmResult * iter = iter_start;
+
+            if(iter->matches_cnt != 0) {
+                const char * encode = string_encode(needle->needle, needle->len);
+                
+                while(iter) {
+                    ImmMatch * m = iter->matches;
+                    while(m) {
+                        char buf[256];
+                        snprintf(buf, sizeof(buf), "   at 0x%08X key 0x%016" PRIx64 " / %-3u", m->offsets[0], get_key(i), i);
+                        fprintf(f, "%-50s [%-3u]: '%s'\n", buf, needle->len + 1, encode);
+
+                        cnt_matches++;
+                        m = m->next;
+                    }
+                    iter = iter->next;
+                }
+            }
+
+            imm_result_free(iter_start);
+
+            if(cnt_matches) {
+                cnts[n] += cnt_matches;
+                
+                if(!list) {
+                    lf_i("found %u matches using key %u", cnt_matches, i);
+                }
+            }
+            
+            if(i == key_cnt) {
+                if(list) {
+                    fprintf(f, "\n");
+                }
+                
+                cnt_total += cnts[n];
+            }
+        }
+        
+        free(res);
+    }
+    
+    progress_stop();
+    
+    free(defs);
+    
+    return cnt_total;
+}
+
+/** Tries to decode string at addr with every key. Only first block is xored
+ * and validated up front, so most keys are rejected without touching the rest.
  */
-int fscan_string(FILE * f, const MemFile * mf, uint32_t key_cnt, const char * target) {
+static uint32_t fscan_decode(FILE * f, const MemFile * mf, const KeySet * ks, uint32_t key_start, uint32_t addr) {
     char tmp[MAX_STRING_LEN];
-        
-    fprintf(f, "// %-47s [%-3u]: '%s'\n", "lookup string", (uint32_t)strlen(target) + 1, target);
-    
-    char target2[strlen(target) + 1];
-    snprintf(target2, sizeof(target2), "%s", target);
-    string_decode(target2, sizeof(target2) + 1);
+    uint32_t cnt_total = 0;
     
+    uint32_t len = mf->len - addr;
+    len = MIN(len, sizeof(tmp));
     
-    KeySet * ks = gen_key_set(key_cnt);
-    ks->keys[0] = 0;
+    // first block covers 8 B plus lookahead of character straddling it
+    uint32_t head = MIN(len, 16);
     
-    uint32_t mem_start = 0;
-    uint32_t max_len = (mf->len / 8) * 8;
+    // validation peeks up to 3 bytes past len, keep tail deterministic
+    memset(tmp, 0, sizeof(tmp));
     
-    uint32_t tgt_len = strlen(target2);
-    uint32_t tgt_len_compare = MIN(tgt_len, 8);
-
-    uint32_t * matches = init_matches_cnt(ks->key_cnt);
+    stats_add(STATS_KEYS_TRIED, ks->key_cnt - key_start);
     
-    for(uint32_t i = mem_start; i < max_len;) {
-        uint32_t rem = max_len - i;
-        uint32_t len = MIN(rem, MAX_STRING_LEN);
-        char * start = (char*)(mf->data + i);
-
-        for(uint32_t k = key_cnt ? 1 : 0; k < ks->key_cnt; k++) {
-            memcpy(tmp, start, 8);
-            uint64_t key = ks->keys[k];
-
-            for(uint32_t x = 0; x < 8; x++) {
-                uint8_t xor = (key >> ((x & 7) * 8)) & 0xFF;
-                tmp[x] ^= xor;
-            }
+    for(uint32_t i = key_start; i < ks->key_cnt; i++) {
+        uint64_t key = ks->keys[i];
+        
+        memcpy(tmp, mf->data + addr, head);
+        key_xor(tmp, 0, head, key);
+        
+        // walk is deterministic, so continuing past 8 B gives the same result
+        // as walking whole payload in one go
+        utf8_prefix prefix;
+        utf8_validate_prefix(tmp, MIN(len, 8), 1, &prefix);
+        
+        if(prefix.valid_len >= 8 && len > 8) {
+            memcpy(tmp + head, mf->data + addr + head, len - head);
+            key_xor(tmp, head, len, key);
+            
+            utf8_validate_prefix(tmp, len, 1, &prefix);
+        }
+        
+        uint32_t offset = prefix.valid_len;
 
-            if(memcmp(tmp, target2, tgt_len_compare) == 0) {
-                memcpy(tmp, start, len);
+        if(offset < len && offset != 0 && tmp[offset] == 0) {
+            const char * encode = string_encode(tmp, offset);
+            offset++;
 
-                for(uint32_t x = 0; x < len; x++) {
-                    uint8_t xor = (key >> ((x & 7) * 8)) & 0xFF;
-                    tmp[x] ^= xor;
-                }
-                
-                uint32_t offset = 0;
-                while(offset < len) {
-                    utf8_char_validity val = utf8_check_char_unchecked(tmp, offset);
-                    if(val.valid) {
-                        offset = val.next_offset;
-                    } else {
-                        if(tmp[offset] == 0) {
-                            offset++;
-                        }
-                        break;
-                    }
-                }
-                
-                const char * encode = string_encode(tmp, offset);
+            char buf[256];
+            snprintf(buf, sizeof(buf), "   at 0x%08X key 0x%016" PRIx64 " / %-3u", addr, key, i);
+            fprintf(f, "%-50s [%-3u]: '%s'\n", buf, offset, encode);
 
-                char buf[256];
-                snprintf(buf, sizeof(buf), "   at 0x%08X key 0x%016" PRIx64 " / %-3u", i, key, k);
-                fprintf(f, "%-50s [%-3u]: '%s'\n", buf, offset, encode);
-                
-                matches[k]++;
-            }
+            cnt_total++;
         }
-
-        i += 8;
     }
-     
-    int ret = free_matches_cnt(matches, ks->key_cnt);
-    free_key_set(ks);
-    return ret;
+    
+    return cnt_total;
 }
 
-static void print_data_ref(FILE * f, TextReference * ref, DataRef * iter) {
+static void print_data_ref(OutBuf * ob, TextReference * ref, DataRef * iter) {
     uint8_t raw[ref->text_length];
     
     const uint8_t * src = (const uint8_t*)ref->text;
@@ -846,25 +1455,84 @@ static void print_data_ref(FILE * f, TextReference * ref, DataRef * iter) {
     while(iter) {
         uint32_t iter_cnt = (iter->len + 7) / 8;
         
-        fprintf(f, "// at 0x%08X diff=%u\n", iter->offset, iter->len);
+        ob_lit(ob, "// at 0x");
+        ob_hex(ob, iter->offset, 8, 1);
+        ob_lit(ob, " diff=");
+        ob_u32(ob, iter->len, 0);
+        ob_lit(ob, "\n");
 
         for(uint32_t i = 0; i < iter_cnt; i++) {
             uint32_t raw_idx = i * 8;
             uint32_t rem = iter->len - raw_idx;
             rem = MIN(rem, 8);
 
-            fprintf(f, "\tdat=0x%08X;offset=%u;len=%u;imm=0x", iter->offset + raw_idx, raw_idx, rem);
-
-            for(uint32_t j = rem; j --> 0;) {
-                fprintf(f, "%02X", raw[raw_idx + j]);
-            }
-            fprintf(f, "\n");
+            ob_lit(ob, "\tdat=0x");
+            ob_hex(ob, iter->offset + raw_idx, 8, 1);
+            ob_lit(ob, ";offset=");
+            ob_u32(ob, raw_idx, 0);
+            ob_lit(ob, ";len=");
+            ob_u32(ob, rem, 0);
+            ob_lit(ob, ";imm=0x");
+            ob_hex_rev(ob, raw + raw_idx, rem);
+            ob_lit(ob, "\n");
         }
 
         iter = iter->next;
     }
 }
 
+/** Encodes string straight into output buffer.
+ */
+static void print_encoded(OutBuf * ob, const char * text) {
+    char * dst = ob_reserve(ob, MAX_STRING_LEN * 2);
+    if(dst) {
+        ob_commit(ob, string_encode_into(dst, MAX_STRING_LEN * 2, text, UINT32_MAX));
+    }
+}
+
+/** key=0x%016llx;id=%-40s// [%-3u]: '%s'
+ */
+static void print_key_line(OutBuf * ob, const TextReference * ref) {
+    ob_lit(ob, "key=0x");
+    ob_hex(ob, ref->key, 16, 0);
+    ob_lit(ob, ";id=");
+    ob_str_pad(ob, ref->name, 40);
+    ob_lit(ob, "// [");
+    ob_u32(ob, ref->text_length, 3);
+    ob_lit(ob, "]: '");
+    print_encoded(ob, ref->text);
+    ob_lit(ob, "'" CRLF);
+}
+
+/** // %-10s[k=0x%016llx / %-3u  len=%-5u]: '%s', mismatched references
+ * also show their match counts.
+ */
+static void print_comment_line(OutBuf * ob, const TextReference * ref, uint8_t counts) {
+    ob_lit(ob, "// ");
+    ob_str_pad(ob, ref->name, 10);
+    ob_lit(ob, "[k=0x");
+    ob_hex(ob, ref->key, 16, 0);
+    ob_lit(ob, " / ");
+    ob_u32(ob, ref->key_idx, 3);
+    if(counts) {
+        ob_lit(ob, "  p=");
+        ob_u32(ob, ref->match_partial, 0);
+        ob_lit(ob, "  f=");
+        ob_u32(ob, ref->match_full, 0);
+    }
+    ob_lit(ob, "  len=");
+    ob_u32(ob, ref->text_length, 5);
+    ob_lit(ob, "]: '");
+    print_encoded(ob, ref->text);
+    ob_lit(ob, "'" CRLF);
+}
+
+static void print_section(OutBuf * ob, const char * name) {
+    ob_lit(ob, "//------------------------" CRLF "// [");
+    ob_str(ob, name);
+    ob_lit(ob, "]" CRLF "//------------------------" CRLF CRLF);
+}
+
 MemArea * text_reference_match_full(TextReference * refs, uint32_t ref_len, const MemFile * mf, uint32_t mem_start, uint32_t mem_len) {
     //char tmp[MAX_STRING_LEN];
     // 0x005A0000 0x38000
@@ -874,6 +1542,9 @@ MemArea * text_reference_match_full(TextReference * refs, uint32_t ref_len, cons
         lf_e("data not aligned to %u B", (uint32_t)sizeof(uint64_t));
     }
     
+    StatsMark t_start = stats_phase_begin();
+    uint64_t slots = 0;
+    
     MemArea * memarea_start = NULL;
     MemArea * memarea_last = NULL;
     
@@ -902,6 +1573,7 @@ MemArea * text_reference_match_full(TextReference * refs, uint32_t ref_len, cons
         uint32_t rem = mem_end - i;
         uint32_t len = MIN(rem, MAX_STRING_LEN);
         char * start = (char*)(mf->data + i);
+        slots++;
         
         TextReference * matched = NULL;
         uint32_t max_matched_length = 0;
@@ -981,6 +1653,9 @@ MemArea * text_reference_match_full(TextReference * refs, uint32_t ref_len, cons
         memarea_link(&memarea_start, &memarea_last, mf->data + mem_start, mem_end - mem_start);
     }
 
+    stats_add(STATS_SLOTS_VISITED, slots);
+    stats_phase_end(STATS_PHASE_MATCH_FULL, &t_start);
+    
     return memarea_start;
 }
 
@@ -991,6 +1666,9 @@ MemArea * text_reference_match_partial(TextReference * refs, uint32_t ref_len, c
         return NULL;
     }
     
+    StatsMark t_start = stats_phase_begin();
+    uint64_t slots = 0;
+    
     MemArea * memarea_start = NULL;
     MemArea * memarea_last = NULL;
         
@@ -1018,6 +1696,7 @@ MemArea * text_reference_match_partial(TextReference * refs, uint32_t ref_len, c
             //uint32_t rem = mem_end - i;
             //uint32_t len = MIN(rem, MAX_STRING_LEN);
             char * start = (char*)(mf->data + i);
+            slots++;
 
             TextReference * matched = NULL;
             uint32_t max_matched_length = 0;
@@ -1080,6 +1759,10 @@ MemArea * text_reference_match_partial(TextReference * refs, uint32_t ref_len, c
     }
     
     memarea_free_chain(area);
+    
+    stats_add(STATS_SLOTS_VISITED, slots);
+    stats_phase_end(STATS_PHASE_MATCH_PARTIAL, &t_start);
+    
     return memarea_start;
 }
 
@@ -1088,10 +1771,7 @@ MemArea * text_reference_match(TextReference * refs, uint32_t ref_len, const Mem
     for(uint32_t i = 0; i < ref_len; i++) {
         TextReference * ref = &refs[i];
         
-        for(uint32_t i = 0; i < ref->text_length; i++) {
-            uint8_t xor = (ref->key >> ((i & 7) * 8)) & 0xFF;
-            ref->text[i] ^= xor;
-        }
+        key_xor(ref->text, 0, ref->text_length, ref->key);
     }
     
     MemArea * result = text_reference_match_full(refs, ref_len, mf, mem_start, mem_len);
@@ -1101,12 +1781,11 @@ MemArea * text_reference_match(TextReference * refs, uint32_t ref_len, const Mem
     for(uint32_t i = 0; i < ref_len; i++) {
         TextReference * ref = &refs[i];
 
-        for(uint32_t i = 0; i < ref->text_length; i++) {
-            uint8_t xor = (ref->key >> ((i & 7) * 8)) & 0xFF;
-            ref->text[i] ^= xor;
-        }
+        key_xor(ref->text, 0, ref->text_length, ref->key);
     }
     
+    StatsMark t_dup = stats_phase_begin();
+    
     for(uint32_t i = 0; i < ref_len; i++) {
         TextReference * ref_cur = &refs[i];
         
@@ -1124,21 +1803,308 @@ MemArea * text_reference_match(TextReference * refs, uint32_t ref_len, const Mem
         }
     }
     
+    stats_phase_end(STATS_PHASE_DUPLICATES, &t_dup);
+    
     return result;
 }
 
+/** Loads one needle per line, skipping empty lines.
+ */
+static char ** needle_list_load(const char * file, uint32_t * cnt) {
+    FILE * f = fopen(file, "r");
+    if(!f) {
+        return NULL;
+    }
+    
+    uint32_t needle_max = 64;
+    uint32_t needle_cnt = 0;
+    char ** needles = malloc(sizeof(*needles) * needle_max);
+    
+    char * line = NULL;
+    size_t line_len = 0;
+    ssize_t ret;
+    while((ret = getline(&line, &line_len, f)) > 0) {
+        line[strcspn(line, "\r\n")] = 0;
+        
+        if(line[0] == 0) {
+            continue;
+        }
+        
+        if(needle_cnt == needle_max) {
+            needle_max *= 2;
+            needles = realloc(needles, sizeof(*needles) * needle_max);
+        }
+        
+        needles[needle_cnt++] = strdup(line);
+    }
+    
+    if(line) {
+        free(line);
+    }
+    fclose(f);
+    
+    *cnt = needle_cnt;
+    return needles;
+}
+
+static void needle_list_free(char ** needles, uint32_t cnt) {
+    for(uint32_t i = 0; i < cnt; i++) {
+        free(needles[i]);
+    }
+    free(needles);
+}
+
 int scan_string(const ScanStringArgs * args) {        
     FILE * out = stdout;
     
     if(args->out != NULL) {
         out = args->out;
     }
+    
+    if(args->lookup_file) {
+        uint32_t needle_cnt;
+        char ** needles = needle_list_load(args->lookup_file, &needle_cnt);
+        
+        if(!needles) {
+            lf_e("failed to load \"%s\"", args->lookup_file);
+            return EXIT_FAILURE;
+        } else {
+            lf_i("using needle file \"%s\" (%u needles)", args->lookup_file, needle_cnt);
+        }
+        
+        int ret = fscan_string_list(out, args->dbi_mf, args->key_cnt, needles, needle_cnt);
+        needle_list_free(needles, needle_cnt);
+        
+        return ret;
+    }
 
     int ret = fscan_string(out, args->dbi_mf, args->key_cnt, args->lookup);
         
     return ret;
 }
 
+int scan_immediate(const ScanImmediateArgs * args) {
+    FILE * out = stdout;
+    
+    if(args->out != NULL) {
+        out = args->out;
+    }
+    
+    const MemFile * mf = args->dbi_mf;
+    
+    if(!args->lookup_file) {
+        uint32_t needle_len = strlen(args->lookup);
+        if(needle_len >= 8) {
+            lf_e("lookup too long");
+            return EXIT_FAILURE;
+        }
+        
+        ImmNeedle needle = {
+            .needle = args->lookup,
+            .len = needle_len,
+            .name = args->lookup,
+        };
+        
+        uint32_t cnt;
+        CodeAnalysis * ca = code_analysis_init(mf, ANALYSIS_STREAM);
+        uint32_t cnt_total = fscan_immediate(out, ca->stream, args->key_cnt, &needle, 1, &cnt, 0);
+        code_analysis_free(ca);
+        
+        if(cnt_total) {
+            lf_i("found total of %u matches", cnt_total);
+        } else {
+            lf_e("no matches found");
+            return EXIT_FAILURE;
+        }
+        
+        return EXIT_SUCCESS;
+    }
+    
+    uint32_t needle_cnt;
+    char ** needles = needle_list_load(args->lookup_file, &needle_cnt);
+
+    if(!needles) {
+        lf_e("failed to load \"%s\"", args->lookup_file);
+        return EXIT_FAILURE;
+    } else {
+        lf_i("using needle file \"%s\" (%u needles)", args->lookup_file, needle_cnt);
+    }
+    
+    // decode whole .text once, all needles are matched against it
+    CodeAnalysis * ca = code_analysis_init(mf, ANALYSIS_STREAM);
+    uint32_t cnt_total = 0;
+    
+    ImmNeedle * decoded = malloc(sizeof(*decoded) * (needle_cnt + 1));
+    uint32_t * cnts = malloc(sizeof(*cnts) * (needle_cnt + 1));
+    uint32_t decoded_cnt = 0;
+    
+    for(uint32_t i = 0; i < needle_cnt; i++) {
+        char * needle = strdup(needles[i]);
+        string_decode(needle, strlen(needle) + 1);
+        
+        uint32_t needle_len = strlen(needle);
+        if(needle_len >= 8) {
+            lf_e("lookup too long \"%s\"", needles[i]);
+            free(needle);
+            continue;
+        }
+        
+        decoded[decoded_cnt++] = (ImmNeedle){
+            .needle = needle,
+            .len = needle_len,
+            .name = needles[i],
+        };
+    }
+    
+    fscan_immediate(out, ca->stream, args->key_cnt, decoded, decoded_cnt, cnts, 1);
+    
+    for(uint32_t i = 0; i < decoded_cnt; i++) {
+        if(cnts[i]) {
+            lf_i("found %u matches for \"%s\"", cnts[i], decoded[i].name);
+        } else {
+            lf_w("no matches found for \"%s\"", decoded[i].name);
+        }
+        
+        cnt_total += cnts[i];
+        free((char*)decoded[i].needle);
+    }
+    
+    free(decoded);
+    free(cnts);
+    code_analysis_free(ca);
+    needle_list_free(needles, needle_cnt);
+    
+    if(cnt_total) {
+        lf_i("found total of %u matches", cnt_total);
+    } else {
+        lf_e("no matches found");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/** Lists instructions completing address of addr, so it is visible who uses
+ * the slot.
+ */
+static void fprint_xrefs(FILE * f, const MemFile * mf, const XrefIndex * xrefs, uint32_t addr) {
+    uint32_t cnt;
+    const XrefEntry * e = xref_index_find(xrefs, addr, &cnt);
+    
+    if(!cnt) {
+        fprintf(f, "// no references" CRLF);
+        return;
+    }
+    
+    for(uint32_t i = 0; i < cnt; i++) {
+        uint32_t raw;
+        memcpy(&raw, mf->data + e[i].from, 4);
+        
+        arm64_instr_t d;
+        instr_decode(raw, &d, e[i].from);
+        fprintf(f, "// referenced from %s (adrp at 0x%08X)" CRLF, instr_to_string(&d, raw, e[i].from), e[i].adrp);
+    }
+}
+
+int scan_decode(const ScanDecodeArgs * args) {
+    FILE * out = stdout;
+    
+    if(args->out != NULL) {
+        out = args->out;
+    }
+    
+    const MemFile * mf = args->dbi_mf;
+    uint32_t key_start = args->key_cnt > 0 ? 1 : 0;
+    
+    if(!args->addr_file) {
+        fprintf(out, "// decoding string at 0x%08X" CRLF, args->addr);
+
+        if(mf->len <= args->addr) {
+            lf_e("provided address out of range");
+            return EXIT_FAILURE;
+        }
+        
+        if(args->xref) {
+            XrefIndex * xrefs = xref_index_init(mf);
+            fprint_xrefs(out, mf, xrefs, args->addr);
+            xref_index_free(xrefs);
+        }
+        
+        KeySet * ks = gen_key_set(args->key_cnt);
+        uint32_t cnt_total = fscan_decode(out, mf, ks, key_start, args->addr);
+        free_key_set(ks);
+        
+        if(cnt_total) {
+            lf_i("found total of %u matches", cnt_total);
+        } else {
+            lf_e("no matches found");
+            return EXIT_FAILURE;
+        }
+        
+        return EXIT_SUCCESS;
+    }
+    
+    uint32_t line_cnt;
+    char ** lines = needle_list_load(args->addr_file, &line_cnt);
+
+    if(!lines) {
+        lf_e("failed to load \"%s\"", args->addr_file);
+        return EXIT_FAILURE;
+    } else {
+        lf_i("using address file \"%s\" (%u lines)", args->addr_file, line_cnt);
+    }
+    
+    // keys are generated once and shared by all addresses
+    KeySet * ks = gen_key_set(args->key_cnt);
+    XrefIndex * xrefs = args->xref ? xref_index_init(mf) : NULL;
+    uint32_t cnt_total = 0;
+    
+    for(uint32_t i = 0; i < line_cnt; i++) {
+        uint32_t addr;
+        
+        if(parse_address(lines[i], &addr) != 0) {
+            lf_w("skipping invalid address \"%s\"", lines[i]);
+            continue;
+        }
+        
+        fprintf(out, "// decoding string at 0x%08X" CRLF, addr);
+        
+        if(mf->len <= addr) {
+            lf_e("address 0x%08X out of range", addr);
+            fprintf(out, "\n");
+            continue;
+        }
+        
+        if(xrefs) {
+            fprint_xrefs(out, mf, xrefs, addr);
+        }
+        
+        uint32_t cnt = fscan_decode(out, mf, ks, key_start, addr);
+        
+        if(cnt) {
+            lf_i("found %u matches at 0x%08X", cnt, addr);
+        } else {
+            lf_w("no matches found at 0x%08X", addr);
+        }
+        
+        fprintf(out, "\n");
+        cnt_total += cnt;
+    }
+    
+    xref_index_free(xrefs);
+    free_key_set(ks);
+    needle_list_free(lines, line_cnt);
+    
+    if(cnt_total) {
+        lf_i("found total of %u matches", cnt_total);
+    } else {
+        lf_e("no matches found");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
 int scan_strings_type(const ScanTypeArgs * args) {
     // 0x005A0000, 0x38000
     
@@ -1170,14 +2136,16 @@ int scan_strings_type(const ScanTypeArgs * args) {
     }
     
     MemArea * memarea_start = text_reference_match(refs, ref_len, mf, start, len);
+    XrefIndex * xrefs = args->xref ? xref_index_init(mf) : NULL;
     int ret;
     
     if(args->type == SCAN_RUSSIAN) {
-        ret = fscan_russian(out, mf, args->min_match, args->key_cnt, memarea_start);  
+        ret = fscan_russian(out, mf, args->min_match, args->key_cnt, memarea_start, xrefs);  
     } else {
-        ret = fscan_english(out, mf, args->min_match, args->key_cnt, memarea_start);    
+        ret = fscan_english(out, mf, args->min_match, args->key_cnt, memarea_start, xrefs);    
     }
     
+    xref_index_free(xrefs);
     memarea_free_chain(memarea_start);
     text_reference_free(refs, ref_len);
         
@@ -1221,6 +2189,54 @@ int scan_partials(const ScanPartialsArgs * args) {
     return ret;
 }
 
+/** Looks up immediates only around places where d->key is materialized, as
+ * short strings and partial tails are built right next to their key. Falls
+ * back to whole stream when window is disabled or key has no known site.
+ */
+static ImmResult * imm_lookup_near_key(const ImmStream * stream, const KeySet * ks, uint32_t window, ImmDefine * d, uint32_t tolerance) {
+    uint32_t site_cnt = 0;
+    const KeySite * sites = NULL;
+    
+    if(ks && window) {
+        sites = key_set_sites(ks, d->key, &site_cnt);
+    }
+    
+    if(!sites) {
+        return imm_stream_lookup(stream, d, tolerance);
+    }
+    
+    // sites are sorted, so windows only need merging with previous one
+    uint32_t * ranges = malloc((size_t)site_cnt * 2 * sizeof(uint32_t));
+    uint32_t range_cnt = 0;
+    
+    if(!ranges) {
+        return imm_stream_lookup(stream, d, tolerance);
+    }
+    
+    for(uint32_t i = 0; i < site_cnt; i++) {
+        uint32_t offset = sites[i].offset;
+        uint32_t start = offset > window ? offset - window : 0;
+        uint32_t end = offset + KEY_SITE_LEN + window;
+        
+        if(end < offset) {
+            end = UINT32_MAX;
+        }
+        
+        if(range_cnt && start <= ranges[range_cnt * 2 - 1]) {
+            ranges[range_cnt * 2 - 1] = MAX(ranges[range_cnt * 2 - 1], end);
+        } else {
+            ranges[range_cnt * 2] = start;
+            ranges[range_cnt * 2 + 1] = end;
+            range_cnt++;
+        }
+    }
+    
+    ImmResult * res = imm_stream_lookup_ranges(stream, d, tolerance, ranges, range_cnt);
+    free(ranges);
+    
+    return res;
+}
+
 int scan_blueprint(const ScanBlueprintArgs * args) {
     TextReference * refs;
     uint32_t ref_len;
@@ -1242,25 +2258,30 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
     
     lf_i("loaded %u references", ref_len);
     
-    FILE * out = stdout;
-    
-    if(args->out != NULL) {
-        out = args->out;
-    }
+    OutBuf ob;
+    ob_init(&ob, args->out ? args->out : stdout);
         
     //--------------------------------------------------------------------------
     // FIRST PASS - match known key-string combo
     //--------------------------------------------------------------------------
     MemArea * memarea_start = text_reference_match(refs, ref_len, mf, start, len);
+    
+    // keys and immediates come out of single decoding pass over .text
+    CodeAnalysis * ca = code_analysis_init(mf, ANALYSIS_STREAM | (args->key_window ? ANALYSIS_KEYS : 0));
+    const ImmStream * stream = ca->stream;
+    const KeySet * ks = ca->keys;
+    
+    if(ks) {
+        lf_i("searching immediates within %u B of %u key sites", args->key_window, ks->site_cnt);
+    }
         
     //--------------------------------------------------------------------------
     // SECOND PASS - match partials
     //--------------------------------------------------------------------------
 
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, "// [MATCHED LONG]" CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, CRLF);
+    StatsMark t_out = stats_phase_begin();
+    
+    print_section(&ob, "MATCHED LONG");
     
     uint32_t cnt_matched_full = 0;
     for(uint32_t i = 0; i < ref_len; i++) {
@@ -1272,21 +2293,19 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
             //// at 0x005A1998 diff=8
             //  dat=0x005A1998;offset=0;len=8;imm=0x617F0991BF1A4B97
             
-            fprintf(out, "key=0x%016" PRIx64 ";id=%-40s", ref->key, ref->name);
-            fprintf(out, "// [%-3u]: '%s'" CRLF, ref->text_length, string_encode(ref->text, -1));
+            print_key_line(&ob, ref);
             
-            print_data_ref(out, ref, ref->data);
+            print_data_ref(&ob, ref, ref->data);
             
-            fprintf(out, "\n");
+            ob_lit(&ob, "\n");
             
             cnt_matched_full++;
         }
     }
     
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, "// [MATCHED PARTIAL]" CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, CRLF);
+    stats_phase_end(STATS_PHASE_OUTPUT, &t_out);
+    
+    print_section(&ob, "MATCHED PARTIAL");
     
     uint32_t cnt_matched_partial = 0;
     uint32_t cnt_unmatched_partial = 0;
@@ -1301,10 +2320,9 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
             uint8_t found = 0;
             //lf_i("%-10s[k=0x%016" PRIx64 " / %-3u  len=%-5u  full=%-3u  partial=%-3u]:%s", ref->name, ref->key, ref->key_idx, ref->text_length, ref->match_full, ref->match_partial, string_encode(ref->text, -1));
             
-            fprintf(out, "key=0x%016" PRIx64 ";id=%-40s", ref->key, ref->name);
-            fprintf(out, "// [%-3u]: '%s'" CRLF, ref->text_length, string_encode(ref->text, -1));
+            print_key_line(&ob, ref);
             
-            print_data_ref(out, ref, ref->data);
+            print_data_ref(&ob, ref, ref->data);
             
             ImmDefine d = {
                 .key = ref->key,
@@ -1316,7 +2334,7 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
             // not really interested in final null terminator
             if(ref->text_length > 9) {
                 // first try matching whole partial
-                ImmResult * res = imm_lookup(mf->data, mf->len, &d, 4);
+                ImmResult * res = imm_lookup_near_key(stream, ks, args->key_window, &d, 4);
                 
                 // now, I have seen single partial, which was missing its null
                 // terminator - so, lets try matching without null terminator, 
@@ -1326,30 +2344,32 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
                 // matches found in this way will need to be manualy evaluated!
                 if(res->matches_cnt == 0 && ref->text_length > 10) {
                     d.len--;
-                    res = imm_lookup(mf->data, mf->len, &d, 4);
+                    res = imm_lookup_near_key(stream, ks, args->key_window, &d, 4);
                     d.len++;
                 } 
                 
                 if(res->matches_cnt != 0) {
                     found = 1;
                     
-                    imm_print(out, &d, res);
+                    imm_print(&ob, &d, res);
                     
                     if(d.len != res->raw_len + d.offset) {
                         d.offset += res->raw_len;
-                        imm_print_dummy(out, &d);
+                        imm_print_dummy(&ob, &d);
                     }
                 }
                 
                 imm_result_free(res);
             } else if(ref->text_length == 9) {
                 found = 1;
-                imm_print_dummy(out, &d);
+                imm_print_dummy(&ob, &d);
             }
             
-            fprintf(out, CRLF);
+            ob_lit(&ob, CRLF);
             
             if(found) {
+                StatsMark t_dup = stats_phase_begin();
+                
                 for(uint32_t j = i + 1; j < ref_len; j++) {
                     TextReference * ref_check = &refs[j];
 
@@ -1358,7 +2378,7 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
                     }
                 }
                 
-                
+                stats_phase_end(STATS_PHASE_DUPLICATES, &t_dup);
                 cnt_matched_partial++;
             } else {
                 lf_w("unmatched found key=0x%016" PRIx64 ";id=%-40s [%-3u]: '%s'", ref->key, ref->name, ref->text_length, string_encode(ref->text, -1));
@@ -1370,10 +2390,7 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
         }
     }
     
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, "// [MATCHED SHORT]" CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, CRLF);
+    print_section(&ob, "MATCHED SHORT");
     
     uint32_t cnt_unmatched_short = 0;
     for(uint32_t i = 0; i < ref_len; i++) {
@@ -1394,19 +2411,18 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
                 .offset = 0,
             };
             
-            ImmResult * res = imm_lookup(mf->data, mf->len, &d, 4);
+            ImmResult * res = imm_lookup_near_key(stream, ks, args->key_window, &d, 4);
             
             if(res->matches_cnt != 0) {
                 ref->match_partial = res->matches_cnt;
                 
-                fprintf(out, "key=0x%016" PRIx64 ";id=%-40s", ref->key, ref->name);
-                fprintf(out, "// [%-3u]: '%s'" CRLF, ref->text_length, string_encode(ref->text, -1));
+                print_key_line(&ob, ref);
             
-                imm_print(out, &d, res);
+                imm_print(&ob, &d, res);
                 
-                fprintf(out, CRLF);
+                ob_lit(&ob, CRLF);
             } else {
-                //imm_print_dummy(out, &d);
+                //imm_print_dummy(&ob, &d);
                 cnt_unmatched_short++;
             }
             
@@ -1414,11 +2430,10 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
         }
     }
     
-    fprintf(out, CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, "// [UNMATCHED LONG]" CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, CRLF);
+    t_out = stats_phase_begin();
+    
+    ob_lit(&ob, CRLF);
+    print_section(&ob, "UNMATCHED LONG");
     
     uint32_t cnt_unmatched_long = 0;
     for(uint32_t i = 0; i < ref_len; i++) {
@@ -1429,16 +2444,13 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
         }
         
         if(!(ref->match_full || ref->match_partial) && ref->text_length >= 16) {
-            fprintf(out, "// %-10s[k=0x%016" PRIx64 " / %-3u  len=%-5u]: '%s'" CRLF, ref->name, ref->key, ref->key_idx, ref->text_length, string_encode(ref->text, -1));
+            print_comment_line(&ob, ref, 0);
             cnt_unmatched_long++;
         }
     }
     
-    fprintf(out, CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, "// [UNMATCHED PARTIAL]" CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, CRLF);
+    ob_lit(&ob, CRLF);
+    print_section(&ob, "UNMATCHED PARTIAL");
     
     //uint32_t cnt_unmatched_long = 0;
     for(uint32_t i = 0; i < ref_len; i++) {
@@ -1449,16 +2461,13 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
         }
         
         if(!(ref->match_full || ref->match_partial) && ref->text_length > 8 && ref->text_length < 16) {
-            fprintf(out, "// %-10s[k=0x%016" PRIx64 " / %-3u  len=%-5u]: '%s'" CRLF, ref->name, ref->key, ref->key_idx, ref->text_length, string_encode(ref->text, -1));
+            print_comment_line(&ob, ref, 0);
             //cnt_unmatched_long++;
         }
     }
     
-    fprintf(out, CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, "// [UNMATCHED SHORT]" CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, CRLF);
+    ob_lit(&ob, CRLF);
+    print_section(&ob, "UNMATCHED SHORT");
     
     //uint32_t cnt_unmatched_long = 0;
     for(uint32_t i = 0; i < ref_len; i++) {
@@ -1469,66 +2478,56 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
         }
         
         if(!(ref->match_full || ref->match_partial) && ref->text_length <= 8) {
-            fprintf(out, "// %-10s[k=0x%016" PRIx64 " / %-3u  len=%-5u]: '%s'" CRLF, ref->name, ref->key, ref->key_idx, ref->text_length, string_encode(ref->text, -1));
+            print_comment_line(&ob, ref, 0);
             //cnt_unmatched_long++;
         }
     }
 
-    fprintf(out, CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, "// [DUPLICATES]" CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, CRLF);
+    ob_lit(&ob, CRLF);
+    print_section(&ob, "DUPLICATES");
     
     uint32_t cnt_duplicate = 0;
     for(uint32_t i = 0; i < ref_len; i++) {
         TextReference * ref = &refs[i];
         
         if(ref->duplicate) {
-            fprintf(out, "// %-10s[k=0x%016" PRIx64 " / %-3u  len=%-5u]: '%s'" CRLF, ref->name, ref->key, ref->key_idx, ref->text_length, string_encode(ref->text, -1));
+            print_comment_line(&ob, ref, 0);
             cnt_duplicate++;
         }
     }
     
-    fprintf(out, CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, "// [MISMATCHED]" CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, CRLF);
+    ob_lit(&ob, CRLF);
+    print_section(&ob, "MISMATCHED");
     
     uint32_t cnt_mismatched = 0;
     for(uint32_t i = 0; i < ref_len; i++) {
         TextReference * ref = &refs[i];
         
         if(ref->match_full && ref->match_partial) {
-            fprintf(out, "// %-10s[k=0x%016" PRIx64 " / %-3u  p=%u  f=%u  len=%-5u]: '%s'" CRLF, ref->name, ref->key, ref->key_idx, ref->match_partial, ref->match_full, ref->text_length, string_encode(ref->text, -1));
+            print_comment_line(&ob, ref, 1);
             cnt_mismatched++;
         }
     }
 
-    fprintf(out, CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, "// [MEMORY AREAS]" CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, CRLF);
+    ob_lit(&ob, CRLF);
+    print_section(&ob, "MEMORY AREAS");
     
     MemArea * iter = memarea_start;
     while(iter) {
-        fprintf(out, "// 0x%08X;%u" CRLF, (uint32_t)(iter->start - mf->data), iter->len);
+        ob_lit(&ob, "// 0x");
+        ob_hex(&ob, (uint32_t)(iter->start - mf->data), 8, 1);
+        ob_lit(&ob, ";");
+        ob_u32(&ob, iter->len, 0);
+        ob_lit(&ob, CRLF);
         iter = iter->next;
     }
     
-    fprintf(out, CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, "// [STATS]" CRLF);
-    fprintf(out, "//------------------------" CRLF);
-    fprintf(out, CRLF);
+    ob_lit(&ob, CRLF);
+    print_section(&ob, "STATS");
     
     #define PRINT_BOTH(fmt, ...) do {\
         lf_i(fmt, __VA_ARGS__);\
-        fprintf(out, "//");\
-        fprintf(out, fmt, __VA_ARGS__);\
-        fprintf(out, CRLF);\
+        ob_printf(&ob, "//" fmt CRLF, __VA_ARGS__);\
     } while(0)
     
     lf_i("stats:");
@@ -1539,6 +2538,16 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
     PRINT_BOTH(" unmatched_short:   %u", cnt_unmatched_short);
     PRINT_BOTH(" duplicates:        %u", cnt_duplicate);
     PRINT_BOTH(" mismatched:        %u", cnt_mismatched);
+    
+    int ret = 0;
+    if(ob_close(&ob) != 0) {
+        lf_e("failed to write blueprint");
+        ret = EXIT_FAILURE;
+    }
+    
+    stats_phase_end(STATS_PHASE_OUTPUT, &t_out);
+    
+    code_analysis_free(ca);
         
     for(uint32_t i = 0; i < ref_len; i++) {
         TextReference * ref = &refs[i];
@@ -1546,5 +2555,5 @@ int scan_blueprint(const ScanBlueprintArgs * args) {
     }
     free(refs);
     
-    return 0;
+    return ret;
 }
\ No newline at end of file
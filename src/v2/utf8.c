@@ -23,11 +23,12 @@
  */
 
 /*
-    Okay, this is ugly. Basicaly just edit is_allowed_character when new char
-    is found in russian strings.
+    Okay, this is ugly. Basicaly just edit utf8_ranges.def when new char
+    is found in russian strings, table is regenerated by make.
  */
 
 #include "v2/utf8.h"
+#include "utf8_table.h"
 
 #include <stdint.h>
 
@@ -59,121 +60,20 @@ uint32_t extract_codepoint(const char* str, uint32_t offset, int byte_count) {
     return codepoint;
 }
 
-// Character range validation function
+// Character range validation function, classes come from utf8_ranges.def
 int is_allowed_character(uint32_t codepoint) {
-    // Allow specific control characters: \r (0x0D), \n (0x0A), ESC (0x1B)
-    if (codepoint == 0x0A || codepoint == 0x0D || codepoint == 0x1B) {
-        return UT_GENERIC;
-    }
-    
-    // Allow ASCII printable characters (0x20-0x7E) and space (0x20)
-    if (codepoint >= 0x20 && codepoint <= 0x7E) {
-        if((codepoint >= 'a' && codepoint <= 'z') || (codepoint >= 'A' && codepoint <= 'Z')) {
-            return UT_LETTER;
-        }
-        
-        if(codepoint >= '0' && codepoint <= '9') {
-            return UT_NUMBER;
-        }
-        
-        /*switch(codepoint) {
-            case '`':
-            case '^':
-            case '$':
-                return UT_INVALID;
-            default:
-                break;
-        }*/
-        
-        return UT_GENERIC;
-    }
-    
-    // Allow common Unicode whitespace characters
-    switch (codepoint) {
-        case 0x0009: // HT (Horizontal Tab)
-        case 0x000B: // VT (Vertical Tab) 
-        case 0x000C: // FF (Form Feed)
-        case 0x0020: // SPACE (already covered above but explicit)
-        case 0x00A0: // NO-BREAK SPACE
-        case 0x00B0: // DEGREE
-        case 0x00AB: // 《 
-        case 0x00BB: // 》
-        case 0x1680: // OGHAM SPACE MARK  
-        case 0x2000: // EN QUAD
-        case 0x2001: // EM QUAD
-        case 0x2002: // EN SPACE
-        case 0x2003: // EM SPACE
-        case 0x2004: // THREE-PER-EM SPACE
-        case 0x2005: // FOUR-PER-EM SPACE
-        case 0x2006: // SIX-PER-EM SPACE
-        case 0x2007: // FIGURE SPACE
-        case 0x2008: // PUNCTUATION SPACE
-        case 0x2009: // THIN SPACE
-        case 0x200A: // HAIR SPACE
-        case 0x2026: // Horizontal Ellipsis
-        case 0x2715: // Multiplication X
-        case 0x202F: // NARROW NO-BREAK SPACE
-        case 0x205F: // MEDIUM MATHEMATICAL SPACE
-        case 0x3000: // IDEOGRAPHIC SPACE
-        
-        case 0x27A1: // BLACK RIGHTWARDS ARROW
-        case 0x2B05: // LEFTWARDS BLACK ARROW
-        case 0x2B06: // UPWARDS BLACK ARROW
-        case 0x2B07: // DOWNWARDS BLACK ARROW
-            return UT_GENERIC;
-    }
-    
-    // Allow main Cyrillic block (U+0400–U+04FF)
-    if (codepoint >= 0x0400 && codepoint <= 0x04FF) {        
-        if(codepoint >= 0x0410 && codepoint <= 0x042F) {
-            return UT_CYRILLIC;
-        }
-        
-        if(codepoint >= 0x0430 && codepoint <= 0x044F) {
-            return UT_CYRILLIC;
-        }
-        
-        if(codepoint == 0x0401) {
-            return UT_CYRILLIC;
-        }
-        
-        if(codepoint == 0x0451) {
-            return UT_CYRILLIC;
-        }
-        
-        return UT_INVALID;
-    }
-    
-    // Allow Cyrillic Supplement (U+0500–U+052F)
-    if (codepoint >= 0x0500 && codepoint <= 0x052F) {
+    if (codepoint >= 0x10000) {
         return UT_INVALID;
     }
     
-    // Allow Cyrillic Extended-A (U+2DE0–U+2DFF)
-    if (codepoint >= 0x2DE0 && codepoint <= 0x2DFF) {
-        return UT_INVALID;
-    }
-    
-    // Allow Cyrillic Extended-B (U+A640–U+A69F)
-    if (codepoint >= 0xA640 && codepoint <= 0xA69F) {
-        return UT_INVALID;
-    }
-    
-    // Allow Cyrillic Extended-C (U+1C80–U+1C8F)
-    if (codepoint >= 0x1C80 && codepoint <= 0x1C8F) {
-        return UT_INVALID;
-    }
-    
-    // Reject all other characters
-    return UT_INVALID;
+    return utf8_class_block[utf8_class_page[codepoint >> 8]][codepoint & 0xFF];
 }
 
 utf8_char_validity utf8_check_char(const char* str, uint32_t offset) {
     int type = UT_INVALID;
-    // Single-byte UTF-8 characters have the form 0xxxxxxx
+    // Single-byte UTF-8 characters have the form 0xxxxxxx, ASCII lives in block 0
     if (((uint8_t)str[offset] & 0b10000000) == 0b00000000) {
-        uint32_t codepoint = extract_codepoint(str, offset, 1);
-        if ((type = is_allowed_character(codepoint)) == UT_INVALID) {
+        if ((type = utf8_class_block[0][(uint8_t)str[offset]]) == UT_INVALID) {
             return (utf8_char_validity) { .valid = type, .next_offset = offset };
         }
         return (utf8_char_validity) { .valid = type, .next_offset = offset + 1 };
@@ -314,4 +214,182 @@ utf8_char_validity utf8_check_char_unchecked(const char* str, uint32_t offset) {
     }
 
     return (utf8_char_validity) { .valid = UT_INVALID, .next_offset = offset };
-}
\ No newline at end of file
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <pthread.h>
+
+#define UTF8_HAS_SIMD 1
+#endif
+
+#ifdef UTF8_HAS_SIMD
+
+static inline uint32_t utf8_ctz(uint64_t mask) {
+    return __builtin_ctzll(mask);
+}
+
+static inline uint32_t utf8_popcnt(uint64_t mask) {
+    return __builtin_popcountll(mask);
+}
+
+/** Consumes valid ASCII run in 16 B steps. Returns number of bytes consumed,
+ * which is less than len only when run was broken by something scalar path
+ * has to look at (non-ASCII, NUL, disallowed control char).
+ */
+static uint32_t utf8_ascii_run_sse2(const uint8_t * str, uint32_t len, uint8_t unchecked, utf8_prefix * res) {
+    uint32_t offset = 0;
+    
+    while (offset + 16 <= len) {
+        __m128i b = _mm_loadu_si128((const __m128i*)(str + offset));
+        __m128i valid;
+        
+        // bytes >= 0x80 are negative, so signed compares reject them
+        if (unchecked) {
+            valid = _mm_cmpgt_epi8(b, _mm_setzero_si128());
+        } else {
+            __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(b, _mm_set1_epi8(0x1F)), _mm_cmplt_epi8(b, _mm_set1_epi8(0x7F)));
+            __m128i space = _mm_and_si128(_mm_cmpgt_epi8(b, _mm_set1_epi8(0x08)), _mm_cmplt_epi8(b, _mm_set1_epi8(0x0E)));
+            __m128i esc = _mm_cmpeq_epi8(b, _mm_set1_epi8(0x1B));
+            valid = _mm_or_si128(_mm_or_si128(printable, space), esc);
+        }
+        
+        uint32_t valid_mask = _mm_movemask_epi8(valid);
+        uint32_t run = valid_mask == 0xFFFF ? 16 : utf8_ctz(~valid_mask);
+        
+        // unchecked scalar walk reports every character as UT_GENERIC, so
+        // only checked walk has anything to count
+        if (!unchecked) {
+            uint64_t run_mask = (1ULL << run) - 1;
+            __m128i lower = _mm_or_si128(b, _mm_set1_epi8(0x20));
+            __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+            __m128i number = _mm_and_si128(_mm_cmpgt_epi8(b, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(b, _mm_set1_epi8('9' + 1)));
+            
+            res->letters += utf8_popcnt(_mm_movemask_epi8(letter) & run_mask);
+            res->numbers += utf8_popcnt(_mm_movemask_epi8(number) & run_mask);
+        }
+        
+        offset += run;
+        if (run != 16) {
+            break;
+        }
+    }
+    
+    return offset;
+}
+
+__attribute__((target("avx2")))
+static uint32_t utf8_ascii_run_avx2(const uint8_t * str, uint32_t len, uint8_t unchecked, utf8_prefix * res) {
+    uint32_t offset = 0;
+    
+    while (offset + 32 <= len) {
+        __m256i b = _mm256_loadu_si256((const __m256i*)(str + offset));
+        __m256i valid;
+        
+        if (unchecked) {
+            valid = _mm256_cmpgt_epi8(b, _mm256_setzero_si256());
+        } else {
+            __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(b, _mm256_set1_epi8(0x1F)), _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7F), b));
+            __m256i space = _mm256_and_si256(_mm256_cmpgt_epi8(b, _mm256_set1_epi8(0x08)), _mm256_cmpgt_epi8(_mm256_set1_epi8(0x0E), b));
+            __m256i esc = _mm256_cmpeq_epi8(b, _mm256_set1_epi8(0x1B));
+            valid = _mm256_or_si256(_mm256_or_si256(printable, space), esc);
+        }
+        
+        uint32_t valid_mask = _mm256_movemask_epi8(valid);
+        uint32_t run = valid_mask == 0xFFFFFFFF ? 32 : utf8_ctz(~valid_mask);
+        
+        if (!unchecked) {
+            uint64_t run_mask = (1ULL << run) - 1;
+            __m256i lower = _mm256_or_si256(b, _mm256_set1_epi8(0x20));
+            __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+            __m256i number = _mm256_and_si256(_mm256_cmpgt_epi8(b, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), b));
+            
+            res->letters += utf8_popcnt((uint32_t)_mm256_movemask_epi8(letter) & run_mask);
+            res->numbers += utf8_popcnt((uint32_t)_mm256_movemask_epi8(number) & run_mask);
+        }
+        
+        offset += run;
+        if (run != 32) {
+            break;
+        }
+    }
+    
+    // leftover below 32 B is still worth one or two sse2 steps
+    if (offset + 32 > len) {
+        offset += utf8_ascii_run_sse2(str + offset, len - offset, unchecked, res);
+    }
+    
+    return offset;
+}
+
+typedef uint32_t (*utf8_ascii_run_fn)(const uint8_t*, uint32_t, uint8_t, utf8_prefix*);
+
+static utf8_ascii_run_fn utf8_ascii_run_fn_cpu = NULL;
+static pthread_once_t utf8_ascii_run_once = PTHREAD_ONCE_INIT;
+
+static void utf8_ascii_run_init(void) {
+    __builtin_cpu_init();
+    utf8_ascii_run_fn_cpu = __builtin_cpu_supports("avx2") ? utf8_ascii_run_avx2 : utf8_ascii_run_sse2;
+}
+
+/** Resolved once, validation runs from worker threads of library and build
+ * matrix.
+ */
+static utf8_ascii_run_fn utf8_ascii_run_select(void) {
+    pthread_once(&utf8_ascii_run_once, utf8_ascii_run_init);
+    
+    return utf8_ascii_run_fn_cpu;
+}
+
+#endif
+
+/** Walks str the same way as repeated utf8_check_char (or unchecked variant)
+ * calls would, stopping at first invalid character or once offset reaches
+ * len. ASCII runs are validated and counted 16/32 B at a time.
+ * 
+ * Same as the scalar walk, last character may extend past len, so up to 3
+ * bytes after str + len may be read.
+ */
+void utf8_validate_prefix(const char* str, uint32_t len, uint8_t unchecked, utf8_prefix* res) {
+    uint32_t offset = 0;
+    
+    res->valid_len = 0;
+    res->nul_offset = UTF8_NO_NUL;
+    res->cyrillic = 0;
+    res->letters = 0;
+    res->numbers = 0;
+    
+#ifdef UTF8_HAS_SIMD
+    utf8_ascii_run_fn ascii_run = len >= 16 ? utf8_ascii_run_select() : NULL;
+#endif
+    
+    while (offset < len) {
+#ifdef UTF8_HAS_SIMD
+        if (offset + 16 <= len && (uint8_t)str[offset] < 0x80) {
+            offset += ascii_run((const uint8_t*)str + offset, len - offset, unchecked, res);
+            if (offset >= len) {
+                break;
+            }
+        }
+#endif
+        utf8_char_validity val = unchecked ? utf8_check_char_unchecked(str, offset) : utf8_check_char(str, offset);
+        if (!val.valid) {
+            if (str[offset] == 0) {
+                res->nul_offset = offset;
+            }
+            break;
+        }
+        
+        if (val.valid == UT_CYRILLIC) {
+            res->cyrillic++;
+        } else if (val.valid == UT_LETTER) {
+            res->letters++;
+        } else if (val.valid == UT_NUMBER) {
+            res->numbers++;
+        }
+        
+        offset = val.next_offset;
+    }
+    
+    res->valid_len = offset;
+}
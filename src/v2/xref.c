@@ -0,0 +1,198 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "v2/xref.h"
+#include "v2/nro.h"
+#include "v2/analysis.h"
+#include "log.h"
+
+#define BITS(v,h,l) (((v)>>(l)) & ((1u<<((h)-(l)+1))-1))
+
+#define IS_ADRP(i)      (((i) & 0x9F000000) == 0x90000000)
+#define IS_ADD_X_IMM(i) (((i) & 0xFF800000) == 0x91000000)
+// LDR (immediate, unsigned offset) of any size, general or SIMD register
+#define IS_LDR_UIMM(i)  (((i) & 0x3B400000) == 0x39400000)
+
+typedef struct {
+    uint32_t page;
+    uint32_t pc;
+} PendingAdrp;
+
+struct _XrefBuilder {
+    XrefIndex * idx;
+    uint32_t cap;
+    PendingAdrp pending[32];
+};
+
+static void xref_append(XrefBuilder * xb, uint32_t target, uint32_t from, uint32_t adrp) {
+    XrefIndex * idx = xb->idx;
+    
+    if(idx->cnt == xb->cap) {
+        xb->cap = xb->cap ? xb->cap * 2 : 1024;
+        idx->entries = realloc(idx->entries, sizeof(*idx->entries) * xb->cap);
+    }
+
+    XrefEntry * e = &idx->entries[idx->cnt++];
+    e->target = target;
+    e->from = from;
+    e->adrp = adrp;
+}
+
+static int xref_compare(const void * a, const void * b) {
+    const XrefEntry * ea = a;
+    const XrefEntry * eb = b;
+
+    if(ea->target != eb->target) {
+        return ea->target < eb->target ? -1 : 1;
+    }
+    if(ea->from != eb->from) {
+        return ea->from < eb->from ? -1 : 1;
+    }
+    return 0;
+}
+
+XrefBuilder * xref_builder_init(void) {
+    XrefBuilder * xb = calloc(1, sizeof(*xb));
+    xb->idx = calloc(1, sizeof(*xb->idx));
+    
+    return xb;
+}
+
+/** Resolves ADRP + ADD / LDR pairs into absolute addresses. Register state is
+ * tracked only loosely: ADRP stays pending for XREF_WINDOW instructions or
+ * until its register is overwritten by ADD / LDR, which is good enough for
+ * compiler generated code.
+ */
+void xref_builder_step(void * ctx, const arm64_instr_t * d, uint32_t i, uint32_t pc) {
+    XrefBuilder * xb = ctx;
+    
+    if(IS_ADRP(i)) {
+        int64_t imm = (BITS(i, 23, 5) << 2) | BITS(i, 30, 29);
+        imm = (imm ^ (1 << 20)) - (1 << 20);
+
+        PendingAdrp * p = &xb->pending[BITS(i, 4, 0)];
+        p->page = (uint32_t)((pc & ~0xFFFu) + (imm << 12));
+        p->pc = pc + 4;
+        return;
+    }
+
+    uint8_t is_add = IS_ADD_X_IMM(i);
+    if(!is_add && !IS_LDR_UIMM(i)) {
+        return;
+    }
+
+    uint32_t rn = BITS(i, 9, 5);
+    uint32_t rd = BITS(i, 4, 0);
+    PendingAdrp * p = &xb->pending[rn];
+
+    // pc of 0 marks empty slot, adrp at 0 is not possible as header is there
+    if(p->pc == 0 || pc - p->pc >= XREF_WINDOW * 4) {
+        return;
+    }
+
+    uint32_t off;
+    if(is_add) {
+        off = BITS(i, 21, 10) << (BITS(i, 22, 22) ? 12 : 0);
+    } else {
+        uint32_t scale = BITS(i, 31, 30);
+        // 128 bit SIMD load
+        if((i & 0x04800000) == 0x04800000) {
+            scale = 4;
+        }
+        off = BITS(i, 21, 10) << scale;
+    }
+
+    xref_append(xb, p->page + off, pc, p->pc - 4);
+
+    // destination is overwritten, SIMD loads do not touch general registers
+    if(is_add || !(i & 0x04000000)) {
+        xb->pending[rd].pc = 0;
+    }
+}
+
+XrefIndex * xref_builder_finish(XrefBuilder * xb) {
+    XrefIndex * idx = xb->idx;
+    free(xb);
+    
+    qsort(idx->entries, idx->cnt, sizeof(*idx->entries), xref_compare);
+    
+    return idx;
+}
+
+XrefIndex * xref_index_init(const MemFile * mf) {
+    NroSegment seg[NRO_SEG_CNT];
+    if(nro_segments(mf, seg) != 0) {
+        lf_w("not a nro, resolving references over whole file");
+    }
+    
+    CodeAnalysis * ca = code_analysis_init(mf, ANALYSIS_XREFS);
+    XrefIndex * idx = ca->xrefs;
+    
+    // caller owns result, resident one has to be copied
+    if(ca->borrowed & ANALYSIS_XREFS) {
+        idx = calloc(1, sizeof(*idx));
+        idx->cnt = ca->xrefs->cnt;
+        idx->entries = malloc(sizeof(*idx->entries) * (idx->cnt + 1));
+        memcpy(idx->entries, ca->xrefs->entries, sizeof(*idx->entries) * idx->cnt);
+    } else {
+        ca->xrefs = NULL;
+    }
+    
+    code_analysis_free(ca);
+    
+    lf_i("resolved %u references in 0x%08X to 0x%08X", idx->cnt, seg[NRO_SEG_TEXT].offset, seg[NRO_SEG_TEXT].offset + seg[NRO_SEG_TEXT].len);
+
+    return idx;
+}
+
+void xref_index_free(XrefIndex * idx) {
+    if(idx) {
+        free(idx->entries);
+        free(idx);
+    }
+}
+
+static uint32_t xref_lower_bound(const XrefIndex * idx, uint32_t target) {
+    uint32_t lo = 0;
+    uint32_t hi = idx->cnt;
+
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if(idx->entries[mid].target < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/** Returns all references of target, NULL when there are none.
+ */
+const XrefEntry * xref_index_find(const XrefIndex * idx, uint32_t target, uint32_t * cnt) {
+    uint32_t first = xref_lower_bound(idx, target);
+
+    uint32_t last = first;
+    while(last < idx->cnt && idx->entries[last].target == target) {
+        last++;
+    }
+
+    *cnt = last - first;
+    return *cnt ? &idx->entries[first] : NULL;
+}
+
+/** Returns lowest referenced address >= target, UINT32_MAX when there is none.
+ */
+uint32_t xref_index_next(const XrefIndex * idx, uint32_t target) {
+    uint32_t pos = xref_lower_bound(idx, target);
+
+    return pos < idx->cnt ? idx->entries[pos].target : UINT32_MAX;
+}
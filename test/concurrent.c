@@ -0,0 +1,202 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * Concurrency test of libdbipatcher used by make test.
+ *
+ * Blueprint, patch and string search are first run serially, then every one
+ * of them again from its own thread with its own context, all at once and
+ * CONCURRENT_ROUNDS times in a row. Outputs of concurrent runs must be equal
+ * to serial ones byte by byte. String search looks up start of first
+ * dictionary record.
+ *
+ * usage: concurrent <nro> <dict.txt> <lang.txt> <work dir>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "dbipatcher.h"
+#include "log.h"
+#include "v2/strings.h"
+
+#define CONCURRENT_ROUNDS   3
+// threads per operation
+#define CONCURRENT_COPIES   2
+#define FIND_NEEDLE_LEN     12
+#define FIND_KEYS           16
+
+typedef enum {
+    OP_BLUEPRINT = 0,
+    OP_PATCH,
+    OP_FIND_STR,
+    OP_CNT,
+} Operation;
+
+static const char * op_names[OP_CNT] = {
+    [OP_BLUEPRINT]  = "blueprint",
+    [OP_PATCH]      = "patch",
+    [OP_FIND_STR]   = "find_str",
+};
+
+static const char * nro_path;
+static const char * dict_path;
+static const char * lang_path;
+static const char * work_dir;
+static char needle[FIND_NEEDLE_LEN + 1];
+
+typedef struct {
+    Operation op;
+    char out[FILENAME_MAX];
+    int ret;
+    pthread_t thread;
+} Job;
+
+static void job_path(char * out, size_t len, Operation op, const char * tag) {
+    snprintf(out, len, "%s/%s.%s", work_dir, op_names[op], tag);
+}
+
+/** Blueprint is patched from serial one, so patch does not depend on
+ * blueprint run next to it.
+ */
+static int job_exec(Operation op, const char * out) {
+    char bp[FILENAME_MAX];
+    job_path(bp, sizeof(bp), OP_BLUEPRINT, "serial");
+
+    // shared analysis cache of user is left alone
+    DbiContext * ctx = dbi_init();
+    dbi_set_cache(ctx, 0);
+    int ret = -1;
+
+    switch(op) {
+        case OP_BLUEPRINT:  ret = dbi_blueprint(ctx, nro_path, dict_path, KEY_WINDOW_DEFAULT, out); break;
+        case OP_PATCH:      ret = dbi_patch(ctx, bp, nro_path, lang_path, out);                   break;
+        case OP_FIND_STR:   ret = dbi_find_str(ctx, nro_path, needle, FIND_KEYS, out);            break;
+        default:            break;
+    }
+
+    dbi_free(ctx);
+
+    return ret;
+}
+
+static void * job_run(void * arg) {
+    Job * job = arg;
+    job->ret = job_exec(job->op, job->out);
+
+    return NULL;
+}
+
+/** Text of first "id;seed;text" line of dictionary.
+ */
+static int load_needle(void) {
+    char line[256];
+    FILE * f = fopen(dict_path, "r");
+    char * text = NULL;
+
+    if(f && fgets(line, sizeof(line), f) && (text = strchr(line, ';')) && (text = strchr(text + 1, ';'))) {
+        snprintf(needle, sizeof(needle), "%s", text + 1);
+        needle[strcspn(needle, "\r\n")] = '\0';
+    }
+
+    if(f) {
+        fclose(f);
+    }
+
+    return needle[0] ? 0 : -1;
+}
+
+static int files_equal(const char * a, const char * b) {
+    FILE * fa = fopen(a, "rb");
+    FILE * fb = fopen(b, "rb");
+    int equal = fa && fb;
+
+    while(equal) {
+        int ca = fgetc(fa);
+        int cb = fgetc(fb);
+
+        if(ca != cb) {
+            equal = 0;
+        } else if(ca == EOF) {
+            break;
+        }
+    }
+
+    if(fa) {
+        fclose(fa);
+    }
+    if(fb) {
+        fclose(fb);
+    }
+
+    return equal;
+}
+
+int main(int argc, char ** argv) {
+    if(argc < 5) {
+        fprintf(stderr, "usage: %s <nro> <dict.txt> <lang.txt> <work dir>\n", argc ? argv[0] : "concurrent");
+        return EXIT_FAILURE;
+    }
+
+    nro_path = argv[1];
+    dict_path = argv[2];
+    lang_path = argv[3];
+    work_dir = argv[4];
+
+    log_set_level(LOG_ERROR);
+
+    if(load_needle() != 0) {
+        fprintf(stderr, "failed to read \"%s\"\n", dict_path);
+        return EXIT_FAILURE;
+    }
+
+    // blueprint first, patch needs it
+    for(Operation op = 0; op < OP_CNT; op++) {
+        char out[FILENAME_MAX];
+        job_path(out, sizeof(out), op, "serial");
+
+        if(job_exec(op, out) != 0) {
+            fprintf(stderr, "serial %s failed\n", op_names[op]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    uint32_t failed = 0;
+
+    for(uint32_t round = 0; round < CONCURRENT_ROUNDS; round++) {
+        Job jobs[OP_CNT * CONCURRENT_COPIES];
+
+        for(uint32_t i = 0; i < OP_CNT * CONCURRENT_COPIES; i++) {
+            char tag[32];
+            snprintf(tag, sizeof(tag), "thread%u", i / OP_CNT);
+
+            jobs[i].op = i % OP_CNT;
+            job_path(jobs[i].out, sizeof(jobs[i].out), jobs[i].op, tag);
+            pthread_create(&jobs[i].thread, NULL, job_run, &jobs[i]);
+        }
+
+        for(uint32_t i = 0; i < OP_CNT * CONCURRENT_COPIES; i++) {
+            pthread_join(jobs[i].thread, NULL);
+        }
+
+        for(uint32_t i = 0; i < OP_CNT * CONCURRENT_COPIES; i++) {
+            char serial[FILENAME_MAX];
+            job_path(serial, sizeof(serial), jobs[i].op, "serial");
+
+            if(jobs[i].ret != 0 || !files_equal(serial, jobs[i].out)) {
+                fprintf(stderr, "round %u: %s differs from serial run (ret %d)\n", round, jobs[i].out, jobs[i].ret);
+                failed++;
+            }
+        }
+    }
+
+    printf("%u operations on %u threads x %u rounds, %u failed\n", OP_CNT, OP_CNT * CONCURRENT_COPIES, CONCURRENT_ROUNDS, failed);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+/*
+ * To change this license header, choose License Headers in Project Properties.
+ * To change this template file, choose Tools | Templates
+ * and open the template in the editor.
+ */
+
+/*
+ * Build time generator of code point class table used by src/v2/utf8.c.
+ *
+ * Expands src/v2/utf8_ranges.def into two level table covering BMP: page
+ * index (code point >> 8) -> deduplicated block of 256 class bytes. Page 0
+ * always ends up in block 0, so ASCII may be looked up directly.
+ *
+ * usage: utf8_table_gen <output.h>
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "v2/utf8.h"
+
+#define PAGE_CNT    256
+#define PAGE_SIZE   256
+
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+    uint8_t type;
+} Range;
+
+static const Range ranges[] = {
+#define UTF8_RANGE(first, last, type)   { first, last, type },
+#include "v2/utf8_ranges.def"
+#undef UTF8_RANGE
+};
+
+static uint8_t classes[PAGE_CNT * PAGE_SIZE];
+static uint8_t blocks[PAGE_CNT][PAGE_SIZE];
+static uint8_t pages[PAGE_CNT];
+
+int main(int argc, char ** argv) {
+    if(argc != 2) {
+        fprintf(stderr, "usage: %s <output.h>\n", argc ? argv[0] : "utf8_table_gen");
+        return 1;
+    }
+
+    memset(classes, UT_INVALID, sizeof(classes));
+
+    for(uint32_t i = 0; i < sizeof(ranges) / sizeof(*ranges); i++) {
+        const Range * r = &ranges[i];
+
+        if(r->first > r->last || r->last >= PAGE_CNT * PAGE_SIZE) {
+            fprintf(stderr, "invalid range 0x%04X-0x%04X\n", r->first, r->last);
+            return 1;
+        }
+
+        memset(classes + r->first, r->type, r->last - r->first + 1);
+    }
+
+    // code point 0 terminates strings, never allow it
+    classes[0] = UT_INVALID;
+
+    uint32_t block_cnt = 0;
+    for(uint32_t page = 0; page < PAGE_CNT; page++) {
+        const uint8_t * src = classes + page * PAGE_SIZE;
+
+        uint32_t block = 0;
+        while(block < block_cnt && memcmp(blocks[block], src, PAGE_SIZE) != 0) {
+            block++;
+        }
+
+        if(block == block_cnt) {
+            memcpy(blocks[block_cnt++], src, PAGE_SIZE);
+        }
+
+        pages[page] = block;
+    }
+
+    FILE * f = fopen(argv[1], "w");
+    if(!f) {
+        fprintf(stderr, "failed to open \"%s\" for writing\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(f, "/* generated by tools/utf8_table_gen.c from src/v2/utf8_ranges.def, do not edit */\n\n");
+    fprintf(f, "#ifndef UTF8_TABLE_H\n#define UTF8_TABLE_H\n\n");
+    fprintf(f, "#include <stdint.h>\n\n");
+    fprintf(f, "#define UTF8_TABLE_BLOCKS   %u\n\n", block_cnt);
+
+    fprintf(f, "static const uint8_t utf8_class_page[%u] = {", PAGE_CNT);
+    for(uint32_t i = 0; i < PAGE_CNT; i++) {
+        fprintf(f, "%s%u,", (i % 32) ? " " : "\n    ", pages[i]);
+    }
+    fprintf(f, "\n};\n\n");
+
+    fprintf(f, "static const uint8_t utf8_class_block[UTF8_TABLE_BLOCKS][%u] = {\n", PAGE_SIZE);
+    for(uint32_t b = 0; b < block_cnt; b++) {
+        fprintf(f, "    {");
+        for(uint32_t i = 0; i < PAGE_SIZE; i++) {
+            fprintf(f, "%s%u,", (i % 32) ? " " : "\n        ", blocks[b][i]);
+        }
+        fprintf(f, "\n    },\n");
+    }
+    fprintf(f, "};\n\n");
+
+    fprintf(f, "#endif /* UTF8_TABLE_H */\n");
+
+    if(fclose(f) != 0) {
+        fprintf(stderr, "failed to write \"%s\"\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}